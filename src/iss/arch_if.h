@@ -41,11 +41,14 @@
 #include <dbt_rise_common.h>
 
 #include <algorithm>
+#include <cstring>
 #include <iomanip>
 #include <iostream>
 #include <vector>
 
 namespace iss {
+// forward declaration
+class core_context;
 /**
  * exception to be thrown if the architecture encounters a synchronous trap
  */
@@ -152,7 +155,8 @@ public:
         return write(addr.type, addr.access, addr.space, addr.val, length, data);
     }
     /**
-     * write to addresses
+     * write to addresses. If a context is attached to the core the write passes it (see core_context::write()) before
+     * reaching wr_func, so the core may replace its wr_func at any time
      *
      * @param addr address to read from, contains access type, address space and
      * address
@@ -162,8 +166,91 @@ public:
      */
     inline iss::status write(const address_type type, const access_type access, const uint32_t space, const uint64_t addr,
                              const unsigned length, const uint8_t* const data) {
-        return wr_func(type, access, space, addr, length, data);
+        return context ? context_write(type, access, space, addr, length, data) : wr_func(type, access, space, addr, length, data);
     };
+    /**
+     * read a list of address ranges at once, e.g. for loaders, semihosting or large debugger requests. The ranges are
+     * accessed in order, the default implementation copies the parts backed by host memory (see get_host_region())
+     * using memcpy and reads the remaining parts through read()
+     *
+     * @param type the address type
+     * @param access the access type
+     * @param space the address space
+     * @param elems the ranges to read and the buffers to read them into
+     * @param count the number of ranges
+     * @return success or the failure of the first access failing, the following ranges are not read then
+     */
+    virtual iss::status read_vectored(const address_type type, const access_type access, const uint32_t space, transfer const* elems,
+                                      size_t count) {
+        for(size_t i = 0; i < count; ++i) {
+            auto addr = elems[i].addr;
+            auto* data = elems[i].data;
+            for(auto left = elems[i].length; left;) {
+                uint64_t n;
+                auto region = get_host_region(type, access, space, addr);
+                if(region && region.contains(addr, 1)) {
+                    n = std::min(left, region.size - (addr - region.start));
+                    std::memcpy(data, region.at(addr), n);
+                } else {
+                    n = std::min<uint64_t>(left, max_transfer_chunk);
+                    auto res = read(type, access, space, addr, static_cast<unsigned>(n), data);
+                    if(res != iss::Ok)
+                        return res;
+                }
+                addr += n;
+                data += n;
+                left -= n;
+            }
+        }
+        return iss::Ok;
+    }
+    /**
+     * read a list of address ranges at once, see read_vectored(const address_type, const access_type, const uint32_t,
+     * transfer const*, size_t)
+     */
+    inline iss::status read_vectored(const address_type type, const access_type access, const uint32_t space,
+                                     std::vector<transfer> const& elems) {
+        return read_vectored(type, access, space, elems.data(), elems.size());
+    }
+    /**
+     * write a list of address ranges at once, e.g. for loaders, semihosting or large debugger requests. The ranges are
+     * accessed in order. If a context is attached to the core the ranges are written by it (see
+     * core_context::write_vectored()), otherwise the default implementation writes them through write()
+     *
+     * @param type the address type
+     * @param access the access type
+     * @param space the address space
+     * @param elems the ranges to write and the buffers holding the data
+     * @param count the number of ranges
+     * @return success or the failure of the first access failing, the following ranges are not written then
+     */
+    virtual iss::status write_vectored(const address_type type, const access_type access, const uint32_t space,
+                                       transfer const* elems, size_t count) {
+        if(context)
+            return context_write_vectored(type, access, space, elems, count);
+        for(size_t i = 0; i < count; ++i) {
+            auto addr = elems[i].addr;
+            uint8_t const* data = elems[i].data;
+            for(auto left = elems[i].length; left;) {
+                auto n = std::min<uint64_t>(left, max_transfer_chunk);
+                auto res = write(type, access, space, addr, static_cast<unsigned>(n), data);
+                if(res != iss::Ok)
+                    return res;
+                addr += n;
+                data += n;
+                left -= n;
+            }
+        }
+        return iss::Ok;
+    }
+    /**
+     * write a list of address ranges at once, see write_vectored(const address_type, const access_type, const uint32_t,
+     * transfer const*, size_t)
+     */
+    inline iss::status write_vectored(const address_type type, const access_type access, const uint32_t space,
+                                      std::vector<transfer> const& elems) {
+        return write_vectored(type, access, space, elems.data(), elems.size());
+    }
     /**
      * vm encountered a trap (exception, interrupt), process accordingly in core
      *
@@ -208,12 +295,75 @@ public:
      * @return non-owning pointer to the instrumentation interface of the architecture or nullptr
      */
     virtual instrumentation_if* get_instrumentation_if() { return nullptr; };
+    /**
+     * get the pointer to a flag which is set whenever the core needs to stop executing, i.e. whenever should_stop()
+     * returns true. JIT backends poll it to chain translated blocks without returning to the dispatch loop. In case
+     * there is no such flag a null pointer is returned and each block returns to the dispatch loop
+     *
+     * @return non-owning pointer to the stop flag or nullptr
+     */
+    virtual bool const* get_stop_flag_ptr() { return nullptr; }
+    /**
+     * get the region of host memory backing a guest address so the vm, debuggers, loaders or plugins can access it
+     * directly (e.g. using memcpy) instead of calling read() and write() for each access. Only plain memory may be
+     * returned, i.e. accesses to the region must not have side effects besides changing the memory (no MMIO, no
+     * watchpoints, no access tracing). A region returned for a write access must be writable. The core needs to flush
+     * the software TLB of its context (get_context()->get_tlb().flush()) whenever the result changes, e.g. if the address
+     * translation changes
+     *
+     * @param type the address type
+     * @param access the access type
+     * @param space the address space
+     * @param addr the guest address
+     * @return the region containing addr, an empty region if addr has to be accessed through read() and write()
+     */
+    virtual host_region get_host_region(const address_type type, const access_type access, const uint32_t space, const uint64_t addr) {
+        return {};
+    }
+    /**
+     * get the host memory backing a guest page so generated code can access it directly through the software TLB. The
+     * default implementation returns the page if the region returned by get_host_region() covers it completely
+     *
+     * @param type the address type
+     * @param access the access type, READ or WRITE
+     * @param space the address space
+     * @param page_addr the address of the page
+     * @return the host memory of the page or nullptr if it has to be accessed through read() and write()
+     */
+    virtual uint8_t* get_host_page(const address_type type, const access_type access, const uint32_t space, const uint64_t page_addr) {
+        auto region = get_host_region(type, access, space, page_addr);
+        if(!region || (access == access_type::WRITE && !region.writable) ||
+           !region.contains(page_addr, uint64_t(1) << host_page_bits))
+            return nullptr;
+        return region.at(page_addr);
+    }
+    /**
+     * get the context the vm executing the core keeps for it, see core_context. It exists while the core is executed by
+     * a vm
+     *
+     * @return non-owning pointer to the context or nullptr
+     */
+    core_context* get_context() const { return context; }
+
+    //! the size of the pages get_host_page() returns
+    static constexpr unsigned host_page_bits = 12;
 
 protected:
+    //! the largest part of a vectored access passed to a single read() or write() call
+    static constexpr uint64_t max_transfer_chunk = uint64_t(1) << 30;
     using rd_func_sig = iss::status(address_type, access_type, uint32_t, uint64_t, unsigned, uint8_t*);
     util::delegate<rd_func_sig> rd_func;
     using wr_func_sig = iss::status(address_type, access_type, uint32_t, uint64_t, unsigned, uint8_t const*);
     util::delegate<wr_func_sig> wr_func;
+
+private:
+    friend class core_context;
+    core_context* context{nullptr};
+    //! core_context::write() of the attached context
+    util::delegate<wr_func_sig> context_write;
+    using wr_vec_func_sig = iss::status(address_type, access_type, uint32_t, transfer const*, size_t);
+    //! core_context::write_vectored() of the attached context
+    util::delegate<wr_vec_func_sig> context_write_vectored;
 };
 } // namespace iss
 
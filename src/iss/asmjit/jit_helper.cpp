@@ -35,12 +35,20 @@
 
 #include "jit_helper.h"
 #include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
 #include <exception>
 #include <fmt/format.h>
 #include <fstream>
 #include <iostream>
 #include <memory>
+#ifdef _WIN32
+#include <windows.h>
+#else
 #include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 using namespace asmjit;
 using namespace logging;
@@ -52,11 +60,10 @@ int set_pages_executable(void* ptr, unsigned long length) {
     unsigned long old_protect;
     return VirtualProtect(ptr, length, PAGE_EXECUTE_READWRITE, &old_protect);
 #else
-    unsigned long start, end;
-    start = (unsigned long)ptr & ~(PAGESIZE - 1);
-    end = (unsigned long)ptr + length;
-    end = (end + PAGESIZE - 1) & ~(PAGESIZE - 1);
-    return mprotect((void*)start, end - start, PROT_READ | PROT_WRITE | PROT_EXEC);
+    auto page_size = static_cast<unsigned long>(sysconf(_SC_PAGESIZE));
+    auto start = reinterpret_cast<unsigned long>(ptr) & ~(page_size - 1);
+    auto end = (reinterpret_cast<unsigned long>(ptr) + length + page_size - 1) & ~(page_size - 1);
+    return mprotect(reinterpret_cast<void*>(start), end - start, PROT_READ | PROT_WRITE | PROT_EXEC);
 #endif
 };
 class MyErrorHandler : public ErrorHandler {
@@ -66,18 +73,128 @@ public:
     }
 };
 
+namespace {
+// the jump to a successor stores the successor into the cur_tb slot held in r10 before jumping to its chain entry:
+// mov r11, imm64; mov [r10], r11; jmp rel32
+constexpr size_t jump_size = 18;
+constexpr size_t jump_tb_offset = 2;
+constexpr size_t jump_rel_offset = 14;
+// the registers the block functions get their arguments in
+#ifdef _WIN32
+std::array<x86::Gp, 3> const arg_regs{x86::rcx, x86::rdx, x86::r8};
+#else
+std::array<x86::Gp, 3> const arg_regs{x86::rdi, x86::rsi, x86::rdx};
+#endif
+
+void load_last_branch(x86::Assembler& a, x86::Gp const& dst, x86::Gp const& addr, unsigned size) {
+    switch(size) {
+    case 1:
+        a.movzx(dst.r32(), x86::byte_ptr(addr));
+        break;
+    case 2:
+        a.movzx(dst.r32(), x86::word_ptr(addr));
+        break;
+    case 4:
+        a.mov(dst.r32(), x86::dword_ptr(addr));
+        break;
+    case 8:
+        a.mov(dst, x86::qword_ptr(addr));
+        break;
+    default:
+        throw std::runtime_error(fmt::format("Invalid size ({}) of the last branch register", size));
+    }
+}
+/**
+ * emit the entry the chain loop calls a block through. It keeps the arguments, calls the block function and unless
+ * chaining needs to stop jumps to the successor selected by LAST_BRANCH. The jumps initially return to the chain loop
+ * and get patched by translation_block::chain(), the first one starts at the returned label
+ */
+Label emit_chain_entry(x86::Assembler& a, Label const& func, Label const& entry, iss::jit::chain_config const& cfg) {
+    Label leave = a.newLabel();
+    Label jumps = a.newLabel();
+    Label second = a.newLabel();
+    a.bind(entry);
+    // three pushes align the stack to 16 bytes again
+    for(auto const& r : arg_regs)
+        a.push(r);
+#ifdef _WIN32
+    a.sub(x86::rsp, 32);
+#endif
+    a.call(func);
+#ifdef _WIN32
+    a.add(x86::rsp, 32);
+#endif
+    for(auto it = arg_regs.rbegin(); it != arg_regs.rend(); ++it)
+        a.pop(*it);
+    // rax holds the next pc returned to the chain loop, r10 and r11 are free in both calling conventions
+    a.mov(x86::r10, reinterpret_cast<uintptr_t>(cfg.stop_flag));
+    a.cmp(x86::byte_ptr(x86::r10), 0);
+    a.jne(leave);
+    a.mov(x86::r10, reinterpret_cast<uintptr_t>(cfg.icount));
+    a.mov(x86::r11, x86::qword_ptr(x86::r10));
+    a.mov(x86::r10, reinterpret_cast<uintptr_t>(cfg.icount_limit));
+    a.cmp(x86::r11, x86::qword_ptr(x86::r10));
+    a.jae(leave);
+    a.mov(x86::r10, reinterpret_cast<uintptr_t>(cfg.last_branch));
+    load_last_branch(a, x86::r11, x86::r10, cfg.last_branch_size);
+    a.mov(x86::r10, reinterpret_cast<uintptr_t>(cfg.cur_tb));
+    a.test(x86::r11, x86::r11);
+    a.jz(jumps);
+    a.cmp(x86::r11, 1);
+    a.je(second);
+    // the return is the target of the unpatched jumps right behind it
+    a.bind(leave);
+    a.ret();
+    std::array<uint8_t, jump_size> unpatched;
+    unpatched.fill(0xcc);
+    a.bind(jumps);
+    a.embed(unpatched.data(), unpatched.size());
+    a.bind(second);
+    a.embed(unpatched.data(), unpatched.size());
+    return jumps;
+}
+} // namespace
+
+void translation_block::chain(unsigned idx, translation_block const* to) {
+    if(!jumps_offset || !arena)
+        return;
+    std::array<uint8_t, jump_size> code;
+    code.fill(0xcc);
+    auto offset = jumps_offset + idx * jump_size;
+    auto end = reinterpret_cast<intptr_t>(f_mem.rx) + static_cast<intptr_t>(offset + jump_size);
+    auto rel = to ? static_cast<intptr_t>(to->chain_ptr) - end : 0;
+    if(to && to->jumps_offset && rel >= INT32_MIN && rel <= INT32_MAX) {
+        auto tb = reinterpret_cast<uint64_t>(to);
+        auto rel32 = static_cast<int32_t>(rel);
+        code[0] = 0x49; // mov r11, imm64
+        code[1] = 0xbb;
+        std::memcpy(code.data() + jump_tb_offset, &tb, sizeof(tb));
+        code[10] = 0x4d; // mov [r10], r11
+        code[11] = 0x89;
+        code[12] = 0x1a;
+        code[13] = 0xe9; // jmp rel32
+        std::memcpy(code.data() + jump_rel_offset, &rel32, sizeof(rel32));
+    } else {
+        // jump back to the return in front of the jumps
+        auto rel32 = -static_cast<int32_t>(idx * jump_size + 5 + 1);
+        code[0] = 0xe9;
+        std::memcpy(code.data() + 1, &rel32, sizeof(rel32));
+    }
+    arena->patch(f_mem, offset, code.data(), code.size());
+}
+
 translation_block getPointerToFunction(unsigned cluster_id, uint64_t phys_addr, std::function<void(jit_holder&)>& generator,
-                                       bool dumpEnabled) {
+                                       iss::jit::code_arena& arena, bool dumpEnabled, iss::jit::chain_config const* chain) {
 #ifndef NDEBUG
     CPPLOG(TRACE) << "Compiling and executing code for 0x" << std::hex << phys_addr << std::dec;
 #endif
-    static int i = 0;
-    JitRuntime rt;
+    static std::atomic<unsigned> i{0};
     StringLogger logger;
     MyErrorHandler myErrorHandler;
     CodeHolder code;
     code.setLogger(&logger); // TODO check how much performance this costs, possibly set logger conditionally with dumpEnabled
-    code.init(rt.environment(), rt.cpuFeatures());
+    // the code is placed in the arena so there is no need for a JitRuntime, the host environment is sufficient
+    code.init(Environment::host(), CpuInfo::host().features());
 
     code.setErrorHandler(&myErrorHandler);
     x86::Compiler cc(&code);
@@ -90,9 +207,16 @@ translation_block getPointerToFunction(unsigned cluster_id, uint64_t phys_addr,
     funcNode->setArg(2, vm_if_ptr);
     Label trap_entry = cc.newNamedLabel("\ntrap_entry");
     jit_holder jh{cc, regs_base_ptr, arch_if_ptr, vm_if_ptr, trap_entry};
+    jh.read_buf = cc.newStack(8, 8, "read_buf");
     generator(jh);
     cc.endFunc();
     cc.finalize();
+    Label chain_entry, jumps;
+    if(chain) {
+        x86::Assembler a(&code);
+        chain_entry = a.newLabel();
+        jumps = emit_chain_entry(a, funcNode->label(), chain_entry, *chain);
+    }
     code.flatten();
 
     if(dumpEnabled) {
@@ -100,20 +224,165 @@ translation_block getPointerToFunction(unsigned cluster_id, uint64_t phys_addr,
         std::ofstream ofs(name);
         ofs << logger.data() << std::endl;
     }
-    // allocate memory and make it executable
+    // allocate memory in the arena, write the code and make it executable
     auto size = code.codeSize();
-    auto* fmem = malloc(size);
-    int err = code.relocateToBase(uintptr_t(fmem));
-    if(err)
+    auto fmem = arena.allocate(size);
+    int err = code.relocateToBase(uintptr_t(fmem.rx));
+    if(err) {
+        arena.release(fmem);
         throw std::runtime_error("could not relocate compiled code");
-    err = code.copyFlattenedData(fmem, size);
-    if(err)
+    }
+    err = code.copyFlattenedData(fmem.rw, size);
+    if(err) {
+        arena.release(fmem);
         throw std::runtime_error("could not copy compiled code");
-    err = set_pages_executable(fmem, size);
-    if(err)
-        throw std::runtime_error("could not set memory as executable");
-    // abort();
-    return translation_block(fmem, {nullptr, nullptr}, fmem);
+    }
+    translation_block tb(fmem.rx, {nullptr, nullptr}, fmem, &arena);
+    if(chain) {
+        tb.chain_ptr = reinterpret_cast<uintptr_t>(fmem.rx) + code.labelOffsetFromBase(chain_entry);
+        tb.jumps_offset = code.labelOffsetFromBase(jumps);
+        tb.chain(0, nullptr);
+        tb.chain(1, nullptr);
+    }
+    arena.seal(fmem);
+    return tb;
+}
+
+iss::jit::code_arena::allocation create_chain_loop(iss::jit::code_arena& arena, iss::jit::chain_config const& cfg) {
+    MyErrorHandler myErrorHandler;
+    CodeHolder code;
+    code.init(Environment::host(), CpuInfo::host().features());
+    code.setErrorHandler(&myErrorHandler);
+    x86::Compiler cc(&code);
+    FuncNode* funcNode = cc.addFunc(FuncSignature::build<uint64_t, uint8_t*, void*, void*>());
+    x86::Gp regs_base_ptr = cc.newUIntPtr("regs_base_ptr");
+    x86::Gp arch_if_ptr = cc.newIntPtr("arch_if_ptr");
+    x86::Gp vm_if_ptr = cc.newIntPtr("vm_if_ptr");
+    funcNode->setArg(0, regs_base_ptr);
+    funcNode->setArg(1, arch_if_ptr);
+    funcNode->setArg(2, vm_if_ptr);
+    x86::Gp cur_tb_slot = cc.newUIntPtr("cur_tb_slot");
+    x86::Gp cur_tb = cc.newUIntPtr("cur_tb");
+    x86::Gp f_ptr = cc.newUIntPtr("f_ptr");
+    x86::Gp next_pc = cc.newUInt64("next_pc");
+    x86::Gp last_branch = cc.newUInt64("last_branch");
+    x86::Gp icount = cc.newUInt64("icount");
+    x86::Gp addr = cc.newUIntPtr("addr");
+    x86::Gp next_tb = cc.newUIntPtr("next_tb");
+    Label loop = cc.newLabel();
+    Label leave = cc.newLabel();
+    Label indirect = cc.newLabel();
+    Label next = cc.newLabel();
+    cc.mov(cur_tb_slot, reinterpret_cast<uintptr_t>(cfg.cur_tb));
+    cc.bind(loop);
+    cc.mov(cur_tb, x86::ptr(cur_tb_slot));
+    cc.mov(f_ptr, x86::ptr(cur_tb, static_cast<int32_t>(cfg.f_ptr_offset)));
+    InvokeNode* invokeNode;
+    cc.invoke(&invokeNode, f_ptr, FuncSignature::build<uint64_t, uint8_t*, void*, void*>());
+    invokeNode->setArg(0, regs_base_ptr);
+    invokeNode->setArg(1, arch_if_ptr);
+    invokeNode->setArg(2, vm_if_ptr);
+    invokeNode->setRet(0, next_pc);
+    // the block may have jumped to its successors, the last one executed is in the slot
+    cc.mov(cur_tb, x86::ptr(cur_tb_slot));
+    cc.mov(addr, reinterpret_cast<uintptr_t>(cfg.stop_flag));
+    cc.cmp(x86::byte_ptr(addr), 0);
+    cc.jne(leave);
+    cc.mov(addr, reinterpret_cast<uintptr_t>(cfg.last_branch));
+    switch(cfg.last_branch_size) {
+    case 1:
+        cc.movzx(last_branch.r32(), x86::byte_ptr(addr));
+        break;
+    case 2:
+        cc.movzx(last_branch.r32(), x86::word_ptr(addr));
+        break;
+    case 4:
+        cc.mov(last_branch.r32(), x86::dword_ptr(addr));
+        break;
+    case 8:
+        cc.mov(last_branch, x86::qword_ptr(addr));
+        break;
+    default:
+        throw std::runtime_error(fmt::format("Invalid size ({}) of the last branch register", cfg.last_branch_size));
+    }
+    cc.mov(addr, reinterpret_cast<uintptr_t>(cfg.icount));
+    cc.mov(icount, x86::qword_ptr(addr));
+    cc.mov(addr, reinterpret_cast<uintptr_t>(cfg.icount_limit));
+    cc.cmp(icount, x86::qword_ptr(addr));
+    cc.jae(leave);
+    // NO_JUMP and KNOWN_JUMP have a fixed successor, UNKNOWN_JUMP uses the cached targets
+    cc.cmp(last_branch, 2);
+    cc.je(indirect);
+    cc.ja(leave);
+    cc.mov(next_tb, x86::qword_ptr(cur_tb, last_branch, 3, static_cast<int32_t>(cfg.cont_offset)));
+    cc.test(next_tb, next_tb);
+    cc.jz(leave);
+    cc.jmp(next);
+    cc.bind(indirect);
+    auto target_offset = [&cfg](unsigned idx, size_t member) {
+        return static_cast<int32_t>(cfg.targets_offset + idx * sizeof(iss::jit::indirect_target) + member);
+    };
+    for(unsigned i = 0; i < iss::jit::indirect_target_ways; ++i) {
+        Label miss = cc.newLabel();
+        cc.cmp(next_pc, x86::qword_ptr(cur_tb, target_offset(i, offsetof(iss::jit::indirect_target, pc))));
+        cc.jne(miss);
+        cc.mov(next_tb, x86::qword_ptr(cur_tb, target_offset(i, offsetof(iss::jit::indirect_target, tb))));
+        cc.test(next_tb, next_tb);
+        cc.jnz(next);
+        cc.bind(miss);
+    }
+    // a return continues with the block cached by the caller on top of the return stack, architectures without call
+    // marks have no return stack and rely on the indirect targets only
+    if(!cfg.ras) {
+        cc.jmp(leave);
+    } else {
+        x86::Gp top = cc.newUInt32("ras_top");
+        x86::Gp entry = cc.newUIntPtr("ras_entry");
+        x86::Gp caller = cc.newUIntPtr("caller");
+        x86::Gp epoch = cc.newUInt64("epoch");
+        cc.mov(addr, reinterpret_cast<uintptr_t>(cfg.ras));
+        cc.mov(top, x86::dword_ptr(addr, static_cast<int32_t>(offsetof(iss::jit::return_stack, top))));
+        cc.imul(entry, top.r64(), sizeof(iss::jit::return_stack::entry));
+        cc.add(entry, addr);
+        auto entry_ptr = [&entry](size_t member) {
+            return x86::qword_ptr(entry, static_cast<int32_t>(offsetof(iss::jit::return_stack, entries) + member));
+        };
+        cc.cmp(next_pc, entry_ptr(offsetof(iss::jit::return_stack::entry, pc)));
+        cc.jne(leave);
+        cc.mov(caller, reinterpret_cast<uintptr_t>(cfg.cache_epoch));
+        cc.mov(epoch, x86::qword_ptr(caller));
+        cc.cmp(epoch, entry_ptr(offsetof(iss::jit::return_stack::entry, epoch)));
+        cc.jne(leave);
+        cc.mov(caller, entry_ptr(offsetof(iss::jit::return_stack::entry, caller)));
+        cc.test(caller, caller);
+        cc.jz(leave);
+        cc.cmp(next_pc, x86::qword_ptr(caller, target_offset(iss::jit::return_target_idx, offsetof(iss::jit::indirect_target, pc))));
+        cc.jne(leave);
+        cc.mov(next_tb, x86::qword_ptr(caller, target_offset(iss::jit::return_target_idx, offsetof(iss::jit::indirect_target, tb))));
+        cc.test(next_tb, next_tb);
+        cc.jz(leave);
+        cc.mov(entry_ptr(offsetof(iss::jit::return_stack::entry, pc)), 0);
+        cc.dec(top);
+        cc.and_(top, iss::jit::return_stack::depth - 1);
+        cc.mov(x86::dword_ptr(addr, static_cast<int32_t>(offsetof(iss::jit::return_stack, top))), top);
+    }
+    cc.bind(next);
+    cc.mov(x86::qword_ptr(cur_tb_slot), next_tb);
+    cc.jmp(loop);
+    cc.bind(leave);
+    cc.ret(next_pc);
+    cc.endFunc();
+    cc.finalize();
+    code.flatten();
+
+    auto size = code.codeSize();
+    auto fmem = arena.allocate(size);
+    if(code.relocateToBase(uintptr_t(fmem.rx)) || code.copyFlattenedData(fmem.rw, size)) {
+        arena.release(fmem);
+        throw std::runtime_error("could not place the chain loop code");
+    }
+    arena.seal(fmem);
+    return fmem;
 }
 } // namespace asmjit
 } // namespace iss
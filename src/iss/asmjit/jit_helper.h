@@ -35,12 +35,12 @@
 #include <string>
 #include <unordered_map>
 #include <vector>
-#ifndef PAGESIZE
-#define PAGESIZE 4096
-#endif
 
 #include <asmjit/asmjit.h>
+#include <dbt_rise_common.h>
 #include <functional>
+#include <iss/jit/chaining.h>
+#include <iss/jit/code_arena.h>
 
 namespace iss {
 namespace asmjit {
@@ -48,12 +48,21 @@ namespace asmjit {
 struct alignas(4 * sizeof(void*)) translation_block {
     uintptr_t f_ptr = 0;
     std::array<translation_block*, 2> cont;
-    void* f_mem;
+    iss::jit::indirect_targets targets{};
+    iss::jit::code_arena::allocation f_mem;
+    iss::jit::code_arena* arena{nullptr};
+    //! entry called by the chain loop, it jumps to the chained successors directly (see chain())
+    uintptr_t chain_ptr = 0;
+    //! offset of the jumps to the successors in f_mem, 0 if the block has none
+    size_t jumps_offset{0};
 
-    explicit translation_block(void* f_ptr_, std::array<translation_block*, 2> cont_, void* mem_ptr = nullptr)
+    explicit translation_block(void* f_ptr_, std::array<translation_block*, 2> cont_, iss::jit::code_arena::allocation mem = {},
+                               iss::jit::code_arena* arena_ = nullptr)
     : f_ptr(reinterpret_cast<uintptr_t>(f_ptr_))
     , cont(cont_)
-    , f_mem(mem_ptr) {}
+    , f_mem(mem)
+    , arena(arena_)
+    , chain_ptr(f_ptr) {}
 
     translation_block() = delete;
 
@@ -66,8 +75,14 @@ struct alignas(4 * sizeof(void*)) translation_block {
         cont = o.cont;
         o.cont[0] = nullptr;
         o.cont[1] = nullptr;
+        targets = o.targets;
+        o.targets = {};
         f_mem = o.f_mem;
-        o.f_mem = nullptr;
+        o.f_mem = {};
+        arena = o.arena;
+        o.arena = nullptr;
+        chain_ptr = o.chain_ptr, o.chain_ptr = 0;
+        jumps_offset = o.jumps_offset, o.jumps_offset = 0;
     }
 
     translation_block& operator=(translation_block&& o) {
@@ -75,12 +90,32 @@ struct alignas(4 * sizeof(void*)) translation_block {
         cont = o.cont;
         o.cont[0] = nullptr;
         o.cont[1] = nullptr;
+        targets = o.targets;
+        o.targets = {};
+        if(arena)
+            arena->release(f_mem);
         f_mem = o.f_mem;
-        o.f_mem = nullptr;
+        o.f_mem = {};
+        arena = o.arena;
+        o.arena = nullptr;
+        chain_ptr = o.chain_ptr, o.chain_ptr = 0;
+        jumps_offset = o.jumps_offset, o.jumps_offset = 0;
         return *this;
     }
+    /**
+     * patch the jump of a continuation so the block continues with its successor without returning to the chain loop,
+     * the translation cache calls it whenever it changes the cont array. Successors too far away for a rel32 jump are
+     * still chained by the chain loop
+     *
+     * @param idx the index into the cont array
+     * @param to the successor or nullptr to return to the chain loop
+     */
+    void chain(unsigned idx, translation_block const* to);
 
-    ~translation_block() { free(f_mem); }
+    ~translation_block() {
+        if(arena)
+            arena->release(f_mem);
+    }
 };
 
 struct jit_holder {
@@ -93,10 +128,44 @@ struct jit_holder {
     ::asmjit::x86::Gp next_pc;
     std::vector<::asmjit::x86::Gp> globals;
     std::vector<char*> disass_collection;
+    //! stack slot of the block function memory reads return their value in
+    ::asmjit::x86::Mem read_buf;
 };
+/**
+ * compile a block function. If the vm chains blocks the function gets an entry for the chain loop (see
+ * translation_block::chain_ptr) calling it and jumping to the chained successor afterwards, so chained blocks run
+ * without returning to the chain loop while the successor is known
+ *
+ * @param cluster_id the cluster of the core
+ * @param phys_addr the address of the block
+ * @param generator the generator of the block code
+ * @param arena the arena to place the code in
+ * @param dumpEnabled write the generated code to a file
+ * @param chain the chaining state of the vm or nullptr if the vm does not chain blocks
+ * @return the block
+ */
 translation_block getPointerToFunction(unsigned cluster_id, uint64_t phys_addr, std::function<void(jit_holder&)>& generator,
-                                       bool dumpEnabled);
-int set_pages_executable(void* ptr, unsigned long length);
+                                       iss::jit::code_arena& arena, bool dumpEnabled, iss::jit::chain_config const* chain = nullptr);
+/**
+ * create a function with the signature of a block function executing the block in cfg.cur_tb and its chained
+ * successors until chaining needs to stop. Blocks created by the asmjit compiler own their stack frame, the entries
+ * the loop calls them through jump to the known successors directly (see translation_block::chain()). The loop
+ * follows the indirect targets and the return stack and continues with the successors a block could not jump to
+ *
+ * @param arena the arena to place the code in
+ * @param cfg the chaining state of the vm
+ * @return the allocation holding the function
+ */
+iss::jit::code_arena::allocation create_chain_loop(iss::jit::code_arena& arena, iss::jit::chain_config const& cfg);
+/**
+ * make the pages covering a memory range readable, writable and executable. Code placed in a jit::code_arena is
+ * executable already, use jit::code_arena::seal() to publish code written into it
+ *
+ * @param ptr the start of the range
+ * @param length the length of the range in bytes
+ * @return the result of the underlying OS call
+ */
+DEPRECATED int set_pages_executable(void* ptr, unsigned long length);
 } // namespace asmjit
 } // namespace iss
 #endif // ISS_ASMJIT_JIT__HELPER_H
\ No newline at end of file
@@ -43,8 +43,11 @@
 #include <fmt/format.h>
 #include <iss/arch/traits.h>
 #include <iss/arch_if.h>
+#include <iss/core_context.h>
 #include <iss/debugger/target_adapter_base.h>
 #include <iss/debugger_if.h>
+#include <iss/jit/pretranslation.h>
+#include <iss/jit/translation_cache.h>
 #include <iss/vm_if.h>
 #include <iss/vm_plugin.h>
 #include <util/ities.h>
@@ -113,44 +116,210 @@ public:
 
     int start(uint64_t icount_limit = std::numeric_limits<uint64_t>::max(), bool dump = false,
               finish_cond_e cond = finish_cond_e::ICOUNT_LIMIT | finish_cond_e::JUMP_TO_SELF) override {
+        auto start = std::chrono::high_resolution_clock::now();
+        CPPLOG(INFO) << "Start at 0x" << std::hex << obtain_reg<typename arch::traits<ARCH>::addr_t>(arch::traits<ARCH>::PC) << std::dec;
+        slice_e result;
+        auto error = execute(icount_limit, dump, cond, result);
+        auto end = std::chrono::high_resolution_clock::now(); // end measurement
+        auto elapsed = end - start;
+        auto millis = std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count();
+        auto cur_icount = get_reg_ref<uint64_t>(arch::traits<ARCH>::reg_e::ICOUNT);
+        CPPLOG(INFO) << "Executed " << cur_icount << " instructions in " << func_map.size() << " code blocks during " << millis
+                     << "ms resulting in " << (cur_icount * 0.001 / millis) << "MIPS";
+        auto& cache_stats = func_map.get_stats();
+        CPPLOG(DEBUG) << "Translation cache holds " << cache_stats.footprint() << " bytes, " << cache_stats.insertions
+                      << " blocks translated, " << cache_stats.evictions << " evicted, hit rate " << cache_stats.hit_rate() << " ("
+                      << cache_stats.jump_cache_hits << " from the jump cache)";
+        auto& arena_stats = code_mem.get_stats();
+        CPPLOG(DEBUG) << "Code arena holds " << arena_stats.used_bytes << " bytes of code in " << arena_stats.chunks << " chunks ("
+                      << arena_stats.reserved_bytes << " bytes mapped, " << arena_stats.wasted_bytes << " bytes wasted)";
+        return error;
+    }
+
+    int run_slice(uint64_t icount_limit, finish_cond_e cond, slice_e& result) override {
+        return execute(icount_limit, false, cond, result);
+    }
+
+    void reset() override { core.reset(); }
+
+    void reset(uint64_t address) override { core.reset(address); }
+
+    iss::jit::translation_cache_if* get_translation_cache() override { return &func_map; }
+
+    size_t pretranslate(std::vector<uint64_t> const& entries, size_t max_blocks) override {
+        if(this->debugging_enabled())
+            sync_exec |= PRE_SYNC;
+        virt_addr_t pc(iss::access_type::DEBUG_FETCH, 0, 0);
+        continuation_e cont = CONT;
+        auto generator = make_generator(pc, cont, std::numeric_limits<uint64_t>::max());
+        iss::jit::pretranslation walk(entries, max_blocks);
+        // translating does not change the state of the core
+        spec_regs.assign(regs_base_ptr, regs_base_ptr + iss::jit::register_file_size<ARCH>());
+        uint64_t block_pc;
+        while(walk.next(block_pc)) {
+            if(func_map.peek(block_pc) || !func_map.admit(block_pc))
+                continue;
+            try {
+                pc.val = block_pc;
+                if(translate_block(block_pc, generator, cont, false, true) && successors.from == block_pc)
+                    walk.translated(successors);
+            } catch(trap_access&) {
+            } catch(decoding_error&) {
+            }
+        }
+        walk.link(func_map);
+        std::copy(spec_regs.begin(), spec_regs.end(), regs_base_ptr);
+        return walk.size();
+    }
+
+    void pre_instr_sync() override {
+        uint64_t pc = obtain_reg<typename arch::traits<ARCH>::addr_t>(arch::traits<ARCH>::PC);
+        tgt_adapter->check_continue(pc);
+    }
+
+protected:
+    /**
+     * translate the block at pc and insert it into the cache. The pages of its guest code are tracked from the start
+     * of reading it on, see translation_cache::translate_tracked()
+     *
+     * @param pc the physical address of the block
+     * @param generator the generator of the block code
+     * @param cont the continuation the generator sets
+     * @param dump write the generated code to a file
+     * @param speculative the block is translated ahead of its first execution, it is dropped if the dispatcher would
+     * need to handle its continuation
+     * @return the block or nullptr if it got dropped
+     */
+    translation_block* translate_block(uint64_t pc, std::function<void(jit_holder&)>& generator, continuation_e& cont, bool dump,
+                                       bool speculative = false) {
+        auto tb = func_map.translate_tracked(pc, [this, pc, &generator, dump](uint64_t& end) {
+            auto res = iss::asmjit::getPointerToFunction(cluster_id, pc, generator, code_mem, dump, chain_loop ? &chain_cfg : nullptr);
+            end = successors.from == pc ? successors.end : pc + 1;
+            return res;
+        });
+        // the dispatcher handles all continuations but CONT and BRANCH right after translating the block
+        if(speculative && cont != CONT && cont != BRANCH) {
+            func_map.untrack(pc);
+            return nullptr;
+        }
+        auto* res = func_map.insert(pc, std::move(tb), speculative);
+        // blocks synchronizing the instruction stream return to the dispatcher each time they are executed
+        if(cont == FLUSH)
+            func_map.mark_code_sync(res);
+        return res;
+    }
+    /**
+     * translate the successors of a block which are known at translation time and chain them to the block so that
+     * the first execution of a successor does not return to the dispatcher. Translating does not change the state of
+     * the core, successors outside the page of the block or failing to translate are skipped
+     *
+     * @param succ the successors of the block
+     * @param generator the generator of the block code
+     * @param pc the pc the generator translates from
+     * @param cont the continuation the generator sets
+     * @param dump write the generated code to a file
+     */
+    void speculate(iss::jit::block_successors const& succ, std::function<void(jit_holder&)>& generator, virt_addr_t& pc,
+                   continuation_e& cont, bool dump) {
+        auto saved_pc = pc;
+        auto saved_cont = cont;
+        spec_regs.assign(regs_base_ptr, regs_base_ptr + iss::jit::register_file_size<ARCH>());
+        for(unsigned idx = 0; idx < succ.pc.size(); ++idx) {
+            if(!succ.in_page(idx) || func_map.peek(succ.pc[idx]) || !func_map.admit(succ.pc[idx]))
+                continue;
+            translation_block* tb = nullptr;
+            try {
+                pc.val = succ.pc[idx];
+                tb = translate_block(succ.pc[idx], generator, cont, dump, true);
+            } catch(trap_access&) {
+            } catch(decoding_error&) {
+            }
+            auto* from = func_map.peek(succ.from);
+            if(tb && from && from->cont[idx] == nullptr)
+                func_map.link(from, idx, tb);
+        }
+        std::copy(spec_regs.begin(), spec_regs.end(), regs_base_ptr);
+        pc = saved_pc;
+        cont = saved_cont;
+    }
+
+    /**
+     * create the generator translating the block at pc
+     *
+     * @param pc the pc the generator translates from, needs to outlive the generator
+     * @param cont the continuation the generator sets, needs to outlive the generator
+     * @param icount_limit the instruction count to run up to
+     * @return the generator
+     */
+    std::function<void(jit_holder&)> make_generator(virt_addr_t& pc, continuation_e& cont, uint64_t icount_limit) {
+        return [this, &pc, &cont, icount_limit](jit_holder& jh) -> void {
+            gen_block_prologue(jh);
+            cont = translate(pc, jh, icount_limit);
+            gen_block_epilogue(jh);
+            // move local disass collection to global collection by appending
+            this->global_disass_collection.insert(this->global_disass_collection.end(), jh.disass_collection.begin(),
+                                                  jh.disass_collection.end());
+            jh.disass_collection.clear();
+        };
+    }
+
+    int execute(uint64_t icount_limit, bool dump, finish_cond_e cond, slice_e& result) {
         int error = 0;
         uint32_t was_illegal = 0;
         if(this->debugging_enabled())
             sync_exec |= PRE_SYNC;
-        auto start = std::chrono::high_resolution_clock::now();
         virt_addr_t pc(iss::access_type::DEBUG_FETCH, 0, obtain_reg<typename arch::traits<ARCH>::addr_t>(arch::traits<ARCH>::PC));
-        CPPLOG(INFO) << "Start at 0x" << std::hex << pc.val << std::dec;
+        result = slice_e::LIMIT;
         try {
             continuation_e cont = CONT;
 
-            std::function<void(jit_holder&)> generator{[this, &pc, &cont, icount_limit](jit_holder& jh) -> void {
-                gen_block_prologue(jh);
-                cont = translate(pc, jh, icount_limit);
-                gen_block_epilogue(jh);
-                // move local disass collection to global collection by appending
-                this->global_disass_collection.insert(this->global_disass_collection.end(), jh.disass_collection.begin(),
-                                                      jh.disass_collection.end());
-                jh.disass_collection.clear();
-            }};
+            std::function<void(jit_holder&)> generator = make_generator(pc, cont, icount_limit);
             // explicit std::function to allow use as reference in call below
             // std::function<Function*(Module*)> gen_ref(std::ref(generator));
             translation_block *last_tb = nullptr, *cur_tb = nullptr;
+            uint64_t last_epoch = func_map.epoch();
+            // blocks removed from the cache are freed only after this loop passed a quiescent point
+            iss::jit::translation_cache<translation_block>::dispatcher tb_dispatcher(func_map);
+            // if the core provides a stop flag chained blocks are executed by a native loop
+            if(!chain_loop && core.get_stop_flag_ptr()) {
+                chain_cfg = get_chain_config();
+                chain_loop_mem = create_chain_loop(code_mem, chain_cfg);
+                chain_loop = reinterpret_cast<func_ptr>(chain_loop_mem.rx);
+            }
+            chain_icount_limit = icount_limit;
             auto& last_branch = get_reg_ref(reg_e::LAST_BRANCH);
             uint64_t& cur_icount = get_reg_ref<uint64_t>(reg_e::ICOUNT);
             arch_if* const arch_if_ptr = static_cast<arch_if*>(&core);
             vm_if* const vm_if_ptr = static_cast<vm_if*>(this);
+            // the successors of the block translated in this iteration, translated after it got executed
+            iss::jit::block_successors spec;
             while(!core.should_stop() && cur_icount < icount_limit) {
+                spec.clear(0);
                 try {
                     // translate into physical address
                     phys_addr_t pc_p(pc.access, pc.space, pc.val);
+                    // remove the blocks whose guest code got written by the blocks executed so far
+                    if(func_map.has_written())
+                        func_map.invalidate_written();
                     // check if we have the block already compiled
-                    auto it = this->func_map.find(pc_p.val);
-                    if(it == this->func_map.end()) { // if not generate and compile it
-                        auto res = func_map.insert(
-                            std::make_pair(pc_p.val, iss::asmjit::getPointerToFunction(cluster_id, pc_p.val, generator, dump)));
-                        it = res.first;
+                    cur_tb = func_map.find(pc_p.val);
+                    if(cur_tb == nullptr) { // if not generate and compile it unless the block is left to another engine
+                        if(!func_map.admit(pc_p.val)) {
+                            result = slice_e::DECLINED;
+                            break;
+                        }
+                        cur_tb = translate_block(pc_p.val, generator, cont, dump);
+                        if(func_map.get_config().speculate && successors.from == pc_p.val)
+                            spec = successors;
+                    }
+                    // inserting may have evicted blocks, last_tb is one of them if the epoch changed
+                    if(last_epoch != func_map.epoch()) {
+                        last_tb = nullptr;
+                        last_epoch = func_map.epoch();
                     }
-                    cur_tb = &(it->second);
+                    tb_dispatcher.quiescent();
+                    // stores must not bypass the write path to pages holding code since translating the block
+                    core_ctx->sync_tlb();
                     if(cont == JUMP_TO_SELF) {
                         // Execute the block we just compiled, but we know it will be the last one
                         reinterpret_cast<func_ptr>(cur_tb->f_ptr)(regs_base_ptr, arch_if_ptr, vm_if_ptr);
@@ -158,12 +327,21 @@ public:
                     }
                     // if we have a previous block link the just compiled one as successor of the last tb
                     if(last_tb && last_branch < 2 && last_tb->cont[last_branch] == nullptr) {
-                        last_tb->cont[last_branch] = cur_tb;
+                        func_map.link(last_tb, last_branch, cur_tb);
                         assert(cur_tb->f_ptr != 0);
-                    }
+                    } else if(last_tb && last_branch == UNKNOWN_JUMP && chain_loop)
+                        link_indirect(last_tb, pc_p.val, cur_tb);
                     do {
-                        // execute the compiled function
-                        pc.val = reinterpret_cast<func_ptr>(cur_tb->f_ptr)(regs_base_ptr, arch_if_ptr, vm_if_ptr);
+                        // execute the compiled function and the blocks chained to it
+                        if(chain_loop) {
+                            chain_tb = cur_tb;
+                            pc.val = chain_loop(regs_base_ptr, arch_if_ptr, vm_if_ptr);
+                            if(chain_tb != cur_tb) {
+                                cur_tb = static_cast<translation_block*>(chain_tb);
+                                cont = CONT;
+                            }
+                        } else
+                            pc.val = reinterpret_cast<func_ptr>(cur_tb->f_ptr)(regs_base_ptr, arch_if_ptr, vm_if_ptr);
                         if(core.should_stop() || last_branch == BRANCH_TO_SELF)
                             throw simulation_stopped(0);
                         // update last state
@@ -178,11 +356,14 @@ public:
                             cur_tb = nullptr;
                         }
                     } while(cur_tb != nullptr);
-                    if(cont == FLUSH)
-                        func_map.clear();
+                    if(last_tb && func_map.is_code_sync(last_tb))
+                        func_map.sync_code();
+                    else if(!spec.empty())
+                        speculate(spec, generator, pc, cont, dump);
                     if(cont == ILLEGAL_INSTR) {
                         if(was_illegal > 2) {
                             CPPLOG(ERR) << "ISS execution aborted after trying to execute illegal instructions 3 times in a row";
+                            result = slice_e::STOPPED;
                             error = -1;
                             break;
                         }
@@ -199,38 +380,29 @@ public:
             }
         } catch(simulation_stopped& e) {
             CPPLOG(INFO) << "ISS execution stopped with status 0x" << std::hex << e.state << std::dec;
+            result = slice_e::STOPPED;
             if(e.state != 1)
                 error = e.state;
         } catch(decoding_error& e) {
             CPPLOG(ERR) << "ISS execution aborted at address 0x" << std::hex << e.addr << std::dec;
+            result = slice_e::STOPPED;
             error = -1;
         }
-        auto end = std::chrono::high_resolution_clock::now(); // end measurement
-        auto elapsed = end - start;
-        auto millis = std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count();
-        auto cur_icount = get_reg_ref<uint64_t>(arch::traits<ARCH>::reg_e::ICOUNT);
-        CPPLOG(INFO) << "Executed " << cur_icount << " instructions in " << func_map.size() << " code blocks during " << millis
-                     << "ms resulting in " << (cur_icount * 0.001 / millis) << "MIPS";
         return error;
     }
 
-    void reset() override { core.reset(); }
-
-    void reset(uint64_t address) override { core.reset(address); }
-
-    void pre_instr_sync() override {
-        uint64_t pc = obtain_reg<typename arch::traits<ARCH>::addr_t>(arch::traits<ARCH>::PC);
-        tgt_adapter->check_continue(pc);
-    }
-
-protected:
     continuation_e translate(virt_addr_t pc, jit_holder& jh, uint64_t icount_limit) {
         unsigned cur_blk_size = 0;
         continuation_e cont = CONT;
+        successors.clear(pc.val);
         while(cont == CONT && cur_blk_size < blk_size && cur_blk_size < icount_limit) {
             cont = gen_single_inst_behavior(pc, jh);
             cur_blk_size++;
         }
+        if(cont == CONT)
+            successors.known[0] = true;
+        successors.pc[0] = pc.val;
+        successors.end = pc.val;
         if(cont == ILLEGAL_FETCH && cur_blk_size == 1) {
             throw trap_access(0, pc.val);
         }
@@ -239,25 +411,52 @@ protected:
     virtual continuation_e gen_single_inst_behavior(virt_addr_t&, jit_holder&) = 0;
     virtual void gen_block_prologue(jit_holder&) = 0;
     virtual void gen_block_epilogue(jit_holder&) = 0;
+    /**
+     * record the target of the direct branch ending the block being translated, called by the instruction generators
+     *
+     * @param target the address the branch goes to
+     * @param conditional the branch may fall through to the next instruction
+     */
+    void set_branch_target(uint64_t target, bool conditional) {
+        successors.pc[1] = target;
+        successors.known[1] = true;
+        successors.known[0] = conditional;
+    }
 
     explicit vm_base(ARCH& core, unsigned core_id = 0, unsigned cluster_id = 0)
     : core(core)
+    , core_ctx_ref(iss::core_context::of(core))
+    , core_ctx(core_ctx_ref.get())
     , core_id(core_id)
     , cluster_id(cluster_id)
     , regs_base_ptr(core.get_regs_base_ptr()) {
         sync_exec = static_cast<sync_type>(sync_exec | core.needed_sync());
+        // writes of the core to the guest code invalidate the blocks translated from it
+        core_ctx->get_code_pages().set_space(arch::traits<ARCH>::MEM);
+        func_map.set_code_pages(core_ctx->get_code_pages());
+        // accesses of the generated code to the memory look up the software TLB first
+        core_ctx->get_tlb().enable(arch::traits<ARCH>::MEM);
     }
 
     explicit vm_base(std::unique_ptr<ARCH> core_ptr, unsigned core_id = 0, unsigned cluster_id = 0)
     : core(*core_ptr)
     , core_ptr(std::move(core_ptr))
+    , core_ctx_ref(iss::core_context::of(core))
+    , core_ctx(core_ctx_ref.get())
     , core_id(core_id)
     , cluster_id(cluster_id)
     , regs_base_ptr(core.get_regs_base_ptr()) {
         sync_exec = static_cast<sync_type>(sync_exec | core.needed_sync());
+        // writes of the core to the guest code invalidate the blocks translated from it
+        core_ctx->get_code_pages().set_space(arch::traits<ARCH>::MEM);
+        func_map.set_code_pages(core_ctx->get_code_pages());
+        // accesses of the generated code to the memory look up the software TLB first
+        core_ctx->get_tlb().enable(arch::traits<ARCH>::MEM);
     }
 
     ~vm_base() override {
+        if(chain_loop)
+            code_mem.release(chain_loop_mem);
         delete tgt_adapter;
         for(auto& each : global_disass_collection) {
             free(each);
@@ -274,6 +473,36 @@ protected:
     const std::array<const iss::arch_if::exec_phase, 4> notifier_mapping = {
         {iss::arch_if::ISTART, iss::arch_if::ISTART, iss::arch_if::IEND, iss::arch_if::ISTART}};
 
+    iss::jit::chain_config get_chain_config() {
+        iss::jit::chain_config cfg;
+        cfg.cur_tb = &chain_tb;
+        cfg.f_ptr_offset = offsetof(translation_block, chain_ptr);
+        cfg.cont_offset = offsetof(translation_block, cont);
+        cfg.targets_offset = offsetof(translation_block, targets);
+        cfg.stop_flag = core.get_stop_flag_ptr();
+        cfg.last_branch = regs_base_ptr + arch::traits<ARCH>::reg_byte_offsets[arch::traits<ARCH>::LAST_BRANCH];
+        cfg.last_branch_size = arch::traits<ARCH>::reg_bit_widths[arch::traits<ARCH>::LAST_BRANCH] / 8;
+        cfg.icount = reinterpret_cast<uint64_t const*>(regs_base_ptr + arch::traits<ARCH>::reg_byte_offsets[arch::traits<ARCH>::ICOUNT]);
+        cfg.icount_limit = &chain_icount_limit;
+        if(iss::jit::has_call_marks<ARCH>()) {
+            cfg.ras = &chain_ras;
+            cfg.cache_epoch = func_map.epoch_ptr();
+        }
+        return cfg;
+    }
+    // caches the target of an indirect branch and, if the branch returns from a marked call, the return site of the caller
+    void link_indirect(translation_block* from, uint64_t pc, translation_block* to) {
+        func_map.link_indirect(from, pc, to);
+        if(!chain_cfg.ras)
+            return;
+        auto& ret = chain_ras.entries[chain_ras.top];
+        if(ret.pc == pc) {
+            if(ret.caller && ret.epoch == func_map.epoch())
+                func_map.link_return(static_cast<translation_block*>(ret.caller), pc, to);
+            chain_ras.pop();
+        }
+    }
+
     void gen_sync(jit_holder& jh, sync_type s, unsigned inst_id) {
         if(plugins.size() /*or debugger*/)
             write_back(jh);
@@ -305,17 +534,52 @@ protected:
 
     ARCH& core;
     std::unique_ptr<ARCH> core_ptr;
+    //! the context of the core, shared with the other vms executing it
+    std::shared_ptr<iss::core_context> const core_ctx_ref;
+    //! the context, generated code loads it from the vm
+    iss::core_context* const core_ctx;
     unsigned core_id = 0;
     unsigned cluster_id = 0;
     uint8_t* regs_base_ptr{nullptr};
     sync_type sync_exec{sync_type::NO_SYNC};
-    std::unordered_map<uint64_t, translation_block> func_map;
+    // needs to outlive func_map as the translation blocks return their code to it
+    iss::jit::code_arena code_mem;
+    iss::jit::translation_cache<translation_block> func_map;
+    // state shared with the generated code, see iss::jit::chain_config
+    void* chain_tb{nullptr};
+    uint64_t chain_icount_limit{0};
+    iss::jit::return_stack chain_ras;
+    iss::jit::chain_config chain_cfg;
+    // the successors of the block translated last
+    iss::jit::block_successors successors;
+    // the register contents saved while translating successors
+    std::vector<uint8_t> spec_regs;
+    func_ptr chain_loop{nullptr};
+    iss::jit::code_arena::allocation chain_loop_mem;
     iss::debugger::target_adapter_base* tgt_adapter{nullptr};
     std::vector<plugin_entry> plugins;
     std::vector<char*> global_disass_collection;
 
     // Asmjit generator functions
 
+    /**
+     * mark a call, the return address is pushed onto the return stack so the matching return can be chained. Only
+     * architectures declaring the call marks in their traits may use it, see iss::jit::has_call_marks()
+     *
+     * @param jh the jit holder of the block
+     * @param ret_pc the 64 bit register holding the return address
+     */
+    void gen_push_return_address(jit_holder& jh, x86::Gp ret_pc) {
+        static_assert(iss::jit::has_call_marks<ARCH>(), "the traits of the architecture need to declare the call marks");
+        if(!chain_loop)
+            return;
+        InvokeNode* call_push;
+        jh.cc.comment("//gen_push_return_address");
+        jh.cc.invoke(&call_push, &iss::jit::push_return_address, FuncSignature::build<void, void*, uint64_t>());
+        call_push->setArg(0, &chain_cfg);
+        call_push->setArg(1, ret_pc);
+    }
+
     void gen_leave(jit_holder& jh, unsigned lvl) {
         InvokeNode* call_leave;
         jh.cc.comment("//gen_leave");
@@ -370,6 +634,37 @@ protected:
         mov(jh.cc, ptr, reg);
     }
 
+    /**
+     * zero extend an address and get the address of its software TLB entry minus the offset of the TLB, the entry is
+     * found through the context loaded from the vm pointer so blocks do not depend on the core they got translated for
+     */
+    inline x86::Gp gen_tlb_entry(jit_holder& jh, x86::Gp const& addr, x86::Gp const& addr64) {
+        x86::Compiler& cc = jh.cc;
+        if(addr.size() == 8)
+            cc.mov(addr64, addr);
+        else if(addr.size() == 4)
+            cc.mov(addr64.r32(), addr);
+        else
+            cc.movzx(addr64.r32(), addr);
+        auto entry = cc.newUIntPtr();
+        cc.mov(entry, addr64);
+        cc.shr(entry, iss::jit::soft_tlb::page_bits);
+        cc.and_(entry, iss::jit::soft_tlb::entry_count - 1);
+        cc.shl(entry, iss::jit::soft_tlb::entry_bits);
+        cc.add(entry, x86::qword_ptr(jh.vm_if_ptr, ctx_offset()));
+        return entry;
+    }
+    /**
+     * get the offset of the pointer to the context from the vm pointer the blocks get called with
+     */
+    int32_t ctx_offset() {
+        return static_cast<int32_t>(reinterpret_cast<uintptr_t>(&core_ctx) - reinterpret_cast<uintptr_t>(static_cast<vm_if*>(this)));
+    }
+    /**
+     * get the offset of the software TLB from the context
+     */
+    int32_t tlb_offset() { return static_cast<int32_t>(core_ctx->get_tlb_offset()); }
+
     inline x86_reg_t gen_read_mem(jit_holder& jh, mem_type_e type, x86_reg_t _addr, uint32_t length) {
         if(nonstd::holds_alternative<x86::Gp>(_addr)) {
             auto addr = nonstd::get<x86::Gp>(_addr);
@@ -382,11 +677,28 @@ protected:
             auto space_reg = cc.newInt32();
             cc.mov(space_reg, static_cast<uint16_t>(iss::address_type::VIRTUAL));
 
+            x86::Gp val_reg = get_reg_Gp(cc, length * 8, true);
+            auto done = cc.newLabel();
+            if(type == arch::traits<ARCH>::MEM) {
+                // look up the software TLB and load from the host memory of the page if it is entered
+                auto slow = cc.newLabel();
+                auto addr64 = cc.newUInt64();
+                auto entry = gen_tlb_entry(jh, addr, addr64);
+                auto tag = cc.newUInt64();
+                cc.mov(tag, iss::jit::soft_tlb::tag_mask(length));
+                cc.and_(tag, addr64);
+                cc.cmp(tag, x86::qword_ptr(entry, static_cast<int32_t>(tlb_offset() + iss::jit::soft_tlb::read_tag_offset)));
+                cc.jne(slow);
+                cc.add(addr64, x86::qword_ptr(entry, static_cast<int32_t>(tlb_offset() + iss::jit::soft_tlb::addend_offset)));
+                cc.mov(val_reg, x86::ptr(addr64, 0, length));
+                cc.jmp(done);
+                cc.bind(slow);
+            }
+
             auto val_ptr = cc.newUIntPtr();
-            cc.mov(val_ptr, read_mem_buf);
+            cc.lea(val_ptr, jh.read_buf);
             x86::Mem read_res;
             InvokeNode* invokeNode;
-            x86::Gp val_reg = get_reg_Gp(cc, length * 8, true);
 
             switch(length) {
             case 1: {
@@ -423,6 +735,7 @@ protected:
             cc.jne(jh.trap_entry);
 
             cc.mov(val_reg, read_res);
+            cc.bind(done);
             return val_reg;
         }
         // In case of dGp
@@ -448,6 +761,22 @@ protected:
             auto val = nonstd::get<x86::Gp>(_val);
             x86::Compiler& cc = jh.cc;
             assert(val.size() == length);
+            auto done = cc.newLabel();
+            if(type == arch::traits<ARCH>::MEM) {
+                // look up the software TLB and store to the host memory of the page if it is entered as writable
+                auto slow = cc.newLabel();
+                auto addr64 = cc.newUInt64();
+                auto entry = gen_tlb_entry(jh, addr, addr64);
+                auto tag = cc.newUInt64();
+                cc.mov(tag, iss::jit::soft_tlb::tag_mask(length));
+                cc.and_(tag, addr64);
+                cc.cmp(tag, x86::qword_ptr(entry, static_cast<int32_t>(tlb_offset() + iss::jit::soft_tlb::write_tag_offset)));
+                cc.jne(slow);
+                cc.add(addr64, x86::qword_ptr(entry, static_cast<int32_t>(tlb_offset() + iss::jit::soft_tlb::addend_offset)));
+                cc.mov(x86::ptr(addr64, 0, length), val);
+                cc.jmp(done);
+                cc.bind(slow);
+            }
             auto mem_type_reg = cc.newInt32();
             jh.cc.mov(mem_type_reg, type);
             auto space_reg = cc.newInt32();
@@ -479,6 +808,7 @@ protected:
 
             cc.cmp(ret_reg, 0);
             cc.jne(jh.trap_entry);
+            cc.bind(done);
         } else {
             throw std::runtime_error("Invalid variant combination in gen_write_mem");
         }
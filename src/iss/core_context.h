@@ -0,0 +1,432 @@
+/*******************************************************************************
+ * Copyright (C) 2024 MINRES Technologies GmbH
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Contributors:
+ *       eyck@minres.com - initial implementation
+ ******************************************************************************/
+
+#ifndef _CORE_CONTEXT_H_
+#define _CORE_CONTEXT_H_
+
+#include "arch_if.h"
+#include "jit/code_pages.h"
+#include "jit/soft_tlb.h"
+#include "mem/host_window.h"
+#include "smp/atomics.h"
+#include "util/delegate.h"
+#include "vm_types.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+
+namespace iss {
+/**
+ * the state a vm keeps at runtime for the core it executes: the pages holding code translated for the core, the
+ * software TLB, the atomic domain synchronizing the core with others and its reservation, and the host window
+ * generated code may access.
+ *
+ * The context attaches to the core for its lifetime, arch_if::get_context() returns it. The writes of the core
+ * (arch_if::write()) pass the context, so stores to code pages invalidate the translated blocks and stores of
+ * synchronized cores take the stripes of the atomic domain, before the context writes through the wr_func of the core.
+ * All vms executing the core share its context (see of()), e.g. the engines of a tiered vm.
+ */
+class core_context : public std::enable_shared_from_this<core_context> {
+public:
+    /**
+     * get the context of a core shared by the vms executing it, it gets created for the first one
+     *
+     * @param core the core
+     * @return the context
+     */
+    static std::shared_ptr<core_context> of(arch_if& core) {
+        if(!core.context)
+            return std::make_shared<core_context>(core);
+        if(auto ctx = core.context->weak_from_this().lock())
+            return ctx;
+        throw std::runtime_error("the core is attached to a context not shared with vms");
+    }
+
+    explicit core_context(arch_if& core)
+    : core(core) {
+        if(core.context)
+            throw std::runtime_error("the core is attached to another context already");
+        core.context_write = util::delegate<arch_if::wr_func_sig>::from<core_context, &core_context::write>(this);
+        core.context_write_vectored = util::delegate<arch_if::wr_vec_func_sig>::from<core_context, &core_context::write_vectored>(this);
+        core.context = this;
+        mark_handler_id = code_map.add_mark_handler([this](uint64_t page, bool marked) {
+            auto addr = page << jit::code_pages::page_bits;
+            // the handler may run on the thread of another core, the owning one protects its TLB at its next dispatch.
+            // Cores synchronized by an atomic domain never enter writable pages
+            if(marked && !atomics)
+                protect_pending.store(true, std::memory_order_release);
+            // stores of generated code to the page need to fault so they invalidate the translated blocks
+            if(window && marked)
+                window->limit(addr, 1U << jit::code_pages::page_bits, mem::host_window::protection_e::READ);
+            else if(window)
+                window->unlimit(addr, 1U << jit::code_pages::page_bits);
+        });
+    }
+
+    core_context(core_context const&) = delete;
+
+    core_context& operator=(core_context const&) = delete;
+
+    ~core_context() {
+        code_map.remove_mark_handler(mark_handler_id);
+        if(window)
+            window->remove_protection_handler(protection_handler_id);
+        core.context = nullptr;
+    }
+    /**
+     * get the core the context is attached to
+     *
+     * @return the core
+     */
+    arch_if& get_core() { return core; }
+    /**
+     * write to addresses, the core forwards arch_if::write() to it. The write is synchronized with the cores sharing
+     * the atomic domain and invalidates the code translated from the addresses
+     *
+     * @param type the address type
+     * @param access the access type
+     * @param space the address space
+     * @param addr the address to write to
+     * @param length length of the data to write
+     * @param data pointer to the memory to write from
+     * @return success or failure of access
+     */
+    iss::status write(const address_type type, const access_type access, const uint32_t space, const uint64_t addr,
+                      const unsigned length, const uint8_t* const data) {
+        if(auto* domain = domain_of(space))
+            return domain->store(addr, length, [&]() { return write_through(type, access, space, addr, length, data); });
+        return write_through(type, access, space, addr, length, data);
+    }
+    /**
+     * write a list of address ranges at once, the core forwards arch_if::write_vectored() to it. The ranges are
+     * accessed in order, the parts backed by writable host memory (see arch_if::get_host_region()) are copied using
+     * memcpy, the remaining parts are written through arch_if::write(). Translated code and other cores sharing the
+     * atomic domain observe the writes the same way as if they were done using arch_if::write()
+     *
+     * @param type the address type
+     * @param access the access type
+     * @param space the address space
+     * @param elems the ranges to write and the buffers holding the data
+     * @param count the number of ranges
+     * @return success or the failure of the first access failing, the following ranges are not written then
+     */
+    iss::status write_vectored(const address_type type, const access_type access, const uint32_t space, transfer const* elems,
+                               size_t count) {
+        auto* domain = domain_of(space);
+        for(size_t i = 0; i < count; ++i) {
+            auto addr = elems[i].addr;
+            uint8_t const* data = elems[i].data;
+            for(auto left = elems[i].length; left;) {
+                uint64_t n;
+                auto region = core.get_host_region(type, access, space, addr);
+                if(region && region.writable && region.contains(addr, 1)) {
+                    n = std::min(left, region.size - (addr - region.start));
+                    // bound the number of stripes a synchronized copy holds at a time
+                    if(domain)
+                        n = std::min(n, (uint64_t(1) << jit::soft_tlb::page_bits) - (addr & ~jit::soft_tlb::page_mask));
+                    auto copy = [&]() {
+                        std::memcpy(region.at(addr), data, n);
+                        return iss::Ok;
+                    };
+                    if(domain)
+                        domain->store(addr, static_cast<unsigned>(n), copy);
+                    else
+                        copy();
+                    if(code_map.holds_code(space, addr, n))
+                        code_map.written(addr, n);
+                } else {
+                    n = std::min<uint64_t>(left, arch_if::max_transfer_chunk);
+                    auto res = write(type, access, space, addr, static_cast<unsigned>(n), data);
+                    if(res != iss::Ok)
+                        return res;
+                }
+                addr += n;
+                data += n;
+                left -= n;
+            }
+        }
+        return iss::Ok;
+    }
+    /**
+     * write a list of address ranges at once, see write_vectored(const address_type, const access_type, const uint32_t,
+     * transfer const*, size_t)
+     */
+    inline iss::status write_vectored(const address_type type, const access_type access, const uint32_t space,
+                                      std::vector<transfer> const& elems) {
+        return write_vectored(type, access, space, elems.data(), elems.size());
+    }
+    /**
+     * read from addresses and take a reservation for them, e.g. for a load-reserved instruction
+     *
+     * @param type the address type
+     * @param space the address space
+     * @param addr the address to read from
+     * @param length length of the data to read
+     * @param data pointer to the memory to read into
+     * @return success or failure of access
+     */
+    iss::status load_reserved(const address_type type, const uint32_t space, const uint64_t addr, const unsigned length,
+                              uint8_t* const data) {
+        auto load = [&]() { return core.read(type, access_type::READ, space, addr, length, data); };
+        auto* domain = domain_of(space);
+        auto res = domain ? domain->load_reserved(reserved, addr, load) : load();
+        if(!domain)
+            reserved = smp::reservation{addr, 0, true};
+        if(res != iss::Ok)
+            reserved.valid = false;
+        return res;
+    }
+    /**
+     * write to addresses if the reservation taken by load_reserved() for them is still valid, e.g. for a
+     * store-conditional instruction. The reservation is cleared in any case
+     *
+     * @param type the address type
+     * @param space the address space
+     * @param addr the address to write to
+     * @param length length of the data to write
+     * @param data pointer to the memory to write from
+     * @param success set to true if the data was written
+     * @return success or failure of access
+     */
+    iss::status store_conditional(const address_type type, const uint32_t space, const uint64_t addr, const unsigned length,
+                                  const uint8_t* const data, bool& success) {
+        auto store = [&]() { return write_through(type, access_type::WRITE, space, addr, length, data); };
+        if(auto* domain = domain_of(space))
+            return domain->store_conditional(reserved, addr, store, success);
+        success = reserved.valid && reserved.addr == addr;
+        reserved.valid = false;
+        return success ? store() : iss::Ok;
+    }
+    /**
+     * atomically read from an address and write the result of an operation on the value read and an operand to it,
+     * e.g. for an atomic memory operation instruction
+     *
+     * @param type the address type
+     * @param space the address space
+     * @param addr the address accessed, aligned to the length
+     * @param length length of the data accessed, 1, 2, 4 or 8 bytes
+     * @param op the operation
+     * @param operand the operand
+     * @param old set to the value read
+     * @return success or failure of access
+     */
+    iss::status atomic_rmw(const address_type type, const uint32_t space, const uint64_t addr, const unsigned length, smp::amo_e op,
+                           uint64_t operand, uint64_t& old) {
+        auto rmw = [&]() {
+            uint64_t val = 0;
+            auto res = core.read(type, access_type::READ, space, addr, length, reinterpret_cast<uint8_t*>(&val));
+            if(res != iss::Ok)
+                return res;
+            old = val;
+            switch(length) {
+            case 1:
+                val = smp::amo_result<uint8_t>(op, val, operand);
+                break;
+            case 2:
+                val = smp::amo_result<uint16_t>(op, val, operand);
+                break;
+            case 4:
+                val = smp::amo_result<uint32_t>(op, val, operand);
+                break;
+            case 8:
+                val = smp::amo_result<uint64_t>(op, val, operand);
+                break;
+            default:
+                return iss::NotSupported;
+            }
+            return write_through(type, access_type::WRITE, space, addr, length, reinterpret_cast<uint8_t*>(&val));
+        };
+        auto* domain = domain_of(space);
+        return domain ? domain->atomic(addr, rmw) : rmw();
+    }
+    /**
+     * drop the reservation taken by load_reserved(), e.g. when entering a trap
+     */
+    void clear_reservation() { reserved.valid = false; }
+    /**
+     * get the pages holding code translated for the core. Translation caches mark the pages of their blocks in it and
+     * get notified about writes to them
+     *
+     * @return the code pages
+     */
+    jit::code_pages& get_code_pages() { return code_map; }
+    /**
+     * share the code pages with the context of another core using the same memory, so writes of either core
+     * invalidate the translated code of both. Needs to be called before code gets translated for this core, see
+     * code_pages::share()
+     *
+     * @param other the context of the other core
+     */
+    void share_code_pages(core_context& other) {
+        code_map.share(other.code_map);
+        // pages translated for the other core must not stay writable in the software TLB
+        tlb.flush();
+    }
+    /**
+     * get the software TLB of the core, see jit::soft_tlb
+     *
+     * @return the TLB
+     */
+    jit::soft_tlb& get_tlb() { return tlb; }
+    /**
+     * get the offset of the TLB entries from the context. Generated code loads the context from the vm it gets passed
+     * and finds the entries at this offset, it is the same for all contexts
+     *
+     * @return the offset in bytes
+     */
+    size_t get_tlb_offset() { return reinterpret_cast<uintptr_t>(tlb.data()) - reinterpret_cast<uintptr_t>(this); }
+    /**
+     * enter the page of an address accessed through arch_if::read() or arch_if::write() into the software TLB if the
+     * core backs it by host memory. Called by the out-of-line access functions of generated code.
+     * The code pages hold the physical addresses blocks get translated from while the entries are tagged by virtual
+     * addresses. So stores may only access the host memory of a page directly if the page is mapped to the physical
+     * page of the same address, stores to pages aliasing others take the write path of the core which reports them
+     * with their physical address (e.g. mem::memory_map::set_code_pages())
+     *
+     * @param type the address type
+     * @param space the address space
+     * @param addr the address accessed
+     */
+    void refill_tlb(const address_type type, const uint32_t space, const uint64_t addr) {
+        if(type != address_type::VIRTUAL || !tlb.is_enabled(space))
+            return;
+        auto page_addr = addr & jit::soft_tlb::page_mask;
+        auto* host = core.get_host_page(type, access_type::READ, space, page_addr);
+        if(!host)
+            return;
+        // stores to code pages need to invalidate translated blocks, stores of synchronized cores need to take stripes
+        auto writable = !domain_of(space) && !code_map.holds_code(space, page_addr, 1U << jit::soft_tlb::page_bits) &&
+                        core.get_host_page(type, access_type::WRITE, space, page_addr) == host &&
+                        core.get_host_page(address_type::PHYSICAL, access_type::WRITE, space, page_addr) == host;
+        tlb.fill(page_addr, host, writable);
+    }
+    /**
+     * stop the stores of generated code from accessing pages directly which got marked as holding code since the last
+     * call, also if they got marked by other cores sharing the code pages. Needs to be called by the vm on the thread
+     * of the core before it executes blocks
+     */
+    void sync_tlb() {
+        if(protect_pending.load(std::memory_order_relaxed) && protect_pending.exchange(false, std::memory_order_acquire))
+            tlb.protect();
+    }
+    /**
+     * synchronize the writes and atomic accesses of the core with the cores sharing the domain, needed if cores share
+     * memory while running on concurrent threads
+     *
+     * @param domain the domain of the cores or nullptr to stop synchronizing
+     * @param space the address space of the shared memory, accesses to other spaces are not synchronized
+     */
+    void set_atomic_domain(smp::atomic_domain* domain, uint32_t space) {
+        atomics = domain;
+        atomics_space = space;
+        reserved.valid = false;
+        tlb.flush();
+    }
+    /**
+     * let generated code access the guest RAM of an address space as plain loads and stores of a host window instead of
+     * looking up the software TLB, see mem::host_window. The addresses of the space need to be physical ones and the
+     * core needs to permit misaligned accesses to RAM as generated code neither translates nor checks them. Needs to be
+     * set before code gets translated. host_window::protect() flushes the software TLB of the core, so it needs to be
+     * called on the thread of the core or while the core is stopped
+     *
+     * @param win the window or nullptr to use the software TLB only
+     * @param space the address space of the RAM in the window
+     */
+    void set_host_window(mem::host_window* win, uint32_t space) {
+        if(window)
+            window->remove_protection_handler(protection_handler_id);
+        window = win;
+        window_space = space;
+        window_regs.base = win ? win->host_base() : nullptr;
+        // the entries are tagged by virtual addresses, any of them may map a page changing its protection
+        if(win)
+            protection_handler_id = win->add_protection_handler([this](uint64_t, uint64_t) { tlb.flush(); });
+    }
+    /**
+     * get the host window generated code may access, there is none while the core is synchronized with an atomic domain
+     *
+     * @param space the address space
+     * @return the window or nullptr
+     */
+    mem::host_window* get_host_window(uint32_t space) const { return space == window_space && !domain_of(space) ? window : nullptr; }
+    /**
+     * get the offset of the window registers from the context, see get_tlb_offset(). Generated code loads the base of
+     * the window from the first one and stores the guest pc of each window access to the second one
+     *
+     * @return the offset in bytes
+     */
+    size_t get_window_offset() const { return reinterpret_cast<uintptr_t>(&window_regs) - reinterpret_cast<uintptr_t>(this); }
+    /**
+     * get the guest pc of the last window access executed, after a fault the one of the faulting instruction
+     *
+     * @return the pc
+     */
+    uint64_t get_window_pc() const { return window_regs.pc; }
+
+private:
+    static_assert(arch_if::host_page_bits == jit::soft_tlb::page_bits, "the software TLB maps the host pages of the cores");
+
+    smp::atomic_domain* domain_of(uint32_t space) const { return space == atomics_space ? atomics : nullptr; }
+
+    iss::status write_through(const address_type type, const access_type access, const uint32_t space, const uint64_t addr,
+                              const unsigned length, const uint8_t* const data) {
+        auto res = core.wr_func(type, access, space, addr, length, data);
+        if(code_map.holds_code(space, addr, length))
+            code_map.written(addr, length);
+        return res;
+    }
+
+    arch_if& core;
+    jit::code_pages code_map;
+    size_t mark_handler_id{0};
+    smp::atomic_domain* atomics{nullptr};
+    uint32_t atomics_space{0};
+    smp::reservation reserved;
+    jit::soft_tlb tlb;
+    //! set if pages got marked as holding code and the TLB may still grant direct write access to them
+    std::atomic<bool> protect_pending{false};
+    mem::host_window* window{nullptr};
+    uint32_t window_space{0};
+    size_t protection_handler_id{0};
+    struct {
+        uint8_t* base{nullptr};
+        uint64_t pc{0};
+    } window_regs;
+};
+} // namespace iss
+
+#endif /* _CORE_CONTEXT_H_ */
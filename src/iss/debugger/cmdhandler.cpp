@@ -579,13 +579,12 @@ std::string cmd_handler::query(std::string const& in_buf) {
         char* ptr = nullptr;
         auto offset = strtoul(token[4].c_str(), &ptr, 16);
         auto length = strtoul(ptr + 1, nullptr, 16);
-        static std::string buf;
-        if(buf.size() == 0)
-            t->target_xml_query(buf);
-        if((offset + length) > buf.size()) {
-            return std::string("l") + buf.substr(offset);
+        if(target_xml.size() == 0)
+            t->target_xml_query(target_xml);
+        if((offset + length) > target_xml.size()) {
+            return std::string("l") + target_xml.substr(offset);
         } else {
-            return std::string("m") + buf.substr(offset, length);
+            return std::string("m") + target_xml.substr(offset, length);
         }
     }
     if(strncmp(in_buf.c_str() + 1, "Supported", 9) == 0 && (in_buf[10] == ':' || in_buf[10] == '\0')) {
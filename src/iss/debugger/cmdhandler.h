@@ -154,6 +154,8 @@ public:
     bool can_restart;
     std::function<void(unsigned)>& stop_callback;
     std::unordered_map<uint64_t, unsigned> bp_map;
+    // the target description sent to the debugger, queried from the target on first use
+    std::string target_xml;
     std::array<const my_custom_command, 3> rp_remote_commands = {{
         /* Table of commands */
         GEN_ENTRY(help, "This help text"),
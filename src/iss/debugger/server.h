@@ -36,10 +36,15 @@
 #define _SERVER_H_
 
 #include "server_base.h"
+#include <algorithm>
 #include <boost/asio.hpp>
 #include <boost/asio/io_context.hpp>
 #include <boost/thread.hpp>
 #include <ctime>
+#include <dbt_rise_common.h>
+#include <mutex>
+#include <utility>
+#include <vector>
 #include <util/logging.h>
 
 namespace iss {
@@ -47,19 +52,50 @@ namespace debugger {
 
 template <class SESSION> class server : public server_base {
 public:
+    /**
+     * start the server of a vm, each vm has at most one server
+     *
+     * @param vm the vm to be debugged
+     * @param port the port to listen on
+     */
     static void run_server(iss::debugger_if* vm, unsigned int port) {
-        if(get() != NULL) {
-            CPPLOG(FATAL) << "server already initialized";
-        }
+        std::lock_guard<std::mutex> lock(registry_mutex());
+        for(auto& e : registry())
+            if(e.first == vm) {
+                CPPLOG(FATAL) << "server already initialized";
+                return;
+            }
         CPPLOG(DEBUG) << "starting server listening on port " << port;
-        get(new server<SESSION>(vm, port));
+        registry().emplace_back(vm, new server<SESSION>(vm, port));
+    }
+    /**
+     * get the server started first, use get(iss::debugger_if*) as there may be one server per vm
+     *
+     * @return the server or nullptr if none is running
+     */
+    DEPRECATED static server<SESSION>* get() {
+        std::lock_guard<std::mutex> lock(registry_mutex());
+        return registry().empty() ? nullptr : registry().front().second;
+    }
+    /**
+     * get the server of a vm
+     *
+     * @param vm the vm being debugged
+     * @return the server or nullptr if none is running for the vm
+     */
+    static server<SESSION>* get(iss::debugger_if* vm) {
+        std::lock_guard<std::mutex> lock(registry_mutex());
+        for(auto& e : registry())
+            if(e.first == vm)
+                return e.second;
+        return nullptr;
     }
-
-    static server<SESSION>* get() { return get(NULL); }
 
     unsigned short get_port_nr() { return acceptor.local_endpoint().port(); }
 
     void shutdown() override {
+        // the vm may start a new server from now on
+        unregister();
         delete work_ctrl;
         work_ctrl = nullptr;
         // Wait for all threads in the pool to exit.
@@ -69,11 +105,21 @@ public:
     }
 
 protected:
-    static server<SESSION>* get(server<SESSION>* srv) {
-        static server<SESSION>* s = NULL;
-        if(srv != NULL && s == NULL)
-            s = srv;
-        return s;
+    // the servers by the vm they debug, in the order they got started
+    static std::vector<std::pair<iss::debugger_if*, server<SESSION>*>>& registry() {
+        static std::vector<std::pair<iss::debugger_if*, server<SESSION>*>> servers;
+        return servers;
+    }
+
+    static std::mutex& registry_mutex() {
+        static std::mutex mtx;
+        return mtx;
+    }
+
+    void unregister() {
+        std::lock_guard<std::mutex> lock(registry_mutex());
+        auto& servers = registry();
+        servers.erase(std::remove_if(servers.begin(), servers.end(), [this](auto const& e) { return e.second == this; }), servers.end());
     }
 
     server(iss::debugger_if* vm, unsigned short port)
@@ -89,6 +135,8 @@ protected:
         createNewSession();
     };
 
+    ~server() override { unregister(); }
+
     void createNewSession() {
         boost::shared_ptr<SESSION> new_session(new SESSION(this, io_service));
         acceptor.async_accept(new_session->socket(),
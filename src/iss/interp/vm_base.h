@@ -37,6 +37,7 @@
 
 #include <iss/arch/traits.h>
 #include <iss/arch_if.h>
+#include <iss/core_context.h>
 #include <iss/debugger/target_adapter_base.h>
 #include <iss/debugger_if.h>
 #include <iss/vm_if.h>
@@ -142,6 +143,19 @@ public:
         return error;
     }
 
+    int run_slice(uint64_t count, finish_cond_e cond, slice_e& result) override {
+        virt_addr_t pc(iss::access_type::FETCH, arch::traits<ARCH>::MEM, get_reg<addr_t>(arch::traits<ARCH>::PC));
+        result = slice_e::LIMIT;
+        try {
+            execute_inst(cond, pc, count);
+        } catch(simulation_stopped& e) {
+            result = slice_e::STOPPED;
+            this->core.interrupt_sim = true;
+            return e.state != 1 ? e.state : 0;
+        }
+        return 0;
+    }
+
     void reset() override { core.reset(); }
 
     void reset(uint64_t address) override { core.reset(address); }
@@ -156,6 +170,7 @@ protected:
 
     explicit vm_base(ARCH& core, unsigned core_id = 0, unsigned cluster_id = 0)
     : core(core)
+    , core_ctx_ref(iss::core_context::of(core))
     , core_id(core_id)
     , cluster_id(cluster_id)
     , regs_base_ptr(core.get_regs_base_ptr()) {
@@ -165,6 +180,7 @@ protected:
     explicit vm_base(std::unique_ptr<ARCH> core_ptr, unsigned core_id = 0, unsigned cluster_id = 0)
     : core(*core_ptr)
     , core_ptr(std::move(core_ptr))
+    , core_ctx_ref(iss::core_context::of(core))
     , core_id(core_id)
     , cluster_id(cluster_id)
     , regs_base_ptr(core.get_regs_base_ptr()) {
@@ -228,6 +244,8 @@ protected:
 
     ARCH& core;
     std::unique_ptr<ARCH> core_ptr;
+    //! the context of the core, shared with the other vms executing it
+    std::shared_ptr<iss::core_context> const core_ctx_ref;
     unsigned core_id = 0;
     unsigned cluster_id = 0;
     uint8_t* regs_base_ptr;
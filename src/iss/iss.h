@@ -53,6 +53,9 @@ template <typename ARCH> std::unique_ptr<iss::vm_if> create(ARCH*, unsigned shor
 namespace asmjit {
 template <typename ARCH> std::unique_ptr<iss::vm_if> create(ARCH*, unsigned short port = 0, bool dump = false);
 }
+namespace tiered {
+template <typename ARCH> std::unique_ptr<iss::vm_if> create(ARCH*, unsigned short port = 0, bool dump = false);
+}
 } // namespace iss
 
 #endif /* _ISS_H */
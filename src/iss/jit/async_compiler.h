@@ -0,0 +1,218 @@
+/*******************************************************************************
+ * Copyright (C) 2024 MINRES Technologies GmbH
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Contributors:
+ *       eyck@minres.com - initial implementation
+ ******************************************************************************/
+
+#ifndef _ISS_JIT_ASYNC_COMPILER_H_
+#define _ISS_JIT_ASYNC_COMPILER_H_
+
+#include <absl/container/flat_hash_map.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace iss {
+namespace jit {
+/**
+ * pool of worker threads compiling translated blocks in the background
+ *
+ * The vm generates the code of a block in the simulation thread and submits the expensive compilation as a job. Jobs
+ * are run in submission order. Finished blocks are handed back to the vm by install() which is called by the
+ * dispatch loop between two blocks, so a block becomes visible to the translation cache and the chains atomically.
+ * Each job is tagged with the generation of the translation cache it was submitted for, blocks finished after the
+ * cache got flushed are dropped as the code they were translated from might have changed.
+ * All member functions but the workers themselves are used from the simulation thread only.
+ *
+ * @tparam R the result of a job, usually the translation block of the backend
+ */
+template <typename R> class async_compiler {
+public:
+    /**
+     * create the worker threads
+     *
+     * @param threads the number of worker threads, at least 1
+     */
+    explicit async_compiler(unsigned threads) {
+        for(unsigned i = 0; i < std::max(threads, 1U); ++i)
+            workers.emplace_back([this]() { work(); });
+    }
+    /**
+     * stop the workers, jobs not started yet are dropped
+     */
+    ~async_compiler() {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            stopping = true;
+            jobs.clear();
+        }
+        work_cv.notify_all();
+        for(auto& t : workers)
+            t.join();
+    }
+
+    async_compiler(async_compiler const&) = delete;
+
+    async_compiler& operator=(async_compiler const&) = delete;
+    /**
+     * check if the block at pc is submitted but not installed yet
+     *
+     * @param pc the physical address of the block
+     * @return true if the block is being compiled
+     */
+    bool pending(uint64_t pc) const { return in_flight.find(pc) != in_flight.end(); }
+    /**
+     * submit the compilation of a block
+     *
+     * @param pc the physical address of the block
+     * @param generation the generation of the translation cache the block is compiled for
+     * @param job the compilation, may be a move-only callable
+     */
+    template <typename F> void submit(uint64_t pc, uint64_t generation, F&& job) {
+        // the job is counted as completed before its result becomes ready so install() never misses a ready result
+        std::packaged_task<R()> task([this, job = std::forward<F>(job)]() mutable {
+            count_completion guard{completed};
+            return job();
+        });
+        in_flight[pc] = pending_job{generation, task.get_future()};
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            jobs.push_back(std::move(task));
+        }
+        work_cv.notify_one();
+    }
+    /**
+     * wait until the compilation of the block at pc finished, it still needs to be installed
+     *
+     * @param pc the physical address of the block
+     */
+    void wait(uint64_t pc) {
+        auto it = in_flight.find(pc);
+        if(it != in_flight.end())
+            it->second.result.wait();
+    }
+    /**
+     * wait until all submitted blocks finished compiling, they still need to be installed
+     */
+    void wait_all() {
+        for(auto& job : in_flight)
+            job.second.result.wait();
+    }
+    /**
+     * hand the finished blocks to the vm. A compilation error is rethrown
+     *
+     * @param generation the current generation of the translation cache, blocks of other generations are dropped
+     * @param f the function installing a block, called as f(pc, R&&)
+     * @param dropped the function called with the pc of a block which is dropped or failed to compile
+     * @return the number of installed blocks
+     */
+    template <typename F, typename D> size_t install(uint64_t generation, F&& f, D&& dropped) {
+        auto finished = completed.load(std::memory_order_acquire);
+        if(finished == consumed)
+            return 0;
+        size_t installed = 0;
+        for(auto it = in_flight.begin(); it != in_flight.end();) {
+            auto cur = it++;
+            if(cur->second.result.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+                continue;
+            auto pc = cur->first;
+            auto job_generation = cur->second.generation;
+            auto result = std::move(cur->second.result);
+            in_flight.erase(cur);
+            consumed++;
+            try {
+                auto block = result.get();
+                if(job_generation == generation) {
+                    f(pc, std::move(block));
+                    installed++;
+                    continue;
+                }
+            } catch(...) {
+                dropped(pc);
+                throw;
+            }
+            dropped(pc);
+        }
+        return installed;
+    }
+    /**
+     * get the number of submitted blocks not installed yet
+     *
+     * @return the number of blocks
+     */
+    size_t size() const { return in_flight.size(); }
+
+private:
+    struct count_completion {
+        std::atomic<uint64_t>& counter;
+        ~count_completion() { counter.fetch_add(1, std::memory_order_release); }
+    };
+
+    struct pending_job {
+        uint64_t generation;
+        std::future<R> result;
+    };
+
+    void work() {
+        for(;;) {
+            std::packaged_task<R()> task;
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                work_cv.wait(lock, [this]() { return stopping || !jobs.empty(); });
+                if(stopping)
+                    return;
+                task = std::move(jobs.front());
+                jobs.pop_front();
+            }
+            task();
+        }
+    }
+
+    std::mutex mtx;
+    std::condition_variable work_cv;
+    std::deque<std::packaged_task<R()>> jobs;
+    bool stopping{false};
+    std::atomic<uint64_t> completed{0};
+    uint64_t consumed{0};
+    absl::flat_hash_map<uint64_t, pending_job> in_flight;
+    std::vector<std::thread> workers;
+};
+} // namespace jit
+} // namespace iss
+#endif /* _ISS_JIT_ASYNC_COMPILER_H_ */
@@ -0,0 +1,181 @@
+/*******************************************************************************
+ * Copyright (C) 2024 MINRES Technologies GmbH
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Contributors:
+ *       eyck@minres.com - initial implementation
+ ******************************************************************************/
+
+#ifndef _ISS_JIT_CHAINING_H_
+#define _ISS_JIT_CHAINING_H_
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <iss/arch/traits.h>
+
+namespace iss {
+namespace jit {
+/**
+ * a recently seen target of an indirect branch, cached in the translation block the branch ends
+ */
+struct indirect_target {
+    uint64_t pc{0};
+    void* tb{nullptr};
+};
+//! number of targets cached for the indirect branch ending a block
+constexpr unsigned indirect_target_ways = 2;
+//! index of the target caching the block at the return address of a call ending a block
+constexpr unsigned return_target_idx = indirect_target_ways;
+//! the type of the indirect target array of the translation blocks
+using indirect_targets = std::array<indirect_target, indirect_target_ways + 1>;
+/**
+ * the successors of a block known when translating it, indexed like the cont array of the translation blocks: the
+ * block falls through to successor 0 (NO_JUMP) and branches to successor 1 (KNOWN_JUMP)
+ */
+struct block_successors {
+    //! the start address of the block
+    uint64_t from{0};
+    std::array<uint64_t, 2> pc{};
+    std::array<bool, 2> known{};
+    //! the address following the guest code of the block, of all blocks of a region
+    uint64_t end{0};
+
+    void clear(uint64_t block_pc) {
+        from = block_pc;
+        known = {false, false};
+    }
+
+    bool empty() const { return !known[0] && !known[1]; }
+    /**
+     * check if a successor is in the 4kB page of the block. Only such successors are translated ahead of time as other
+     * pages might not be mapped and fetching from them would raise a trap
+     *
+     * @param idx the index of the successor
+     * @return true if the successor is known and in the page of the block
+     */
+    bool in_page(unsigned idx) const { return known[idx] && (pc[idx] >> 12) == (from >> 12); }
+};
+/**
+ * get the size of the register file of an architecture, i.e. the state to be preserved when translating ahead of time
+ *
+ * @tparam ARCH the architecture
+ * @return the number of bytes up to the end of the last register
+ */
+template <typename ARCH> constexpr size_t register_file_size() {
+    size_t size = 0;
+    for(size_t i = 0; i < arch::traits<ARCH>::NUM_REGS; ++i)
+        size = std::max<size_t>(size, arch::traits<ARCH>::reg_byte_offsets[i] + (arch::traits<ARCH>::reg_bit_widths[i] + 7) / 8);
+    return size;
+}
+// the call_marks member of the traits of an architecture, false if the traits do not define it
+template <typename ARCH> constexpr auto call_marks(int) -> decltype(bool(arch::traits<ARCH>::call_marks)) {
+    return arch::traits<ARCH>::call_marks;
+}
+
+template <typename ARCH> constexpr bool call_marks(long) { return false; }
+/**
+ * check if the generator of an architecture marks calls by calling gen_push_return_address() of the vm. Such an
+ * architecture defines the member call_marks in its traits:
+ *
+ *     static constexpr bool call_marks = true;
+ *
+ * Without the marks the vm has no return stack and returns are chained through the indirect targets of their block
+ *
+ * @tparam ARCH the architecture
+ * @return true if the architecture marks calls
+ */
+template <typename ARCH> constexpr bool has_call_marks() { return call_marks<ARCH>(0); }
+/**
+ * shadow stack of the return addresses of the calls the architecture marked
+ */
+struct return_stack {
+    struct entry {
+        uint64_t pc{0};
+        //! the block ending with the call, its return target caches the block at pc
+        void* caller{nullptr};
+        //! epoch of the translation cache at the time of the call, the entry is stale once the epoch changed
+        uint64_t epoch{0};
+    };
+    //! needs to be a power of 2
+    static constexpr unsigned depth = 16;
+    std::array<entry, depth> entries;
+    uint32_t top{0};
+
+    void pop() {
+        entries[top] = entry{};
+        top = (top - 1) & (depth - 1);
+    }
+};
+/**
+ * the state generated code needs to chain translated blocks without returning to the dispatch loop
+ *
+ * When a block finishes it looks up its successor in the cont array of the block in cur_tb using the LAST_BRANCH
+ * register and transfers control to it unless the stop flag is set, the instruction count limit is reached or the
+ * successor is not linked yet. Blocks ending with an indirect branch continue with the block cached in their indirect
+ * targets or, in case of a return, with the return target of the caller on top of the return stack if there is one.
+ * All pointers are absolute addresses owned by the vm, they are embedded into the generated code and need to stay
+ * valid as long as the translated blocks exist.
+ */
+struct chain_config {
+    //! slot holding the block being executed, updated by the generated code when moving to a successor
+    void** cur_tb{nullptr};
+    //! offset of the host code pointer in the translation block
+    size_t f_ptr_offset{0};
+    //! offset of the cont array in the translation block
+    size_t cont_offset{0};
+    //! offset of the indirect_targets array in the translation block
+    size_t targets_offset{0};
+    //! flag being set if the core needs to stop, see arch_if::get_stop_flag_ptr()
+    bool const* stop_flag{nullptr};
+    uint8_t const* last_branch{nullptr};
+    //! size of the LAST_BRANCH register in bytes
+    unsigned last_branch_size{0};
+    uint64_t const* icount{nullptr};
+    uint64_t const* icount_limit{nullptr};
+    //! the return stack of the vm, nullptr if the architecture does not mark calls, see has_call_marks()
+    return_stack* ras{nullptr};
+    //! the epoch of the translation cache, see translation_cache::epoch()
+    uint64_t const* cache_epoch{nullptr};
+};
+/**
+ * push the return address of a call, called by the generated code. The block in cur_tb is recorded as caller
+ *
+ * @param cfg the chaining state of the vm
+ * @param pc the address the call returns to
+ */
+inline void push_return_address(chain_config const* cfg, uint64_t pc) {
+    auto& ras = *cfg->ras;
+    ras.top = (ras.top + 1) & (return_stack::depth - 1);
+    ras.entries[ras.top] = return_stack::entry{pc, *cfg->cur_tb, *cfg->cache_epoch};
+}
+} // namespace jit
+} // namespace iss
+#endif /* _ISS_JIT_CHAINING_H_ */
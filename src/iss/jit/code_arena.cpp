@@ -0,0 +1,226 @@
+/*******************************************************************************
+ * Copyright (C) 2024 MINRES Technologies GmbH
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Contributors:
+ *       eyck@minres.com - initial implementation
+ ******************************************************************************/
+
+#include "code_arena.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace iss {
+namespace jit {
+
+struct code_arena::chunk {
+    uint8_t* rx{nullptr};
+    uint8_t* rw{nullptr};
+    size_t size{0};
+    size_t top{0};
+    size_t live{0};
+    size_t wasted{0};
+};
+
+namespace {
+size_t page_size() {
+#ifdef _WIN32
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return si.dwPageSize;
+#else
+    static size_t const size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    return size;
+#endif
+}
+
+inline size_t align_up(size_t val, size_t alignment) { return (val + alignment - 1) & ~(alignment - 1); }
+
+bool set_protection(uint8_t* ptr, size_t length, bool writable) {
+    auto start = reinterpret_cast<uintptr_t>(ptr) & ~(page_size() - 1);
+    auto end = align_up(reinterpret_cast<uintptr_t>(ptr) + length, page_size());
+#ifdef _WIN32
+    DWORD old_protect;
+    return VirtualProtect(reinterpret_cast<void*>(start), end - start, writable ? PAGE_READWRITE : PAGE_EXECUTE_READ, &old_protect);
+#else
+    return mprotect(reinterpret_cast<void*>(start), end - start, writable ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC) == 0;
+#endif
+}
+} // namespace
+
+code_arena::code_arena(size_t chunk_size, size_t alignment)
+: chunk_size(align_up(std::max<size_t>(chunk_size, 1), page_size()))
+, alignment(alignment) {
+    if(!alignment || (alignment & (alignment - 1)))
+        throw std::invalid_argument("code arena alignment needs to be a power of 2");
+#if !defined(__linux__)
+    dual_mapped = false;
+#endif
+}
+
+code_arena::~code_arena() {
+    while(!chunks.empty())
+        unmap_chunk(chunks.back().get());
+}
+
+code_arena::allocation code_arena::allocate(size_t size) {
+    size = std::max<size_t>(size, 1);
+    // without a second mapping the protection of the pages changes, so allocations must not share a page
+    auto offs = active ? align_up(active->top, dual_mapped ? alignment : std::max(alignment, page_size())) : 0;
+    if(!active || offs + size > active->size) {
+        if(active) {
+            active->wasted += active->size - active->top;
+            arena_stats.wasted_bytes += active->size - active->top;
+            active->top = active->size;
+            auto* last = active;
+            active = nullptr;
+            if(!last->live)
+                unmap_chunk(last);
+        }
+        active = new_chunk(std::max(chunk_size, align_up(size, page_size())));
+        offs = 0;
+    }
+    allocation mem{active->rx + offs, active->rw + offs, size, active};
+    active->wasted += offs - active->top;
+    arena_stats.wasted_bytes += offs - active->top;
+    active->top = offs + size;
+    active->live++;
+    if(active->rw == active->rx && !set_protection(mem.rw, size, true))
+        throw std::runtime_error("could not make code memory writable");
+    arena_stats.allocations++;
+    arena_stats.used_bytes += size;
+    return mem;
+}
+
+void code_arena::seal(allocation const& mem) {
+    if(mem.rw == mem.rx && !set_protection(mem.rx, mem.size, false))
+        throw std::runtime_error("could not set memory as executable");
+}
+
+void code_arena::patch(allocation const& mem, size_t offset, void const* data, size_t size) {
+    if(offset > mem.size || size > mem.size - offset)
+        throw std::runtime_error("the patched code exceeds its allocation");
+    if(mem.rw == mem.rx && !set_protection(mem.rw + offset, size, true))
+        throw std::runtime_error("could not make code memory writable");
+    std::memcpy(mem.rw + offset, data, size);
+    if(mem.rw == mem.rx && !set_protection(mem.rx + offset, size, false))
+        throw std::runtime_error("could not set memory as executable");
+}
+
+void code_arena::release(allocation const& mem) {
+    auto* c = mem.owner;
+    if(!c)
+        return;
+    c->live--;
+    arena_stats.used_bytes -= mem.size;
+    arena_stats.releases++;
+    if(c->live)
+        return;
+    if(c != active) {
+        unmap_chunk(c);
+    } else {
+        // nothing in the active chunk is reachable anymore so restart from the beginning
+        arena_stats.wasted_bytes -= c->wasted;
+        c->wasted = 0;
+        c->top = 0;
+    }
+}
+
+code_arena::chunk* code_arena::new_chunk(size_t size) {
+    std::unique_ptr<chunk> c{new chunk};
+    c->size = size;
+#if defined(__linux__)
+    if(dual_mapped) {
+        int fd = memfd_create("dbt-rise-code", MFD_CLOEXEC);
+        if(fd >= 0 && ftruncate(fd, size) == 0) {
+            auto* rw = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            auto* rx = mmap(nullptr, size, PROT_READ | PROT_EXEC, MAP_SHARED, fd, 0);
+            if(rw != MAP_FAILED && rx != MAP_FAILED) {
+                c->rw = static_cast<uint8_t*>(rw);
+                c->rx = static_cast<uint8_t*>(rx);
+            } else {
+                if(rw != MAP_FAILED)
+                    munmap(rw, size);
+                if(rx != MAP_FAILED)
+                    munmap(rx, size);
+            }
+        }
+        if(fd >= 0)
+            close(fd);
+        // the host does not allow shared executable mappings (e.g. SELinux), so fall back to a single mapping
+        if(!c->rx)
+            dual_mapped = false;
+    }
+#endif
+    if(!c->rx) {
+#ifdef _WIN32
+        auto* mem = VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+        if(!mem)
+            throw std::runtime_error("could not allocate memory for generated code");
+#else
+        auto* mem = mmap(nullptr, size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(mem == MAP_FAILED)
+            throw std::runtime_error("could not allocate memory for generated code");
+#endif
+        c->rx = c->rw = static_cast<uint8_t*>(mem);
+    }
+    arena_stats.chunks++;
+    arena_stats.reserved_bytes += size;
+    chunks.push_back(std::move(c));
+    return chunks.back().get();
+}
+
+void code_arena::unmap_chunk(chunk* c) {
+    auto it = std::find_if(chunks.begin(), chunks.end(), [c](std::unique_ptr<chunk> const& e) { return e.get() == c; });
+    if(it == chunks.end())
+        return;
+#ifdef _WIN32
+    VirtualFree(c->rx, 0, MEM_RELEASE);
+#else
+    munmap(c->rx, c->size);
+    if(c->rw != c->rx)
+        munmap(c->rw, c->size);
+#endif
+    arena_stats.chunks--;
+    arena_stats.reserved_bytes -= c->size;
+    arena_stats.wasted_bytes -= c->wasted;
+    arena_stats.chunks_released++;
+    if(active == c)
+        active = nullptr;
+    chunks.erase(it);
+}
+} // namespace jit
+} // namespace iss
@@ -0,0 +1,150 @@
+/*******************************************************************************
+ * Copyright (C) 2024 MINRES Technologies GmbH
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Contributors:
+ *       eyck@minres.com - initial implementation
+ ******************************************************************************/
+
+#ifndef _ISS_JIT_CODE_ARENA_H_
+#define _ISS_JIT_CODE_ARENA_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace iss {
+namespace jit {
+/**
+ * memory arena for generated host code
+ *
+ * Code is bump-allocated out of large chunks obtained directly from the OS. Where the host supports it a chunk is
+ * mapped twice, once writable and once executable, so no page is ever writable and executable at the same time.
+ * Otherwise each allocation gets pages of its own which are switched to RW while the code is written and back to RX by
+ * seal(), so code executing in other allocations never loses its pages.
+ * A chunk is returned to the OS as soon as all allocations in it are released and it is not the active chunk.
+ */
+class code_arena {
+    struct chunk;
+
+public:
+    struct allocation {
+        //! address the code executes at, code needs to be relocated to this address
+        uint8_t* rx{nullptr};
+        //! address the code is written to, the same as rx if the arena is not dual mapped
+        uint8_t* rw{nullptr};
+        size_t size{0};
+        chunk* owner{nullptr};
+    };
+
+    struct stats {
+        //! number of chunks currently mapped
+        size_t chunks{0};
+        //! number of bytes currently mapped
+        size_t reserved_bytes{0};
+        //! number of bytes currently handed out
+        size_t used_bytes{0};
+        //! number of bytes lost to alignment and unused chunk tails
+        size_t wasted_bytes{0};
+        uint64_t allocations{0};
+        uint64_t releases{0};
+        uint64_t chunks_released{0};
+    };
+    /**
+     * create an arena
+     *
+     * @param chunk_size the size of the chunks memory is taken from, rounded up to the page size
+     * @param alignment the alignment of each allocation, needs to be a power of 2
+     */
+    explicit code_arena(size_t chunk_size = 1 << 20, size_t alignment = 64);
+
+    ~code_arena();
+
+    code_arena(code_arena const&) = delete;
+
+    code_arena& operator=(code_arena const&) = delete;
+    /**
+     * allocate memory for code of the given size. The memory can be written through allocation::rw until seal()
+     * is called. Throws std::runtime_error if the OS refuses to provide memory
+     *
+     * @param size the number of bytes needed
+     * @return the allocation
+     */
+    allocation allocate(size_t size);
+    /**
+     * make the written code executable
+     *
+     * @param mem the allocation returned by allocate()
+     */
+    void seal(allocation const& mem);
+    /**
+     * overwrite a part of sealed code, e.g. to redirect a jump to another allocation. The patched bytes must not be
+     * executed while they get written. Without a second mapping the pages of the allocation are writable meanwhile.
+     * Throws std::runtime_error if the range exceeds the allocation or the protection cannot be changed
+     *
+     * @param mem the allocation returned by allocate()
+     * @param offset the offset of the bytes in the allocation
+     * @param data the new bytes
+     * @param size the number of bytes
+     */
+    void patch(allocation const& mem, size_t offset, void const* data, size_t size);
+    /**
+     * return an allocation to the arena. The code must not be reachable anymore
+     *
+     * @param mem the allocation returned by allocate()
+     */
+    void release(allocation const& mem);
+    /**
+     * check if the arena uses separate writable and executable mappings
+     *
+     * @return true if rw and rx of an allocation differ
+     */
+    bool is_dual_mapped() const { return dual_mapped; }
+    /**
+     * get the usage statistics of the arena
+     *
+     * @return the statistics
+     */
+    stats const& get_stats() const { return arena_stats; }
+
+private:
+    chunk* new_chunk(size_t size);
+    void unmap_chunk(chunk* c);
+
+    size_t const chunk_size;
+    size_t const alignment;
+    bool dual_mapped{true};
+    chunk* active{nullptr};
+    std::vector<std::unique_ptr<chunk>> chunks;
+    stats arena_stats;
+};
+} // namespace jit
+} // namespace iss
+#endif /* _ISS_JIT_CODE_ARENA_H_ */
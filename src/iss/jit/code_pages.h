@@ -0,0 +1,287 @@
+/*******************************************************************************
+ * Copyright (C) 2024 MINRES Technologies GmbH
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Contributors:
+ *       eyck@minres.com - initial implementation
+ ******************************************************************************/
+
+#ifndef _ISS_JIT_CODE_PAGES_H_
+#define _ISS_JIT_CODE_PAGES_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace iss {
+namespace jit {
+/**
+ * the guest pages holding translated code of a core
+ *
+ * Translation caches mark the pages their blocks were translated from, the write path of the core checks each write
+ * against them and reports writes to such pages to the observing caches so they invalidate the blocks of the page.
+ * Pages are reference counted as several caches (e.g. of a tiered vm) may translate the same page. Pages below 4GiB
+ * are kept in a bitmap so the check of the write path is a bit test, the others in a hash map.
+ * The code pages of the cores sharing memory get shared (see share()) so the writes of each core reach the caches of
+ * all of them. Shared code pages may be used from concurrent threads, observers are then called on the thread of the
+ * writing core.
+ */
+class code_pages {
+public:
+    static constexpr unsigned page_bits = 12;
+    //! called with the page number of a written page
+    using observer = std::function<void(uint64_t)>;
+    //! called with the page number of a page and whether it became marked or unmarked
+    using mark_handler = std::function<void(uint64_t, bool)>;
+
+    static uint64_t page_of(uint64_t addr) { return addr >> page_bits; }
+
+    code_pages()
+    : pages(std::make_shared<state>()) {
+        pages->members.push_back(this);
+    }
+
+    ~code_pages() {
+        std::lock_guard<std::mutex> lock(pages->mtx);
+        auto& m = pages->members;
+        m.erase(std::remove(m.begin(), m.end(), this), m.end());
+    }
+
+    code_pages(code_pages const&) = delete;
+
+    code_pages& operator=(code_pages const&) = delete;
+    /**
+     * set the address space holding the code, writes to other spaces are ignored
+     *
+     * @param space the address space of the memory
+     */
+    void set_space(uint32_t space) {
+        pages->code_space = space;
+        pages->has_space = true;
+    }
+    /**
+     * share the pages with other code pages, e.g. those of another core of the cluster. Afterwards both, and all code
+     * pages shared with either of them before, report the writes to any of the pages to all observers. Throws
+     * std::runtime_error if pages are marked already, i.e. blocks got translated before sharing. Needs to be called
+     * before the cores run
+     *
+     * @param other the code pages to share with
+     */
+    void share(code_pages& other) {
+        if(other.pages == pages)
+            return;
+        auto from = pages;
+        auto& to = other.pages;
+        std::lock(from->mtx, to->mtx);
+        std::lock_guard<std::mutex> from_lock(from->mtx, std::adopt_lock);
+        std::lock_guard<std::mutex> to_lock(to->mtx, std::adopt_lock);
+        if(from->marked_pages)
+            throw std::runtime_error("code pages holding translated code cannot be shared");
+        if(from->has_space && to->has_space && from->code_space != to->code_space)
+            throw std::runtime_error("code pages of different address spaces cannot be shared");
+        if(!to->has_space) {
+            to->code_space = from->code_space;
+            to->has_space = from->has_space;
+        }
+        std::move(from->observers.begin(), from->observers.end(), std::back_inserter(to->observers));
+        std::move(from->mark_handlers.begin(), from->mark_handlers.end(), std::back_inserter(to->mark_handlers));
+        for(auto* m : from->members) {
+            m->pages = to;
+            to->members.push_back(m);
+        }
+        from->observers.clear();
+        from->mark_handlers.clear();
+        from->members.clear();
+    }
+    /**
+     * check if a write touches a page holding translated code
+     *
+     * @param space the address space written
+     * @param addr the address written
+     * @param length the number of bytes written
+     * @return true if the observers need to be notified
+     */
+    bool holds_code(uint32_t space, uint64_t addr, unsigned length) const {
+        return space == pages->code_space && holds_code(addr, length);
+    }
+    /**
+     * check if a write to the address space holding the code touches a page holding translated code, e.g. a write of
+     * a DMA bypassing the cores
+     *
+     * @param addr the address written
+     * @param length the number of bytes written
+     * @return true if the observers need to be notified
+     */
+    bool holds_code(uint64_t addr, unsigned length) const {
+        if(!pages->marked_pages.load(std::memory_order_acquire))
+            return false;
+        for(auto page = page_of(addr); page <= page_of(addr + std::max(length, 1U) - 1); ++page)
+            if(test(page))
+                return true;
+        return false;
+    }
+    /**
+     * notify the observers about a write to pages holding translated code
+     *
+     * @param addr the address written
+     * @param length the number of bytes written
+     */
+    void written(uint64_t addr, unsigned length) {
+        for(auto page = page_of(addr); page <= page_of(addr + std::max(length, 1U) - 1); ++page)
+            if(test(page)) {
+                std::lock_guard<std::mutex> lock(pages->mtx);
+                for(auto& o : pages->observers)
+                    o.second(page);
+            }
+    }
+    /**
+     * mark a page as holding translated code
+     *
+     * @param page the page number
+     */
+    void acquire(uint64_t page) {
+        auto& s = *pages;
+        std::lock_guard<std::mutex> lock(s.mtx);
+        if(s.counts[page]++)
+            return;
+        if(page < bitmap_pages) {
+            if(!s.bitmap_mem) {
+                s.bitmap_mem.reset(new std::atomic<uint64_t>[bitmap_pages / 64]());
+                s.bitmap.store(s.bitmap_mem.get(), std::memory_order_release);
+            }
+            s.bitmap_mem[page / 64].fetch_or(uint64_t(1) << (page % 64), std::memory_order_relaxed);
+        }
+        s.marked_pages.fetch_add(1, std::memory_order_release);
+        // writes checking the page from now on are reported, so direct stores bypassing the check can be stopped
+        for(auto& h : s.mark_handlers)
+            h.second(page, true);
+    }
+    /**
+     * release a mark set by acquire()
+     *
+     * @param page the page number
+     */
+    void release(uint64_t page) {
+        auto& s = *pages;
+        std::lock_guard<std::mutex> lock(s.mtx);
+        auto it = s.counts.find(page);
+        if(it == s.counts.end() || --it->second)
+            return;
+        s.counts.erase(it);
+        s.marked_pages.fetch_sub(1, std::memory_order_release);
+        if(page < bitmap_pages)
+            s.bitmap_mem[page / 64].fetch_and(~(uint64_t(1) << (page % 64)), std::memory_order_relaxed);
+        for(auto& h : s.mark_handlers)
+            h.second(page, false);
+    }
+    /**
+     * register an observer of writes to pages holding translated code
+     *
+     * @param o the observer
+     * @return the id of the observer to detach it
+     */
+    size_t attach(observer o) {
+        std::lock_guard<std::mutex> lock(pages->mtx);
+        pages->observers.emplace_back(++next_id(), std::move(o));
+        return pages->observers.back().first;
+    }
+
+    void detach(size_t id) {
+        std::lock_guard<std::mutex> lock(pages->mtx);
+        remove_id(pages->observers, id);
+    }
+    /**
+     * add a function called with the page number of a page becoming marked (true), e.g. to stop direct stores to it,
+     * or unmarked (false) as its last block left the caches. With shared code pages it is called on the thread
+     * changing the mark
+     *
+     * @param f the function
+     * @return the id of the function to remove it
+     */
+    size_t add_mark_handler(mark_handler f) {
+        std::lock_guard<std::mutex> lock(pages->mtx);
+        pages->mark_handlers.emplace_back(++next_id(), std::move(f));
+        return pages->mark_handlers.back().first;
+    }
+
+    void remove_mark_handler(size_t id) {
+        std::lock_guard<std::mutex> lock(pages->mtx);
+        remove_id(pages->mark_handlers, id);
+    }
+
+private:
+    static constexpr uint64_t bitmap_pages = uint64_t(1) << (32 - page_bits);
+    // the state of code pages shared with each other
+    struct state {
+        std::mutex mtx;
+        // allocated when the first page below 4GiB gets marked, the checks read it without taking the lock
+        std::unique_ptr<std::atomic<uint64_t>[]> bitmap_mem;
+        std::atomic<std::atomic<uint64_t>*> bitmap{nullptr};
+        std::unordered_map<uint64_t, unsigned> counts;
+        std::atomic<size_t> marked_pages{0};
+        uint32_t code_space{0};
+        bool has_space{false};
+        std::vector<std::pair<size_t, observer>> observers;
+        std::vector<std::pair<size_t, mark_handler>> mark_handlers;
+        std::vector<code_pages*> members;
+    };
+
+    static std::atomic<size_t>& next_id() {
+        static std::atomic<size_t> id{0};
+        return id;
+    }
+
+    template <typename T> static void remove_id(std::vector<std::pair<size_t, T>>& v, size_t id) {
+        v.erase(std::remove_if(v.begin(), v.end(), [id](std::pair<size_t, T> const& e) { return e.first == id; }), v.end());
+    }
+
+    bool test(uint64_t page) const {
+        auto& s = *pages;
+        if(page < bitmap_pages) {
+            auto* bitmap = s.bitmap.load(std::memory_order_acquire);
+            return bitmap && (bitmap[page / 64].load(std::memory_order_relaxed) >> (page % 64)) & 1;
+        }
+        std::lock_guard<std::mutex> lock(s.mtx);
+        return s.counts.find(page) != s.counts.end();
+    }
+
+    std::shared_ptr<state> pages;
+};
+} // namespace jit
+} // namespace iss
+#endif /* _ISS_JIT_CODE_PAGES_H_ */
@@ -0,0 +1,256 @@
+/*******************************************************************************
+ * Copyright (C) 2024 MINRES Technologies GmbH
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Contributors:
+ *       eyck@minres.com - initial implementation
+ ******************************************************************************/
+
+#ifndef _ISS_JIT_CODE_SHARING_H_
+#define _ISS_JIT_CODE_SHARING_H_
+
+#include "chaining.h"
+#include "shared_code.h"
+#include <absl/container/flat_hash_map.h>
+#include <iss/arch_if.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+namespace iss {
+namespace jit {
+/**
+ * read guest code without side effects on the simulated system, e.g. to compare it with the code a shared or a
+ * persisted block got translated from
+ *
+ * @param core the core to read from
+ * @param pc the address of the code
+ * @param size the number of bytes to read
+ * @param data the buffer to read into
+ * @return true if the code could be read
+ */
+inline bool fetch_guest(arch_if& core, uint64_t pc, size_t size, uint8_t* data) {
+    try {
+        return core.read(iss::address_type::VIRTUAL, iss::access_type::DEBUG_FETCH, 0, pc, size, data) == iss::Ok;
+    } catch(trap_access&) {
+        return false;
+    }
+}
+/**
+ * the part of a vm sharing its compiled blocks with the vms of the cluster through shared_code
+ *
+ * The vm adopts a block published by another vm before translating it. A block it translates itself is prepared for
+ * sharing right after generating its code, which records the guest code, and published when it is inserted into the
+ * translation cache of the vm. Blocks holding instructions whose host window accesses faulted are translated with
+ * checked accesses for this vm only, they are neither adopted nor published.
+ *
+ * @tparam TB the translation block type of the backend
+ */
+template <typename TB> class code_sharing {
+public:
+    /**
+     * @param core the core the vm executes
+     */
+    explicit code_sharing(arch_if& core)
+    : core(core) {}
+    /**
+     * attach to the blocks shared within a domain, see shared_code::of_domain(). The blocks prepared for the previous
+     * domain are not published
+     *
+     * @param domain the description of the domain
+     */
+    void attach(std::string const& domain) {
+        if(shared && domain == shared_domain)
+            return;
+        shared_domain = domain;
+        shared = shared_code<TB>::of_domain(shared_domain);
+        to_share.clear();
+    }
+    /**
+     * stop sharing blocks
+     */
+    void detach() {
+        shared = nullptr;
+        shared_domain.clear();
+        to_share.clear();
+    }
+    /**
+     * check if the vm is attached to a domain
+     *
+     * @return true if blocks are shared
+     */
+    bool attached() const { return shared != nullptr; }
+    /**
+     * take the block at pc from the blocks published by the vms of the cluster and insert it into the translation cache
+     *
+     * @param cache the translation cache of the vm
+     * @param pc the physical address of the block
+     * @param cont set to the continuation of the block
+     * @param succ set to the extent of the guest code of the block, its successors are not known
+     * @param speculative the block is not executed right after adopting it
+     * @return the block or nullptr if no vm published it
+     */
+    template <typename CACHE, typename CONT>
+    TB* adopt(CACHE& cache, uint64_t pc, CONT& cont, block_successors& succ, bool speculative) {
+        typename shared_code<TB>::block block;
+        auto fetch = [this](uint64_t addr, size_t size, uint8_t* data) { return fetch_guest(core, addr, size, data); };
+        if(!shared || !shared->find(pc, fetch, block) || holds_window_checked(pc, pc + block.guest_size))
+            return nullptr;
+        // compare the guest code again while its pages are tracked, so writes racing with the comparison are noticed
+        auto found = cache.translate_tracked(pc, [this, pc, &fetch, &block](uint64_t& end) {
+            auto res = shared->find(pc, fetch, block);
+            end = res ? pc + block.guest_size : pc + 1;
+            return res;
+        });
+        if(!found) {
+            cache.untrack(pc);
+            return nullptr;
+        }
+        cont = static_cast<CONT>(block.cont);
+        succ.clear(pc);
+        succ.end = pc + block.guest_size;
+        auto view = TB::view_of(*block.code);
+        return cache.insert(pc, std::move(view), speculative, std::move(block.code));
+    }
+    /**
+     * record the guest code of the block just generated at pc so it gets published once it is inserted
+     *
+     * @param pc the physical address of the block
+     * @param cont the continuation of the block
+     * @param succ the successors of the block just generated
+     */
+    void prepare(uint64_t pc, unsigned cont, block_successors const& succ) {
+        to_share.erase(pc);
+        // blocks with checked window accesses stay private, the unchecked block already published would replace them
+        if(!shared || succ.from != pc || succ.end <= pc || holds_window_checked(pc, succ.end))
+            return;
+        auto& block = to_share[pc];
+        block.cont = cont;
+        block.guest.resize(succ.end - pc);
+        if(!fetch_guest(core, pc, block.guest.size(), block.guest.data()))
+            to_share.erase(pc);
+    }
+    /**
+     * drop the guest code recorded for the block at pc, e.g. as it does not make it into the translation cache
+     *
+     * @param pc the physical address of the block
+     */
+    void withdraw(uint64_t pc) { to_share.erase(pc); }
+    /**
+     * insert a compiled block into the translation cache, it is published to the vms of the cluster if prepare()
+     * recorded its guest code
+     *
+     * @param cache the translation cache of the vm
+     * @param pc the physical address of the block
+     * @param tb the compiled block
+     * @param speculative the block is not executed right after inserting it
+     * @return the block as stored in the cache
+     */
+    template <typename CACHE> TB* insert(CACHE& cache, uint64_t pc, TB&& tb, bool speculative = false) {
+        auto it = to_share.find(pc);
+        if(it == to_share.end() || !shared)
+            return cache.insert(pc, std::move(tb), speculative);
+        auto code = shared->publish(pc, std::move(tb), it->second.cont, it->second.guest);
+        to_share.erase(it);
+        auto view = TB::view_of(*code);
+        return cache.insert(pc, std::move(view), speculative, std::move(code));
+    }
+    /**
+     * record an instruction whose host window access faulted, its accesses are checked from now on
+     *
+     * @param pc the guest pc of the instruction
+     */
+    void add_window_checked(uint64_t pc) {
+        // bounded as each entry stays for good otherwise, instructions dropped fault once more and get checked again
+        if(window_checked.size() >= max_window_checked)
+            window_checked.clear();
+        window_checked.insert(pc);
+    }
+    /**
+     * check if the accesses of an instruction to the host window are checked
+     *
+     * @param pc the guest pc of the instruction
+     * @return true if the accesses are checked
+     */
+    bool is_window_checked(uint64_t pc) const { return window_checked.count(pc) != 0; }
+    /**
+     * forget the instructions with checked accesses once the translation cache got flushed, as they may hold other
+     * code then
+     *
+     * @param flushes the number of flushes of the translation cache
+     */
+    void sync_window_checked(uint64_t flushes) {
+        if(flushes == window_checked_flushes)
+            return;
+        window_checked.clear();
+        window_checked_flushes = flushes;
+    }
+    /**
+     * check whether the guest code of a block contains an instruction with checked host window accesses
+     *
+     * @param pc the physical address of the block
+     * @param end the end of the guest code of the block
+     * @return true if one of the instructions needs checked accesses
+     */
+    bool holds_window_checked(uint64_t pc, uint64_t end) const {
+        if(window_checked.empty())
+            return false;
+        if(end - pc < window_checked.size()) {
+            for(auto addr = pc; addr < end; ++addr)
+                if(window_checked.count(addr))
+                    return true;
+            return false;
+        }
+        return std::any_of(window_checked.begin(), window_checked.end(), [pc, end](uint64_t addr) { return addr >= pc && addr < end; });
+    }
+
+private:
+    //! a block to be published once it is inserted, together with the guest bytes it got translated from
+    struct shared_block {
+        unsigned cont{0};
+        std::vector<uint8_t> guest;
+    };
+    static constexpr size_t max_window_checked = 4096;
+
+    arch_if& core;
+    //! the blocks shared with the vms of the cluster, null if they are not shared
+    std::shared_ptr<shared_code<TB>> shared;
+    std::string shared_domain;
+    absl::flat_hash_map<uint64_t, shared_block> to_share;
+    std::unordered_set<uint64_t> window_checked;
+    uint64_t window_checked_flushes{0};
+};
+} // namespace jit
+} // namespace iss
+#endif /* _ISS_JIT_CODE_SHARING_H_ */
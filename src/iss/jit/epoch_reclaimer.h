@@ -0,0 +1,152 @@
+/*******************************************************************************
+ * Copyright (C) 2024 MINRES Technologies GmbH
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Contributors:
+ *       eyck@minres.com - initial implementation
+ ******************************************************************************/
+
+#ifndef _ISS_JIT_EPOCH_RECLAIMER_H_
+#define _ISS_JIT_EPOCH_RECLAIMER_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <list>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace iss {
+namespace jit {
+/**
+ * epoch based deferred reclamation
+ *
+ * Objects which are not reachable from shared structures anymore are retired instead of being destroyed. They are
+ * destroyed once every attached participant passed a quiescent point after the retirement, i.e. once no participant
+ * can still hold a pointer to them. A participant is a thread executing code out of the shared structures, e.g.
+ * the dispatch loop of a vm.
+ *
+ * @tparam T the type owning a retired object, destroying it releases the object
+ */
+template <typename T> class epoch_reclaimer {
+public:
+    class participant {
+        friend class epoch_reclaimer;
+        //! the epoch the participant observed at its last quiescent point
+        std::atomic<uint64_t> epoch{0};
+    };
+
+    epoch_reclaimer() = default;
+
+    epoch_reclaimer(epoch_reclaimer const&) = delete;
+
+    epoch_reclaimer& operator=(epoch_reclaimer const&) = delete;
+
+    ~epoch_reclaimer() = default;
+    /**
+     * register a participant, it is considered to be at a quiescent point
+     *
+     * @return the handle of the participant
+     */
+    participant* attach() {
+        std::lock_guard<std::mutex> lock(mtx);
+        participants.emplace_back();
+        participants.back().epoch = global_epoch.load(std::memory_order_acquire);
+        return &participants.back();
+    }
+    /**
+     * unregister a participant, it must not hold pointers to shared objects anymore
+     *
+     * @param p the handle of the participant
+     */
+    void detach(participant* p) {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            participants.remove_if([p](participant const& e) { return &e == p; });
+        }
+        collect();
+    }
+    /**
+     * signal that the participant does not hold pointers to objects retired before this call
+     *
+     * @param p the handle of the participant
+     */
+    void quiescent(participant* p) {
+        p->epoch.store(global_epoch.load(std::memory_order_acquire), std::memory_order_release);
+        if(pending.load(std::memory_order_acquire))
+            collect();
+    }
+    /**
+     * hand over an object which got unreachable for participants passing their next quiescent point
+     *
+     * @param obj the owner of the object
+     */
+    void retire(T&& obj) {
+        std::lock_guard<std::mutex> lock(mtx);
+        retired.emplace_back(global_epoch.fetch_add(1, std::memory_order_acq_rel), std::move(obj));
+        pending.store(retired.size(), std::memory_order_release);
+    }
+    /**
+     * destroy all retired objects no participant can reach anymore
+     */
+    void collect() {
+        std::vector<std::pair<uint64_t, T>> reclaimable;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            auto min_epoch = std::numeric_limits<uint64_t>::max();
+            for(auto& p : participants)
+                min_epoch = std::min(min_epoch, p.epoch.load(std::memory_order_acquire));
+            auto it = std::partition(retired.begin(), retired.end(),
+                                     [min_epoch](std::pair<uint64_t, T> const& e) { return e.first >= min_epoch; });
+            std::move(it, retired.end(), std::back_inserter(reclaimable));
+            retired.erase(it, retired.end());
+            pending.store(retired.size(), std::memory_order_release);
+        }
+        // the objects get destroyed outside of the lock as destruction might be costly
+    }
+    /**
+     * get the number of objects waiting for reclamation
+     *
+     * @return the number of objects
+     */
+    size_t size() const { return pending.load(std::memory_order_acquire); }
+
+private:
+    std::mutex mtx;
+    std::atomic<uint64_t> global_epoch{1};
+    std::atomic<size_t> pending{0};
+    std::list<participant> participants;
+    std::vector<std::pair<uint64_t, T>> retired;
+};
+} // namespace jit
+} // namespace iss
+#endif /* _ISS_JIT_EPOCH_RECLAIMER_H_ */
@@ -0,0 +1,186 @@
+/*******************************************************************************
+ * Copyright (C) 2024 MINRES Technologies GmbH
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Contributors:
+ *       eyck@minres.com - initial implementation
+ ******************************************************************************/
+
+#include "persistent_cache.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <system_error>
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+namespace iss {
+namespace jit {
+
+namespace fs = std::filesystem;
+
+namespace {
+constexpr std::array<char, 8> magic{{'D', 'B', 'T', 'R', 'B', 'L', 'K', '1'}};
+// magic, continuation and symbol length
+constexpr size_t header_size = magic.size() + 2 * sizeof(uint32_t);
+
+std::string hex(uint64_t val) {
+    std::array<char, 17> buf;
+    snprintf(buf.data(), buf.size(), "%016" PRIx64, val);
+    return buf.data();
+}
+} // namespace
+
+uint64_t persistent_cache::hash(uint8_t const* data, size_t size, uint64_t seed) {
+    auto res = seed;
+    for(size_t i = 0; i < size; ++i) {
+        res ^= data[i];
+        res *= 0x100000001b3ULL;
+    }
+    return res;
+}
+
+persistent_cache::persistent_cache(std::string const& dir, std::string const& domain)
+: domain_dir((fs::path(dir) / hex(hash(reinterpret_cast<uint8_t const*>(domain.data()), domain.size()))).string())
+, domain_hash(hash(reinterpret_cast<uint8_t const*>(domain.data()), domain.size())) {
+    std::error_code ec;
+    fs::create_directories(domain_dir, ec);
+    if(ec)
+        throw std::runtime_error("could not create the translation cache directory " + domain_dir + ": " + ec.message());
+    // the description of the domain is kept for inspection only
+    std::ofstream(fs::path(domain_dir) / "domain.txt") << domain << std::endl;
+    for(auto const& f : fs::directory_iterator(domain_dir, ec)) {
+        uint64_t pc, guest_hash;
+        size_t size;
+        auto name = f.path().filename().string();
+        if(f.path().extension() == ".blk" && sscanf(name.c_str(), "%" SCNx64 "-%zx-%" SCNx64 ".blk", &pc, &size, &guest_hash) == 3)
+            index[pc].push_back(candidate{size, guest_hash});
+    }
+}
+
+std::string persistent_cache::file_name(uint64_t pc, size_t size, uint64_t guest_hash) const {
+    std::array<char, 64> buf;
+    snprintf(buf.data(), buf.size(), "%016" PRIx64 "-%zx-%016" PRIx64 ".blk", pc, size, guest_hash);
+    return (fs::path(domain_dir) / buf.data()).string();
+}
+
+bool persistent_cache::find(uint64_t pc, fetch_func const& fetch, entry& result) {
+    std::vector<candidate> candidates;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto it = index.find(pc);
+        if(it != index.end())
+            candidates = it->second;
+    }
+    std::vector<uint8_t> guest;
+    for(auto& c : candidates) {
+        guest.resize(c.size);
+        if(!fetch(pc, c.size, guest.data()) || hash(guest.data(), guest.size()) != c.hash)
+            continue;
+        std::ifstream is(file_name(pc, c.size, c.hash), std::ios::binary);
+        std::array<char, header_size> header;
+        if(!is.read(header.data(), header.size()) || !std::equal(magic.begin(), magic.end(), header.begin()))
+            continue;
+        uint32_t cont, symbol_size;
+        memcpy(&cont, header.data() + magic.size(), sizeof(cont));
+        memcpy(&symbol_size, header.data() + magic.size() + sizeof(cont), sizeof(symbol_size));
+        result.symbol.resize(symbol_size);
+        if(!is.read(&result.symbol[0], symbol_size))
+            continue;
+        result.path = file_name(pc, c.size, c.hash);
+        result.cont = cont;
+        result.object_offset = header_size + symbol_size;
+        std::error_code ec;
+        auto file_size = fs::file_size(result.path, ec);
+        if(ec || file_size <= result.object_offset)
+            continue;
+        result.object_size = file_size - result.object_offset;
+        result.guest_size = c.size;
+        std::lock_guard<std::mutex> lock(mtx);
+        cache_stats.hits++;
+        return true;
+    }
+    std::lock_guard<std::mutex> lock(mtx);
+    cache_stats.misses++;
+    return false;
+}
+
+bool persistent_cache::store(uint64_t pc, std::vector<uint8_t> const& guest, unsigned cont, std::string const& symbol,
+                             std::string const& object) {
+    static std::atomic<unsigned> tmp_id{0};
+    auto guest_hash = hash(guest.data(), guest.size());
+    auto path = file_name(pc, guest.size(), guest_hash);
+    // the pid keeps the temporary names of concurrent runs apart
+    auto tmp_path = path + "." + std::to_string(getpid()) + "." + std::to_string(++tmp_id) + ".tmp";
+    {
+        std::ofstream os(tmp_path, std::ios::binary);
+        uint32_t cont_val = cont, symbol_size = static_cast<uint32_t>(symbol.size());
+        os.write(magic.data(), magic.size());
+        os.write(reinterpret_cast<char const*>(&cont_val), sizeof(cont_val));
+        os.write(reinterpret_cast<char const*>(&symbol_size), sizeof(symbol_size));
+        os.write(symbol.data(), symbol.size());
+        os.write(object.data(), object.size());
+        if(!os)
+            return false;
+    }
+    std::error_code ec;
+    fs::rename(tmp_path, path, ec);
+    if(ec) {
+        fs::remove(tmp_path, ec);
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mtx);
+    auto& candidates = index[pc];
+    auto known = [&guest, guest_hash](candidate const& c) { return c.size == guest.size() && c.hash == guest_hash; };
+    if(std::none_of(candidates.begin(), candidates.end(), known))
+        candidates.push_back(candidate{guest.size(), guest_hash});
+    cache_stats.stores++;
+    return true;
+}
+
+std::string persistent_cache::symbol_name(uint64_t pc, std::vector<uint8_t> const& guest) const {
+    return "dbt_blk_" + hex(domain_hash) + "_" + hex(pc) + "_" + hex(hash(guest.data(), guest.size()));
+}
+
+persistent_cache::stats persistent_cache::get_stats() const {
+    std::lock_guard<std::mutex> lock(mtx);
+    return cache_stats;
+}
+} // namespace jit
+} // namespace iss
@@ -0,0 +1,145 @@
+/*******************************************************************************
+ * Copyright (C) 2024 MINRES Technologies GmbH
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Contributors:
+ *       eyck@minres.com - initial implementation
+ ******************************************************************************/
+
+#ifndef _ISS_JIT_PERSISTENT_CACHE_H_
+#define _ISS_JIT_PERSISTENT_CACHE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace iss {
+namespace jit {
+/**
+ * on-disk store of compiled blocks shared between simulation runs
+ *
+ * Blocks are stored per domain, which describes everything besides the guest code that influences the generated code:
+ * the architecture, the backend and its version as well as the code generation settings of the vm. Within a domain a
+ * block is identified by its address and the hash of its guest bytes, so a block is reused only if the code at its
+ * address is unchanged. Each block is a file holding a relocatable object, the symbol of the block function in it and
+ * the continuation of the block. Files are written to a temporary name and renamed so concurrent runs sharing the
+ * directory only ever see complete entries.
+ */
+class persistent_cache {
+public:
+    struct entry {
+        //! file of the entry
+        std::string path;
+        //! symbol of the block function within the object
+        std::string symbol;
+        //! continuation of the block
+        unsigned cont{0};
+        //! location of the object within the file
+        size_t object_offset{0};
+        size_t object_size{0};
+        //! number of guest bytes the block got translated from
+        size_t guest_size{0};
+    };
+
+    struct stats {
+        uint64_t hits{0};
+        uint64_t misses{0};
+        uint64_t stores{0};
+    };
+    /**
+     * read the guest bytes of a block without side effects on the simulated system
+     */
+    using fetch_func = std::function<bool(uint64_t pc, size_t size, uint8_t* data)>;
+    /**
+     * open the store of a domain, the directory is created if needed and the blocks stored so far are indexed
+     *
+     * @param dir the root directory of the cache
+     * @param domain the description of the domain
+     */
+    persistent_cache(std::string const& dir, std::string const& domain);
+
+    persistent_cache(persistent_cache const&) = delete;
+
+    persistent_cache& operator=(persistent_cache const&) = delete;
+    /**
+     * find a stored block whose guest bytes match the current memory content
+     *
+     * @param pc the physical address of the block
+     * @param fetch reads the current guest bytes
+     * @param result the entry found
+     * @return true if an entry was found
+     */
+    bool find(uint64_t pc, fetch_func const& fetch, entry& result);
+    /**
+     * store a compiled block, can be called from any thread
+     *
+     * @param pc the physical address of the block
+     * @param guest the guest bytes the block was translated from
+     * @param cont the continuation of the block
+     * @param symbol the symbol of the block function in the object
+     * @param object the relocatable object
+     * @return true if the block got stored
+     */
+    bool store(uint64_t pc, std::vector<uint8_t> const& guest, unsigned cont, std::string const& symbol, std::string const& object);
+    /**
+     * get the symbol name of a stored block function. It is unique for the guest code within the domain so objects
+     * loaded from different runs do not clash
+     *
+     * @param pc the physical address of the block
+     * @param guest the guest bytes of the block
+     * @return the symbol name
+     */
+    std::string symbol_name(uint64_t pc, std::vector<uint8_t> const& guest) const;
+
+    stats get_stats() const;
+    /**
+     * 64 bit FNV-1a hash, stable between runs and hosts
+     */
+    static uint64_t hash(uint8_t const* data, size_t size, uint64_t seed = 0xcbf29ce484222325ULL);
+
+private:
+    struct candidate {
+        size_t size;
+        uint64_t hash;
+    };
+    std::string file_name(uint64_t pc, size_t size, uint64_t guest_hash) const;
+
+    std::string const domain_dir;
+    uint64_t const domain_hash;
+    mutable std::mutex mtx;
+    std::unordered_map<uint64_t, std::vector<candidate>> index;
+    stats cache_stats;
+};
+} // namespace jit
+} // namespace iss
+#endif /* _ISS_JIT_PERSISTENT_CACHE_H_ */
@@ -0,0 +1,152 @@
+/*******************************************************************************
+ * Copyright (C) 2024 MINRES Technologies GmbH
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Contributors:
+ *       eyck@minres.com - initial implementation
+ ******************************************************************************/
+
+#ifndef _ISS_JIT_PRETRANSLATION_H_
+#define _ISS_JIT_PRETRANSLATION_H_
+
+#include "chaining.h"
+#include <iss/arch_if.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+namespace iss {
+namespace jit {
+/**
+ * an address range of an executable segment, e.g. one arch_if::load_file() mapped for the text of an executable
+ */
+struct code_range {
+    //! the first address of the range
+    uint64_t start{0};
+    //! the size of the range in bytes
+    uint64_t size{0};
+
+    bool contains(uint64_t addr) const { return addr >= start && addr - start < size; }
+};
+/**
+ * collect the addresses to translate a loaded executable from ahead of its execution: its entry point and the
+ * addresses of its symbols within the executable segments
+ *
+ * @param core the core the executable got loaded into with arch_if::load_file()
+ * @param file the name of the executable
+ * @param entry the entry point returned by arch_if::load_file()
+ * @param text the executable segments of the executable
+ * @return the addresses
+ */
+inline std::vector<uint64_t> pretranslation_entries(arch_if& core, std::string const& file, uint64_t entry,
+                                                    std::vector<code_range> const& text) {
+    std::vector<uint64_t> entries{entry};
+    if(auto* instr_if = core.get_instrumentation_if())
+        for(auto const& sym : instr_if->get_symbol_table(file))
+            if(sym.second != entry && std::any_of(text.begin(), text.end(), [&sym](code_range const& r) { return r.contains(sym.second); }))
+                entries.push_back(sym.second);
+    return entries;
+}
+/**
+ * the walk of the code reachable from a set of entry points along the successors known at translation time. The
+ * vm translates the blocks the walk hands out and reports their successors, once all blocks are in the translation
+ * cache the walk chains them
+ */
+class pretranslation {
+public:
+    /**
+     * @param entries the addresses to start from
+     * @param max_blocks the maximum number of blocks to hand out
+     */
+    pretranslation(std::vector<uint64_t> const& entries, size_t max_blocks)
+    : work(entries.begin(), entries.end())
+    , max_blocks(max_blocks) {}
+    /**
+     * get the next block to translate, each address is handed out once
+     *
+     * @param pc the address of the block
+     * @return false if the walk is finished
+     */
+    bool next(uint64_t& pc) {
+        while(!work.empty() && handed_out < max_blocks) {
+            pc = work.front();
+            work.pop_front();
+            if(visited.insert(pc).second) {
+                handed_out++;
+                return true;
+            }
+        }
+        return false;
+    }
+    /**
+     * report a translated block, its known successors are walked next
+     *
+     * @param succ the successors of the block
+     */
+    void translated(block_successors const& succ) {
+        translated_blocks.push_back(succ);
+        for(unsigned idx = 0; idx < succ.pc.size(); ++idx)
+            if(succ.known[idx])
+                work.push_back(succ.pc[idx]);
+    }
+    /**
+     * chain the translated blocks to their successors
+     *
+     * @param cache the translation cache holding the blocks
+     */
+    template <typename CACHE> void link(CACHE& cache) const {
+        for(auto const& succ : translated_blocks) {
+            auto* from = cache.peek(succ.from);
+            for(unsigned idx = 0; from && idx < succ.pc.size(); ++idx) {
+                auto* to = succ.known[idx] ? cache.peek(succ.pc[idx]) : nullptr;
+                if(to && from->cont[idx] == nullptr)
+                    cache.link(from, idx, to);
+            }
+        }
+    }
+    /**
+     * get the number of blocks translated
+     */
+    size_t size() const { return translated_blocks.size(); }
+
+private:
+    std::deque<uint64_t> work;
+    std::unordered_set<uint64_t> visited;
+    std::vector<block_successors> translated_blocks;
+    size_t const max_blocks;
+    size_t handed_out{0};
+};
+} // namespace jit
+} // namespace iss
+#endif /* _ISS_JIT_PRETRANSLATION_H_ */
@@ -0,0 +1,187 @@
+/*******************************************************************************
+ * Copyright (C) 2024 MINRES Technologies GmbH
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Contributors:
+ *       eyck@minres.com - initial implementation
+ ******************************************************************************/
+
+#ifndef _ISS_JIT_SHARED_CODE_H_
+#define _ISS_JIT_SHARED_CODE_H_
+
+#include "persistent_cache.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace iss {
+namespace jit {
+/**
+ * compiled blocks shared by the vms of the cores of a cluster
+ *
+ * The cores of a cluster mostly run the same code. The vm translating a block first publishes its code and the vms of
+ * the other cores adopt it instead of translating the block again. Each vm holds its own descriptor of an adopted block
+ * with its own chaining state, the code itself is owned jointly by these descriptors and released with the last one.
+ * The store only refers to the code weakly so it never keeps code alive. Like in the persistent cache a block is
+ * identified by its address and the hash of its guest bytes and adopted only if the guest code is unchanged, thus the
+ * vms do not need to coordinate on modifications of the code.
+ * Lookups take a shared lock so the cores of a cluster look up blocks in parallel, only publishing is exclusive.
+ *
+ * @tparam TB the translation block type of the backend
+ */
+template <typename TB> class shared_code {
+public:
+    struct block {
+        //! the code, kept alive as long as the caller holds it
+        std::shared_ptr<TB> code;
+        //! continuation of the block
+        unsigned cont{0};
+        //! number of guest bytes the block got translated from
+        size_t guest_size{0};
+    };
+
+    struct stats {
+        uint64_t publications{0};
+        uint64_t adoptions{0};
+        //! number of lookups finding a block whose guest code changed since
+        uint64_t stale{0};
+    };
+    /**
+     * read the guest bytes of a block without side effects on the simulated system
+     */
+    using fetch_func = persistent_cache::fetch_func;
+    /**
+     * get the store of a domain, it is created if no vm holds it so far. The domain identifies the cluster and
+     * describes everything besides the guest code that influences the generated code, vms only share code within it
+     *
+     * @param domain the description of the domain
+     * @return the store
+     */
+    static std::shared_ptr<shared_code> of_domain(std::string const& domain) {
+        static std::mutex mtx;
+        static std::unordered_map<std::string, std::weak_ptr<shared_code>> stores;
+        std::lock_guard<std::mutex> lock(mtx);
+        auto& slot = stores[domain];
+        auto res = slot.lock();
+        if(!res) {
+            res = std::make_shared<shared_code>();
+            slot = res;
+        }
+        return res;
+    }
+    /**
+     * find a published block whose guest bytes match the current memory content
+     *
+     * @param pc the physical address of the block
+     * @param fetch reads the current guest bytes
+     * @param result the block found
+     * @return true if a block was found
+     */
+    bool find(uint64_t pc, fetch_func const& fetch, block& result) {
+        uint64_t guest_hash;
+        {
+            std::shared_lock<std::shared_mutex> lock(mtx);
+            auto it = blocks.find(pc);
+            if(it == blocks.end() || !(result.code = it->second.code.lock()))
+                return false;
+            result.cont = it->second.cont;
+            result.guest_size = it->second.guest_size;
+            guest_hash = it->second.guest_hash;
+        }
+        std::vector<uint8_t> guest(result.guest_size);
+        if(!fetch(pc, guest.size(), guest.data()) || persistent_cache::hash(guest.data(), guest.size()) != guest_hash) {
+            result.code = nullptr;
+            block_stats.stale++;
+            return false;
+        }
+        block_stats.adoptions++;
+        return true;
+    }
+    /**
+     * publish a compiled block. If another vm published a block of the same guest code meanwhile that one is returned
+     * and the block passed in is released
+     *
+     * @param pc the physical address of the block
+     * @param tb the compiled block, it must not embed addresses specific to the vm
+     * @param cont the continuation of the block
+     * @param guest the guest bytes the block was translated from
+     * @return the code of the block to be held by the vm
+     */
+    std::shared_ptr<TB> publish(uint64_t pc, TB&& tb, unsigned cont, std::vector<uint8_t> const& guest) {
+        auto guest_hash = persistent_cache::hash(guest.data(), guest.size());
+        auto code = std::make_shared<TB>(std::move(tb));
+        std::unique_lock<std::shared_mutex> lock(mtx);
+        auto& slot = blocks[pc];
+        if(slot.guest_size == guest.size() && slot.guest_hash == guest_hash)
+            if(auto existing = slot.code.lock())
+                return existing;
+        slot = entry{code, cont, guest.size(), guest_hash};
+        // drop the slots of blocks no vm holds anymore from time to time
+        if(++block_stats.publications % purge_interval == 0)
+            for(auto it = blocks.begin(); it != blocks.end();)
+                it = it->second.code.expired() ? blocks.erase(it) : std::next(it);
+        return code;
+    }
+
+    stats get_stats() const {
+        stats res;
+        res.publications = block_stats.publications;
+        res.adoptions = block_stats.adoptions;
+        res.stale = block_stats.stale;
+        return res;
+    }
+
+private:
+    struct entry {
+        std::weak_ptr<TB> code;
+        unsigned cont{0};
+        size_t guest_size{0};
+        uint64_t guest_hash{0};
+    };
+    struct atomic_stats {
+        std::atomic<uint64_t> publications{0};
+        std::atomic<uint64_t> adoptions{0};
+        std::atomic<uint64_t> stale{0};
+    };
+    static constexpr uint64_t purge_interval = 1024;
+
+    mutable std::shared_mutex mtx;
+    std::unordered_map<uint64_t, entry> blocks;
+    atomic_stats block_stats;
+};
+} // namespace jit
+} // namespace iss
+#endif /* _ISS_JIT_SHARED_CODE_H_ */
@@ -0,0 +1,123 @@
+/*******************************************************************************
+ * Copyright (C) 2024 MINRES Technologies GmbH
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Contributors:
+ *       eyck@minres.com - initial implementation
+ ******************************************************************************/
+
+#ifndef _ISS_JIT_SLAB_POOL_H_
+#define _ISS_JIT_SLAB_POOL_H_
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace iss {
+namespace jit {
+/**
+ * pool of objects at stable addresses
+ *
+ * Objects are constructed in slabs of N slots which are never moved or returned before the pool is destroyed, freed
+ * slots are reused. The pool does not track live objects, the owner needs to destroy them before the pool goes away.
+ *
+ * @tparam T the type of the objects
+ * @tparam N the number of objects per slab
+ */
+template <typename T, size_t N = 256> class slab_pool {
+    union slot {
+        slot() {}
+        ~slot() {}
+        slot* next;
+        T obj;
+    };
+
+public:
+    slab_pool() = default;
+
+    slab_pool(slab_pool const&) = delete;
+
+    slab_pool& operator=(slab_pool const&) = delete;
+    /**
+     * construct an object in a free slot
+     *
+     * @param args the constructor arguments
+     * @return the object
+     */
+    template <typename... Args> T* create(Args&&... args) {
+        if(!free_list) {
+            slabs.emplace_back(new slot[N]);
+            auto* s = slabs.back().get();
+            for(size_t i = N; i > 0; --i) {
+                s[i - 1].next = free_list;
+                free_list = &s[i - 1];
+            }
+        }
+        auto* s = free_list;
+        auto* next = s->next;
+        auto* obj = new(&s->obj) T(std::forward<Args>(args)...);
+        free_list = next;
+        live++;
+        return obj;
+    }
+    /**
+     * destroy an object and make its slot available again
+     *
+     * @param obj the object returned by create()
+     */
+    void destroy(T* obj) {
+        obj->~T();
+        auto* s = reinterpret_cast<slot*>(obj);
+        s->next = free_list;
+        free_list = s;
+        live--;
+    }
+    /**
+     * get the number of live objects
+     *
+     * @return the number of objects
+     */
+    size_t size() const { return live; }
+    /**
+     * get the memory held by the pool
+     *
+     * @return the number of bytes
+     */
+    size_t capacity_bytes() const { return slabs.size() * N * sizeof(slot); }
+
+private:
+    std::vector<std::unique_ptr<slot[]>> slabs;
+    slot* free_list{nullptr};
+    size_t live{0};
+};
+} // namespace jit
+} // namespace iss
+#endif /* _ISS_JIT_SLAB_POOL_H_ */
@@ -0,0 +1,162 @@
+/*******************************************************************************
+ * Copyright (C) 2024 MINRES Technologies GmbH
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Contributors:
+ *       eyck@minres.com - initial implementation
+ ******************************************************************************/
+
+#ifndef _ISS_JIT_SOFT_TLB_H_
+#define _ISS_JIT_SOFT_TLB_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace iss {
+namespace jit {
+/**
+ * an entry of the software TLB, generated code accesses its members by their offsets
+ */
+struct tlb_entry {
+    //! address of the page if loads may access its host memory directly, soft_tlb::invalid_tag otherwise
+    uint64_t read_tag;
+    //! address of the page if stores may access its host memory directly, soft_tlb::invalid_tag otherwise
+    uint64_t write_tag;
+    //! difference between the host address and the guest address of the page
+    uint64_t addend;
+    uint64_t unused;
+};
+/**
+ * direct mapped software TLB of a core translating guest pages of the memory space to the host memory backing them
+ *
+ * Generated code looks up the entry of an address, compares the address masked with tag_mask() against the tag of the
+ * entry and on a match accesses the host memory at the address plus the addend of the entry. Otherwise, including
+ * accesses crossing the natural alignment, it calls the out-of-line access functions which refill the entry after the
+ * access from the host page the core reports (arch_if::get_host_page()). Pages without host memory (e.g. MMIO) are never
+ * entered so they always take the out-of-line path. Entries are tagged by the address the core issues (virtual
+ * addresses), the core needs to flush the TLB whenever the translation of addresses or their host memory changes.
+ */
+class soft_tlb {
+public:
+    static constexpr unsigned page_bits = 12;
+    static constexpr unsigned index_bits = 8;
+    static constexpr unsigned entry_bits = 5;
+    static constexpr uint64_t page_mask = ~((uint64_t(1) << page_bits) - 1);
+    static constexpr uint64_t invalid_tag = ~uint64_t(0);
+    static constexpr size_t entry_count = size_t(1) << index_bits;
+    static constexpr size_t read_tag_offset = offsetof(tlb_entry, read_tag);
+    static constexpr size_t write_tag_offset = offsetof(tlb_entry, write_tag);
+    static constexpr size_t addend_offset = offsetof(tlb_entry, addend);
+    static_assert(sizeof(tlb_entry) == size_t(1) << entry_bits, "generated code indexes entries by shifting");
+    /**
+     * get the mask selecting the bits of an address compared against the tag, it keeps the bits of the address below
+     * the access size so misaligned accesses never match
+     *
+     * @param size the size of the access in bytes
+     * @return the mask
+     */
+    static constexpr uint64_t tag_mask(unsigned size) { return page_mask | (size - 1); }
+
+    static size_t index_of(uint64_t addr) { return (addr >> page_bits) & (entry_count - 1); }
+
+    soft_tlb() { flush(); }
+
+    soft_tlb(soft_tlb const&) = delete;
+
+    soft_tlb& operator=(soft_tlb const&) = delete;
+    /**
+     * enable refilling for an address space, generated code only looks up accesses to this space
+     *
+     * @param space the address space of the memory
+     */
+    void enable(uint32_t space) {
+        mem_space = space;
+        enabled = true;
+    }
+
+    bool is_enabled(uint32_t space) const { return enabled && space == mem_space; }
+    /**
+     * enter the host memory of a page
+     *
+     * @param addr an address in the page
+     * @param host the host memory of the page
+     * @param writable true if stores may access the host memory directly
+     */
+    void fill(uint64_t addr, uint8_t* host, bool writable) {
+        auto& e = entries[index_of(addr)];
+        e.read_tag = addr & page_mask;
+        e.write_tag = writable ? addr & page_mask : invalid_tag;
+        e.addend = reinterpret_cast<uintptr_t>(host) - (addr & page_mask);
+    }
+    /**
+     * drop the entry of a page
+     *
+     * @param addr an address in the page
+     */
+    void flush_page(uint64_t addr) {
+        auto& e = entries[index_of(addr)];
+        if(e.read_tag == (addr & page_mask) || e.write_tag == (addr & page_mask))
+            e.read_tag = e.write_tag = invalid_tag;
+    }
+    /**
+     * stop stores to a page from accessing its host memory directly, e.g. as it holds translated code now
+     *
+     * @param addr an address in the page
+     */
+    void protect_page(uint64_t addr) {
+        auto& e = entries[index_of(addr)];
+        if(e.write_tag == (addr & page_mask))
+            e.write_tag = invalid_tag;
+    }
+    /**
+     * stop stores to all pages from accessing their host memory directly, loads keep using it
+     */
+    void protect() {
+        for(auto& e : entries)
+            e.write_tag = invalid_tag;
+    }
+    /**
+     * drop all entries
+     */
+    void flush() {
+        for(auto& e : entries)
+            e = tlb_entry{invalid_tag, invalid_tag, 0, 0};
+    }
+
+    tlb_entry* data() { return entries.data(); }
+
+private:
+    std::array<tlb_entry, entry_count> entries;
+    uint32_t mem_space{0};
+    bool enabled{false};
+};
+} // namespace jit
+} // namespace iss
+#endif /* _ISS_JIT_SOFT_TLB_H_ */
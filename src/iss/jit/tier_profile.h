@@ -0,0 +1,139 @@
+/*******************************************************************************
+ * Copyright (C) 2024 MINRES Technologies GmbH
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Contributors:
+ *       eyck@minres.com - initial implementation
+ ******************************************************************************/
+
+#ifndef _ISS_JIT_TIER_PROFILE_H_
+#define _ISS_JIT_TIER_PROFILE_H_
+
+#include <absl/container/flat_hash_map.h>
+#include <cstdint>
+
+namespace iss {
+namespace jit {
+/**
+ * execution tiers of a tiered vm, ordered by increasing translation cost and code quality
+ */
+enum class tier_e { INTERPRETED, BASELINE, OPTIMIZED };
+/**
+ * thresholds of the promotion between the tiers
+ */
+struct tier_config {
+    //! number of interpreted executions of a block until it gets translated by the baseline engine
+    uint32_t warm_threshold{16};
+    //! number of samples taken at a block while running baseline code until it gets translated by the optimizing engine
+    uint32_t hot_threshold{64};
+    //! number of instructions the baseline engine runs between two samples
+    uint64_t sample_interval{4096};
+    //! number of background compile threads of each translating engine, 0 compiles in the simulation thread
+    unsigned compile_threads{1};
+};
+/**
+ * execution profile of the blocks of a tiered vm deciding which tier executes a block
+ *
+ * Interpreted blocks are counted whenever they are entered. Blocks running as baseline code are chained and do not
+ * return to the vm so they are sampled instead: the block the baseline engine is in after each sample interval gets
+ * a sample. A block is promoted to the next tier once its count reaches the threshold, it is never demoted.
+ */
+class tier_profile {
+public:
+    explicit tier_profile(tier_config const& cfg = tier_config{})
+    : cfg(cfg) {}
+    /**
+     * get the tier executing a block
+     *
+     * @param pc the start address of the block
+     * @return the tier
+     */
+    tier_e tier_of(uint64_t pc) const {
+        auto it = blocks.find(pc);
+        return it == blocks.end() ? tier_e::INTERPRETED : it->second.tier;
+    }
+    /**
+     * count an interpreted execution of a block
+     *
+     * @param pc the start address of the block
+     * @return the tier executing the block from now on
+     */
+    tier_e record_entry(uint64_t pc) {
+        auto& e = blocks[pc];
+        if(e.tier == tier_e::INTERPRETED && ++e.count >= cfg.warm_threshold)
+            promote(e, tier_e::BASELINE);
+        return e.tier;
+    }
+    /**
+     * count a sample taken at a block running as baseline code
+     *
+     * @param pc the start address of the block
+     * @return the tier executing the block from now on
+     */
+    tier_e record_sample(uint64_t pc) {
+        auto& e = blocks[pc];
+        if(e.tier == tier_e::INTERPRETED)
+            promote(e, tier_e::BASELINE);
+        if(e.tier == tier_e::BASELINE && ++e.count >= cfg.hot_threshold)
+            promote(e, tier_e::OPTIMIZED);
+        return e.tier;
+    }
+    /**
+     * forget all blocks, e.g. after the code changed
+     */
+    void clear() { blocks.clear(); }
+
+    tier_config const& get_config() const { return cfg; }
+    /**
+     * get the number of blocks promoted to a tier since construction
+     *
+     * @param tier the tier
+     * @return the number of promotions
+     */
+    uint64_t promotions(tier_e tier) const { return promoted[static_cast<unsigned>(tier)]; }
+
+private:
+    struct block {
+        tier_e tier{tier_e::INTERPRETED};
+        uint32_t count{0};
+    };
+
+    void promote(block& e, tier_e tier) {
+        e.tier = tier;
+        e.count = 0;
+        promoted[static_cast<unsigned>(tier)]++;
+    }
+
+    tier_config cfg;
+    absl::flat_hash_map<uint64_t, block> blocks;
+    uint64_t promoted[3]{0, 0, 0};
+};
+} // namespace jit
+} // namespace iss
+#endif /* _ISS_JIT_TIER_PROFILE_H_ */
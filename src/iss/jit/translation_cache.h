@@ -0,0 +1,707 @@
+/*******************************************************************************
+ * Copyright (C) 2024 MINRES Technologies GmbH
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Contributors:
+ *       eyck@minres.com - initial implementation
+ ******************************************************************************/
+
+#ifndef _ISS_JIT_TRANSLATION_CACHE_H_
+#define _ISS_JIT_TRANSLATION_CACHE_H_
+
+#include "chaining.h"
+#include "code_pages.h"
+#include "epoch_reclaimer.h"
+#include "slab_pool.h"
+#include "translation_cache_if.h"
+#include <absl/container/flat_hash_map.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace iss {
+namespace jit {
+/**
+ * cache of translated blocks keyed by their physical start address
+ *
+ * The cache owns the translation blocks and keeps them at stable addresses in a slab pool so they can be chained
+ * via their cont array and their indirect targets, a compact open addressing index maps the start addresses to the
+ * blocks. A small direct mapped jump cache in front of the index serves the lookups of indirect branches. It accounts
+ * for the host code (see code_size()) and the descriptor memory of each block and, if a budget is configured, evicts
+ * blocks in FIFO generations. An evicted block is unlinked from all its predecessors.
+ * If pages are tracked the cache marks the guest pages of its blocks in the code pages of the core and collects the
+ * pages written since, a synchronization of the instruction stream then only removes the blocks of those pages. Blocks
+ * ending with such a synchronization are never chained to their successors so each execution of them returns to the
+ * dispatcher, which needs to call sync_code() then.
+ * Whenever blocks are removed the epoch changes so a dispatcher knows that block pointers it holds became invalid.
+ * Removed blocks are not destroyed right away but retired, their code and descriptors are released once every
+ * dispatcher executing out of the cache passed a quiescent point. The code of a block may be shared with the caches of
+ * other vms, the block then holds a share of it and the code is accounted in each cache holding it.
+ *
+ * @tparam TB the translation block type of the backend, needs the members f_ptr and cont and the size of its code,
+ * either as member f_size or, for code in a code_arena, as member f_mem. Backends chaining indirect branches add the
+ * member targets, backends whose blocks jump to their successors directly add the member function chain(idx, to) which
+ * gets called whenever an element of the cont array changes
+ */
+template <typename TB> class translation_cache : public translation_cache_if {
+    //! the number of times translate_tracked() translates a block at most
+    static constexpr unsigned max_track_attempts = 4;
+
+    struct entry : public TB {
+        entry(TB&& tb, uint64_t pc, unsigned generation)
+        : TB(std::move(tb))
+        , pc(pc)
+        , generation(generation) {}
+        uint64_t pc;
+        unsigned generation;
+        //! pc and cont index of the blocks chained to this one
+        std::vector<std::pair<uint64_t, unsigned>> preds;
+        //! first and last guest page the block got translated from, empty if the pages are not tracked
+        std::pair<uint64_t, uint64_t> pages{1, 0};
+        //! owner of the code if it is shared with other vms, the block itself does not own it then
+        std::shared_ptr<TB> shared;
+        //! the block ends with a synchronization of the instruction stream
+        bool code_sync{false};
+    };
+
+    using pool_t = slab_pool<entry>;
+    using index_t = absl::flat_hash_map<uint64_t, entry*>;
+    //! owner of a retired block, returns it to the pool when being destroyed
+    class retired_entry {
+    public:
+        retired_entry(pool_t& pool, entry* e)
+        : pool(&pool)
+        , e(e) {}
+
+        retired_entry(retired_entry&& o)
+        : pool(o.pool)
+        , e(o.e) {
+            o.e = nullptr;
+        }
+
+        retired_entry& operator=(retired_entry&& o) {
+            std::swap(pool, o.pool);
+            std::swap(e, o.e);
+            return *this;
+        }
+
+        ~retired_entry() {
+            if(e)
+                pool->destroy(e);
+        }
+
+    private:
+        pool_t* pool;
+        entry* e;
+    };
+
+    struct generation {
+        unsigned id;
+        size_t bytes;
+        std::vector<uint64_t> pcs;
+    };
+    // the slot and control byte an entry occupies in the index
+    static constexpr size_t index_overhead = sizeof(typename index_t::value_type) + 1;
+
+    struct jump_cache_entry {
+        uint64_t pc;
+        TB* tb;
+    };
+    static constexpr unsigned jump_cache_bits = 10;
+    // instructions are at least 2 bytes aligned on all supported targets so bit 0 does not carry information
+    static size_t jump_cache_index(uint64_t pc) { return (pc >> 1) & ((1U << jump_cache_bits) - 1); }
+
+public:
+    /**
+     * registration of a dispatch loop executing blocks of the cache for the lifetime of the object
+     */
+    class dispatcher {
+    public:
+        explicit dispatcher(translation_cache& cache)
+        : reclaimer(cache.reclaimer)
+        , handle(cache.reclaimer.attach()) {}
+
+        ~dispatcher() { reclaimer.detach(handle); }
+
+        dispatcher(dispatcher const&) = delete;
+
+        dispatcher& operator=(dispatcher const&) = delete;
+        /**
+         * signal that the dispatcher does not hold pointers to blocks removed before this call anymore
+         */
+        void quiescent() { reclaimer.quiescent(handle); }
+
+    private:
+        epoch_reclaimer<retired_entry>& reclaimer;
+        typename epoch_reclaimer<retired_entry>::participant* handle;
+    };
+
+    explicit translation_cache(cache_config const& cfg = cache_config{})
+    : cfg(cfg) {}
+
+    ~translation_cache() override {
+        release_pages();
+        if(code_map)
+            code_map->detach(observer_id);
+        for(auto& e : blocks)
+            pool.destroy(e.second);
+    }
+
+    translation_cache(translation_cache const&) = delete;
+
+    translation_cache& operator=(translation_cache const&) = delete;
+    /**
+     * find the block starting at pc
+     *
+     * @param pc the physical address of the block
+     * @return the block or nullptr if there is none
+     */
+    TB* find(uint64_t pc) {
+        stats.lookups++;
+        auto& jc = jump_cache[jump_cache_index(pc)];
+        if(jc.tb && jc.pc == pc) {
+            stats.jump_cache_hits++;
+            stats.hits++;
+            return jc.tb;
+        }
+        stats.jump_cache_misses++;
+        auto it = blocks.find(pc);
+        if(it == blocks.end())
+            return nullptr;
+        stats.hits++;
+        jc = jump_cache_entry{pc, it->second};
+        return it->second;
+    }
+    /**
+     * find the block starting at pc without accounting it as a lookup of the dispatcher
+     *
+     * @param pc the physical address of the block
+     * @return the block or nullptr if there is none
+     */
+    TB* peek(uint64_t pc) const {
+        auto it = blocks.find(pc);
+        return it == blocks.end() ? nullptr : it->second;
+    }
+    /**
+     * add a block to the cache, this may evict older blocks and thus change the epoch
+     *
+     * @param pc the physical address of the block
+     * @param tb the translated block
+     * @param speculative true if the block is translated ahead of its first execution
+     * @param shared the owner of the code if it is shared, tb does not own the code then
+     * @return the block as stored in the cache
+     */
+    TB* insert(uint64_t pc, TB&& tb, bool speculative = false, std::shared_ptr<TB> shared = nullptr) {
+        auto it = blocks.find(pc);
+        if(it != blocks.end())
+            remove(it);
+        if(generations.empty() || (cfg.budget && generations.back().bytes >= cfg.budget / std::max(cfg.generations, 1U)))
+            generations.push_back(generation{next_generation++, 0, {}});
+        auto& gen = generations.back();
+        auto& e = *pool.create(std::move(tb), pc, gen.id);
+        e.shared = std::move(shared);
+        blocks.emplace(pc, &e);
+        index_code(e, true);
+        auto pit = pending_pages.find(pc);
+        if(pit != pending_pages.end()) {
+            e.pages = pit->second;
+            pending_pages.erase(pit);
+            for(auto page = e.pages.first; page <= e.pages.second; ++page)
+                page_blocks[page].push_back(pc);
+        }
+        auto size = code_size(e, 0) + sizeof(entry) + index_overhead;
+        gen.bytes += size;
+        gen.pcs.push_back(pc);
+        stats.blocks++;
+        stats.code_bytes += code_size(e, 0);
+        stats.descriptor_bytes += sizeof(entry) + index_overhead;
+        stats.insertions++;
+        if(speculative)
+            stats.speculative_insertions++;
+        enforce_budget();
+        return &e;
+    }
+    /**
+     * check whether the block at pc may be translated
+     *
+     * @param pc the physical address of the block
+     * @return true if there is no admission filter or the filter admits the block
+     */
+    bool admit(uint64_t pc) const { return !admission_filter || admission_filter(pc); }
+    /**
+     * chain a block to its successor
+     *
+     * @param from the predecessor
+     * @param idx the index into the cont array of the predecessor
+     * @param to the successor
+     */
+    void link(TB* from, unsigned idx, TB* to) {
+        if(static_cast<entry*>(from)->code_sync)
+            return;
+        from->cont[idx] = to;
+        chain(*from, idx, to, 0);
+        add_pred(from, idx, to);
+    }
+    /**
+     * cache the target of the indirect branch ending a block, the most recent target is kept first
+     *
+     * @param from the block ending with the indirect branch
+     * @param pc the address the branch went to
+     * @param to the block at pc
+     */
+    void link_indirect(TB* from, uint64_t pc, TB* to) {
+        if(static_cast<entry*>(from)->code_sync)
+            return;
+        auto& targets = from->targets;
+        if(targets[0].tb == to)
+            return;
+        for(unsigned i = indirect_target_ways - 1; i > 0; --i) {
+            targets[i] = targets[i - 1];
+            if(targets[i].tb)
+                add_pred(from, pred_idx(i), static_cast<TB*>(targets[i].tb));
+        }
+        targets[0] = indirect_target{pc, to};
+        add_pred(from, pred_idx(0), to);
+    }
+    /**
+     * mark a block ending with a synchronization of the instruction stream (e.g. a fence.i). It is not chained to its
+     * successors, so the blocks executed after it are looked up again once the dispatcher called sync_code()
+     *
+     * @param tb the block, not chained to any successor yet
+     */
+    void mark_code_sync(TB* tb) { static_cast<entry*>(tb)->code_sync = true; }
+    /**
+     * check if the dispatcher needs to call sync_code() after executing a block, see mark_code_sync()
+     *
+     * @param tb the block
+     * @return true if the block ends with a synchronization of the instruction stream
+     */
+    bool is_code_sync(TB const* tb) const { return static_cast<entry const*>(tb)->code_sync; }
+    /**
+     * cache the block a call ending a block returns to
+     *
+     * @param from the block ending with the call
+     * @param pc the return address
+     * @param to the block at pc
+     */
+    void link_return(TB* from, uint64_t pc, TB* to) {
+        from->targets[return_target_idx] = indirect_target{pc, to};
+        add_pred(from, pred_idx(return_target_idx), to);
+    }
+    /**
+     * get the current epoch. It changes whenever blocks are removed from the cache
+     *
+     * @return the epoch
+     */
+    uint64_t epoch() const { return removal_epoch; }
+    /**
+     * get the location of the epoch to be checked by generated code
+     *
+     * @return the pointer to the epoch
+     */
+    uint64_t const* epoch_ptr() const { return &removal_epoch; }
+
+    size_t size() const { return blocks.size(); }
+
+    void set_config(cache_config const& config) override {
+        // blocks translated before need to be tracked to be invalidated
+        auto retrack = config.invalidate_pages != cfg.invalidate_pages;
+        cfg = config;
+        if(retrack)
+            flush();
+        enforce_budget();
+    }
+
+    cache_config const& get_config() const override { return cfg; }
+
+    cache_stats const& get_stats() const override { return stats; }
+
+    void set_admission_filter(std::function<bool(uint64_t)> filter) override { admission_filter = std::move(filter); }
+
+    /**
+     * observe the writes of a core to the pages holding translated code. If cache_config::invalidate_pages is set the
+     * blocks of written pages are invalidated by sync_code()
+     *
+     * @param pages the code pages of the core
+     */
+    void set_code_pages(code_pages& pages) {
+        code_map = &pages;
+        // shared code pages report the writes of other cores on their threads
+        observer_id = pages.attach([this](uint64_t page) {
+            std::lock_guard<std::mutex> lock(written_mtx);
+            if(std::find(written_pages.begin(), written_pages.end(), page) == written_pages.end())
+                written_pages.push_back(page);
+            any_written.store(true, std::memory_order_release);
+        });
+    }
+    /**
+     * record the guest code a block gets generated from. It needs to be called before the guest code is read so writes
+     * from then on until the block is inserted are noticed, see translate_tracked()
+     *
+     * @param pc the physical address of the block
+     * @param end the address following the guest code of the block
+     */
+    void track(uint64_t pc, uint64_t end) {
+        if(!code_map || !cfg.invalidate_pages)
+            return;
+        auto range = std::make_pair(code_pages::page_of(pc), code_pages::page_of(std::max(end, pc + 1) - 1));
+        // the pages tracked before stay marked while the range changes
+        for(auto page = range.first; page <= range.second; ++page)
+            code_map->acquire(page);
+        auto it = pending_pages.find(pc);
+        if(it != pending_pages.end()) {
+            release(it->second);
+            it->second = range;
+        } else
+            pending_pages.emplace(pc, range);
+    }
+    /**
+     * read and translate the guest code of a block with its pages tracked (see track()), so writes of other cores
+     * racing with the translation are noticed. The pages a block reaches into are only known after translating it, so
+     * the translation is repeated if it read pages not tracked before. It is repeated as well if pages holding code got
+     * written meanwhile, at most max_track_attempts times in total as other cores might keep writing them. The blocks
+     * of pages written during the last attempt get invalidated by the next invalidate_written() then
+     *
+     * @param pc the physical address of the block
+     * @param translate the translation, called with a reference to set to the address following the guest code read
+     * @return the result of the last translation
+     */
+    template <typename F> auto translate_tracked(uint64_t pc, F&& translate) -> decltype(translate(std::declval<uint64_t&>())) {
+        uint64_t end = pc + 1;
+        if(!code_map || !cfg.invalidate_pages)
+            return translate(end);
+        auto tracked = end;
+        for(unsigned attempt = 1;; ++attempt) {
+            track(pc, tracked);
+            end = pc + 1;
+            try {
+                auto res = translate(end);
+                auto retry = attempt < max_track_attempts;
+                if(retry && code_pages::page_of(std::max(end, pc + 1) - 1) > code_pages::page_of(tracked - 1)) {
+                    tracked = end;
+                    continue;
+                }
+                if(retry && has_written()) {
+                    invalidate_written();
+                    continue;
+                }
+                track(pc, end);
+                return res;
+            } catch(...) {
+                untrack(pc);
+                throw;
+            }
+        }
+    }
+    /**
+     * drop the guest code recorded by track() for a block which does not get inserted, e.g. as compiling it failed
+     *
+     * @param pc the physical address of the block
+     */
+    void untrack(uint64_t pc) {
+        auto it = pending_pages.find(pc);
+        if(it == pending_pages.end())
+            return;
+        release(it->second);
+        pending_pages.erase(it);
+    }
+    /**
+     * get the generation blocks are compiled for, blocks compiled for an older one must not be inserted. It changes if
+     * the cache is flushed or if pages of blocks being compiled got written
+     *
+     * @return the generation
+     */
+    uint64_t install_generation() const { return code_generation; }
+    /**
+     * check if pages holding translated code got written since the last invalidation
+     *
+     * @return true if blocks need to be invalidated
+     */
+    bool has_written() const { return any_written.load(std::memory_order_acquire); }
+    /**
+     * remove the blocks of the pages written since the last invalidation, they are unlinked from their predecessors
+     */
+    void invalidate_written() {
+        if(!has_written())
+            return;
+        std::vector<uint64_t> pages;
+        {
+            std::lock_guard<std::mutex> lock(written_mtx);
+            pages.swap(written_pages);
+            any_written.store(false, std::memory_order_relaxed);
+        }
+        for(auto page : pages) {
+            auto pit = page_blocks.find(page);
+            if(pit == page_blocks.end())
+                continue;
+            auto pcs = std::move(pit->second);
+            page_blocks.erase(pit);
+            for(auto pc : pcs) {
+                auto it = blocks.find(pc);
+                if(it != blocks.end()) {
+                    remove(it);
+                    stats.invalidations++;
+                }
+            }
+        }
+        // the guest code of blocks being compiled might have changed
+        if(!pending_pages.empty()) {
+            for(auto& p : pending_pages)
+                release(p.second);
+            pending_pages.clear();
+            code_generation++;
+        }
+    }
+    /**
+     * handle a synchronization of the instruction stream, e.g. fence.i. If pages are tracked only the blocks of the
+     * pages written since are removed, otherwise all blocks
+     */
+    void sync_code() {
+        if(code_map && cfg.invalidate_pages)
+            invalidate_written();
+        else
+            flush();
+    }
+
+    /**
+     * remove a block, e.g. to translate its guest code again differently. It is unlinked from its predecessors
+     *
+     * @param tb the block
+     */
+    void invalidate(TB* tb) {
+        auto it = blocks.find(static_cast<entry*>(tb)->pc);
+        if(it != blocks.end() && static_cast<TB*>(it->second) == tb) {
+            remove(it);
+            stats.invalidations++;
+        }
+    }
+    /**
+     * find the block whose host code holds an address, e.g. to map the host pc of a fault back to the guest code. The
+     * code of a block is taken to span its code size from f_ptr, the lookup only checks the blocks spanning the host
+     * page of the address
+     *
+     * @param host_pc the host address
+     * @return the block or nullptr
+     */
+    TB* find_code(uintptr_t host_pc) const {
+        auto it = code_index.find(host_pc >> code_page_bits);
+        if(it == code_index.end())
+            return nullptr;
+        entry* res = nullptr;
+        // the spans may reach into the code of following blocks, the block starting last before host_pc holds it
+        for(auto* e : it->second)
+            if(e->f_ptr <= host_pc && host_pc - e->f_ptr < code_size(*e, 0) && (!res || e->f_ptr > res->f_ptr))
+                res = e;
+        return res;
+    }
+
+    void flush() override {
+        release_pages();
+        page_blocks.clear();
+        pending_pages.clear();
+        {
+            std::lock_guard<std::mutex> lock(written_mtx);
+            written_pages.clear();
+            any_written.store(false, std::memory_order_relaxed);
+        }
+        code_generation++;
+        if(!blocks.empty())
+            removal_epoch++;
+        for(auto& e : blocks)
+            reclaimer.retire(retired_entry(pool, e.second));
+        blocks.clear();
+        code_index.clear();
+        jump_cache.fill(jump_cache_entry{0, nullptr});
+        reclaimer.collect();
+        generations.clear();
+        stats.blocks = 0;
+        stats.code_bytes = 0;
+        stats.descriptor_bytes = 0;
+        stats.flushes++;
+    }
+
+private:
+    // the predecessor index of a link through the indirect targets, the cont array uses 0 and 1
+    static unsigned pred_idx(unsigned target) { return 2 + target; }
+
+    // the size of the host code of a block, blocks in a code_arena take it from their allocation
+    template <typename B> static auto code_size(B const& tb, int) -> decltype(size_t(tb.f_size)) { return tb.f_size; }
+
+    template <typename B> static auto code_size(B const& tb, long) -> decltype(size_t(tb.f_mem.size)) { return tb.f_mem.size; }
+
+    // the host pages of the code index
+    static constexpr unsigned code_page_bits = 12;
+
+    // clears an indirect target of a block still pointing to a removed block, blocks without targets are never linked
+    template <typename B> static auto unlink_indirect(B& from, unsigned target, TB* to, int) -> decltype(from.targets, bool()) {
+        if(from.targets[target].tb != to)
+            return false;
+        from.targets[target] = indirect_target{};
+        return true;
+    }
+
+    template <typename B> static bool unlink_indirect(B&, unsigned, TB*, long) { return false; }
+
+    // lets blocks jumping to their successors directly follow the changes of their cont array
+    template <typename B> static auto chain(B& from, unsigned idx, TB* to, int) -> decltype(from.chain(idx, to), void()) {
+        from.chain(idx, to);
+    }
+
+    template <typename B> static void chain(B&, unsigned, TB*, long) {}
+
+    void add_pred(TB* from, unsigned idx, TB* to) {
+        auto& preds = static_cast<entry*>(to)->preds;
+        std::pair<uint64_t, unsigned> pred{static_cast<entry*>(from)->pc, idx};
+        if(std::find(preds.begin(), preds.end(), pred) == preds.end()) {
+            preds.push_back(pred);
+            stats.descriptor_bytes += sizeof(pred);
+        }
+    }
+
+    void index_code(entry& e, bool add) {
+        auto size = code_size(e, 0);
+        if(!e.f_ptr || !size)
+            return;
+        for(auto page = e.f_ptr >> code_page_bits; page <= (e.f_ptr + size - 1) >> code_page_bits; ++page) {
+            if(add) {
+                code_index[page].push_back(&e);
+                continue;
+            }
+            auto it = code_index.find(page);
+            if(it != code_index.end()) {
+                auto& v = it->second;
+                v.erase(std::remove(v.begin(), v.end(), &e), v.end());
+                if(v.empty())
+                    code_index.erase(it);
+            }
+        }
+    }
+
+    void release(std::pair<uint64_t, uint64_t> const& pages) {
+        for(auto page = pages.first; page <= pages.second; ++page)
+            code_map->release(page);
+    }
+
+    void release_pages() {
+        if(!code_map)
+            return;
+        for(auto& e : blocks)
+            release(e.second->pages);
+        for(auto& p : pending_pages)
+            release(p.second);
+    }
+
+    void enforce_budget() {
+        // the youngest generation holds the block just added so it is never evicted
+        while(cfg.budget && generations.size() > 1 && stats.footprint() > cfg.budget) {
+            auto& gen = generations.front();
+            for(auto pc : gen.pcs) {
+                auto it = blocks.find(pc);
+                if(it != blocks.end() && it->second->generation == gen.id) {
+                    remove(it);
+                    stats.evictions++;
+                }
+            }
+            generations.pop_front();
+        }
+    }
+
+    void remove(typename index_t::iterator it) {
+        auto& e = *it->second;
+        for(auto& pred : e.preds) {
+            auto pit = blocks.find(pred.first);
+            if(pit == blocks.end())
+                continue;
+            auto& from = *pit->second;
+            if(pred.second < 2 && from.cont[pred.second] == &e) {
+                from.cont[pred.second] = nullptr;
+                chain(from, pred.second, nullptr, 0);
+                stats.unlinks++;
+            } else if(pred.second >= 2 && unlink_indirect(from, pred.second - 2, &e, 0)) {
+                stats.unlinks++;
+            }
+        }
+        for(auto page = e.pages.first; page <= e.pages.second; ++page) {
+            auto pit = page_blocks.find(page);
+            if(pit != page_blocks.end()) {
+                auto& pcs = pit->second;
+                pcs.erase(std::remove(pcs.begin(), pcs.end(), e.pc), pcs.end());
+                if(pcs.empty())
+                    page_blocks.erase(pit);
+            }
+            code_map->release(page);
+        }
+        index_code(e, false);
+        auto& jc = jump_cache[jump_cache_index(e.pc)];
+        if(jc.tb == &e)
+            jc = jump_cache_entry{0, nullptr};
+        stats.blocks--;
+        stats.code_bytes -= code_size(e, 0);
+        stats.descriptor_bytes -= sizeof(entry) + index_overhead + e.preds.size() * sizeof(typename decltype(e.preds)::value_type);
+        blocks.erase(it);
+        // a dispatcher might still hold a pointer to the block so it is destroyed once all dispatchers passed a quiescent
+        // point
+        reclaimer.retire(retired_entry(pool, &e));
+        removal_epoch++;
+    }
+
+    cache_config cfg;
+    cache_stats stats;
+    std::function<bool(uint64_t)> admission_filter;
+    // the pool needs to outlive the reclaimer which returns retired blocks to it
+    pool_t pool;
+    epoch_reclaimer<retired_entry> reclaimer;
+    index_t blocks;
+    std::array<jump_cache_entry, 1U << jump_cache_bits> jump_cache{};
+    std::deque<generation> generations;
+    unsigned next_generation{0};
+    uint64_t removal_epoch{0};
+    // the code pages of the core, null if pages are not tracked
+    code_pages* code_map{nullptr};
+    size_t observer_id{0};
+    // the page ranges of blocks generated but not inserted yet, e.g. being compiled in the background
+    absl::flat_hash_map<uint64_t, std::pair<uint64_t, uint64_t>> pending_pages;
+    // the start addresses of the blocks translated from each page
+    absl::flat_hash_map<uint64_t, std::vector<uint64_t>> page_blocks;
+    // the blocks whose host code spans each host page, see find_code()
+    absl::flat_hash_map<uintptr_t, std::vector<entry*>> code_index;
+    // the pages written since the last invalidation, they are added from the threads of all cores sharing the pages
+    std::mutex written_mtx;
+    std::vector<uint64_t> written_pages;
+    std::atomic<bool> any_written{false};
+    uint64_t code_generation{0};
+};
+} // namespace jit
+} // namespace iss
+#endif /* _ISS_JIT_TRANSLATION_CACHE_H_ */
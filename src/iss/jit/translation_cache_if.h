@@ -0,0 +1,146 @@
+/*******************************************************************************
+ * Copyright (C) 2024 MINRES Technologies GmbH
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Contributors:
+ *       eyck@minres.com - initial implementation
+ ******************************************************************************/
+
+#ifndef _ISS_JIT_TRANSLATION_CACHE_IF_H_
+#define _ISS_JIT_TRANSLATION_CACHE_IF_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+namespace iss {
+namespace jit {
+/**
+ * configuration of a translation cache
+ */
+struct cache_config {
+    //! upper limit of host code plus descriptor memory in bytes, 0 means unlimited
+    size_t budget{0};
+    //! number of FIFO generations the budget is split into, the oldest generation is evicted as a whole
+    unsigned generations{8};
+    //! translate the successors of a block known at translation time ahead of their first execution and chain them
+    bool speculate{false};
+    //! executions after which a block is translated again with optimizations and its observed branch outcomes, 0
+    //! disables it. Only backends with an optimizing code generator (LLVM) support it
+    unsigned recompile_threshold{0};
+    //! maximum number of blocks a recompiled block is merged with into a region, taken from its known successors
+    //! which were executed before. The blocks of a region branch to each other within the generated code
+    unsigned region_blocks{1};
+    //! directory of the on-disk cache reusing compiled blocks between runs, empty disables it. Only backends emitting
+    //! relocatable objects (LLVM) support it
+    std::string persistent_dir;
+    //! track the guest pages blocks are translated from and invalidate only the blocks of pages written since the last
+    //! synchronization of the instruction stream (e.g. fence.i) instead of flushing the whole cache. Only suitable if
+    //! the architecture requests a flush solely for modified code, not e.g. for address translation changes. Writes of
+    //! other cores are only noticed if the cores share their code pages (core_context::share_code_pages(), smp::engine does
+    //! so), writes of other bus masters if they write through a mem::memory_map knowing the code pages
+    bool invalidate_pages{false};
+    //! share the compiled blocks with the vms of the other cores of the cluster, each vm keeps its own descriptors and
+    //! chaining of the blocks. Blocks embedding addresses of a vm (plugins, profiling, native chaining) are not shared.
+    //! Only backends with blocks independent of the vm (LLVM, TCC) support it
+    bool share_cluster{false};
+};
+/**
+ * occupancy and efficiency figures of a translation cache
+ */
+struct cache_stats {
+    //! number of translated blocks held
+    size_t blocks{0};
+    //! bytes of host code held
+    size_t code_bytes{0};
+    //! bytes of block descriptors and lookup structures held
+    size_t descriptor_bytes{0};
+    //! number of lookups done by the dispatcher, chained block executions do not need a lookup
+    uint64_t lookups{0};
+    //! number of lookups which found a translated block
+    uint64_t hits{0};
+    //! number of lookups answered by the jump cache without probing the index
+    uint64_t jump_cache_hits{0};
+    uint64_t jump_cache_misses{0};
+    uint64_t insertions{0};
+    //! number of blocks translated ahead of their first execution or recompiled, blocks compiled in the background are
+    //! not included
+    uint64_t speculative_insertions{0};
+    uint64_t evictions{0};
+    uint64_t flushes{0};
+    //! number of blocks removed because their guest code got written
+    uint64_t invalidations{0};
+    //! number of chain links removed because the successor got evicted or invalidated
+    uint64_t unlinks{0};
+
+    size_t footprint() const { return code_bytes + descriptor_bytes; }
+
+    double hit_rate() const { return lookups ? static_cast<double>(hits) / lookups : 0.0; }
+};
+/**
+ * backend independent access to the translation cache of a vm. The cache must not be modified while the vm is
+ * executing
+ */
+class translation_cache_if {
+public:
+    virtual ~translation_cache_if() = default;
+    /**
+     * set the configuration, a reduced budget is enforced immediately
+     *
+     * @param cfg the new configuration
+     */
+    virtual void set_config(cache_config const& cfg) = 0;
+    /**
+     * get the configuration
+     *
+     * @return the configuration
+     */
+    virtual cache_config const& get_config() const = 0;
+    /**
+     * get the statistics of the cache
+     *
+     * @return the statistics
+     */
+    virtual cache_stats const& get_stats() const = 0;
+    /**
+     * remove all translated blocks
+     */
+    virtual void flush() = 0;
+    /**
+     * set a filter deciding whether a block may be translated. A vm only translates blocks the filter admits and leaves
+     * the others to the caller of vm_if::run_slice(). An empty filter admits all blocks
+     *
+     * @param filter the filter getting the physical address of the block
+     */
+    virtual void set_admission_filter(std::function<bool(uint64_t)> filter) = 0;
+};
+} // namespace jit
+} // namespace iss
+#endif /* _ISS_JIT_TRANSLATION_CACHE_IF_H_ */
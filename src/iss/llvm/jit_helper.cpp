@@ -33,6 +33,7 @@
 
 #include "jit_helper.h"
 #include <iss/log_categories.h>
+#include <llvm/Config/llvm-config.h>
 #include <llvm/Support/Debug.h> //EnableDebugBuffering
 #include <llvm/Support/Error.h>
 #include <llvm/Support/TargetSelect.h>
@@ -40,19 +41,26 @@
 #include <llvm/Support/Signals.h> // llvm::sys::PrintStackTraceOnErrorSignal()
 #include <llvm/Support/TargetSelect.h>
 #include <llvm/Support/raw_ostream.h> //outs()
-// needed to get the execution engine linked in
-#include <llvm/ExecutionEngine/MCJIT.h>
+#include <llvm/ExecutionEngine/Orc/ExecutionUtils.h>
+#include <llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/ExecutionEngine/Orc/ObjectTransformLayer.h>
 
 #include "llvm/Support/CodeGen.h"
 
 #include <array>
+#include <atomic>
 #include <iostream>
 #include <memory>
+#include <mutex>
 
 #include "llvm/IR/Module.h"
-#include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
 #include <llvm/IR/DataLayout.h>
 #include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/MDBuilder.h>
+#include <llvm/Passes/PassBuilder.h>
 #include <llvm/Support/MemoryBuffer.h>
 
 using namespace llvm;
@@ -77,43 +85,356 @@ void init_jit_debug(int argc, const char* const argv[]) {
 
 namespace llvm {
 
-LLVMContext& getContext() {
-    static LLVMContext context;
+orc::ThreadSafeContext& getThreadSafeContext() {
+    static orc::ThreadSafeContext context(std::make_unique<LLVMContext>());
     return context;
 }
 
-translation_block getPointerToFunction(unsigned cluster_id, uint64_t phys_addr, std::function<Function*(Module*)>& generator,
-                                       bool dumpEnabled) {
+namespace {
+// the context the generator running in this thread creates its IR in
+thread_local LLVMContext* current_context{nullptr};
+}
+
+LLVMContext& getContext() { return current_context ? *current_context : *getThreadSafeContext().getContext(); }
+
+std::recursive_mutex& context_mutex() {
+    static std::recursive_mutex mtx;
+    return mtx;
+}
+
+void module_deleter::operator()(Module* mod) const {
+    auto lock = context.getLock();
+    delete mod;
+}
+
+namespace {
+// serializes checking for a symbol in a session with adding it
+std::mutex& session_mutex() {
+    static std::mutex mtx;
+    return mtx;
+}
+// size of the object file of the block emitted last by this thread. Sessions without compile threads materialize a
+// block in the thread looking it up
+thread_local size_t emitted_size{0};
+// receives a copy of the object of the block emitted next by this thread if not null
+thread_local std::string* emitted_object{nullptr};
+
+std::unique_ptr<orc::LLJIT> create_session(bool optimize) {
+    auto jtmb = orc::JITTargetMachineBuilder::detectHost();
+    if(!jtmb)
+        throw std::runtime_error(toString(jtmb.takeError()));
+    jtmb->setCodeGenOptLevel(optimize ? CodeGenOptLevel::Default : CodeGenOptLevel::None);
+    jtmb->getOptions().EnableFastISel = !optimize;
+    jtmb->getOptions().GuaranteedTailCallOpt = false;
+    auto jit = orc::LLJITBuilder().setJITTargetMachineBuilder(std::move(*jtmb)).create();
+    if(!jit)
+        throw std::runtime_error(toString(jit.takeError()));
+    // the helper functions called by the blocks are resolved in the process
+    auto generator = orc::DynamicLibrarySearchGenerator::GetForCurrentProcess((*jit)->getDataLayout().getGlobalPrefix());
+    if(!generator)
+        throw std::runtime_error(toString(generator.takeError()));
+    (*jit)->getMainJITDylib().addGenerator(std::move(*generator));
+    (*jit)->getObjTransformLayer().setTransform([](std::unique_ptr<MemoryBuffer> obj) -> Expected<std::unique_ptr<MemoryBuffer>> {
+        emitted_size = obj->getBufferSize();
+        if(emitted_object)
+            emitted_object->assign(obj->getBufferStart(), obj->getBufferSize());
+        return std::move(obj);
+    });
+    return std::move(*jit);
+}
+/**
+ * get the JIT session shared by all vms. Code generator settings are per session so there is one for unoptimized and
+ * one for optimized blocks
+ */
+orc::LLJIT& session(bool optimize) {
+    static std::unique_ptr<orc::LLJIT> fast = create_session(false);
+    static std::unique_ptr<orc::LLJIT> optimizing = create_session(true);
+    return optimize ? *optimizing : *fast;
+}
+bool is_defined(orc::LLJIT& jit, std::string const& symbol) {
+    auto sym = jit.lookup(symbol);
+    if(sym)
+        return true;
+    consumeError(sym.takeError());
+    return false;
+}
+/**
+ * make the block function the only symbol of the module visible to the session. Blocks of the same address get
+ * translated again, e.g. after being evicted, so its name gets a unique suffix
+ */
+std::string expose_block_function(Module& mod, std::string const& fname) {
+    static std::atomic<uint64_t> id{0};
+    for(auto& f : mod.functions())
+        if(!f.isDeclaration())
+            f.setLinkage(GlobalValue::InternalLinkage);
+    for(auto& gv : mod.globals())
+        if(!gv.isDeclaration())
+            gv.setLinkage(GlobalValue::InternalLinkage);
+    auto* f = mod.getFunction(fname);
+    assert(f != nullptr && "Block function is missing in module");
+    f->setName(fname + "." + std::to_string(++id));
+    f->setLinkage(GlobalValue::ExternalLinkage);
+    return f->getName().str();
+}
+
+void optimize_module(Module& mod, unsigned opt_level) {
+    LoopAnalysisManager lam;
+    FunctionAnalysisManager fam;
+    CGSCCAnalysisManager cgam;
+    ModuleAnalysisManager mam;
+    PassBuilder pb;
+    pb.registerModuleAnalyses(mam);
+    pb.registerCGSCCAnalyses(cgam);
+    pb.registerFunctionAnalyses(fam);
+    pb.registerLoopAnalyses(lam);
+    pb.crossRegisterProxies(lam, fam, cgam, mam);
+    auto level = opt_level > 2 ? OptimizationLevel::O3 : opt_level > 1 ? OptimizationLevel::O2 : OptimizationLevel::O1;
+    pb.buildPerModuleDefaultPipeline(level).run(mod, mam);
+}
+/**
+ * move a module of a vm into a context of its own so optimizing and linking it does not hold the lock of the context
+ * of the vm. The module is only touched under that lock while it gets serialized
+ */
+orc::ThreadSafeModule detach_module(module_ptr mod) {
+    SmallVector<char, 0> bitcode;
+    std::string name;
+    {
+        auto lock = mod.get_deleter().context.getLock();
+        name = mod->getName().str();
+        raw_svector_ostream os(bitcode);
+        WriteBitcodeToFile(*mod, os);
+        mod.reset();
+    }
+    auto ctx = std::make_unique<LLVMContext>();
+    auto res = parseBitcodeFile(MemoryBufferRef(StringRef(bitcode.data(), bitcode.size()), name), *ctx);
+    if(!res)
+        throw std::runtime_error(toString(res.takeError()));
+    return orc::ThreadSafeModule(std::move(*res), std::move(ctx));
+}
+} // namespace
+
+translation_block getPointerToFunction(orc::ThreadSafeContext context, unsigned cluster_id, uint64_t phys_addr,
+                                       std::function<Function*(Module*)>& generator, bool dumpEnabled, unsigned opt_level) {
+    auto res = generate_module(context, cluster_id, phys_addr, generator);
+    return compile_module(std::move(std::get<0>(res)), std::get<1>(res), dumpEnabled, opt_level);
+}
+
+std::tuple<module_ptr, std::string> generate_module(orc::ThreadSafeContext context, unsigned cluster_id, uint64_t phys_addr,
+                                                    gen_func& generator) {
 #ifndef NDEBUG
     CPPLOG(TRACE) << "Compiling and executing code for 0x" << std::hex << phys_addr << std::dec;
 #endif
-    static unsigned i = 0;
+    static std::atomic<unsigned> i{0};
     std::array<char, 32> s;
-    sprintf(s.data(), "llvm_jit_%u", ++i);
-    auto mod = std::make_unique<Module>(s.data(), getContext());
+    snprintf(s.data(), s.size(), "llvm_jit_%u", ++i);
+    auto lock = context.getLock();
+    struct context_scope {
+        explicit context_scope(LLVMContext* ctx)
+        : saved(current_context) {
+            current_context = ctx;
+        }
+        ~context_scope() { current_context = saved; }
+        LLVMContext* saved;
+    } scope(context.getContext());
+    module_ptr mod(new Module(s.data(), *context.getContext()), module_deleter{context});
     auto* f = generator(mod.get());
     assert(f != nullptr && "Generator function did return nullptr");
+    return std::make_tuple(std::move(mod), f->getName().str());
+}
+
+std::string get_host_description() {
+    auto jtmb = orc::JITTargetMachineBuilder::detectHost();
+    if(!jtmb)
+        throw std::runtime_error(toString(jtmb.takeError()));
+    return std::string("LLVM ") + LLVM_VERSION_STRING + " " + jtmb->getTargetTriple().str() + " " + jtmb->getCPU() + " " +
+           jtmb->getFeatures().getString();
+}
+
+translation_block compile_module(module_ptr mod, std::string const& fname, bool dumpEnabled, unsigned opt_level,
+                                 persisted_object* persist) {
+    auto& jit = session(opt_level > 0);
+    std::string sym_name;
+    {
+        auto lock = mod.get_deleter().context.getLock();
+        sym_name = expose_block_function(*mod, fname);
+    }
+    // the context of the vm is not needed anymore, the vm generates the next block while this one gets compiled
+    auto tsm = detach_module(std::move(mod));
+    auto* block_mod = tsm.getModuleUnlocked();
+    if(opt_level)
+        optimize_module(*block_mod, opt_level);
     if(dumpEnabled) {
         std::error_code ec;
-        std::string name(((std::string)mod->getName()) + ".ll");
+        std::string name(((std::string)block_mod->getName()) + ".ll");
         raw_fd_ostream os(StringRef(name), ec); // sys::fs::F_None);
-        // WriteBitcodeToFile(mod, OS);
-        // mod->dump();
-        mod->print(os, nullptr, false, true);
+        block_mod->print(os, nullptr, false, true);
         os.flush();
     }
-    //mod->setTargetTriple(sys::getProcessTriple());
-    std::string ErrStr;
-    EngineBuilder eb(std::move(mod)); // eb and ee take ownership of module
-    TargetOptions to;
-    to.EnableFastISel = true;
-    to.GuaranteedTailCallOpt = false;
-    ExecutionEngine* ee =
-        eb.setEngineKind(EngineKind::JIT).setTargetOptions(to).setErrorStr(&ErrStr).setOptLevel(CodeGenOptLevel::None).create();
-    if(!ee)
-        throw std::runtime_error(ErrStr);
-    ee->setVerifyModules(false);
-    return std::move(translation_block(ee->getFunctionAddress(f->getName().str()), {nullptr, nullptr}, ee));
+    auto tracker = jit.getMainJITDylib().createResourceTracker();
+    // the session compiles the module in the thread looking it up using a single target machine, so adding and
+    // compiling blocks is serialized while generating and optimizing them runs in parallel. This also serializes the
+    // check whether the same guest code is loaded already, e.g. by another vm, with adding the block
+    std::lock_guard<std::mutex> lock(session_mutex());
+    if(persist) {
+        if(is_defined(jit, persist->symbol))
+            persist = nullptr;
+        else {
+            auto* f = block_mod->getFunction(sym_name);
+            f->setName(persist->symbol);
+            sym_name = f->getName().str();
+        }
+    }
+    if(auto err = jit.addIRModule(tracker, std::move(tsm)))
+        throw std::runtime_error(toString(std::move(err)));
+    emitted_size = 0;
+    emitted_object = persist ? &persist->object : nullptr;
+    auto sym = jit.lookup(sym_name);
+    emitted_object = nullptr;
+    if(!sym) {
+        consumeError(tracker->remove());
+        throw std::runtime_error(toString(sym.takeError()));
+    }
+    return translation_block(sym->getValue(), {nullptr, nullptr}, std::move(tracker), emitted_size);
+}
+
+translation_block load_object(std::string const& path, size_t offset, size_t size, std::string const& symbol, unsigned opt_level) {
+    auto& jit = session(opt_level > 0);
+    auto tracker = jit.getMainJITDylib().createResourceTracker();
+    // serializes the check for the symbol and linking with compile_module()
+    std::lock_guard<std::mutex> lock(session_mutex());
+    if(is_defined(jit, symbol))
+        throw std::runtime_error("block " + symbol + " is loaded already");
+    // the object gets mapped and is only read while linking
+    auto buf = MemoryBuffer::getFileSlice(path, size, offset);
+    if(!buf)
+        throw std::runtime_error("could not read " + path + ": " + buf.getError().message());
+    if(auto err = jit.addObjectFile(tracker, std::move(*buf)))
+        throw std::runtime_error(toString(std::move(err)));
+    emitted_size = 0;
+    auto sym = jit.lookup(symbol);
+    if(!sym) {
+        consumeError(tracker->remove());
+        throw std::runtime_error(toString(sym.takeError()));
+    }
+    return translation_block(sym->getValue(), {nullptr, nullptr}, std::move(tracker), emitted_size);
+}
+
+void add_native_chaining(Function* f, iss::jit::chain_config const& cfg, block_profile const* profile) {
+    std::vector<ReturnInst*> rets;
+    for(auto& bb : *f)
+        if(auto* ret = dyn_cast_or_null<ReturnInst>(bb.getTerminator()))
+            rets.push_back(ret);
+    auto& ctx = f->getContext();
+    IRBuilder<> builder(ctx);
+    auto* ptr_ty = PointerType::getUnqual(ctx);
+    auto abs_addr = [&builder, ptr_ty](void const* p) {
+        return ConstantExpr::getIntToPtr(builder.getInt64(reinterpret_cast<uintptr_t>(p)), ptr_ty);
+    };
+    std::vector<Value*> args;
+    for(auto& arg : f->args())
+        args.push_back(&arg);
+    for(auto* ret : rets) {
+        // the ret moves into a block of its own which is taken whenever chaining is not possible
+        auto* leave = ret->getParent()->splitBasicBlock(ret, "chain_leave");
+        auto* check = leave->getSinglePredecessor();
+        check->getTerminator()->eraseFromParent();
+        auto* check_limit = BasicBlock::Create(ctx, "chain_limit", f, leave);
+        auto* get_next = BasicBlock::Create(ctx, "chain_next", f, leave);
+        auto* get_indirect = BasicBlock::Create(ctx, "chain_indirect", f, leave);
+        auto* call_next = BasicBlock::Create(ctx, "chain_call", f, leave);
+        builder.SetInsertPoint(check);
+        auto* stop = builder.CreateLoad(builder.getInt8Ty(), abs_addr(cfg.stop_flag), true);
+        builder.CreateCondBr(builder.CreateICmpNE(stop, builder.getInt8(0)), leave, check_limit);
+        builder.SetInsertPoint(check_limit);
+        auto* last_branch_val = builder.CreateLoad(builder.getIntNTy(cfg.last_branch_size * 8), abs_addr(cfg.last_branch));
+        auto* last_branch = builder.CreateZExt(last_branch_val, builder.getInt64Ty());
+        auto* icount = builder.CreateLoad(builder.getInt64Ty(), abs_addr(cfg.icount));
+        auto* icount_limit = builder.CreateLoad(builder.getInt64Ty(), abs_addr(cfg.icount_limit));
+        auto* cur_tb = builder.CreateLoad(ptr_ty, abs_addr(cfg.cur_tb));
+        auto* dispatch = BasicBlock::Create(ctx, "chain_dispatch", f, get_next);
+        builder.CreateCondBr(builder.CreateICmpULT(icount, icount_limit), dispatch, leave);
+        builder.SetInsertPoint(dispatch);
+        // NO_JUMP and KNOWN_JUMP have a fixed successor, UNKNOWN_JUMP uses the cached targets
+        auto* sw = builder.CreateSwitch(last_branch, leave, 3);
+        sw->addCase(builder.getInt64(0), get_next);
+        sw->addCase(builder.getInt64(1), get_next);
+        sw->addCase(builder.getInt64(2), get_indirect);
+        if(profile)
+            sw->setMetadata(LLVMContext::MD_prof, MDBuilder(ctx).createBranchWeights(
+                                                      {profile->weight(3), profile->weight(0), profile->weight(1), profile->weight(2)}));
+        builder.SetInsertPoint(get_next);
+        auto* cont_offs = builder.CreateAdd(builder.getInt64(cfg.cont_offset), builder.CreateShl(last_branch, builder.getInt64(3)));
+        auto* next_tb = builder.CreateLoad(ptr_ty, builder.CreateGEP(builder.getInt8Ty(), cur_tb, cont_offs));
+        builder.CreateCondBr(builder.CreateIsNull(next_tb), leave, call_next);
+        builder.SetInsertPoint(get_indirect);
+        auto* next_pc = builder.CreateZExt(ret->getReturnValue(), builder.getInt64Ty());
+        auto load_target = [&](Value* tb, unsigned idx) {
+            auto offs = cfg.targets_offset + idx * sizeof(iss::jit::indirect_target);
+            auto* pc = builder.CreateLoad(builder.getInt64Ty(), builder.CreateGEP(builder.getInt8Ty(), tb, builder.getInt64(offs)));
+            auto* target_tb = builder.CreateLoad(
+                ptr_ty, builder.CreateGEP(builder.getInt8Ty(), tb, builder.getInt64(offs + offsetof(iss::jit::indirect_target, tb))));
+            return std::make_pair(pc, target_tb);
+        };
+        Value* indirect_tb = ConstantPointerNull::get(ptr_ty);
+        for(unsigned i = iss::jit::indirect_target_ways; i > 0; --i) {
+            auto target = load_target(cur_tb, i - 1);
+            indirect_tb = builder.CreateSelect(builder.CreateICmpEQ(target.first, next_pc), target.second, indirect_tb);
+        }
+        // a return continues with the block cached by the caller on top of the return stack, architectures without call
+        // marks have no return stack and rely on the indirect targets only
+        BasicBlock* pop_ras = nullptr;
+        Value* return_tb = nullptr;
+        if(!cfg.ras) {
+            builder.CreateCondBr(builder.CreateIsNull(indirect_tb), leave, call_next);
+        } else {
+            auto* check_ras = BasicBlock::Create(ctx, "chain_ras", f, call_next);
+            auto* get_return = BasicBlock::Create(ctx, "chain_return", f, call_next);
+            pop_ras = BasicBlock::Create(ctx, "chain_ras_pop", f, call_next);
+            builder.CreateCondBr(builder.CreateIsNull(indirect_tb), check_ras, call_next);
+            builder.SetInsertPoint(check_ras);
+            auto* ras = abs_addr(cfg.ras);
+            auto* top_ptr = builder.CreateGEP(builder.getInt8Ty(), ras, builder.getInt64(offsetof(iss::jit::return_stack, top)));
+            auto* top = builder.CreateLoad(builder.getInt32Ty(), top_ptr);
+            auto* entry_offs = builder.CreateAdd(builder.getInt64(offsetof(iss::jit::return_stack, entries)),
+                                                 builder.CreateMul(builder.CreateZExt(top, builder.getInt64Ty()),
+                                                                   builder.getInt64(sizeof(iss::jit::return_stack::entry))));
+            auto* entry = builder.CreateGEP(builder.getInt8Ty(), ras, entry_offs);
+            auto load_entry = [&](Type* ty, size_t offs) {
+                return builder.CreateLoad(ty, builder.CreateGEP(builder.getInt8Ty(), entry, builder.getInt64(offs)));
+            };
+            auto* entry_pc = load_entry(builder.getInt64Ty(), offsetof(iss::jit::return_stack::entry, pc));
+            auto* entry_epoch = load_entry(builder.getInt64Ty(), offsetof(iss::jit::return_stack::entry, epoch));
+            auto* caller = load_entry(ptr_ty, offsetof(iss::jit::return_stack::entry, caller));
+            auto* cache_epoch = builder.CreateLoad(builder.getInt64Ty(), abs_addr(cfg.cache_epoch));
+            auto* hit = builder.CreateAnd(builder.CreateICmpEQ(entry_pc, next_pc), builder.CreateICmpEQ(entry_epoch, cache_epoch));
+            builder.CreateCondBr(builder.CreateAnd(hit, builder.CreateIsNotNull(caller)), get_return, leave);
+            builder.SetInsertPoint(get_return);
+            auto return_target = load_target(caller, iss::jit::return_target_idx);
+            return_tb = return_target.second;
+            builder.CreateCondBr(builder.CreateAnd(builder.CreateICmpEQ(return_target.first, next_pc), builder.CreateIsNotNull(return_tb)),
+                                 pop_ras, leave);
+            builder.SetInsertPoint(pop_ras);
+            auto* entry_pc_ptr =
+                builder.CreateGEP(builder.getInt8Ty(), entry, builder.getInt64(offsetof(iss::jit::return_stack::entry, pc)));
+            builder.CreateStore(builder.getInt64(0), entry_pc_ptr);
+            auto* new_top =
+                builder.CreateAnd(builder.CreateSub(top, builder.getInt32(1)), builder.getInt32(iss::jit::return_stack::depth - 1));
+            builder.CreateStore(new_top, top_ptr);
+            builder.CreateBr(call_next);
+        }
+        builder.SetInsertPoint(call_next);
+        auto* target_tb = builder.CreatePHI(ptr_ty, pop_ras ? 3 : 2);
+        target_tb->addIncoming(next_tb, get_next);
+        target_tb->addIncoming(indirect_tb, get_indirect);
+        if(pop_ras)
+            target_tb->addIncoming(return_tb, pop_ras);
+        builder.CreateStore(target_tb, abs_addr(cfg.cur_tb));
+        auto* next_f = builder.CreateLoad(ptr_ty, builder.CreateGEP(builder.getInt8Ty(), target_tb, builder.getInt64(cfg.f_ptr_offset)));
+        auto* call = builder.CreateCall(f->getFunctionType(), next_f, args);
+        call->setCallingConv(f->getCallingConv());
+        call->setTailCallKind(CallInst::TCK_MustTail);
+        builder.CreateRet(call);
+    }
 }
 } // namespace llvm
 } // namespace iss
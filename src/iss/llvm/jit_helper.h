@@ -39,7 +39,10 @@
 #include "llvm/IR/LegacyPassManager.h"
 #include <iostream>
 #include <iss/arch/traits.h>
+#include <iss/jit/chaining.h>
 #include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/ExecutionEngine/Orc/Core.h>
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
 #include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/Module.h>
 #include <llvm/Support/Error.h>
@@ -47,7 +50,10 @@
 
 #include "boost/variant.hpp"
 #include "jit_init.h"
+#include <algorithm>
+#include <limits>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <tuple>
 #include <unordered_map>
@@ -61,31 +67,191 @@ class vm_if;
 namespace llvm {
 
 /**
- * get the LLVM context
- * NOTE: this is a singleton and not threadsave
+ * get the LLVM context blocks are generated in by this thread. While generate_module() runs it is the context of the
+ * vm translating the block, otherwise it is the default context returned by getThreadSafeContext()
+ * NOTE: using the default context requires holding context_mutex()
  * @return the cotext
  */
 ::llvm::LLVMContext& getContext();
+/**
+ * get the default thread safe context, used by code generated outside of a vm
+ * @return the thread safe context
+ */
+::llvm::orc::ThreadSafeContext& getThreadSafeContext();
+/**
+ * get a description of everything on the host side influencing the generated objects: the LLVM version, the target
+ * and the host CPU with its features
+ * @return the description
+ */
+std::string get_host_description();
+/**
+ * get the lock guarding the default LLVM context. Each vm generates its blocks in a context of its own which is guarded
+ * by the lock of its thread safe context, so vms translate and compile in parallel
+ * @return the mutex
+ */
+std::recursive_mutex& context_mutex();
+
+/**
+ * execution profile of the block at an address, updated by the unoptimized code of the block and used as branch
+ * weights when the block gets recompiled with optimizations
+ */
+struct block_profile {
+    uint64_t executions{0};
+    //! number of times the block was left with the respective value of last_branch
+    std::array<uint64_t, 4> outcomes{};
+    /**
+     * get the count of an outcome as branch weight, which needs to be a non-zero 32 bit value
+     *
+     * @param last_branch the outcome
+     * @return the weight
+     */
+    uint32_t weight(unsigned last_branch) const {
+        return static_cast<uint32_t>(std::min<uint64_t>(outcomes[last_branch], std::numeric_limits<uint32_t>::max() - 1) + 1);
+    }
+};
 
 struct alignas(4 * sizeof(void*)) translation_block {
     uintptr_t f_ptr{0};
+    size_t f_size{0};
     std::array<translation_block*, 2> cont;
-    ::llvm::ExecutionEngine* mod_eng{nullptr};
-    explicit translation_block(uintptr_t f_ptr_, std::array<translation_block*, 2> cont_, ::llvm::ExecutionEngine* mod_eng_)
+    iss::jit::indirect_targets targets{};
+    // tracks the code and data of the block in the JIT session
+    ::llvm::orc::ResourceTrackerSP tracker;
+    // the profile the unoptimized code of the block updates, it lives as long as the code or the block recompiled from it
+    std::shared_ptr<block_profile> profile;
+    explicit translation_block(uintptr_t f_ptr_, std::array<translation_block*, 2> cont_, ::llvm::orc::ResourceTrackerSP tracker_,
+                               size_t f_size_ = 0)
     : f_ptr(f_ptr_)
+    , f_size(f_size_)
     , cont(cont_)
-    , mod_eng(mod_eng_){};
+    , tracker(std::move(tracker_)){};
     translation_block() = default;
-    translation_block(translation_block const&) = default;
-    translation_block(translation_block&&) = default;
-    translation_block& operator=(translation_block const& other) = default;
-    translation_block& operator=(translation_block&& other) = default;
-    ~translation_block() = default; // FIXME this possibly leaks the mod_eng, check ownership
+    translation_block(translation_block const&) = delete;
+    translation_block(translation_block&& o)
+    : f_ptr(o.f_ptr)
+    , f_size(o.f_size)
+    , cont(o.cont)
+    , targets(o.targets)
+    , tracker(std::move(o.tracker))
+    , profile(std::move(o.profile)) {}
+    translation_block& operator=(translation_block const& other) = delete;
+    translation_block& operator=(translation_block&& o) {
+        if(this != &o) {
+            release();
+            f_ptr = o.f_ptr;
+            f_size = o.f_size;
+            cont = o.cont;
+            targets = o.targets;
+            tracker = std::move(o.tracker);
+            profile = std::move(o.profile);
+        }
+        return *this;
+    }
+    // removing the tracker frees the code of the block in the JIT session
+    ~translation_block() { release(); }
+    /**
+     * create a block executing the code of another one without owning it, e.g. if the code is shared
+     *
+     * @param owner the block owning the code
+     * @return the block
+     */
+    static translation_block view_of(translation_block const& owner) {
+        return translation_block(owner.f_ptr, {nullptr, nullptr}, nullptr, owner.f_size);
+    }
+
+private:
+    void release() {
+        if(tracker) {
+            if(auto err = tracker->remove())
+                ::llvm::consumeError(std::move(err));
+            tracker = nullptr;
+        }
+        // only after the code is gone
+        profile = nullptr;
+    }
 };
 
 using gen_func = std::function<::llvm::Function*(::llvm::Module*)>;
+/**
+ * deleter of modules not handed to the JIT session, it takes the lock of the context of the module
+ */
+struct module_deleter {
+    //! the context owning the module
+    ::llvm::orc::ThreadSafeContext context;
 
-translation_block getPointerToFunction(unsigned cluster_id, uint64_t phys_addr, gen_func& generator, bool dumpEnabled);
+    void operator()(::llvm::Module* mod) const;
+};
+
+using module_ptr = std::unique_ptr<::llvm::Module, module_deleter>;
+
+/**
+ * compile the function created by the generator
+ *
+ * @param context the context of the vm to generate the block in
+ * @param cluster_id the cluster of the vm
+ * @param phys_addr the physical start address of the block
+ * @param generator the generator creating the block function in the module passed to it
+ * @param dumpEnabled write the IR of the module to a file
+ * @param opt_level 0 compiles as fast as possible, higher levels run the LLVM optimization pipeline of that level
+ * @return the translation block
+ */
+translation_block getPointerToFunction(::llvm::orc::ThreadSafeContext context, unsigned cluster_id, uint64_t phys_addr,
+                                       gen_func& generator, bool dumpEnabled, unsigned opt_level = 0);
+/**
+ * create the module of a block, the first half of getPointerToFunction(). The context is locked and returned by
+ * getContext() while the generator runs
+ *
+ * @param context the context of the vm to generate the block in
+ * @param cluster_id the cluster of the vm
+ * @param phys_addr the physical start address of the block
+ * @param generator the generator creating the block function in the module passed to it
+ * @return the module and the name of the block function
+ */
+std::tuple<module_ptr, std::string> generate_module(::llvm::orc::ThreadSafeContext context, unsigned cluster_id, uint64_t phys_addr,
+                                                    gen_func& generator);
+/**
+ * the relocatable object of a block to be stored in the persistent cache
+ */
+struct persisted_object {
+    //! the symbol the block function gets. If it is in use already the function keeps its name and object stays empty
+    std::string symbol;
+    std::string object;
+};
+/**
+ * compile the module of a block, the second half of getPointerToFunction(). It does not use the vm and can be called
+ * from any thread. The context of the module is only locked while the module is moved into a context of its own, it
+ * gets optimized and linked there so the vm generates further blocks in the meantime
+ *
+ * @param mod the module
+ * @param fname the name of the block function
+ * @param dumpEnabled write the IR of the module to a file
+ * @param opt_level 0 compiles as fast as possible, higher levels run the LLVM optimization pipeline of that level
+ * @param persist if not null the block function is named after persist->symbol and the object is captured in it
+ * @return the translation block
+ */
+translation_block compile_module(module_ptr mod, std::string const& fname, bool dumpEnabled, unsigned opt_level = 0,
+                                 persisted_object* persist = nullptr);
+/**
+ * load a block from an object stored in the persistent cache. Throws std::runtime_error if the object cannot be
+ * loaded, e.g. because the block is loaded already
+ *
+ * @param path the file holding the object
+ * @param offset the offset of the object in the file
+ * @param size the size of the object
+ * @param symbol the symbol of the block function
+ * @param opt_level the optimization level the object got compiled with
+ * @return the translation block
+ */
+translation_block load_object(std::string const& path, size_t offset, size_t size, std::string const& symbol, unsigned opt_level);
+/**
+ * let the returns of a block function continue with the chained successor block via a tail call, the function only
+ * returns if the successor is not linked or chaining needs to stop
+ *
+ * @param f the block function
+ * @param cfg the chaining state of the vm
+ * @param profile the observed outcomes of the block to weight the dispatch on last_branch, may be nullptr
+ */
+void add_native_chaining(::llvm::Function* f, iss::jit::chain_config const& cfg, block_profile const* profile = nullptr);
 } // namespace llvm
 } // namespace iss
 #endif // _ISS_LLVM__JIT_HELPER_H
@@ -75,6 +75,17 @@ void add_functions_2_module(Module* mod) {
     FDECL(write_mem, INT_TYPE(8), THIS_PTR_TYPE, INT_TYPE(32), INT_TYPE(32), INT_TYPE(64), INT_TYPE(32), INT_TYPE(8)->getPointerTo());
     FDECL(read_mem_dbg, INT_TYPE(8), THIS_PTR_TYPE, INT_TYPE(32), INT_TYPE(32), INT_TYPE(64), INT_TYPE(32), INT_TYPE(8)->getPointerTo());
     FDECL(write_mem_dbg, INT_TYPE(8), THIS_PTR_TYPE, INT_TYPE(32), INT_TYPE(32), INT_TYPE(64), INT_TYPE(32), INT_TYPE(8)->getPointerTo());
+    FDECL(load_reserved4, INT_TYPE(32), THIS_PTR_TYPE, INT_TYPE(32), INT_TYPE(32), INT_TYPE(64), INT_TYPE(32)->getPointerTo());
+    FDECL(load_reserved8, INT_TYPE(32), THIS_PTR_TYPE, INT_TYPE(32), INT_TYPE(32), INT_TYPE(64), INT_TYPE(64)->getPointerTo());
+    FDECL(store_conditional4, INT_TYPE(32), THIS_PTR_TYPE, INT_TYPE(32), INT_TYPE(32), INT_TYPE(64), INT_TYPE(32),
+          INT_TYPE(32)->getPointerTo());
+    FDECL(store_conditional8, INT_TYPE(32), THIS_PTR_TYPE, INT_TYPE(32), INT_TYPE(32), INT_TYPE(64), INT_TYPE(64),
+          INT_TYPE(32)->getPointerTo());
+    FDECL(atomic_rmw4, INT_TYPE(32), THIS_PTR_TYPE, INT_TYPE(32), INT_TYPE(32), INT_TYPE(64), INT_TYPE(32), INT_TYPE(32),
+          INT_TYPE(32)->getPointerTo());
+    FDECL(atomic_rmw8, INT_TYPE(32), THIS_PTR_TYPE, INT_TYPE(32), INT_TYPE(32), INT_TYPE(64), INT_TYPE(32), INT_TYPE(64),
+          INT_TYPE(64)->getPointerTo());
+    FDECL(mem_fence, VOID_TYPE, THIS_PTR_TYPE, INT_TYPE(32));
     FDECL(enter_trap, INT_TYPE(64), THIS_PTR_TYPE, INT_TYPE(64), INT_TYPE(64), INT_TYPE(64));
     FDECL(leave_trap, INT_TYPE(64), THIS_PTR_TYPE, INT_TYPE(64));
     FDECL(wait, VOID_TYPE, THIS_PTR_TYPE, INT_TYPE(64));
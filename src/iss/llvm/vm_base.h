@@ -39,8 +39,14 @@
 #include <absl/container/flat_hash_map.h>
 #include <iss/arch/traits.h>
 #include <iss/arch_if.h>
+#include <iss/core_context.h>
 #include <iss/debugger/target_adapter_base.h>
 #include <iss/debugger_if.h>
+#include <iss/jit/async_compiler.h>
+#include <iss/jit/code_sharing.h>
+#include <iss/jit/persistent_cache.h>
+#include <iss/jit/pretranslation.h>
+#include <iss/jit/translation_cache.h>
 #include <iss/vm_if.h>
 #include <iss/vm_plugin.h>
 #include <util/ities.h>
@@ -55,9 +61,11 @@
 #include <array>
 #include <chrono>
 #include <iostream>
+#include <limits>
 #include <map>
 #include <sstream>
 #include <stack>
+#include <typeinfo>
 #include <utility>
 #include <vector>
 
@@ -114,77 +122,557 @@ public:
 
     int start(uint64_t icount_limit = std::numeric_limits<uint64_t>::max(), bool dump = false,
               finish_cond_e cond = finish_cond_e::ICOUNT_LIMIT | finish_cond_e::JUMP_TO_SELF) override {
-        int error = 0;
-        uint32_t was_illegal = 0;
+        auto start = std::chrono::high_resolution_clock::now();
+        CPPLOG(INFO) << "Start at 0x" << std::hex << get_reg<typename arch::traits<ARCH>::addr_t>(arch::traits<ARCH>::PC) << std::dec;
+        slice_e result;
+        auto error = execute(icount_limit, dump, cond, result, true);
+        auto end = std::chrono::high_resolution_clock::now(); // end measurement
+        // here
+        auto elapsed = end - start;
+        auto millis = std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count();
+        uint64_t& cur_icount = get_reg<uint64_t>(reg_e::ICOUNT);
+        CPPLOG(INFO) << "Executed " << cur_icount << " instructions in " << func_map.size() << " code blocks during " << millis
+                     << "ms resulting in " << (cur_icount * 0.001 / millis) << "MIPS";
+        auto& cache_stats = func_map.get_stats();
+        CPPLOG(DEBUG) << "Translation cache holds " << cache_stats.footprint() << " bytes, " << cache_stats.insertions
+                      << " blocks translated, " << cache_stats.evictions << " evicted, hit rate " << cache_stats.hit_rate() << " ("
+                      << cache_stats.jump_cache_hits << " from the jump cache)";
+        return error;
+    }
+
+    int run_slice(uint64_t icount_limit, finish_cond_e cond, slice_e& result) override {
+        return execute(icount_limit, false, cond, result, false);
+    }
+
+    void reset() override { core.reset(); }
+
+    void reset(uint64_t address) override { core.reset(address); }
+
+    iss::jit::translation_cache_if* get_translation_cache() override { return &func_map; }
+
+    void set_compile_threads(unsigned threads) override {
+        compiler = threads ? std::make_unique<iss::jit::async_compiler<translation_block>>(threads) : nullptr;
+    }
+
+    void set_opt_level(unsigned level) override { opt_level = level; }
+
+    size_t pretranslate(std::vector<uint64_t> const& entries, size_t max_blocks) override {
+        setup_translation();
+        virt_addr_t pc(iss::access_type::DEBUG_FETCH, 0, 0);
+        continuation_e cont = CONT;
+        generator_state param{this, pc, cont, std::numeric_limits<uint64_t>::max()};
+        gen_func generator = make_generator(param);
+        iss::jit::pretranslation walk(entries, max_blocks);
+        // translating does not change the state of the core
+        spec_regs.assign(regs_base_ptr, regs_base_ptr + iss::jit::register_file_size<ARCH>());
+        uint64_t block_pc;
+        while(walk.next(block_pc)) {
+            if(func_map.peek(block_pc) || !func_map.admit(block_pc))
+                continue;
+            try {
+                pc.val = block_pc;
+                translate_block(block_pc, generator, cont, false, false, true);
+                if((cont == CONT || cont == BRANCH) && successors.from == block_pc)
+                    walk.translated(successors);
+            } catch(trap_access&) {
+            } catch(decoding_error&) {
+            }
+        }
+        if(compiler)
+            compiler->wait_all();
+        install_compiled();
+        walk.link(func_map);
+        std::copy(spec_regs.begin(), spec_regs.end(), regs_base_ptr);
+        return walk.size();
+    }
+
+    void pre_instr_sync() override {
+        uint64_t pc = get_reg<typename arch::traits<ARCH>::addr_t>(arch::traits<ARCH>::PC);
+        tgt_adapter->check_continue(pc);
+    }
+
+protected:
+    /**
+     * translate the block at pc. With background compilation the block is submitted to the compiler and available once
+     * it got installed. A block published by another vm of the cluster or stored in the persistent cache is taken from
+     * there if the guest code is unchanged
+     *
+     * @param pc the physical address of the block
+     * @param generator the generator of the block code
+     * @param cont the continuation the generator sets, set from the cache for loaded blocks
+     * @param dump write the generated code to a file
+     * @param wait wait for the background compilation of the block
+     * @param speculative the block is not executed right after translating it (translated ahead of its first execution
+     * or recompiled), it is dropped if the dispatcher would need to handle its continuation
+     * @return the block or nullptr if it is being compiled and the caller does not wait
+     */
+    translation_block* translate_block(uint64_t pc, gen_func& generator, continuation_e& cont, bool dump, bool wait,
+                                       bool speculative = false) {
+        if(!compiler || !compiler->pending(pc)) {
+            if(auto* tb = shareable() ? sharing.adopt(func_map, pc, cont, successors, speculative) : nullptr)
+                return tb;
+            if(auto* tb = load_persisted(pc, cont, speculative))
+                return tb;
+            // writes to the guest code from the start of reading it on invalidate the block
+            auto res = generate_tracked(pc, generator);
+            // the dispatcher handles all continuations but CONT and BRANCH right after translating the block
+            auto regular = cont == CONT || cont == BRANCH;
+            if(speculative && !regular) {
+                func_map.untrack(pc);
+                pending_profiles.erase(pc);
+                return nullptr;
+            }
+            if(regular && shareable())
+                sharing.prepare(pc, cont, successors);
+            else
+                sharing.withdraw(pc);
+            auto persist = regular ? persisted_block(pc) : nullptr;
+            if(!compiler || !regular)
+                return compile_block(pc, std::move(res), cont, dump, speculative, persist.get());
+            compiler->submit(pc, func_map.install_generation(),
+                             [this, res = std::move(res), dump, opt = opt_level, persist = std::move(persist), cont]() mutable {
+                                 auto tb = compile_module(std::move(std::get<0>(res)), std::get<1>(res), dump, opt, persist.get());
+                                 store_persisted(persist.get(), cont);
+                                 return tb;
+                             });
+        } else {
+            // the block was generated before, only blocks whose continuation the dispatcher does not handle are compiled
+            // in the background
+            cont = CONT;
+        }
+        if(!wait)
+            return nullptr;
+        compiler->wait(pc);
+        install_compiled();
+        if(auto* tb = func_map.find(pc))
+            return tb;
+        // the cache got flushed meanwhile
+        auto res = generate_tracked(pc, generator);
+        sharing.withdraw(pc);
+        return compile_block(pc, std::move(res), cont, dump);
+    }
+    /**
+     * insert a compiled block into the cache, it is published to the vms of the cluster if it got prepared for sharing
+     * (see iss::jit::code_sharing::prepare()). The block takes the profile it got generated with
+     *
+     * @param pc the physical address of the block
+     * @param tb the compiled block
+     * @param speculative the block is not executed right after inserting it
+     * @return the block as stored in the cache
+     */
+    translation_block* insert_block(uint64_t pc, translation_block&& tb, bool speculative = false) {
+        auto pit = pending_profiles.find(pc);
+        if(pit != pending_profiles.end()) {
+            tb.profile = std::move(pit->second);
+            pending_profiles.erase(pit);
+        }
+        return sharing.insert(func_map, pc, std::move(tb), speculative);
+    }
+    /**
+     * a block to be stored in the persistent cache, together with the guest bytes it got translated from
+     */
+    struct persisted : persisted_object {
+        uint64_t pc;
+        std::vector<uint8_t> guest;
+    };
+    /**
+     * check if the blocks translated now only depend on the guest code and the settings of the vm. Blocks embedding
+     * addresses of this vm (plugins, profiling counters) or depending on the execution profile do not
+     *
+     * @return true if the blocks can be used by other vms and runs
+     */
+    bool vm_independent() const { return plugins.empty() && !recompiled_profile && !func_map.get_config().recompile_threshold; }
+    /**
+     * check if the blocks translated now can be stored in or loaded from the persistent cache
+     *
+     * @return true if the persistent cache can be used
+     */
+    bool persistable() const { return persistent && vm_independent(); }
+    /**
+     * check if the blocks translated now can be shared with the vms of the cluster
+     *
+     * @return true if the blocks can be shared
+     */
+    bool shareable() const { return sharing.attached() && vm_independent(); }
+    /**
+     * load the block at pc from the persistent cache
+     *
+     * @param pc the physical address of the block
+     * @param cont set to the continuation of the block
+     * @param speculative the block is not executed right after loading it
+     * @return the block or nullptr if it is not in the cache or could not be loaded
+     */
+    translation_block* load_persisted(uint64_t pc, continuation_e& cont, bool speculative) {
+        iss::jit::persistent_cache::entry entry;
+        auto fetch = [this](uint64_t addr, size_t size, uint8_t* data) { return iss::jit::fetch_guest(core, addr, size, data); };
+        if(!persistable() || !persistent->find(pc, fetch, entry))
+            return nullptr;
+        // compare the guest code again while its pages are tracked, so writes racing with the comparison are noticed
+        auto found = func_map.translate_tracked(pc, [this, pc, &fetch, &entry](uint64_t& end) {
+            auto res = persistent->find(pc, fetch, entry);
+            end = res ? pc + entry.guest_size : pc + 1;
+            return res;
+        });
+        if(!found) {
+            func_map.untrack(pc);
+            return nullptr;
+        }
+        try {
+            auto tb = load_object(entry.path, entry.object_offset, entry.object_size, entry.symbol, opt_level);
+            cont = static_cast<continuation_e>(entry.cont);
+            // the successors of a loaded block are not known
+            successors.clear(pc);
+            successors.end = pc + entry.guest_size;
+            return func_map.insert(pc, std::move(tb), speculative);
+        } catch(std::runtime_error& e) {
+            func_map.untrack(pc);
+            CPPLOG(DEBUG) << "could not load block 0x" << std::hex << pc << std::dec << " from the persistent cache: " << e.what();
+            return nullptr;
+        }
+    }
+    /**
+     * prepare storing the block just generated at pc in the persistent cache
+     *
+     * @param pc the physical address of the block
+     * @return the block to be filled by compile_module() or nullptr if it is not to be stored
+     */
+    std::unique_ptr<persisted> persisted_block(uint64_t pc) {
+        // the generator ends the block at the fall through successor
+        if(!persistable() || successors.from != pc || successors.pc[0] <= pc)
+            return nullptr;
+        auto block = std::make_unique<persisted>();
+        block->pc = pc;
+        block->guest.resize(successors.pc[0] - pc);
+        if(!iss::jit::fetch_guest(core, pc, block->guest.size(), block->guest.data()))
+            return nullptr;
+        block->symbol = persistent->symbol_name(pc, block->guest);
+        return block;
+    }
+    /**
+     * store a compiled block in the persistent cache, can be called from any thread
+     */
+    void store_persisted(persisted const* block, continuation_e cont) {
+        if(block && !block->object.empty())
+            persistent->store(block->pc, block->guest, cont, block->symbol, block->object);
+    }
+    /**
+     * generate the module of the block at pc with the pages of its guest code tracked, see
+     * translation_cache::translate_tracked()
+     *
+     * @param pc the physical address of the block
+     * @param generator the generator of the block code
+     * @return the module and the name of the block function
+     */
+    std::tuple<module_ptr, std::string> generate_tracked(uint64_t pc, gen_func& generator) {
+        return func_map.translate_tracked(pc, [this, pc, &generator](uint64_t& end) {
+            auto res = generate_module(context, cluster_id, pc, generator);
+            end = successors.from == pc ? successors.end : pc + 1;
+            return res;
+        });
+    }
+    /**
+     * compile the module generated and tracked for the block at pc and insert the block into the cache
+     *
+     * @param pc the physical address of the block
+     * @param res the module and the name of the block function
+     * @param cont the continuation of the block
+     * @param dump write the generated code to a file
+     * @param speculative the block is not executed right after inserting it
+     * @param persist the block to store in the persistent cache or nullptr
+     * @return the block as stored in the cache
+     */
+    translation_block* compile_block(uint64_t pc, std::tuple<module_ptr, std::string>&& res, continuation_e cont, bool dump,
+                                     bool speculative = false, persisted* persist = nullptr) {
+        try {
+            auto tb = compile_module(std::move(std::get<0>(res)), std::get<1>(res), dump, opt_level, persist);
+            store_persisted(persist, cont);
+            auto* res_tb = insert_block(pc, std::move(tb), speculative);
+            // blocks synchronizing the instruction stream return to the dispatcher each time they are executed
+            if(cont == FLUSH)
+                func_map.mark_code_sync(res_tb);
+            return res_tb;
+        } catch(...) {
+            // the pages of a block not making it into the cache must not stay marked
+            func_map.untrack(pc);
+            sharing.withdraw(pc);
+            pending_profiles.erase(pc);
+            throw;
+        }
+    }
+    /**
+     * open the persistent cache if one is configured. The domain covers everything besides the guest code the
+     * generated code depends on
+     */
+    void open_persistent_cache() {
+        auto const& dir = func_map.get_config().persistent_dir;
+        if(persistent || dir.empty())
+            return;
+        std::ostringstream domain;
+        domain << "arch " << typeid(ARCH).name() << "\nbackend llvm " << persistent_format << "\nhost " << get_host_description()
+               << "\nopt_level " << opt_level << "\nsync " << static_cast<unsigned>(sync_exec) << "\ndebugging "
+               << this->debugging_enabled() << "\nblk_size " << blk_size << "\n";
+        persistent = std::make_unique<iss::jit::persistent_cache>(dir, domain.str());
+    }
+    /**
+     * attach to the blocks shared within the cluster if configured. The domain covers the cluster and everything
+     * besides the guest code the generated code depends on
+     */
+    void open_shared_code() {
+        if(!func_map.get_config().share_cluster) {
+            sharing.detach();
+            return;
+        }
+        if(sharing.attached())
+            return;
+        std::ostringstream domain;
+        domain << "cluster " << cluster_id << "\narch " << typeid(ARCH).name() << "\nbackend llvm\nsync "
+               << static_cast<unsigned>(sync_exec) << "\ndebugging " << this->debugging_enabled() << "\nblk_size " << blk_size << "\n";
+        sharing.attach(domain.str());
+    }
+
+    /**
+     * translate the successors of a block which are known at translation time and chain them to the block so that
+     * the first execution of a successor does not return to the dispatcher. Translating does not change the state of
+     * the core, successors outside the page of the block or failing to translate are skipped
+     *
+     * @param succ the successors of the block
+     * @param generator the generator of the block code
+     * @param pc the pc the generator translates from
+     * @param cont the continuation the generator sets
+     * @param dump write the generated code to a file
+     */
+    void speculate(iss::jit::block_successors const& succ, gen_func& generator, virt_addr_t& pc, continuation_e& cont, bool dump) {
+        auto saved_pc = pc;
+        auto saved_cont = cont;
+        spec_regs.assign(regs_base_ptr, regs_base_ptr + iss::jit::register_file_size<ARCH>());
+        for(unsigned idx = 0; idx < succ.pc.size(); ++idx) {
+            if(!succ.in_page(idx) || func_map.peek(succ.pc[idx]) || !func_map.admit(succ.pc[idx]))
+                continue;
+            translation_block* tb = nullptr;
+            try {
+                pc.val = succ.pc[idx];
+                tb = translate_block(succ.pc[idx], generator, cont, dump, false, true);
+            } catch(trap_access&) {
+            } catch(decoding_error&) {
+            }
+            auto* from = func_map.peek(succ.from);
+            if(tb && from && from->cont[idx] == nullptr)
+                func_map.link(from, idx, tb);
+        }
+        std::copy(spec_regs.begin(), spec_regs.end(), regs_base_ptr);
+        pc = saved_pc;
+        cont = saved_cont;
+    }
+    /**
+     * translate a block which got hot again with optimizations and the branch weights observed so far, possibly as a
+     * region of several blocks. The new block replaces the unoptimized one in the cache once it is compiled
+     *
+     * @param block_pc the physical address of the block
+     * @param generator the generator of the block code
+     * @param pc the pc the generator translates from
+     * @param cont the continuation the generator sets
+     * @param dump write the generated code to a file
+     */
+    void recompile(uint64_t block_pc, gen_func& generator, virt_addr_t& pc, continuation_e& cont, bool dump) {
+        auto profile = profile_of(block_pc);
+        if(!profile || (compiler && compiler->pending(block_pc)))
+            return;
+        auto saved_pc = pc;
+        auto saved_cont = cont;
+        auto saved_opt_level = opt_level;
+        spec_regs.assign(regs_base_ptr, regs_base_ptr + iss::jit::register_file_size<ARCH>());
+        recompiled_profile = profile.get();
+        opt_level = std::max(opt_level, 2U);
+        // the recompiled block keeps the profile so regions formed later still know the block got executed
+        pending_profiles[block_pc] = profile;
+        try {
+            pc.val = block_pc;
+            translate_block(block_pc, generator, cont, dump, false, true);
+        } catch(trap_access&) {
+            pending_profiles.erase(block_pc);
+        } catch(decoding_error&) {
+            pending_profiles.erase(block_pc);
+        }
+        recompiled_profile = nullptr;
+        opt_level = saved_opt_level;
+        std::copy(spec_regs.begin(), spec_regs.end(), regs_base_ptr);
+        pc = saved_pc;
+        cont = saved_cont;
+    }
+
+    /**
+     * get the profile of the block at an address in the cache
+     *
+     * @param pc the physical address of the block
+     * @return the profile or nullptr if the block is not in the cache or got no profile
+     */
+    std::shared_ptr<block_profile> profile_of(uint64_t pc) const {
+        auto* tb = func_map.peek(pc);
+        return tb ? tb->profile : nullptr;
+    }
+
+    void install_compiled() {
+        if(!compiler)
+            return;
+        auto install = [this](uint64_t pc, translation_block&& tb) { insert_block(pc, std::move(tb)); };
+        // blocks dropped as their guest code changed meanwhile or failing to compile give their pages up
+        auto drop = [this](uint64_t pc) {
+            func_map.untrack(pc);
+            sharing.withdraw(pc);
+            pending_profiles.erase(pc);
+        };
+        compiler->install(func_map.install_generation(), install, drop);
+    }
+
+    /**
+     * the state the block generator works on, kept outside of its closure to minimize the closure size to allow SSO
+     */
+    struct generator_state {
+        vm_base* vm;
+        virt_addr_t& pc;
+        continuation_e& cont;
+        uint64_t icount_limit;
+    };
+    /**
+     * create the generator translating the block at state.pc
+     *
+     * @param state the state of the generator, needs to outlive it
+     * @return the generator
+     */
+    static gen_func make_generator(generator_state& state) {
+        return gen_func{[&state](Module* m) -> Function* {
+            Function* func;
+            state.vm->mod = m;
+            state.vm->setup_module(m);
+            std::tie(state.cont, func) = state.vm->translate(state.pc, state.icount_limit);
+            if(state.vm->native_chaining)
+                add_native_chaining(func, state.vm->chain_cfg, state.vm->recompiled_profile);
+            state.vm->mod = nullptr;
+            state.vm->func = nullptr;
+            return func;
+        }};
+    }
+    /**
+     * set up the vm state the generated code depends on before translating blocks
+     */
+    void setup_translation() {
         if(this->debugging_enabled())
             sync_exec |= PRE_SYNC;
-        auto start = std::chrono::high_resolution_clock::now();
+        // if the core provides a stop flag the blocks call their chained successors directly. Chained blocks embed
+        // addresses of this vm, they cannot be reused by other runs or vms
+        auto const& cfg = func_map.get_config();
+        native_chaining = core.get_stop_flag_ptr() != nullptr && cfg.persistent_dir.empty() && !cfg.share_cluster;
+        chain_cfg = get_chain_config();
+        open_persistent_cache();
+        open_shared_code();
+    }
+
+    /**
+     * the dispatch loop
+     *
+     * @param icount_limit the instruction count to run up to
+     * @param dump write the generated code to files
+     * @param cond conditions to stop execution
+     * @param result the reason for returning
+     * @param wait wait for blocks compiled in the background instead of returning
+     * @return 0 on success, the error code of the simulation otherwise
+     */
+    int execute(uint64_t icount_limit, bool dump, finish_cond_e cond, slice_e& result, bool wait) {
+        int error = 0;
+        uint32_t was_illegal = 0;
+        setup_translation();
         virt_addr_t pc(iss::access_type::DEBUG_FETCH, 0, get_reg<typename arch::traits<ARCH>::addr_t>(arch::traits<ARCH>::PC));
-        CPPLOG(INFO) << "Start at 0x" << std::hex << pc.val << std::dec;
+        result = slice_e::LIMIT;
         try {
             continuation_e cont = CONT;
-            // struct to minimize the type size of the closure below to allow SSO
-            struct {
-                vm_base* vm;
-                virt_addr_t& pc;
-                continuation_e& cont;
-            } param = {this, pc, cont};
-            std::function<Function*(Module*)> generator{[&param, icount_limit](Module* m) -> Function* {
-                Function* func;
-                param.vm->mod = m;
-                param.vm->setup_module(m);
-                std::tie(param.cont, func) = param.vm->translate(param.pc, icount_limit);
-                param.vm->mod = nullptr;
-                param.vm->func = nullptr;
-                return func;
-            }};
+            generator_state param{this, pc, cont, icount_limit};
+            gen_func generator = make_generator(param);
             // explicit std::function to allow use as reference in call below
             // std::function<Function*(Module*)> gen_ref(std::ref(generator));
             translation_block *last_tb = nullptr, *cur_tb = nullptr;
+            uint64_t last_epoch = func_map.epoch();
+            // blocks removed from the cache are freed only after this loop passed a quiescent point
+            iss::jit::translation_cache<translation_block>::dispatcher tb_dispatcher(func_map);
+            chain_icount_limit = icount_limit;
             auto& last_branch = get_reg(reg_e::LAST_BRANCH);
             uint64_t& cur_icount = get_reg<uint64_t>(reg_e::ICOUNT);
             arch_if* const arch_if_ptr = static_cast<arch_if*>(&core);
             vm_if* const vm_if_ptr = static_cast<vm_if*>(this);
+            // the successors of the block translated in this iteration, translated after it got executed
+            iss::jit::block_successors spec;
             while(!core.should_stop() && cur_icount < icount_limit) {
+                spec.clear(0);
                 try {
                     // translate into physical address
                     phys_addr_t pc_p(pc.access, pc.space, pc.val);
+                    // remove the blocks whose guest code got written by the blocks executed so far
+                    if(func_map.has_written())
+                        func_map.invalidate_written();
+                    // make the blocks compiled in the background available
+                    install_compiled();
+                    // a block crossed the recompilation threshold and stopped chaining
+                    if(hot_block != no_hot_block) {
+                        recompile(hot_block, generator, pc, cont, dump);
+                        hot_block = no_hot_block;
+                        chain_icount_limit = icount_limit;
+                    }
                     // check if we have the block already compiled
-                    auto it = this->func_map.find(pc_p.val);
-                    if(it == this->func_map.end()) { // if not generate and compile it
-                        auto res = func_map.insert(
-                            std::make_pair(pc_p.val, iss::llvm::getPointerToFunction(cluster_id, pc_p.val, generator, dump)));
-                        it = res.first;
+                    cur_tb = func_map.find(pc_p.val);
+                    if(cur_tb == nullptr) { // if not generate and compile it unless the block is left to another engine
+                        if(!func_map.admit(pc_p.val) || !(cur_tb = translate_block(pc_p.val, generator, cont, dump, wait))) {
+                            result = slice_e::DECLINED;
+                            break;
+                        }
+                        if(func_map.get_config().speculate && successors.from == pc_p.val)
+                            spec = successors;
+                    }
+                    // inserting may have evicted blocks, last_tb is one of them if the epoch changed
+                    if(last_epoch != func_map.epoch()) {
+                        last_tb = nullptr;
+                        last_epoch = func_map.epoch();
                     }
-                    cur_tb = &(it->second);
+                    tb_dispatcher.quiescent();
+                    // stores must not bypass the write path to pages holding code since translating the block
+                    core_ctx->sync_tlb();
                     if(cont == JUMP_TO_SELF) {
                         // Execute the block we just compiled, but we know it will be the last one
+                        chain_tb = cur_tb;
                         reinterpret_cast<func_ptr>(cur_tb->f_ptr)(regs_base_ptr, arch_if_ptr, vm_if_ptr);
                         throw simulation_stopped(0);
                     }
                     // if we have a previous block link the just compiled one as successor of the last tb
                     if(last_tb && last_branch < 2 && last_tb->cont[last_branch] == nullptr)
-                        last_tb->cont[last_branch] = cur_tb;
+                        func_map.link(last_tb, last_branch, cur_tb);
+                    else if(last_tb && last_branch == UNKNOWN_JUMP && native_chaining)
+                        link_indirect(last_tb, pc_p.val, cur_tb);
                     do {
-                        // execute the compiled function
+                        // execute the compiled function and the blocks chained to it, chain_tb tells which block returned
+                        chain_tb = cur_tb;
                         pc.val = reinterpret_cast<func_ptr>(cur_tb->f_ptr)(regs_base_ptr, arch_if_ptr, vm_if_ptr);
+                        if(chain_tb != cur_tb) {
+                            cur_tb = static_cast<translation_block*>(chain_tb);
+                            cont = CONT;
+                        }
                         if(core.should_stop() || last_branch == BRANCH_TO_SELF)
                             throw simulation_stopped(0);
                         // update last state
                         last_tb = cur_tb;
-                        // if the current tb has a successor assign to current tb
-                        if(last_branch < 2 && cur_tb->cont[last_branch] != nullptr && cur_icount < icount_limit) {
+                        // if the current tb has a successor assign to current tb, a hot block lowers the chaining limit
+                        if(last_branch < 2 && cur_tb->cont[last_branch] != nullptr && cur_icount < chain_icount_limit) {
                             cur_tb = cur_tb->cont[last_branch];
                             // update cont, as it only gets set when a new fptr gets created
                             cont = static_cast<continuation_e>(last_branch);
                         } else // if not we need to compile one
                             cur_tb = nullptr;
                     } while(cur_tb != nullptr);
-                    if(cont == FLUSH)
-                        func_map.clear();
+                    if(last_tb && func_map.is_code_sync(last_tb))
+                        func_map.sync_code();
+                    else if(!spec.empty())
+                        speculate(spec, generator, pc, cont, dump);
                     if(cont == ILLEGAL_INSTR) {
                         if(was_illegal > 2) {
                             CPPLOG(ERR) << "ISS execution aborted after trying to execute illegal instructions 3 times in a row";
+                            result = slice_e::STOPPED;
                             error = -1;
                             break;
                         }
@@ -201,34 +689,18 @@ public:
             }
         } catch(simulation_stopped& e) {
             CPPLOG(INFO) << "ISS execution stopped with status 0x" << std::hex << e.state << std::dec;
+            result = slice_e::STOPPED;
             if(e.state != 1)
                 error = e.state;
         } catch(decoding_error& e) {
             CPPLOG(ERR) << "ISS execution aborted at address 0x" << std::hex << e.addr << std::dec;
+            result = slice_e::STOPPED;
             error = -1;
         }
-        auto end = std::chrono::high_resolution_clock::now(); // end measurement
-        // here
-        auto elapsed = end - start;
-        auto millis = std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count();
-        uint64_t& cur_icount = get_reg<uint64_t>(reg_e::ICOUNT);
-        CPPLOG(INFO) << "Executed " << cur_icount << " instructions in " << func_map.size() << " code blocks during " << millis
-                     << "ms resulting in " << (cur_icount * 0.001 / millis) << "MIPS";
         return error;
     }
 
-    void reset() override { core.reset(); }
-
-    void reset(uint64_t address) override { core.reset(address); }
-
-    void pre_instr_sync() override {
-        uint64_t pc = get_reg<typename arch::traits<ARCH>::addr_t>(arch::traits<ARCH>::PC);
-        tgt_adapter->check_continue(pc);
-    }
-
-protected:
     std::tuple<continuation_e, Function*> translate(virt_addr_t pc, uint64_t icount_limit) {
-        unsigned cur_blk_size = 0;
         // loaded_regs.clear();
         func = this->open_block_func(pc);
         leave_blk = BasicBlock::Create(mod->getContext(), "leave", func);
@@ -240,21 +712,108 @@ protected:
                                         llvm::ConstantInt::get(llvm::Type::getInt64Ty(mod->getContext()), 0), "tval");
         trap_blk = BasicBlock::Create(mod->getContext(), "trap", func);
         gen_trap_behavior(trap_blk);
-        continuation_e cont = CONT;
-        while(cont == CONT && cur_blk_size < blk_size && cur_blk_size < icount_limit) {
+        if(func_map.get_config().recompile_threshold && !recompiled_profile && opt_level < 2)
+            bb = gen_block_profiling(bb, pc.val);
+        // a recompiled block merges the blocks executed along its known successors into a region, the blocks leave
+        // through a dispatch continuing with the next block of the region
+        auto region_size = recompiled_profile && native_chaining ? func_map.get_config().region_blocks : 1U;
+        auto* exit_blk = leave_blk;
+        if(region_size > 1) {
+            // the dispatch may branch back to the first block of the region, which must not be the entry block
+            auto* head_blk = BasicBlock::Create(mod->getContext(), "region_head", func, leave_blk);
+            // gen_trap_behavior() moved the builder to the trap block
             builder.SetInsertPoint(bb);
-            std::tie(cont, bb) = gen_single_inst_behavior(pc, bb);
-            cur_blk_size++;
+            builder.CreateBr(head_blk);
+            bb = head_blk;
+            leave_blk = BasicBlock::Create(mod->getContext(), "region_dispatch", func, exit_blk);
         }
-        if(bb != nullptr) {
-            builder.SetInsertPoint(bb);
-            builder.CreateBr(leave_blk);
+        std::vector<std::pair<uint64_t, BasicBlock*>> region{{pc.val, bb}};
+        continuation_e cont = CONT;
+        successors.end = 0;
+        for(size_t i = 0; i < region.size(); ++i) {
+            pc.val = region[i].first;
+            if(!region[i].second)
+                region[i].second = BasicBlock::Create(mod->getContext(), "region_blk", func, leave_blk);
+            bb = region[i].second;
+            unsigned cur_blk_size = 0;
+            cont = CONT;
+            successors.clear(pc.val);
+            while(cont == CONT && cur_blk_size < blk_size && cur_blk_size < icount_limit) {
+                builder.SetInsertPoint(bb);
+                std::tie(cont, bb) = gen_single_inst_behavior(pc, bb);
+                cur_blk_size++;
+            }
+            if(cont == CONT)
+                successors.known[0] = true;
+            successors.pc[0] = pc.val;
+            successors.end = std::max(successors.end, pc.val);
+            if(bb != nullptr) {
+                builder.SetInsertPoint(bb);
+                builder.CreateBr(leave_blk);
+            }
+            if(cont == ILLEGAL_FETCH && cur_blk_size == 1) {
+                throw trap_access(0, pc.val);
+            }
+            // the dispatcher needs to handle the continuation after the block, the region gets dropped
+            if(cont != CONT && cont != BRANCH) {
+                if(region_size > 1) {
+                    builder.SetInsertPoint(leave_blk);
+                    builder.CreateBr(exit_blk);
+                    leave_blk = exit_blk;
+                }
+                return std::make_tuple(cont, func);
+            }
+            for(unsigned idx = 0; idx < successors.pc.size(); ++idx) {
+                auto next = successors.pc[idx];
+                auto in_region = [next](std::pair<uint64_t, BasicBlock*> const& e) { return e.first == next; };
+                if(region.size() < region_size && successors.in_page(idx) && profile_of(next) &&
+                   std::none_of(region.begin(), region.end(), in_region))
+                    region.emplace_back(next, nullptr);
+            }
         }
-        if(cont == ILLEGAL_FETCH && cur_blk_size == 1) {
-            throw trap_access(0, pc.val);
+        if(region_size > 1) {
+            gen_region_dispatch(region, exit_blk);
+            leave_blk = exit_blk;
+            successors.clear(region[0].first);
         }
         return std::make_tuple(cont, func);
     }
+    /**
+     * generate the dispatch between the blocks of a region. It continues with the block at the next pc if it is part
+     * of the region and the vm does not need to stop, otherwise the region is left. As the successor depends on the
+     * block leaving the region it is left as unknown jump so that only the pc checked indirect targets get chained
+     *
+     * @param region the start addresses and entry basic blocks of the blocks of the region
+     * @param exit_blk the basic block leaving the block function
+     */
+    void gen_region_dispatch(std::vector<std::pair<uint64_t, BasicBlock*>> const& region, BasicBlock* exit_blk) {
+        auto& ctx = mod->getContext();
+        auto abs_addr = [this, &ctx](void const* p) {
+            return ConstantExpr::getIntToPtr(builder.getInt64(reinterpret_cast<uintptr_t>(p)), PointerType::getUnqual(ctx));
+        };
+        auto* lookup = BasicBlock::Create(ctx, "region_lookup", func, exit_blk);
+        auto* region_exit = BasicBlock::Create(ctx, "region_exit", func, exit_blk);
+        builder.SetInsertPoint(leave_blk);
+        auto* stop = builder.CreateLoad(builder.getInt8Ty(), abs_addr(chain_cfg.stop_flag), true);
+        auto* icount = builder.CreateLoad(builder.getInt64Ty(), abs_addr(chain_cfg.icount));
+        auto* icount_limit = builder.CreateLoad(builder.getInt64Ty(), abs_addr(chain_cfg.icount_limit));
+        builder.CreateCondBr(builder.CreateAnd(builder.CreateICmpEQ(stop, builder.getInt8(0)), builder.CreateICmpULT(icount, icount_limit)),
+                             lookup, region_exit);
+        builder.SetInsertPoint(lookup);
+        // the register is read from the register file directly as the module declares no register accessors
+        Value* next_pc = builder.CreateLoad(get_typeptr(arch::traits<ARCH>::NEXT_PC), get_reg_ptr(arch::traits<ARCH>::NEXT_PC));
+        next_pc = builder.CreateZExtOrTrunc(next_pc, builder.getInt64Ty());
+        auto* sw = builder.CreateSwitch(next_pc, region_exit, region.size());
+        for(auto& e : region)
+            sw->addCase(builder.getInt64(e.first), e.second);
+        builder.SetInsertPoint(region_exit);
+        auto* last_branch_ty = builder.getIntNTy(chain_cfg.last_branch_size * 8);
+        auto* last_branch = builder.CreateLoad(last_branch_ty, abs_addr(chain_cfg.last_branch));
+        auto* unknown = ConstantInt::get(last_branch_ty, UNKNOWN_JUMP);
+        builder.CreateStore(builder.CreateSelect(builder.CreateICmpULT(last_branch, unknown), unknown, last_branch),
+                            abs_addr(chain_cfg.last_branch));
+        builder.CreateBr(exit_blk);
+    }
 
     void GenerateUniqueName(std::string& str, uint64_t mod) const {
         std::array<char, 21> buf;
@@ -267,6 +826,66 @@ protected:
     virtual std::tuple<continuation_e, BasicBlock*> gen_single_inst_behavior(virt_addr_t& pc_v, BasicBlock* this_block) = 0;
 
     virtual void gen_trap_behavior(BasicBlock*) = 0;
+    /**
+     * record the target of the direct branch ending the block being translated, called by the instruction generators
+     *
+     * @param target the address the branch goes to
+     * @param conditional the branch may fall through to the next instruction
+     */
+    void set_branch_target(uint64_t target, bool conditional) {
+        successors.pc[1] = target;
+        successors.known[1] = true;
+        successors.known[0] = conditional;
+    }
+
+    /**
+     * get the branch weights of a conditional branch ending the block being translated, the taken branch is the first
+     * successor. Instruction generators pass them when creating the branch
+     *
+     * @return the weights or nullptr if there is no profile of the block
+     */
+    MDNode* get_branch_weights() {
+        if(!recompiled_profile)
+            return nullptr;
+        auto* profile = recompiled_profile;
+        return MDBuilder(mod->getContext()).createBranchWeights(profile->weight(KNOWN_JUMP), profile->weight(NO_JUMP));
+    }
+    /**
+     * let the block count its executions and outcomes in the profile of its address. The execution crossing the
+     * recompilation threshold requests the recompilation and lowers the chaining limit so that the dispatcher regains
+     * control after the block
+     *
+     * @param entry the entry basic block of the block function
+     * @param block_pc the address of the block
+     * @return the basic block the instructions continue in
+     */
+    BasicBlock* gen_block_profiling(BasicBlock* entry, uint64_t block_pc) {
+        // the profile is handed to the block once it is compiled, see insert_block()
+        auto& profile = pending_profiles[block_pc];
+        profile = std::make_shared<block_profile>();
+        auto& ctx = mod->getContext();
+        auto abs_addr = [this, &ctx](void const* p) {
+            return ConstantExpr::getIntToPtr(builder.getInt64(reinterpret_cast<uintptr_t>(p)), PointerType::getUnqual(ctx));
+        };
+        auto* body = BasicBlock::Create(ctx, "body", func, leave_blk);
+        auto* hot = BasicBlock::Create(ctx, "hot", func, body);
+        builder.SetInsertPoint(entry);
+        auto* executions = builder.CreateAdd(builder.CreateLoad(builder.getInt64Ty(), abs_addr(&profile->executions)), builder.getInt64(1));
+        builder.CreateStore(executions, abs_addr(&profile->executions));
+        auto* threshold = builder.getInt64(func_map.get_config().recompile_threshold);
+        builder.CreateCondBr(builder.CreateICmpEQ(executions, threshold), hot, body, MDBuilder(ctx).createBranchWeights(1, 1024));
+        builder.SetInsertPoint(hot);
+        builder.CreateStore(builder.getInt64(block_pc), gen_vm_field(&hot_block));
+        builder.CreateStore(builder.getInt64(0), gen_vm_field(&chain_icount_limit));
+        builder.CreateBr(body);
+        // count the outcome before the leave behavior
+        builder.SetInsertPoint(leave_blk, leave_blk->getFirstInsertionPt());
+        auto* last_branch = builder.CreateLoad(builder.getIntNTy(chain_cfg.last_branch_size * 8), abs_addr(chain_cfg.last_branch));
+        auto* idx = builder.CreateAnd(builder.CreateZExtOrTrunc(last_branch, builder.getInt64Ty()), builder.getInt64(3));
+        auto* outcome = builder.CreateGEP(builder.getInt64Ty(), abs_addr(profile->outcomes.data()), idx);
+        builder.CreateStore(builder.CreateAdd(builder.CreateLoad(builder.getInt64Ty(), outcome), builder.getInt64(1)), outcome);
+        return body;
+    }
 
     virtual void gen_leave_behavior(BasicBlock* leave_blk) {
         builder.SetInsertPoint(leave_blk);
@@ -276,20 +895,34 @@ protected:
 
     explicit vm_base(ARCH& core, unsigned core_id = 0, unsigned cluster_id = 0)
     : core(core)
+    , core_ctx_ref(iss::core_context::of(core))
+    , core_ctx(core_ctx_ref.get())
     , core_id(core_id)
     , cluster_id(cluster_id)
     , regs_base_ptr(core.get_regs_base_ptr())
-    , builder(::iss::llvm::getContext()) {
+    , builder(*context.getContext()) {
         sync_exec = static_cast<sync_type>(sync_exec | core.needed_sync());
+        // writes of the core to the guest code invalidate the blocks translated from it
+        core_ctx->get_code_pages().set_space(arch::traits<ARCH>::MEM);
+        func_map.set_code_pages(core_ctx->get_code_pages());
+        // accesses of the generated code to the memory look up the software TLB first
+        core_ctx->get_tlb().enable(arch::traits<ARCH>::MEM);
     }
     explicit vm_base(std::unique_ptr<ARCH> unique_core_ptr, unsigned core_id = 0, unsigned cluster_id = 0)
     : core(*unique_core_ptr)
     , owning_core_ptr(std::move(unique_core_ptr))
+    , core_ctx_ref(iss::core_context::of(core))
+    , core_ctx(core_ctx_ref.get())
     , core_id(core_id)
     , cluster_id(cluster_id)
     , regs_base_ptr(core.get_regs_base_ptr())
-    , builder(::iss::llvm::getContext()) {
+    , builder(*context.getContext()) {
         sync_exec = static_cast<sync_type>(sync_exec | core.needed_sync());
+        // writes of the core to the guest code invalidate the blocks translated from it
+        core_ctx->get_code_pages().set_space(arch::traits<ARCH>::MEM);
+        func_map.set_code_pages(core_ctx->get_code_pages());
+        // accesses of the generated code to the memory look up the software TLB first
+        core_ctx->get_tlb().enable(arch::traits<ARCH>::MEM);
     }
 
     ~vm_base() override { delete tgt_adapter; }
@@ -297,8 +930,8 @@ protected:
     void register_plugin(vm_plugin& plugin) override {
         if(plugin.registration("1.0", *this)) {
             // This is wrong, needs ptrType
-            auto* plugin_addr = ConstantInt::get(::iss::llvm::getContext(), APInt(64, (uint64_t)&plugin));
-            Value* ptr = ConstantExpr::getIntToPtr(plugin_addr, PointerType::getUnqual(Type::getInt8Ty(::iss::llvm::getContext())));
+            auto* plugin_addr = ConstantInt::get(builder.getContext(), APInt(64, (uint64_t)&plugin));
+            Value* ptr = ConstantExpr::getIntToPtr(plugin_addr, PointerType::getUnqual(Type::getInt8Ty(builder.getContext())));
             plugins.push_back(plugin_entry{plugin.get_sync(), plugin, ptr});
         }
     }
@@ -337,32 +970,32 @@ protected:
     Generator functions to create often used IR
     */
     inline Value* gen_get_reg(reg_e r) {
-        std::vector<Value*> args{core_ptr, ConstantInt::get(::iss::llvm::getContext(), APInt(16, r))};
+        std::vector<Value*> args{core_ptr, ConstantInt::get(builder.getContext(), APInt(16, r))};
         auto reg_size = arch::traits<ARCH>::reg_bit_widths[r];
         auto ret = builder.CreateCall(mod->getFunction("get_reg"), args);
         return reg_size == 64 ? ret : builder.CreateTrunc(ret, get_type(reg_size));
     }
 
     inline void gen_set_reg(reg_e r, Value* val) {
-        std::vector<Value*> args{core_ptr, ConstantInt::get(::iss::llvm::getContext(), APInt(16, r)), adj_to64(val)};
+        std::vector<Value*> args{core_ptr, ConstantInt::get(builder.getContext(), APInt(16, r)), adj_to64(val)};
         builder.CreateCall(mod->getFunction("set_reg"), args);
     }
 
     inline Value* gen_get_flag(sr_flag_e flag, const char* nm = "") {
-        std::vector<Value*> args{core_ptr, ConstantInt::get(::iss::llvm::getContext(), APInt(16, flag))};
+        std::vector<Value*> args{core_ptr, ConstantInt::get(builder.getContext(), APInt(16, flag))};
         Value* call = builder.CreateCall(mod->getFunction("get_flag"), args);
         return builder.CreateTrunc(call, get_type(1));
     }
 
     inline void gen_set_flag(sr_flag_e flag, Value* val) {
-        std::vector<Value*> args{core_ptr, ConstantInt::get(::iss::llvm::getContext(), APInt(16, flag)),
+        std::vector<Value*> args{core_ptr, ConstantInt::get(builder.getContext(), APInt(16, flag)),
                                  builder.CreateTrunc(val, get_type(1))};
         builder.CreateCall(mod->getFunction("set_flag"), args);
     }
 
     inline void gen_update_flags(iss::arch_if::operations op, Value* oper1, Value* oper2) {
         std::vector<Value*> args{
-            core_ptr, ConstantInt::get(::iss::llvm::getContext(), APInt(16, op)),
+            core_ptr, ConstantInt::get(builder.getContext(), APInt(16, op)),
             oper1->getType()->getScalarSizeInBits() == 64 ? oper1 : builder.CreateZExt(oper1, IntegerType::get(mod->getContext(), 64)),
             oper2->getType()->getScalarSizeInBits() == 64 ? oper2 : builder.CreateZExt(oper2, IntegerType::get(mod->getContext(), 64))};
         builder.CreateCall(mod->getFunction("update_flags"), args);
@@ -373,63 +1006,149 @@ protected:
     }
 
     inline Value* gen_read_mem(mem_type_e type, Value* addr, uint32_t length, const char* nm = "") {
-        auto* storage = builder.CreateAlloca(IntegerType::get(mod->getContext(), length * 8));
-        auto* storage_ptr = builder.CreateBitCast(storage, get_type(8)->getPointerTo(0));
-        std::vector<Value*> args{core_ptr,
-                                 ConstantInt::get(::iss::llvm::getContext(), APInt(32, static_cast<uint16_t>(iss::address_type::VIRTUAL))),
-                                 ConstantInt::get(::iss::llvm::getContext(), APInt(32, type)),
-                                 adj_to64(addr),
-                                 ConstantInt::get(::iss::llvm::getContext(), APInt(32, length)),
-                                 storage_ptr};
-        auto* call = builder.CreateCall(mod->getFunction("read_mem"), args);
-        call->setCallingConv(CallingConv::C);
-        auto* icmp = builder.CreateICmpNE(call, gen_const(8, 0UL));
-        auto* label_cont = BasicBlock::Create(::iss::llvm::getContext(), "", func, this->leave_blk);
-        this->builder.CreateCondBr(icmp, trap_blk, label_cont, MDBuilder(this->mod->getContext()).createBranchWeights(4, 64));
-        builder.SetInsertPoint(label_cont);
         switch(length) {
         case 1:
         case 2:
         case 4:
         case 8:
-            return builder.CreateLoad(this->get_type(length * 8), builder.CreateBitCast(storage, get_type(length * 8)->getPointerTo(0)),
-                                      false);
+            break;
         default:
             throw std::runtime_error("Invalid read attempt");
         }
+        auto* addr64 = adj_to64(addr);
+        BasicBlock* label_fast{nullptr};
+        Value* fast_val{nullptr};
+        if(type == arch::traits<ARCH>::MEM) {
+            // look up the software TLB and load from the host memory of the page if it is entered
+            label_fast = BasicBlock::Create(builder.getContext(), "", func, this->leave_blk);
+            auto* label_slow = BasicBlock::Create(builder.getContext(), "", func, this->leave_blk);
+            auto* entry = gen_tlb_entry(addr64);
+            auto* tag = builder.CreateLoad(get_type(64), gen_tlb_field(entry, iss::jit::soft_tlb::read_tag_offset));
+            auto* hit = builder.CreateICmpEQ(builder.CreateAnd(addr64, gen_const(64, iss::jit::soft_tlb::tag_mask(length))), tag);
+            builder.CreateCondBr(hit, label_fast, label_slow, MDBuilder(mod->getContext()).createBranchWeights(64, 4));
+            builder.SetInsertPoint(label_fast);
+            fast_val = builder.CreateLoad(get_type(length * 8), gen_host_ptr(entry, addr64, length * 8), false);
+            label_fast = builder.GetInsertBlock();
+            builder.SetInsertPoint(label_slow);
+        }
+        auto* storage = gen_entry_alloca(IntegerType::get(mod->getContext(), length * 8));
+        auto* storage_ptr = builder.CreateBitCast(storage, get_type(8)->getPointerTo(0));
+        std::vector<Value*> args{core_ptr,
+                                 ConstantInt::get(builder.getContext(), APInt(32, static_cast<uint16_t>(iss::address_type::VIRTUAL))),
+                                 ConstantInt::get(builder.getContext(), APInt(32, type)),
+                                 addr64,
+                                 ConstantInt::get(builder.getContext(), APInt(32, length)),
+                                 storage_ptr};
+        auto* call = builder.CreateCall(mod->getFunction("read_mem"), args);
+        call->setCallingConv(CallingConv::C);
+        auto* icmp = builder.CreateICmpNE(call, gen_const(8, 0UL));
+        auto* label_cont = BasicBlock::Create(builder.getContext(), "", func, this->leave_blk);
+        auto* label_read = label_fast ? BasicBlock::Create(builder.getContext(), "", func, this->leave_blk) : label_cont;
+        this->builder.CreateCondBr(icmp, trap_blk, label_read, MDBuilder(this->mod->getContext()).createBranchWeights(4, 64));
+        builder.SetInsertPoint(label_read);
+        auto* slow_val =
+            builder.CreateLoad(this->get_type(length * 8), builder.CreateBitCast(storage, get_type(length * 8)->getPointerTo(0)), false);
+        if(!label_fast)
+            return slow_val;
+        builder.CreateBr(label_cont);
+        builder.SetInsertPoint(label_fast);
+        builder.CreateBr(label_cont);
+        builder.SetInsertPoint(label_cont);
+        auto* phi = builder.CreatePHI(get_type(length * 8), 2);
+        phi->addIncoming(fast_val, label_fast);
+        phi->addIncoming(slow_val, label_read);
+        return phi;
     }
     template <typename T>
     inline typename std::enable_if<std::is_integral<T>::value>::type gen_write_mem(mem_type_e type, T addr, Value* val) {
-        gen_write_mem(type, ConstantInt::get(::iss::llvm::getContext(), APInt(sizeof(T) * 8, static_cast<uint64_t>(addr))), val);
+        gen_write_mem(type, ConstantInt::get(builder.getContext(), APInt(sizeof(T) * 8, static_cast<uint64_t>(addr))), val);
     }
 
     inline void gen_write_mem(mem_type_e type, Value* addr, Value* val) {
         uint32_t bitwidth = val->getType()->getIntegerBitWidth();
-        auto* storage = builder.CreateAlloca(IntegerType::get(mod->getContext(), bitwidth));
+        auto* addr64 = adj_to64(addr);
+        auto* label_cont = BasicBlock::Create(builder.getContext(), "", func, this->leave_blk);
+        if(type == arch::traits<ARCH>::MEM && (bitwidth == 8 || bitwidth == 16 || bitwidth == 32 || bitwidth == 64)) {
+            // look up the software TLB and store to the host memory of the page if it is entered as writable
+            auto* label_fast = BasicBlock::Create(builder.getContext(), "", func, this->leave_blk);
+            auto* label_slow = BasicBlock::Create(builder.getContext(), "", func, this->leave_blk);
+            auto* entry = gen_tlb_entry(addr64);
+            auto* tag = builder.CreateLoad(get_type(64), gen_tlb_field(entry, iss::jit::soft_tlb::write_tag_offset));
+            auto* hit = builder.CreateICmpEQ(builder.CreateAnd(addr64, gen_const(64, iss::jit::soft_tlb::tag_mask(bitwidth / 8))), tag);
+            builder.CreateCondBr(hit, label_fast, label_slow, MDBuilder(mod->getContext()).createBranchWeights(64, 4));
+            builder.SetInsertPoint(label_fast);
+            builder.CreateStore(val, gen_host_ptr(entry, addr64, bitwidth), false);
+            builder.CreateBr(label_cont);
+            builder.SetInsertPoint(label_slow);
+        }
+        auto* storage = gen_entry_alloca(IntegerType::get(mod->getContext(), bitwidth));
         builder.CreateStore(val, storage, false);
         auto* storage_ptr = builder.CreateBitCast(storage, get_type(8)->getPointerTo(0));
         std::vector<Value*> args{core_ptr,
-                                 ConstantInt::get(::iss::llvm::getContext(), APInt(32, static_cast<uint16_t>(iss::address_type::VIRTUAL))),
-                                 ConstantInt::get(::iss::llvm::getContext(), APInt(32, type)),
-                                 adj_to64(addr),
-                                 ConstantInt::get(::iss::llvm::getContext(), APInt(32, bitwidth / 8)),
+                                 ConstantInt::get(builder.getContext(), APInt(32, static_cast<uint16_t>(iss::address_type::VIRTUAL))),
+                                 ConstantInt::get(builder.getContext(), APInt(32, type)),
+                                 addr64,
+                                 ConstantInt::get(builder.getContext(), APInt(32, bitwidth / 8)),
                                  storage_ptr};
         auto* call = builder.CreateCall(mod->getFunction("write_mem"), args);
         call->setCallingConv(CallingConv::C);
         auto* icmp = builder.CreateICmpNE(call, gen_const(8, 0UL));
-        auto* label_cont = BasicBlock::Create(::iss::llvm::getContext(), "", func, this->leave_blk);
         this->builder.CreateCondBr(icmp, trap_blk, label_cont, MDBuilder(this->mod->getContext()).createBranchWeights(4, 64));
         builder.SetInsertPoint(label_cont);
     }
+    /**
+     * create a stack slot in the entry block of the function. Allocas placed at the current insert point become dynamic
+     * allocas once they sit inside the loop of a region and grow the stack with every iteration
+     */
+    inline AllocaInst* gen_entry_alloca(Type* type) {
+        auto& entry = func->getEntryBlock();
+        IRBuilder<> entry_builder(&entry, entry.getFirstInsertionPt());
+        return entry_builder.CreateAlloca(type);
+    }
+    /**
+     * get the address of the software TLB entry of a guest address, it is found through the context loaded from the vm
+     * pointer so blocks do not depend on the core they got translated for
+     */
+    inline Value* gen_tlb_entry(Value* addr64) {
+        auto* idx = builder.CreateAnd(builder.CreateLShr(addr64, gen_const(64, iss::jit::soft_tlb::page_bits)),
+                                      gen_const(64, iss::jit::soft_tlb::entry_count - 1));
+        auto* offs = builder.CreateAdd(builder.CreateShl(idx, gen_const(64, iss::jit::soft_tlb::entry_bits)),
+                                       gen_const(64, core_ctx->get_tlb_offset()));
+        // the context of a vm never changes, so the load can be shared by all accesses of the block
+        auto* ctx = builder.CreateLoad(get_type(64), gen_vm_field(reinterpret_cast<uint64_t const*>(&core_ctx)), "ctx");
+        ctx->setMetadata(LLVMContext::MD_invariant_load, MDNode::get(builder.getContext(), {}));
+        return builder.CreateAdd(ctx, offs, "tlb_entry");
+    }
+
+    /**
+     * get the address of a member of this vm relative to the vm pointer the block gets called with
+     *
+     * @param member the member
+     * @return the address
+     */
+    inline Value* gen_vm_field(uint64_t const* member) {
+        auto offs = reinterpret_cast<uintptr_t>(member) - reinterpret_cast<uintptr_t>(static_cast<vm_if*>(this));
+        return builder.CreateIntToPtr(builder.CreateAdd(builder.CreatePtrToInt(vm_ptr, get_type(64)), gen_const(64, offs)),
+                                      get_type(64)->getPointerTo(0));
+    }
+
+    inline Value* gen_tlb_field(Value* entry, size_t offset) {
+        return builder.CreateIntToPtr(builder.CreateAdd(entry, gen_const(64, offset)), get_type(64)->getPointerTo(0));
+    }
+
+    inline Value* gen_host_ptr(Value* entry, Value* addr64, unsigned width) {
+        auto* addend = builder.CreateLoad(get_type(64), gen_tlb_field(entry, iss::jit::soft_tlb::addend_offset));
+        return builder.CreateIntToPtr(builder.CreateAdd(addr64, addend), get_type(width)->getPointerTo(0));
+    }
 
     template <typename T, typename std::enable_if<std::is_signed<T>::value>::type* = nullptr>
     inline ConstantInt* gen_const(unsigned size, T val) const {
-        return ConstantInt::get(::iss::llvm::getContext(), APInt(size, val, true));
+        return ConstantInt::get(builder.getContext(), APInt(size, val, true));
     }
 
     template <typename T, typename std::enable_if<!std::is_signed<T>::value>::type* = nullptr>
     inline ConstantInt* gen_const(unsigned size, T val) const {
-        return ConstantInt::get(::iss::llvm::getContext(), APInt(size, (uint64_t)val, false));
+        return ConstantInt::get(builder.getContext(), APInt(size, (uint64_t)val, false));
     }
 
     template <typename V, typename W, typename = std::enable_if_t<std::is_integral<V>::value && std::is_integral<W>::value>>
@@ -453,12 +1172,12 @@ protected:
 
     template <typename T, typename std::enable_if<std::is_unsigned<T>::value>::type* = nullptr>
     inline Value* gen_ext(T val, unsigned size) const {
-        return ConstantInt::get(::iss::llvm::getContext(), APInt(size, val, false));
+        return ConstantInt::get(builder.getContext(), APInt(size, val, false));
     }
 
     template <typename T, typename std::enable_if<std::is_signed<T>::value>::type* = nullptr>
     inline Value* gen_ext(T val, unsigned size) const {
-        return ConstantInt::get(::iss::llvm::getContext(), APInt(size, val, false));
+        return ConstantInt::get(builder.getContext(), APInt(size, val, false));
     }
 
     template <typename T, typename std::enable_if<std::is_pointer<T>::value, int>::type* = nullptr>
@@ -468,7 +1187,7 @@ protected:
 
     template <typename T, typename std::enable_if<std::is_integral<T>::value>::type* = nullptr>
     inline Value* gen_ext(T val, unsigned size, bool isSigned) const {
-        return ConstantInt::get(::iss::llvm::getContext(), APInt(size, val, isSigned));
+        return ConstantInt::get(builder.getContext(), APInt(size, val, isSigned));
     }
     inline Value* gen_bool(Value* val) {
         if(val->getType()->isIntegerTy(1)) {
@@ -502,6 +1221,53 @@ protected:
             this->builder.CreateCondBr(cond, then, otherwise, MDBuilder(this->mod->getContext()).createBranchWeights(4, 64));
     }
 
+    iss::jit::chain_config get_chain_config() {
+        iss::jit::chain_config cfg;
+        cfg.cur_tb = &chain_tb;
+        cfg.f_ptr_offset = offsetof(translation_block, f_ptr);
+        cfg.cont_offset = offsetof(translation_block, cont);
+        cfg.targets_offset = offsetof(translation_block, targets);
+        cfg.stop_flag = core.get_stop_flag_ptr();
+        cfg.last_branch = regs_base_ptr + arch::traits<ARCH>::reg_byte_offsets[arch::traits<ARCH>::LAST_BRANCH];
+        cfg.last_branch_size = arch::traits<ARCH>::reg_bit_widths[arch::traits<ARCH>::LAST_BRANCH] / 8;
+        cfg.icount = reinterpret_cast<uint64_t const*>(regs_base_ptr + arch::traits<ARCH>::reg_byte_offsets[arch::traits<ARCH>::ICOUNT]);
+        cfg.icount_limit = &chain_icount_limit;
+        if(iss::jit::has_call_marks<ARCH>()) {
+            cfg.ras = &chain_ras;
+            cfg.cache_epoch = func_map.epoch_ptr();
+        }
+        return cfg;
+    }
+    // caches the target of an indirect branch and, if the branch returns from a marked call, the return site of the caller
+    void link_indirect(translation_block* from, uint64_t pc, translation_block* to) {
+        func_map.link_indirect(from, pc, to);
+        if(!chain_cfg.ras)
+            return;
+        auto& ret = chain_ras.entries[chain_ras.top];
+        if(ret.pc == pc) {
+            if(ret.caller && ret.epoch == func_map.epoch())
+                func_map.link_return(static_cast<translation_block*>(ret.caller), pc, to);
+            chain_ras.pop();
+        }
+    }
+
+    /**
+     * mark a call, the return address is pushed onto the return stack so the matching return can be chained. Only
+     * architectures declaring the call marks in their traits may use it, see iss::jit::has_call_marks()
+     *
+     * @param ret_pc the return address
+     */
+    inline void gen_push_return_address(Value* ret_pc) {
+        static_assert(iss::jit::has_call_marks<ARCH>(), "the traits of the architecture need to declare the call marks");
+        if(!native_chaining)
+            return;
+        auto* ptr_ty = PointerType::getUnqual(mod->getContext());
+        auto* push_ty = FunctionType::get(builder.getVoidTy(), {ptr_ty, builder.getInt64Ty()}, false);
+        auto* push_fn = ConstantExpr::getIntToPtr(gen_const(64, reinterpret_cast<uintptr_t>(&iss::jit::push_return_address)), ptr_ty);
+        auto* cfg_ptr = ConstantExpr::getIntToPtr(gen_const(64, reinterpret_cast<uintptr_t>(&chain_cfg)), ptr_ty);
+        builder.CreateCall(push_ty, push_fn, {cfg_ptr, adj_to64(ret_pc)});
+    }
+
     // NO_SYNC = 0, PRE_SYNC = 1, POST_SYNC = 2, ALL_SYNC = 3
     const std::array<const iss::arch_if::exec_phase, 4> notifier_mapping = {
         {iss::arch_if::ISTART, iss::arch_if::ISTART, iss::arch_if::IEND, iss::arch_if::ISTART}};
@@ -545,12 +1311,45 @@ protected:
 
     ARCH& core;
     std::unique_ptr<ARCH> owning_core_ptr;
+    //! the context of the core, shared with the other vms executing it
+    std::shared_ptr<iss::core_context> const core_ctx_ref;
+    //! the context, generated code loads it from the vm
+    iss::core_context* const core_ctx;
     unsigned core_id = 0;
     unsigned cluster_id = 0;
     uint8_t* regs_base_ptr;
     sync_type sync_exec{sync_type::NO_SYNC};
-    absl::flat_hash_map<uint64_t, translation_block> func_map;
-    IRBuilder<> builder{iss::llvm::getContext()};
+    iss::jit::translation_cache<translation_block> func_map;
+    // blocks stored between runs, null if no persistent cache is configured. Declared before the compiler as its jobs
+    // store blocks
+    std::unique_ptr<iss::jit::persistent_cache> persistent;
+    // version of the code generation, part of the persistent cache domain
+    static constexpr unsigned persistent_format = 2;
+    // the blocks shared with the vms of the cluster
+    iss::jit::code_sharing<translation_block> sharing{core};
+    // compiles blocks in the background, null if they are compiled by the simulation thread
+    std::unique_ptr<iss::jit::async_compiler<translation_block>> compiler;
+    // state shared with the generated code, see iss::jit::chain_config
+    bool native_chaining{false};
+    void* chain_tb{nullptr};
+    uint64_t chain_icount_limit{0};
+    unsigned opt_level{0};
+    iss::jit::return_stack chain_ras;
+    iss::jit::chain_config chain_cfg;
+    // the profiles of the blocks generated but not in the cache yet, the blocks in the cache own their profile
+    absl::flat_hash_map<uint64_t, std::shared_ptr<block_profile>> pending_profiles;
+    // the profile of the block being recompiled, nullptr while translating unoptimized blocks
+    block_profile const* recompiled_profile{nullptr};
+    // the address of the block which crossed the recompilation threshold
+    static constexpr uint64_t no_hot_block = std::numeric_limits<uint64_t>::max();
+    uint64_t hot_block{no_hot_block};
+    // the successors of the block translated last
+    iss::jit::block_successors successors;
+    // the register contents saved while translating successors
+    std::vector<uint8_t> spec_regs;
+    // the context the blocks of this vm are generated in, it is locked while translating or compiling a block of the vm
+    ::llvm::orc::ThreadSafeContext context{std::make_unique<LLVMContext>()};
+    IRBuilder<> builder{*context.getContext()};
     // non-owning pointers
     Module* mod{nullptr};
     Function* func{nullptr};
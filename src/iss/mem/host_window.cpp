@@ -0,0 +1,295 @@
+/*******************************************************************************
+ * Copyright (C) 2024 MINRES Technologies GmbH
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Contributors:
+ *       eyck@minres.com - initial implementation
+ ******************************************************************************/
+
+#include "host_window.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#ifdef __linux__
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <unistd.h>
+#endif
+
+namespace iss {
+namespace mem {
+
+#ifdef __linux__
+namespace {
+thread_local void* active_context{nullptr};
+
+struct sigaction prev_segv;
+struct sigaction prev_bus;
+
+int to_prot(host_window::protection_e prot) {
+    switch(prot) {
+    case host_window::protection_e::READ:
+        return PROT_READ;
+    case host_window::protection_e::READ_WRITE:
+        return PROT_READ | PROT_WRITE;
+    default:
+        return PROT_NONE;
+    }
+}
+
+uintptr_t host_pc_of(void* ucontext) {
+    auto* uc = static_cast<ucontext_t*>(ucontext);
+#if defined(__x86_64__)
+    return static_cast<uintptr_t>(uc->uc_mcontext.gregs[REG_RIP]);
+#elif defined(__aarch64__)
+    return static_cast<uintptr_t>(uc->uc_mcontext.pc);
+#else
+    return 0;
+#endif
+}
+} // namespace
+
+host_window::context::context(host_window& window)
+: window(window)
+, outer(static_cast<context*>(active_context)) {
+    active_context = this;
+}
+
+host_window::context::~context() { active_context = outer; }
+
+void host_window::handle_fault(int sig, siginfo_t* info, void* ucontext) {
+    for(auto* ctx = static_cast<context*>(active_context); ctx; ctx = ctx->outer) {
+        auto* addr = static_cast<uint8_t*>(info->si_addr);
+        if(addr >= ctx->window.base && addr < ctx->window.base + ctx->window.get_size() + ctx->window.page_size) {
+            ctx->info.addr = static_cast<uint64_t>(addr - ctx->window.base);
+            ctx->info.host_pc = host_pc_of(ucontext);
+            // the handler is installed with SA_NODEFER so the signal mask needs no restore
+            siglongjmp(ctx->env, 1);
+        }
+    }
+    // not a fault of the window, leave it to the handler installed before
+    auto& prev = sig == SIGBUS ? prev_bus : prev_segv;
+    if(prev.sa_flags & SA_SIGINFO)
+        prev.sa_sigaction(sig, info, ucontext);
+    else if(prev.sa_handler != SIG_DFL && prev.sa_handler != SIG_IGN)
+        prev.sa_handler(sig);
+    else
+        // returning re-executes the faulting instruction which then takes the default action
+        signal(sig, SIG_DFL);
+}
+
+host_window::host_window(unsigned addr_bits)
+: addr_bits(addr_bits)
+, page_size(static_cast<uint64_t>(sysconf(_SC_PAGESIZE))) {
+    if(addr_bits < 16 || addr_bits > 47)
+        throw std::invalid_argument("host window needs to cover 2^16 to 2^47 bytes");
+    static std::once_flag installed;
+    std::call_once(installed, []() {
+        struct sigaction sa;
+        std::memset(&sa, 0, sizeof(sa));
+        sa.sa_sigaction = &host_window::handle_fault;
+        sa.sa_flags = SA_SIGINFO | SA_NODEFER;
+        sigemptyset(&sa.sa_mask);
+        if(sigaction(SIGSEGV, &sa, &prev_segv) || sigaction(SIGBUS, &sa, &prev_bus))
+            throw std::runtime_error("could not install the fault handler of the host window");
+    });
+    // the RAM is a sparse file mapped twice, into the window and as an unprotected alias for the host
+    fd = memfd_create("guest-ram", MFD_CLOEXEC);
+    if(fd < 0 || ftruncate(fd, static_cast<off_t>(get_size())))
+        throw std::runtime_error("could not create the backing file of the host window");
+    // the guard page catches accesses straddling the end of the window
+    auto* mem = mmap(nullptr, get_size() + page_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    auto* alias_mem = mmap(nullptr, get_size(), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE, fd, 0);
+    if(mem == MAP_FAILED || alias_mem == MAP_FAILED) {
+        if(mem != MAP_FAILED)
+            munmap(mem, get_size() + page_size);
+        if(alias_mem != MAP_FAILED)
+            munmap(alias_mem, get_size());
+        close(fd);
+        throw std::runtime_error("could not reserve the host window");
+    }
+    base = static_cast<uint8_t*>(mem);
+    alias = static_cast<uint8_t*>(alias_mem);
+}
+
+host_window::~host_window() {
+    munmap(base, get_size() + page_size);
+    munmap(alias, get_size());
+    close(fd);
+}
+
+void host_window::map_ram(uint64_t addr, uint64_t size) {
+    if(!size || (addr | size) & (page_size - 1) || addr > get_size() || size > get_size() - addr)
+        throw std::invalid_argument("RAM range needs to be aligned to host pages and to lie within the host window");
+    if(find_ram(addr, 1) || find_ram(addr + size - 1, 1))
+        throw std::invalid_argument("RAM range overlaps an already mapped range");
+    if(mmap(base + addr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED | MAP_NORESERVE, fd, static_cast<off_t>(addr)) ==
+       MAP_FAILED)
+        throw std::runtime_error("could not map RAM into the host window");
+    rams.emplace_back(addr, size);
+    std::sort(rams.begin(), rams.end());
+}
+
+void host_window::apply(uint64_t page) {
+    auto prot = protection_e::READ_WRITE;
+    auto w = watched.find(page);
+    if(w != watched.end())
+        prot = std::min(prot, w->second);
+    auto l = limited.find(page);
+    if(l != limited.end())
+        prot = std::min(prot, l->second);
+    auto r = restricted.find(page);
+    if((r == restricted.end() ? protection_e::READ_WRITE : r->second) == prot)
+        return;
+    if(prot == protection_e::READ_WRITE)
+        restricted.erase(r);
+    else
+        restricted[page] = prot;
+    if(mprotect(base + page, page_size, to_prot(prot)))
+        throw std::runtime_error("could not change the protection of the host window");
+}
+#else
+host_window::host_window(unsigned addr_bits)
+: addr_bits(addr_bits) {
+    throw std::runtime_error("host windows are not supported on this host");
+}
+
+host_window::~host_window() = default;
+
+void host_window::map_ram(uint64_t addr, uint64_t size) {}
+
+void host_window::apply(uint64_t page) {}
+#endif
+
+namespace {
+void set_restriction(std::map<uint64_t, host_window::protection_e>& pages, uint64_t page, host_window::protection_e prot) {
+    if(prot == host_window::protection_e::READ_WRITE)
+        pages.erase(page);
+    else
+        pages[page] = prot;
+}
+} // namespace
+
+void host_window::protect(uint64_t addr, uint64_t length, protection_e prot) {
+    std::lock_guard<std::mutex> lock(protection_mtx);
+    auto first = addr & ~(page_size - 1);
+    for(auto page = first; page < addr + length; page += page_size)
+        if(find_ram(page, 1)) {
+            set_restriction(watched, page, prot);
+            apply(page);
+        }
+    for(auto& h : protection_handlers)
+        h.second(first, addr + length - first);
+}
+
+void host_window::limit(uint64_t addr, uint64_t length, protection_e prot) {
+    std::lock_guard<std::mutex> lock(protection_mtx);
+    for(auto page = addr & ~(page_size - 1); page < addr + length; page += page_size)
+        if(find_ram(page, 1)) {
+            set_restriction(limited, page, prot);
+            apply(page);
+        }
+}
+
+void host_window::unlimit(uint64_t addr, uint64_t length) {
+    std::lock_guard<std::mutex> lock(protection_mtx);
+    for(auto page = addr & ~(page_size - 1); page < addr + length; page += page_size)
+        if(limited.erase(page))
+            apply(page);
+}
+
+size_t host_window::add_protection_handler(std::function<void(uint64_t, uint64_t)> f) {
+    std::lock_guard<std::mutex> lock(protection_mtx);
+    protection_handlers.emplace_back(++next_handler_id, std::move(f));
+    return next_handler_id;
+}
+
+void host_window::remove_protection_handler(size_t id) {
+    std::lock_guard<std::mutex> lock(protection_mtx);
+    auto& h = protection_handlers;
+    h.erase(std::remove_if(h.begin(), h.end(), [id](std::pair<size_t, std::function<void(uint64_t, uint64_t)>> const& e) {
+                return e.first == id;
+            }),
+            h.end());
+}
+
+host_window::protection_e host_window::get_protection(uint64_t addr) const {
+    if(!find_ram(addr, 1))
+        return protection_e::NONE;
+    std::lock_guard<std::mutex> lock(protection_mtx);
+    auto it = restricted.find(addr & ~(page_size - 1));
+    return it == restricted.end() ? protection_e::READ_WRITE : it->second;
+}
+
+host_region host_window::region(uint64_t addr, bool for_write) const {
+    auto* ram = find_ram(addr, 1);
+    if(!ram)
+        return {};
+    auto start = ram->first;
+    auto end = ram->first + ram->second;
+    auto page = addr & ~(page_size - 1);
+    std::lock_guard<std::mutex> lock(protection_mtx);
+    auto it = restricted.lower_bound(page);
+    if(it != restricted.end() && it->first == page) {
+        // a restricted page is accessible on its own at most
+        if(it->second == protection_e::NONE || (for_write && it->second == protection_e::READ))
+            return {};
+        return host_region{page, page_size, alias + page, it->second == protection_e::READ_WRITE};
+    }
+    // the run of unrestricted pages around addr
+    if(it != restricted.end())
+        end = std::min(end, it->first);
+    if(it != restricted.begin())
+        start = std::max(start, std::prev(it)->first + page_size);
+    return host_region{start, end - start, alias + start, true};
+}
+
+iss::status host_window::read(uint64_t addr, uint64_t length, uint8_t* data) const {
+    if(!find_ram(addr, length))
+        return iss::Err;
+    std::memcpy(data, alias + addr, length);
+    return iss::Ok;
+}
+
+iss::status host_window::write(uint64_t addr, uint64_t length, uint8_t const* data) {
+    if(!find_ram(addr, length))
+        return iss::Err;
+    std::memcpy(alias + addr, data, length);
+    return iss::Ok;
+}
+
+std::pair<uint64_t, uint64_t> const* host_window::find_ram(uint64_t addr, uint64_t length) const {
+    auto it = std::upper_bound(rams.begin(), rams.end(), std::make_pair(addr, ~uint64_t(0)));
+    if(it == rams.begin())
+        return nullptr;
+    --it;
+    return addr - it->first < it->second && length <= it->second - (addr - it->first) ? &*it : nullptr;
+}
+} // namespace mem
+} // namespace iss
@@ -0,0 +1,236 @@
+/*******************************************************************************
+ * Copyright (C) 2024 MINRES Technologies GmbH
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Contributors:
+ *       eyck@minres.com - initial implementation
+ ******************************************************************************/
+
+#ifndef _ISS_MEM_HOST_WINDOW_H_
+#define _ISS_MEM_HOST_WINDOW_H_
+
+#include <iss/vm_types.h>
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <utility>
+#include <vector>
+#ifdef __linux__
+#include <setjmp.h>
+#include <signal.h>
+#endif
+
+namespace iss {
+namespace mem {
+/**
+ * guest RAM mapped into a window of host address space covering the complete guest physical address space
+ *
+ * The window reserves 2^addr_bits bytes of host address space (plus a guard page) without committing memory, RAM ranges
+ * get mapped into it at the offset of their guest address and are backed by host memory on first touch. Generated code
+ * accesses RAM as a plain load or store of window base + guest address without any check. Everything else in the
+ * window, i.e. unmapped addresses, MMIO ranges and pages restricted by protect() (watchpoints) or limit() (pages
+ * holding translated code), is inaccessible and an access to it faults. run() catches these faults so the vm can
+ * re-execute the instruction through read() and write() of the core.
+ *
+ * The host itself accesses the RAM through a second mapping which is never protected, region() returns it so the
+ * software TLB and vectored accesses keep working. RAM ranges need to be mapped before the cores start; protections may
+ * change at any time, from any thread. A page accessible through the window has the lowest of the protections set by
+ * protect() and limit(), so lifting a limit keeps a watchpoint and vice versa. Only Linux hosts are supported.
+ */
+class host_window {
+public:
+    enum class protection_e { NONE, READ, READ_WRITE };
+    //! a fault of generated code caught by run()
+    struct fault {
+        //! the guest address accessed
+        uint64_t addr{0};
+        //! the host pc of the faulting instruction
+        uintptr_t host_pc{0};
+    };
+    /**
+     * reserve the window
+     *
+     * @param addr_bits the width of the guest physical addresses, the window covers 2^addr_bits bytes
+     */
+    explicit host_window(unsigned addr_bits);
+
+    host_window(host_window const&) = delete;
+
+    host_window& operator=(host_window const&) = delete;
+
+    ~host_window();
+
+    unsigned get_addr_bits() const { return addr_bits; }
+
+    uint64_t get_size() const { return uint64_t(1) << addr_bits; }
+    /**
+     * get the host address of guest address 0 in the window, generated code adds the guest address to it
+     *
+     * @return the base of the window
+     */
+    uint8_t* host_base() const { return base; }
+    /**
+     * map RAM into the window, the range needs to be aligned to host pages
+     *
+     * @param addr the guest address of the RAM
+     * @param size the size of the RAM in bytes
+     */
+    void map_ram(uint64_t addr, uint64_t size);
+    /**
+     * set the protection of RAM pages in the window, e.g. to catch accesses to watched addresses. The range is extended
+     * to host pages. The protection handlers are called afterwards so the cores drop host memory entered before
+     *
+     * @param addr the first guest address
+     * @param length the length of the range
+     * @param prot the protection, READ_WRITE removes the restriction
+     */
+    void protect(uint64_t addr, uint64_t length, protection_e prot);
+    /**
+     * limit the protection of RAM pages in the window independent of protect(), used to catch stores to pages holding
+     * translated code
+     *
+     * @param addr the first guest address
+     * @param length the length of the range
+     * @param prot the protection
+     */
+    void limit(uint64_t addr, uint64_t length, protection_e prot);
+    /**
+     * remove the limit set by limit(), e.g. as the pages hold no translated code anymore
+     *
+     * @param addr the first guest address
+     * @param length the length of the range
+     */
+    void unlimit(uint64_t addr, uint64_t length);
+    /**
+     * add a function called with the range of pages whenever protect() changed them, e.g. to flush the software TLB
+     * of a core. It is called on the thread calling protect()
+     *
+     * @param f the function
+     * @return the id of the function to remove it
+     */
+    size_t add_protection_handler(std::function<void(uint64_t, uint64_t)> f);
+
+    void remove_protection_handler(size_t id);
+    /**
+     * get the protection of an address in the window
+     *
+     * @param addr the guest address
+     * @return NONE if it is not RAM, the protection of its page otherwise
+     */
+    protection_e get_protection(uint64_t addr) const;
+    /**
+     * get the host memory backing a guest address, it excludes the pages whose protection does not permit the access
+     * so accesses through the region notice watchpoints as well
+     *
+     * @param addr the guest address
+     * @param for_write true if the region is requested to write to it
+     * @return the region holding addr or an empty region if addr is not RAM or the access is not permitted
+     */
+    host_region region(uint64_t addr, bool for_write = false) const;
+    /**
+     * read from the RAM ignoring the protection
+     *
+     * @param addr the guest address
+     * @param length the number of bytes to read
+     * @param data the buffer to read into
+     * @return Err if the range is not RAM, Ok otherwise
+     */
+    iss::status read(uint64_t addr, uint64_t length, uint8_t* data) const;
+    /**
+     * write to the RAM ignoring the protection
+     *
+     * @param addr the guest address
+     * @param length the number of bytes to write
+     * @param data the data to write
+     * @return Err if the range is not RAM, Ok otherwise
+     */
+    iss::status write(uint64_t addr, uint64_t length, uint8_t const* data);
+    /**
+     * run generated code accessing the window. If it faults accessing the window the execution is abandoned at the
+     * faulting instruction and the function returns, the frames of func are left without unwinding them so func must
+     * not hold objects needing destruction across the call of generated code
+     *
+     * @param func the function executing the generated code
+     * @param info set to the fault if one got caught
+     * @return true if func returned, false if a fault got caught
+     */
+    template <typename F> bool run(F&& func, fault& info) {
+#ifndef __linux__
+        func();
+        return true;
+#else
+        context ctx(*this);
+        if(sigsetjmp(ctx.env, 0)) {
+            info = ctx.info;
+            return false;
+        }
+        func();
+        return true;
+#endif
+    }
+
+private:
+#ifdef __linux__
+    //! the run() executing on a thread, the fault handler returns to it
+    struct context {
+        explicit context(host_window& window);
+        ~context();
+        host_window& window;
+        sigjmp_buf env;
+        fault info;
+        context* outer;
+    };
+
+    static void handle_fault(int sig, siginfo_t* info, void* ucontext);
+#endif
+    //! the RAM range holding [addr, addr+length) or nullptr
+    std::pair<uint64_t, uint64_t> const* find_ram(uint64_t addr, uint64_t length) const;
+
+    //! update the protection of a page from its watch and its limit
+    void apply(uint64_t page);
+
+    unsigned const addr_bits;
+    uint64_t page_size{0};
+    int fd{-1};
+    uint8_t* base{nullptr};
+    uint8_t* alias{nullptr};
+    std::vector<std::pair<uint64_t, uint64_t>> rams;
+    mutable std::mutex protection_mtx;
+    //! the pages restricted by protect() and by limit(), the others are READ_WRITE
+    std::map<uint64_t, protection_e> watched, limited;
+    //! the resulting protection of the restricted pages, the others are READ_WRITE
+    std::map<uint64_t, protection_e> restricted;
+    std::vector<std::pair<size_t, std::function<void(uint64_t, uint64_t)>>> protection_handlers;
+    size_t next_handler_id{0};
+};
+} // namespace mem
+} // namespace iss
+#endif /* _ISS_MEM_HOST_WINDOW_H_ */
@@ -0,0 +1,85 @@
+/*******************************************************************************
+ * Copyright (C) 2024 MINRES Technologies GmbH
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Contributors:
+ *       eyck@minres.com - initial implementation
+ ******************************************************************************/
+
+#include "memory_map.h"
+#include <stdexcept>
+
+namespace iss {
+namespace mem {
+
+sparse_ram& memory_map::map_ram(uint64_t base, uint64_t size, bool huge_pages) {
+    auto* ram = new sparse_ram(size, huge_pages);
+    add(std::unique_ptr<range>(new range{base, size, std::unique_ptr<sparse_ram>(ram), nullptr, {}, {}}));
+    return *ram;
+}
+
+void memory_map::map_ram(uint64_t base, uint64_t size, host_window& window) {
+    check(base, size);
+    window.map_ram(base, size);
+    add(std::unique_ptr<range>(new range{base, size, nullptr, &window, {}, {}}));
+}
+
+void memory_map::map_mmio(uint64_t base, uint64_t size, read_func rd, write_func wr) {
+    if(!rd || !wr)
+        throw std::invalid_argument("MMIO range needs a read and a write function");
+    add(std::unique_ptr<range>(new range{base, size, nullptr, nullptr, std::move(rd), std::move(wr)}));
+}
+
+void memory_map::track_dirty_pages(bool enable) {
+    for(auto& r : ranges)
+        if(r->ram)
+            r->ram->track_dirty_pages(enable);
+}
+
+void memory_map::collect_dirty_pages(std::function<void(uint64_t)> const& func) {
+    for(auto& r : ranges)
+        if(r->ram)
+            r->ram->collect_dirty_pages([&func, base = r->base](uint64_t offset) { func(base + offset); });
+}
+
+void memory_map::check(uint64_t base, uint64_t size) const {
+    if(!size || base + (size - 1) < base)
+        throw std::invalid_argument("invalid memory range");
+    for(auto& other : ranges)
+        if(base <= other->base + (other->size - 1) && other->base <= base + (size - 1))
+            throw std::invalid_argument("memory range overlaps an already mapped range");
+}
+
+void memory_map::add(std::unique_ptr<range> r) {
+    check(r->base, r->size);
+    ranges.push_back(std::move(r));
+    lut.addEntry(static_cast<unsigned>(ranges.size()), ranges.back()->base, ranges.back()->size);
+}
+} // namespace mem
+} // namespace iss
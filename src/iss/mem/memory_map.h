@@ -0,0 +1,212 @@
+/*******************************************************************************
+ * Copyright (C) 2024 MINRES Technologies GmbH
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Contributors:
+ *       eyck@minres.com - initial implementation
+ ******************************************************************************/
+
+#ifndef _ISS_MEM_MEMORY_MAP_H_
+#define _ISS_MEM_MEMORY_MAP_H_
+
+#include "host_window.h"
+#include "sparse_ram.h"
+#include <iss/jit/code_pages.h>
+#include <util/range_lut.h>
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace iss {
+namespace mem {
+/**
+ * the guest memory of a core: RAM and MMIO ranges mapped into one address space
+ *
+ * Architectures forward their rd_func and wr_func to read() and write() and their arch_if::get_host_region() to
+ * region() (passing access_type::WRITE as for_write). Generated code then accesses RAM through the software TLB without
+ * calling back and only MMIO accesses and the first access to each page take the slow path. The ranges are looked up
+ * in a util::range_lut. Ranges need to be mapped before the cores start, lookups are safe from concurrent threads then.
+ * Writes to RAM through write() are reported to the code pages given by set_code_pages() so that other bus masters
+ * (e.g. a DMA) invalidate translated code they overwrite. Writes to host memory obtained from region() are not seen.
+ */
+class memory_map {
+public:
+    //! the function handling reads of an MMIO range, gets the offset in the range
+    using read_func = std::function<iss::status(uint64_t offset, unsigned length, uint8_t* data)>;
+    //! the function handling writes of an MMIO range, gets the offset in the range
+    using write_func = std::function<iss::status(uint64_t offset, unsigned length, uint8_t const* data)>;
+
+    memory_map()
+    : lut(0) {}
+
+    memory_map(memory_map const&) = delete;
+
+    memory_map& operator=(memory_map const&) = delete;
+    /**
+     * map RAM, its host memory is allocated lazily (see sparse_ram)
+     *
+     * @param base the address of the RAM
+     * @param size the size of the RAM in bytes
+     * @param huge_pages back the RAM by transparent huge pages if the host supports them, ignored on Windows
+     * @return the RAM, e.g. to track dirty pages
+     */
+    sparse_ram& map_ram(uint64_t base, uint64_t size, bool huge_pages = false);
+    /**
+     * map RAM living in a host window, the window maps it at the same address. Generated code accesses it through the
+     * window, dirty pages of it are not tracked
+     *
+     * @param base the address of the RAM
+     * @param size the size of the RAM in bytes
+     * @param window the window
+     */
+    void map_ram(uint64_t base, uint64_t size, host_window& window);
+    /**
+     * map an MMIO range, accesses to it are dispatched to the functions
+     *
+     * @param base the address of the range
+     * @param size the size of the range in bytes
+     * @param rd the function handling reads
+     * @param wr the function handling writes
+     */
+    void map_mmio(uint64_t base, uint64_t size, read_func rd, write_func wr);
+    /**
+     * report the writes to RAM to the code pages of the cores executing out of it, the code pages of all cores need to
+     * be shared (see core_context::share_code_pages()). Writes of the cores reach them through the cores already
+     *
+     * @param pages the code pages or nullptr to stop reporting
+     */
+    void set_code_pages(jit::code_pages* pages) { code_map = pages; }
+    /**
+     * read from the memory, accesses spanning several ranges are split
+     *
+     * @param addr the address to read from
+     * @param length the number of bytes to read
+     * @param data the buffer to read into
+     * @return Err if a part of the access is not mapped, the result of the ranges accessed otherwise
+     */
+    iss::status read(uint64_t addr, unsigned length, uint8_t* data) {
+        while(length) {
+            auto* r = find(addr);
+            if(!r)
+                return iss::Err;
+            auto n = static_cast<unsigned>(std::min<uint64_t>(length, r->size - (addr - r->base)));
+            auto res = r->ram      ? r->ram->read(addr - r->base, n, data)
+                       : r->window ? r->window->read(addr, n, data)
+                                   : r->rd(addr - r->base, n, data);
+            if(res != iss::Ok)
+                return res;
+            addr += n;
+            data += n;
+            length -= n;
+        }
+        return iss::Ok;
+    }
+    /**
+     * write to the memory, accesses spanning several ranges are split
+     *
+     * @param addr the address to write to
+     * @param length the number of bytes to write
+     * @param data the data to write
+     * @return Err if a part of the access is not mapped, the result of the ranges accessed otherwise
+     */
+    iss::status write(uint64_t addr, unsigned length, uint8_t const* data) {
+        while(length) {
+            auto* r = find(addr);
+            if(!r)
+                return iss::Err;
+            auto n = static_cast<unsigned>(std::min<uint64_t>(length, r->size - (addr - r->base)));
+            auto res = r->ram      ? r->ram->write(addr - r->base, n, data)
+                       : r->window ? r->window->write(addr, n, data)
+                                   : r->wr(addr - r->base, n, data);
+            if(res != iss::Ok)
+                return res;
+            if(code_map && !r->wr && code_map->holds_code(addr, n))
+                code_map->written(addr, n);
+            addr += n;
+            data += n;
+            length -= n;
+        }
+        return iss::Ok;
+    }
+    /**
+     * get the host memory backing an address, see sparse_ram::region()
+     *
+     * @param addr the address
+     * @param for_write true if the region is requested to write to it
+     * @return the region holding addr or an empty region if addr is not RAM or may not be written directly
+     */
+    host_region region(uint64_t addr, bool for_write = false) {
+        auto* r = find(addr);
+        if(!r)
+            return {};
+        if(r->window)
+            return r->window->region(addr, for_write);
+        return r->ram ? r->ram->region(addr - r->base, r->base, for_write) : host_region{};
+    }
+    /**
+     * enable or disable the tracking of the pages written to all sparse RAMs, see sparse_ram::track_dirty_pages()
+     *
+     * @param enable true to track the pages written
+     */
+    void track_dirty_pages(bool enable);
+    /**
+     * call a function for each RAM page written since the last call and mark the pages clean, see
+     * sparse_ram::collect_dirty_pages()
+     *
+     * @param func the function, called with the address of each dirty page
+     */
+    void collect_dirty_pages(std::function<void(uint64_t)> const& func);
+
+private:
+    struct range {
+        uint64_t base;
+        uint64_t size;
+        std::unique_ptr<sparse_ram> ram;
+        host_window* window;
+        read_func rd;
+        write_func wr;
+    };
+
+    range* find(uint64_t addr) {
+        auto idx = lut.getEntry(addr);
+        return idx ? ranges[idx - 1].get() : nullptr;
+    }
+
+    void check(uint64_t base, uint64_t size) const;
+
+    void add(std::unique_ptr<range> r);
+
+    std::vector<std::unique_ptr<range>> ranges;
+    util::range_lut<unsigned> lut;
+    jit::code_pages* code_map{nullptr};
+};
+} // namespace mem
+} // namespace iss
+#endif /* _ISS_MEM_MEMORY_MAP_H_ */
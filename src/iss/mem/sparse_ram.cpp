@@ -0,0 +1,160 @@
+/*******************************************************************************
+ * Copyright (C) 2024 MINRES Technologies GmbH
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Contributors:
+ *       eyck@minres.com - initial implementation
+ ******************************************************************************/
+
+#include "sparse_ram.h"
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <util/logging.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+namespace iss {
+namespace mem {
+
+namespace {
+//! missing support for transparent huge pages is reported once only
+std::atomic_flag huge_pages_reported = ATOMIC_FLAG_INIT;
+
+bool use_huge_pages(bool requested) {
+#if defined(_WIN32) || !defined(MADV_HUGEPAGE)
+    if(requested && !huge_pages_reported.test_and_set())
+        CPPLOG(WARN) << "transparent huge pages are not supported on this host, guest RAM is backed by normal pages";
+    return false;
+#else
+    return requested;
+#endif
+}
+
+uint8_t* map_block(bool huge_pages) {
+#ifdef _WIN32
+    // committed pages are zeroed and get backed by physical memory on first touch
+    auto* mem = VirtualAlloc(nullptr, sparse_ram::block_size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    if(!mem)
+        throw std::runtime_error("could not allocate guest memory");
+    return static_cast<uint8_t*>(mem);
+#else
+    // huge pages need a block aligned to its size, map twice the size and trim the excess
+    auto length = huge_pages ? 2 * sparse_ram::block_size : sparse_ram::block_size;
+    auto* mem = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(mem == MAP_FAILED)
+        throw std::runtime_error("could not allocate guest memory");
+    auto* start = static_cast<uint8_t*>(mem);
+    if(huge_pages) {
+        auto* aligned = reinterpret_cast<uint8_t*>((reinterpret_cast<uintptr_t>(start) + sparse_ram::block_size - 1) &
+                                                   ~(sparse_ram::block_size - 1));
+        if(aligned != start)
+            munmap(start, aligned - start);
+        if(auto tail = start + length - (aligned + sparse_ram::block_size))
+            munmap(aligned + sparse_ram::block_size, tail);
+        start = aligned;
+#ifdef MADV_HUGEPAGE
+        // fails e.g. if the kernel lacks THP support, the block stays usable with normal pages then
+        if(madvise(start, sparse_ram::block_size, MADV_HUGEPAGE) != 0 && !huge_pages_reported.test_and_set())
+            CPPLOG(WARN) << "transparent huge pages are unavailable (" << std::strerror(errno)
+                         << "), guest RAM is backed by normal pages";
+#endif
+    }
+    return start;
+#endif
+}
+
+void unmap_block(uint8_t* mem) {
+#ifdef _WIN32
+    VirtualFree(mem, 0, MEM_RELEASE);
+#else
+    munmap(mem, sparse_ram::block_size);
+#endif
+}
+} // namespace
+
+sparse_ram::sparse_ram(uint64_t size, bool huge_pages)
+: size(size)
+, huge_pages(use_huge_pages(huge_pages))
+, table_count((size + (uint64_t(1) << (block_bits + table_bits)) - 1) >> (block_bits + table_bits))
+, tables(new std::atomic<table*>[table_count]) {
+    for(uint64_t i = 0; i < table_count; ++i)
+        tables[i].store(nullptr, std::memory_order_relaxed);
+}
+
+sparse_ram::~sparse_ram() {
+    for(uint64_t t = 0; t < table_count; ++t)
+        if(auto* tbl = tables[t].load(std::memory_order_relaxed)) {
+            for(auto& entry : tbl->blocks)
+                if(auto* b = entry.load(std::memory_order_relaxed)) {
+                    unmap_block(b->mem);
+                    delete b;
+                }
+            delete tbl;
+        }
+}
+
+uint64_t sparse_ram::allocated() const {
+    uint64_t res = 0;
+    for(uint64_t t = 0; t < table_count; ++t)
+        if(auto* tbl = tables[t].load(std::memory_order_relaxed))
+            for(auto& entry : tbl->blocks)
+                if(entry.load(std::memory_order_relaxed))
+                    res += block_size;
+    return res;
+}
+
+sparse_ram::block* sparse_ram::allocate_block(uint64_t addr) {
+    // another thread may allocate the table or the block meanwhile, its allocation wins then
+    auto& tbl_entry = tables[addr >> (block_bits + table_bits)];
+    auto* tbl = tbl_entry.load(std::memory_order_acquire);
+    if(!tbl) {
+        auto* fresh = new table();
+        if(tbl_entry.compare_exchange_strong(tbl, fresh, std::memory_order_acq_rel, std::memory_order_acquire))
+            tbl = fresh;
+        else
+            delete fresh;
+    }
+    auto& entry = tbl->blocks[(addr >> block_bits) & (blocks_per_table - 1)];
+    auto* b = entry.load(std::memory_order_acquire);
+    if(b)
+        return b;
+    auto* fresh = new block();
+    fresh->mem = map_block(huge_pages);
+    if(entry.compare_exchange_strong(b, fresh, std::memory_order_acq_rel, std::memory_order_acquire))
+        return fresh;
+    unmap_block(fresh->mem);
+    delete fresh;
+    return b;
+}
+} // namespace mem
+} // namespace iss
@@ -0,0 +1,253 @@
+/*******************************************************************************
+ * Copyright (C) 2024 MINRES Technologies GmbH
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Contributors:
+ *       eyck@minres.com - initial implementation
+ ******************************************************************************/
+
+#ifndef _ISS_MEM_SPARSE_RAM_H_
+#define _ISS_MEM_SPARSE_RAM_H_
+
+#include <iss/vm_types.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+namespace iss {
+namespace mem {
+/**
+ * guest RAM whose host memory is allocated lazily in blocks when they are first written or requested for writing through
+ * region()
+ *
+ * The blocks are found through a two-level radix table: a directory with one entry per 4GiB of guest memory points to
+ * tables with one entry per 2MiB block. Tables and blocks are allocated on first use, blocks are anonymous host mappings
+ * so only the pages touched count towards the resident set size and multi-GB RAMs are cheap. Blocks can be backed by
+ * transparent huge pages where the host supports them.
+ *
+ * The RAM is directly mappable: region() returns the host memory of the block holding an address so cores can report it
+ * through arch_if::get_host_region() and the vm accesses it without calling the memory model. Reads of blocks never
+ * written return zeros without allocating them, region() returns no host memory for them unless it is requested for
+ * writing. Blocks are allocated without locks so cores running on concurrent
+ * threads may share the RAM; the accesses to the contents themselves are not synchronized.
+ *
+ * Optionally the RAM tracks the pages written. While tracking, region() grants direct write access only to pages already
+ * marked dirty so the first write to each page takes the slow path through write() which marks it.
+ */
+class sparse_ram {
+public:
+    //! the size of the blocks of host memory allocated at once
+    static constexpr unsigned block_bits = 21;
+    static constexpr uint64_t block_size = uint64_t(1) << block_bits;
+    //! the number of blocks mapped by a table of the second level
+    static constexpr unsigned table_bits = 11;
+    //! the granularity of the dirty page tracking, the page size of the software TLB
+    static constexpr unsigned page_bits = 12;
+    static constexpr uint64_t page_size = uint64_t(1) << page_bits;
+    /**
+     * create the RAM
+     *
+     * @param size the size of the RAM in bytes
+     * @param huge_pages back the blocks by transparent huge pages if the host supports them. A warning is logged if it
+     * does not, on Windows the parameter is ignored
+     */
+    explicit sparse_ram(uint64_t size, bool huge_pages = false);
+
+    sparse_ram(sparse_ram const&) = delete;
+
+    sparse_ram& operator=(sparse_ram const&) = delete;
+
+    ~sparse_ram();
+
+    uint64_t get_size() const { return size; }
+    /**
+     * read from the RAM
+     *
+     * @param addr the offset in the RAM
+     * @param length the number of bytes to read
+     * @param data the buffer to read into
+     * @return Err if the range exceeds the RAM, Ok otherwise
+     */
+    iss::status read(uint64_t addr, uint64_t length, uint8_t* data) const {
+        if(!in_range(addr, length))
+            return iss::Err;
+        while(length) {
+            auto n = std::min(length, block_size - (addr & (block_size - 1)));
+            if(auto* b = find_block(addr))
+                std::memcpy(data, b->mem + (addr & (block_size - 1)), n);
+            else
+                std::memset(data, 0, n);
+            addr += n;
+            data += n;
+            length -= n;
+        }
+        return iss::Ok;
+    }
+    /**
+     * write to the RAM, e.g. to load an image
+     *
+     * @param addr the offset in the RAM
+     * @param length the number of bytes to write
+     * @param data the data to write
+     * @return Err if the range exceeds the RAM, Ok otherwise
+     */
+    iss::status write(uint64_t addr, uint64_t length, uint8_t const* data) {
+        if(!in_range(addr, length))
+            return iss::Err;
+        auto tracking = dirty_tracking.load(std::memory_order_relaxed);
+        while(length) {
+            auto n = std::min(length, block_size - (addr & (block_size - 1)));
+            auto* b = get_block(addr);
+            std::memcpy(b->mem + (addr & (block_size - 1)), data, n);
+            if(tracking)
+                mark_dirty(*b, addr, n);
+            addr += n;
+            data += n;
+            length -= n;
+        }
+        return iss::Ok;
+    }
+    /**
+     * get the host memory of the block holding an address. A block not allocated yet gets allocated if the region is
+     * requested for writing, otherwise it has to be read through read(). While dirty pages are tracked the region of
+     * the block is read-only and write access is granted for pages already marked dirty only
+     *
+     * @param addr the offset in the RAM
+     * @param base the address the RAM is mapped at, added to the start of the region
+     * @param for_write true if the region is requested to write to it
+     * @return the region holding addr or an empty region if addr is outside of the RAM, has no host memory yet or may
+     * not be written directly
+     */
+    host_region region(uint64_t addr, uint64_t base = 0, bool for_write = false) {
+        if(addr >= size)
+            return {};
+        auto tracking = dirty_tracking.load(std::memory_order_relaxed);
+        // while tracking the first write to a page takes the slow path anyway, it allocates the block then
+        auto* b = for_write && !tracking ? get_block(addr) : find_block(addr);
+        if(!b)
+            return {};
+        auto start = addr & ~(block_size - 1);
+        if(!tracking)
+            return host_region{base + start, std::min(block_size, size - start), b->mem, true};
+        if(!for_write)
+            return host_region{base + start, std::min(block_size, size - start), b->mem, false};
+        if(!is_dirty(*b, addr))
+            return {};
+        auto page = addr & ~(page_size - 1);
+        return host_region{base + page, std::min(page_size, size - page), b->mem + (page - start), true};
+    }
+    /**
+     * enable or disable the tracking of the pages written. Enabling it restricts the regions returned for writing, so
+     * cores using the RAM need to flush their software TLB afterwards (core_context::get_tlb().flush())
+     *
+     * @param enable true to track the pages written
+     */
+    void track_dirty_pages(bool enable) { dirty_tracking.store(enable, std::memory_order_relaxed); }
+    /**
+     * call a function for each page written since the last call and mark the pages clean. Cores using the RAM need to
+     * flush their software TLB afterwards (core_context::get_tlb().flush()) as they may still hold direct write access to
+     * the pages
+     *
+     * @param func the function, called with the offset of each dirty page in the RAM
+     */
+    template <typename F> void collect_dirty_pages(F&& func) {
+        for(uint64_t t = 0; t < table_count; ++t)
+            if(auto* tbl = tables[t].load(std::memory_order_acquire))
+                for(uint64_t i = 0; i < blocks_per_table; ++i)
+                    if(auto* b = tbl->blocks[i].load(std::memory_order_acquire))
+                        collect_dirty_pages(*b, ((t << table_bits) + i) << block_bits, func);
+    }
+    /**
+     * get the number of bytes of host memory allocated, i.e. reserved for the blocks in use
+     *
+     * @return the allocated size
+     */
+    uint64_t allocated() const;
+
+private:
+    static constexpr uint64_t blocks_per_table = uint64_t(1) << table_bits;
+    static constexpr unsigned dirty_words = (block_size >> page_bits) / 64;
+
+    struct block {
+        uint8_t* mem{nullptr};
+        std::atomic<uint64_t> dirty[dirty_words]{};
+    };
+
+    struct table {
+        std::atomic<block*> blocks[blocks_per_table]{};
+    };
+
+    bool in_range(uint64_t addr, uint64_t length) const { return addr <= size && length <= size - addr; }
+
+    block* find_block(uint64_t addr) const {
+        auto* tbl = tables[addr >> (block_bits + table_bits)].load(std::memory_order_acquire);
+        return tbl ? tbl->blocks[(addr >> block_bits) & (blocks_per_table - 1)].load(std::memory_order_acquire) : nullptr;
+    }
+
+    block* get_block(uint64_t addr) {
+        auto* b = find_block(addr);
+        return b ? b : allocate_block(addr);
+    }
+
+    block* allocate_block(uint64_t addr);
+
+    static bool is_dirty(block const& b, uint64_t addr) {
+        auto p = (addr & (block_size - 1)) >> page_bits;
+        return b.dirty[p / 64].load(std::memory_order_relaxed) & (uint64_t(1) << (p % 64));
+    }
+
+    template <typename F> static void collect_dirty_pages(block& b, uint64_t offset, F& func) {
+        for(unsigned w = 0; w < dirty_words; ++w) {
+            uint64_t bits = b.dirty[w].exchange(0, std::memory_order_relaxed);
+            for(uint64_t p = w * 64; bits; bits >>= 1, ++p)
+                if(bits & 1)
+                    func(offset + (p << page_bits));
+        }
+    }
+
+    static void mark_dirty(block& b, uint64_t addr, uint64_t length) {
+        auto first = (addr & (block_size - 1)) >> page_bits;
+        auto last = ((addr & (block_size - 1)) + length - 1) >> page_bits;
+        for(auto p = first; p <= last; ++p)
+            if(!(b.dirty[p / 64].load(std::memory_order_relaxed) & (uint64_t(1) << (p % 64))))
+                b.dirty[p / 64].fetch_or(uint64_t(1) << (p % 64), std::memory_order_relaxed);
+    }
+
+    uint64_t const size;
+    bool const huge_pages;
+    uint64_t const table_count;
+    std::unique_ptr<std::atomic<table*>[]> tables;
+    std::atomic<bool> dirty_tracking{false};
+};
+} // namespace mem
+} // namespace iss
+#endif /* _ISS_MEM_SPARSE_RAM_H_ */
@@ -138,6 +138,7 @@ std::shared_ptr<loader::plugin_data> loader::get_data(const std::string& filepat
     auto full_path = search_file_for(filepath);
     if(full_path.empty())
         throw std::invalid_argument(std::string("Could not find file for plugin ") + filepath);
+    std::lock_guard<std::mutex> lock(get_mutex());
     auto iter = get_cache().find(full_path);
     if(iter != get_cache().end())
         return iter->second;
@@ -156,6 +157,7 @@ std::shared_ptr<loader::plugin_data> loader::get_data(const std::string& filepat
 }
 
 void loader::bind_function(const std::string& label) {
+    std::lock_guard<std::mutex> lock(get_mutex());
     if(_data->symbols.find(label) != _data->symbols.end())
         return;
 #if OS_IS_WINDOWS
@@ -173,6 +175,7 @@ void loader::bind_function(const std::string& label) {
 }
 
 void loader::bind_variable(const std::string& label) {
+    std::lock_guard<std::mutex> lock(get_mutex());
     if(_data->symbols.find(label) != _data->symbols.end())
         return;
 #if OS_IS_WINDOWS
@@ -188,6 +191,7 @@ void loader::bind_variable(const std::string& label) {
 }
 
 loader::variable loader::get_variable_ptr(const std::string& label) const {
+    std::lock_guard<std::mutex> lock(get_mutex());
     auto iter = _data->symbols.find(label);
     if(iter == _data->symbols.end())
         throw std::invalid_argument("failed to get variable pointer '" + label + "': symbol is not bound");
@@ -197,6 +201,7 @@ loader::variable loader::get_variable_ptr(const std::string& label) const {
 }
 
 loader::function loader::get_function_ptr(const std::string& label) const {
+    std::lock_guard<std::mutex> lock(get_mutex());
     auto iter = _data->symbols.find(label);
     if(iter == _data->symbols.end())
         throw std::invalid_argument("failed to get function '" + label + "': symbol is not bound");
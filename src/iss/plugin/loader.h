@@ -58,6 +58,7 @@
 
 // standard library
 #include <memory>
+#include <mutex>
 #include <stdexcept>
 #include <string>
 #include <unordered_map>
@@ -130,6 +131,11 @@ private: // members
         static cache_t cache;
         return cache;
     }
+    // guards the cache and the symbols of the cached libraries, loaders may be created by concurrently running vms
+    static std::mutex& get_mutex() {
+        static std::mutex mtx;
+        return mtx;
+    }
     std::shared_ptr<plugin_data> _data;
     std::shared_ptr<plugin_data> get_data(const std::string& filepath);
 
@@ -146,19 +152,24 @@ public: // methods
     : _data(std::move(other._data)) {}
 
     loader(const loader& other)
-    : _data(get_cache()[other.filepath()]) {}
+    : _data(other._data) {}
 
     void bind_function(const std::string& label);
     void bind_variable(const std::string& label);
 
-    inline bool contains(const std::string& label) const { return _data->symbols.find(label) != _data->symbols.end(); }
+    inline bool contains(const std::string& label) const {
+        std::lock_guard<std::mutex> lock(get_mutex());
+        return _data->symbols.find(label) != _data->symbols.end();
+    }
 
     inline bool contains_function(const std::string& label) const {
+        std::lock_guard<std::mutex> lock(get_mutex());
         auto iter = _data->symbols.find(label);
         return iter != _data->symbols.end() && iter->second.is_func;
     }
 
     inline bool contains_variable(const std::string& label) const {
+        std::lock_guard<std::mutex> lock(get_mutex());
         auto iter = _data->symbols.find(label);
         return iter != _data->symbols.end() && !iter->second.is_func;
     }
@@ -174,7 +185,7 @@ public: // methods
     }
 
     inline loader& operator=(const loader& other) {
-        _data = get_cache()[other.filepath()];
+        _data = other._data;
         return *this;
     }
 
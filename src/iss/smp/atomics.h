@@ -0,0 +1,323 @@
+/*******************************************************************************
+ * Copyright (C) 2024 MINRES Technologies GmbH
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Contributors:
+ *       eyck@minres.com - initial implementation
+ ******************************************************************************/
+
+#ifndef _ISS_SMP_ATOMICS_H_
+#define _ISS_SMP_ATOMICS_H_
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace iss {
+namespace smp {
+/**
+ * the operations of an atomic read-modify-write access
+ */
+enum class amo_e : uint32_t { SWAP, ADD, AND, OR, XOR, MIN, MAX, MINU, MAXU };
+/**
+ * the orderings a memory fence establishes
+ */
+enum fence_e : uint32_t { FENCE_ACQUIRE = 1, FENCE_RELEASE = 2, FENCE_FULL = 3 };
+/**
+ * compute the value an atomic read-modify-write access stores
+ *
+ * @param op the operation
+ * @param old the value read from memory
+ * @param operand the operand of the access
+ * @return the value to store
+ */
+template <typename T> T amo_result(amo_e op, T old, T operand) {
+    using S = typename std::make_signed<T>::type;
+    switch(op) {
+    case amo_e::SWAP:
+        return operand;
+    case amo_e::ADD:
+        return old + operand;
+    case amo_e::AND:
+        return old & operand;
+    case amo_e::OR:
+        return old | operand;
+    case amo_e::XOR:
+        return old ^ operand;
+    case amo_e::MIN:
+        return static_cast<S>(old) < static_cast<S>(operand) ? old : operand;
+    case amo_e::MAX:
+        return static_cast<S>(old) > static_cast<S>(operand) ? old : operand;
+    case amo_e::MINU:
+        return std::min(old, operand);
+    case amo_e::MAXU:
+        return std::max(old, operand);
+    }
+    return operand;
+}
+/**
+ * the reservation of a core taken by a load-reserved access
+ */
+struct reservation {
+    uint64_t addr{0};
+    //! version of the stripe of the address when the reservation was taken
+    uint64_t version{0};
+    bool valid{false};
+};
+/**
+ * synchronization of the memory accesses of cores running on concurrent host threads
+ *
+ * The guest address space is divided into granules of 64 bytes which are hashed onto a fixed table of stripes. Each
+ * stripe holds a version which is odd while a core updates a granule of the stripe, so the version acts as a
+ * sequence lock: stores and atomic read-modify-write accesses take the stripe by advancing the version to the next odd
+ * value with a compare-and-swap and release it by advancing it to the next even value. A load-reserved remembers the
+ * even version it read along with the data, the store-conditional succeeds only if it can take the stripe at exactly
+ * this version, i.e. no core stored to a granule of the stripe meanwhile. Loads do not touch the table at all.
+ * Stripes are cache line aligned and there is no global lock, so cores only contend if they access the same granule
+ * or granules hashing to the same stripe; the latter lets a store-conditional fail spuriously which guests need to
+ * tolerate anyway.
+ * Accesses are identified by the address the core issues, cores sharing memory need to use the same addresses for it.
+ * An access the memory model of a core issues while handling another access of the same thread (e.g. updating a page
+ * table entry during a store) runs within the synchronization of the outer access and does not take stripes itself,
+ * so the stripes a thread holds are always taken in ascending order.
+ */
+class atomic_domain {
+public:
+    static constexpr unsigned granule_bits = 6;
+    static constexpr unsigned stripe_bits = 12;
+    /**
+     * get the domain shared by all cores of the process running on concurrent threads
+     *
+     * @return the domain
+     */
+    static atomic_domain& global() {
+        static atomic_domain domain;
+        return domain;
+    }
+
+    atomic_domain() = default;
+
+    atomic_domain(atomic_domain const&) = delete;
+
+    atomic_domain& operator=(atomic_domain const&) = delete;
+    /**
+     * run a store while holding the stripes of the bytes written
+     *
+     * @param addr the address written
+     * @param length the number of bytes written
+     * @param store the store, its result is returned
+     */
+    template <typename F> auto store(uint64_t addr, unsigned length, F&& store) -> decltype(store()) {
+        if(depth)
+            return store();
+        auto first = granule_of(addr);
+        auto last = granule_of(addr + std::max(length, 1U) - 1);
+        if(first == last) {
+            guard g(*this, index_of(first));
+            return store();
+        }
+        range_guard g(*this, first, last);
+        return store();
+    }
+    /**
+     * run a load-reserved access and take the reservation for it
+     *
+     * @param res the reservation of the core
+     * @param addr the address read
+     * @param load the load, its result is returned
+     */
+    template <typename F> auto load_reserved(reservation& res, uint64_t addr, F&& load) -> decltype(load()) {
+        auto& v = stripes[index_of(granule_of(addr))].version;
+        for(;;) {
+            auto before = wait_even(v);
+            auto ret = nested(load);
+            // retry if a store overlapped the load, the data might be torn
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if(v.load(std::memory_order_relaxed) == before) {
+                res = reservation{addr, before, true};
+                return ret;
+            }
+        }
+    }
+    /**
+     * run a store-conditional access if the reservation of the core is still valid, the reservation is cleared
+     *
+     * @param res the reservation of the core
+     * @param addr the address written
+     * @param store the store
+     * @param success set to true if the store was executed
+     * @return the result of the store or a default constructed result if it was not executed
+     */
+    template <typename F> auto store_conditional(reservation& res, uint64_t addr, F&& store, bool& success) -> decltype(store()) {
+        success = false;
+        auto held = res;
+        res.valid = false;
+        if(!held.valid || held.addr != addr)
+            return {};
+        auto idx = index_of(granule_of(addr));
+        auto expected = held.version;
+        if(!stripes[idx].version.compare_exchange_strong(expected, expected + 1, std::memory_order_acquire, std::memory_order_relaxed))
+            return {};
+        success = true;
+        release_guard g(*this, idx);
+        return nested(store);
+    }
+    /**
+     * run an atomic read-modify-write access while holding the stripe of the address
+     *
+     * @param addr the address accessed, needs to be aligned to the size of the access
+     * @param rmw the read-modify-write access, its result is returned
+     */
+    template <typename F> auto atomic(uint64_t addr, F&& rmw) -> decltype(rmw()) {
+        guard g(*this, index_of(granule_of(addr)));
+        return rmw();
+    }
+    /**
+     * order the memory accesses of the calling thread
+     *
+     * @param kind the ordering
+     */
+    static void fence(fence_e kind) {
+        switch(kind) {
+        case FENCE_ACQUIRE:
+            std::atomic_thread_fence(std::memory_order_acquire);
+            break;
+        case FENCE_RELEASE:
+            std::atomic_thread_fence(std::memory_order_release);
+            break;
+        default:
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+    }
+
+private:
+    static constexpr size_t stripe_count = size_t(1) << stripe_bits;
+
+    struct alignas(64) stripe {
+        std::atomic<uint64_t> version{0};
+    };
+    //! takes one stripe, does nothing if the thread is within a synchronized access already
+    struct guard {
+        guard(atomic_domain& d, size_t idx)
+        : d(d)
+        , idx(idx) {
+            if(!d.depth)
+                d.lock(idx);
+            ++d.depth;
+        }
+        ~guard() {
+            if(!--d.depth)
+                d.unlock(idx);
+        }
+        atomic_domain& d;
+        size_t idx;
+    };
+    //! releases a stripe the calling thread took, also if the access throws
+    struct release_guard {
+        release_guard(atomic_domain& d, size_t idx)
+        : d(d)
+        , idx(idx) {}
+        ~release_guard() { d.unlock(idx); }
+        atomic_domain& d;
+        size_t idx;
+    };
+    //! marks the calling thread as within a synchronized access, also if the access throws
+    struct depth_guard {
+        depth_guard() { ++depth; }
+        ~depth_guard() { --depth; }
+    };
+    //! takes the stripes of a range of granules in ascending order
+    struct range_guard {
+        range_guard(atomic_domain& d, uint64_t first, uint64_t last)
+        : d(d) {
+            if(last - first + 1 >= stripe_count)
+                for(size_t i = 0; i < stripe_count; ++i)
+                    idxs.push_back(i);
+            else {
+                for(auto g = first; g <= last; ++g)
+                    idxs.push_back(index_of(g));
+                std::sort(idxs.begin(), idxs.end());
+                idxs.erase(std::unique(idxs.begin(), idxs.end()), idxs.end());
+            }
+            for(auto i : idxs)
+                d.lock(i);
+            ++d.depth;
+        }
+        ~range_guard() {
+            --d.depth;
+            for(auto it = idxs.rbegin(); it != idxs.rend(); ++it)
+                d.unlock(*it);
+        }
+        atomic_domain& d;
+        std::vector<size_t> idxs;
+    };
+
+    //! run an access within the synchronization the calling thread holds, so it takes no stripes itself
+    template <typename F> static auto nested(F&& access) -> decltype(access()) {
+        depth_guard g;
+        return access();
+    }
+
+    static uint64_t granule_of(uint64_t addr) { return addr >> granule_bits; }
+
+    static size_t index_of(uint64_t granule) { return static_cast<size_t>((granule ^ (granule >> stripe_bits)) & (stripe_count - 1)); }
+
+    static uint64_t wait_even(std::atomic<uint64_t>& v) {
+        auto cur = v.load(std::memory_order_acquire);
+        while(cur & 1) {
+            std::this_thread::yield();
+            cur = v.load(std::memory_order_acquire);
+        }
+        return cur;
+    }
+
+    void lock(size_t idx) {
+        auto& v = stripes[idx].version;
+        auto cur = v.load(std::memory_order_relaxed);
+        for(;;) {
+            if(cur & 1)
+                cur = wait_even(v);
+            if(v.compare_exchange_weak(cur, cur + 1, std::memory_order_acquire, std::memory_order_relaxed))
+                return;
+        }
+    }
+
+    void unlock(size_t idx) { stripes[idx].version.fetch_add(1, std::memory_order_release); }
+
+    std::array<stripe, stripe_count> stripes;
+    //! nesting of synchronized accesses of the calling thread
+    static inline thread_local unsigned depth{0};
+};
+} // namespace smp
+} // namespace iss
+#endif /* _ISS_SMP_ATOMICS_H_ */
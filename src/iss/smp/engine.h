@@ -0,0 +1,320 @@
+/*******************************************************************************
+ * Copyright (C) 2024 MINRES Technologies GmbH
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Contributors:
+ *       eyck@minres.com - initial implementation
+ ******************************************************************************/
+
+#ifndef _ISS_SMP_ENGINE_H_
+#define _ISS_SMP_ENGINE_H_
+
+#include <iss/arch/traits.h>
+#include <iss/arch_if.h>
+#include <iss/core_context.h>
+#include <iss/smp/atomics.h>
+#include <iss/vm_if.h>
+#include <util/logging.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace iss {
+namespace smp {
+/**
+ * settings of the parallel execution of a cluster
+ */
+struct engine_config {
+    //! instructions each core executes between two synchronization points of the cluster, 0 runs the cores without
+    //! synchronizing them
+    uint64_t quantum{100000};
+    //! instructions a core executes at most between two checks for signals and stop requests if the cores run without
+    //! synchronizing them
+    uint64_t poll_interval{100000};
+};
+/**
+ * engine running the cores of a cluster in parallel, each on its own host thread
+ *
+ * Each thread runs the dispatch loop of its vm in slices of one quantum of instructions (vm_if::run_slice()) and waits
+ * at a barrier for the other cores at the end of each quantum, so the local times of the cores (their instruction
+ * counts) differ by at most one quantum. The thread completing a quantum last runs the time keeper before the cores
+ * continue, e.g. to advance timers of the cluster. Cores may signal each other, e.g. inter-processor interrupts, and
+ * request to stop the cluster from any thread without locks. Signals are delivered on the thread of the receiving core
+ * before it starts its next slice, i.e. within one quantum. If a core stops (a slice returned slice_e::STOPPED) the
+ * other cores stop at the end of their quantum.
+ * The vms must not share state besides the memory of the cluster and the blocks shared by their translation caches,
+ * the memory needs to handle concurrent accesses of the cores. The cores get attached to the global atomic_domain so
+ * their stores, reservations and atomic accesses to the memory space are synchronized.
+ *
+ * @tparam ARCH the architecture of the cores
+ */
+template <typename ARCH> class engine {
+public:
+    /**
+     * handler of the signals sent to a core, called on the thread of the core
+     */
+    using signal_handler = std::function<void(unsigned core, uint64_t signals)>;
+    /**
+     * time keeper called by the last core reaching the end of a quantum while all other cores wait
+     */
+    using time_keeper = std::function<void(uint64_t quantum)>;
+
+    explicit engine(engine_config const& cfg = engine_config{})
+    : cfg(cfg) {}
+
+    engine(engine const&) = delete;
+
+    engine& operator=(engine const&) = delete;
+    /**
+     * add the vm of a core, it must outlive the engine. The cores share their code pages so stores of each core
+     * invalidate the blocks translated for the others, thus no code may have been translated for the core yet
+     *
+     * @param vm the vm executing the core
+     * @return the index of the core, used to signal it
+     */
+    unsigned add(vm_if& vm) {
+        if(running)
+            throw std::runtime_error("cores cannot be added to a running smp engine");
+        auto* core = dynamic_cast<ARCH*>(vm.get_arch());
+        if(!core)
+            throw std::runtime_error("the vm does not execute a core of the architecture of the smp engine");
+        auto* context = core->get_context();
+        if(!context)
+            throw std::runtime_error("the vm does not attach a context to its core");
+        if(!cores.empty())
+            context->share_code_pages(*cores.front()->core.get_context());
+        // the writes and atomic accesses of the cores to their memory get synchronized as they run concurrently
+        context->set_atomic_domain(&atomic_domain::global(), arch::traits<ARCH>::MEM);
+        cores.push_back(std::make_unique<hart>(vm, *core));
+        return static_cast<unsigned>(cores.size() - 1);
+    }
+
+    size_t size() const { return cores.size(); }
+
+    void set_signal_handler(signal_handler handler) { on_signal = std::move(handler); }
+
+    void set_time_keeper(time_keeper keeper) { on_quantum = std::move(keeper); }
+    /**
+     * run all cores until each of them reached the instruction count limit or the cluster got stopped
+     *
+     * @param icount_limit the instruction count each core runs up to
+     * @param cond conditions to stop execution
+     * @return 0 on success, the first error code of a core otherwise
+     */
+    int run(uint64_t icount_limit = std::numeric_limits<uint64_t>::max(),
+            finish_cond_e cond = finish_cond_e::ICOUNT_LIMIT | finish_cond_e::JUMP_TO_SELF) {
+        if(cores.empty())
+            return 0;
+        auto start = std::chrono::high_resolution_clock::now();
+        running = true;
+        stop_requested = false;
+        error = 0;
+        failure = nullptr;
+        sync.reset(cores.size());
+        std::vector<std::thread> threads;
+        threads.reserve(cores.size());
+        for(unsigned i = 0; i < cores.size(); ++i)
+            threads.emplace_back([this, i, icount_limit, cond]() { execute(i, icount_limit, cond); });
+        for(auto& t : threads)
+            t.join();
+        running = false;
+        auto millis = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start).count();
+        uint64_t icount = 0;
+        for(auto& c : cores)
+            icount += c->icount();
+        CPPLOG(INFO) << "Executed " << icount << " instructions on " << cores.size() << " cores in " << sync.quanta() << " quanta during "
+                     << millis << "ms resulting in " << (icount * 0.001 / millis) << "MIPS";
+        if(failure)
+            std::rethrow_exception(failure);
+        return error;
+    }
+    /**
+     * send signals to a core, can be called from any thread including the threads of the cores
+     *
+     * @param core the index of the core
+     * @param signals the signals as bit mask, they accumulate until the core handles them
+     */
+    void signal(unsigned core, uint64_t signals) { cores.at(core)->mailbox.fetch_or(signals, std::memory_order_release); }
+    /**
+     * request all cores to stop at the end of their current quantum, can be called from any thread
+     */
+    void stop() { stop_requested.store(true, std::memory_order_release); }
+    /**
+     * get the number of quanta completed by the cluster, i.e. the time of the cluster
+     *
+     * @return the number of quanta
+     */
+    uint64_t quanta() const { return sync.quanta(); }
+
+private:
+    struct hart {
+        hart(vm_if& vm, ARCH& core)
+        : vm(vm)
+        , core(core) {}
+
+        uint64_t icount() const {
+            auto offset = arch::traits<ARCH>::reg_byte_offsets[arch::traits<ARCH>::ICOUNT];
+            return *reinterpret_cast<uint64_t const*>(core.get_regs_base_ptr() + offset);
+        }
+
+        vm_if& vm;
+        ARCH& core;
+        //! the signals not handled yet
+        std::atomic<uint64_t> mailbox{0};
+    };
+    /**
+     * barrier the cores meet at the end of each quantum, cores leaving the cluster drop out of it
+     */
+    class barrier {
+    public:
+        void reset(size_t participants) {
+            std::lock_guard<std::mutex> lock(mtx);
+            expected = participants;
+            arrived = 0;
+            completed = 0;
+        }
+        /**
+         * wait until all participants arrived, the last one runs the completion before releasing the others
+         */
+        template <typename F> void arrive_and_wait(F const& completion) {
+            std::unique_lock<std::mutex> lock(mtx);
+            auto phase = completed;
+            if(++arrived == expected)
+                complete(completion);
+            else
+                cv.wait(lock, [this, phase]() { return completed != phase; });
+        }
+        /**
+         * leave the barrier, participants waiting for this one are released
+         */
+        template <typename F> void arrive_and_drop(F const& completion) {
+            std::lock_guard<std::mutex> lock(mtx);
+            --expected;
+            if(expected && arrived == expected)
+                complete(completion);
+        }
+
+        uint64_t quanta() const {
+            std::lock_guard<std::mutex> lock(mtx);
+            return completed;
+        }
+
+    private:
+        template <typename F> void complete(F const& completion) {
+            completion(completed);
+            arrived = 0;
+            completed++;
+            cv.notify_all();
+        }
+
+        mutable std::mutex mtx;
+        std::condition_variable cv;
+        size_t expected{0};
+        size_t arrived{0};
+        uint64_t completed{0};
+    };
+
+    void execute(unsigned idx, uint64_t icount_limit, finish_cond_e cond) {
+        auto& c = *cores[idx];
+        auto completion = [this](uint64_t quantum) {
+            if(on_quantum)
+                on_quantum(quantum);
+        };
+        // the slices need to return at the end of the quantum
+        cond = cond | finish_cond_e::ICOUNT_LIMIT;
+        try {
+            while(!stop_requested.load(std::memory_order_acquire)) {
+                if(auto signals = c.mailbox.exchange(0, std::memory_order_acquire))
+                    if(on_signal)
+                        on_signal(idx, signals);
+                auto icount = c.icount();
+                if(icount >= icount_limit || c.core.should_stop())
+                    break;
+                // unsynchronized cores still return regularly to see signals, stop requests and stopped peers
+                auto slice = cfg.quantum ? cfg.quantum : std::max<uint64_t>(cfg.poll_interval, 1);
+                auto limit = std::min(icount_limit, icount + slice);
+                auto result = slice_e::LIMIT;
+                // a vm declines blocks still being compiled in the background, it gets called again once they are done
+                while(true) {
+                    if(auto res = c.vm.run_slice(limit, cond, result)) {
+                        report(res);
+                        result = slice_e::STOPPED;
+                    }
+                    if(result != slice_e::DECLINED || stop_requested.load(std::memory_order_relaxed))
+                        break;
+                    std::this_thread::yield();
+                }
+                if(result == slice_e::STOPPED) {
+                    stop();
+                    break;
+                }
+                if(cfg.quantum)
+                    sync.arrive_and_wait(completion);
+            }
+        } catch(...) {
+            std::lock_guard<std::mutex> lock(result_mtx);
+            if(!failure)
+                failure = std::current_exception();
+            stop();
+        }
+        sync.arrive_and_drop(completion);
+    }
+
+    void report(int res) {
+        std::lock_guard<std::mutex> lock(result_mtx);
+        if(!error)
+            error = res;
+    }
+
+    engine_config const cfg;
+    std::vector<std::unique_ptr<hart>> cores;
+    signal_handler on_signal;
+    time_keeper on_quantum;
+    barrier sync;
+    std::atomic<bool> stop_requested{false};
+    bool running{false};
+    std::mutex result_mtx;
+    int error{0};
+    std::exception_ptr failure;
+};
+} // namespace smp
+} // namespace iss
+
+#endif /* _ISS_SMP_ENGINE_H_ */
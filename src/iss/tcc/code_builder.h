@@ -55,6 +55,22 @@ template <typename ARCH> struct code_builder {
     std::vector<std::string> lines{};
     std::unordered_set<std::string> additional_prologue;
     std::array<bool, arch::traits<ARCH>::NUM_REGS> defined_regs{false};
+    //! offset of the pointer to the context of the core from vm_ptr
+    size_t context_offset{0};
+    //! offset of the software TLB from the context, see core_context::get_tlb_offset()
+    size_t tlb_offset{0};
+    //! true if an access looks up the software TLB
+    bool uses_tlb{false};
+    //! offset of the window registers from the context, see core_context::get_window_offset()
+    size_t window_offset{0};
+    //! mask of the guest addresses covered by the host window
+    uint64_t window_mask{0};
+    //! true if the accesses of the instruction being generated go to the host window
+    bool window_access{false};
+    //! true if an access goes to the host window
+    bool uses_window{false};
+    //! the address of the instruction being generated
+    uint64_t cur_pc{0};
     inline std::string add_reg_ptr(std::string const& name, unsigned reg_num) {
         return fmt::format("  uint{0}_t* {2} = (uint{0}_t*)(regs_ptr+{1:#x});\n", arch::traits<ARCH>::reg_bit_widths[reg_num],
                            arch::traits<ARCH>::reg_byte_offsets[reg_num], name);
@@ -64,6 +80,82 @@ template <typename ARCH> struct code_builder {
                            base_ptr + arch::traits<ARCH>::reg_byte_offsets[reg_num], name);
     }
     std::ostream& write_prologue(std::ostream&);
+    /**
+     * emit a read of the memory, accesses to the memory space load from the host window if the instruction may access
+     * it. Otherwise they look up the software TLB and call read_memN only if the page is not entered
+     */
+    inline value read_mem(mem_type_e type, std::string const& addr, uint32_t size) {
+        switch(size) {
+        case 8:
+        case 16:
+        case 32:
+        case 64: {
+            auto id = lines.size();
+            lines.push_back(fmt::format("uint{}_t rd_{};", size, id));
+            if(type != arch::traits<ARCH>::MEM) {
+                lines.push_back(fmt::format("if((*read_mem{})(core_ptr, {}, {}, {}, &rd_{})) goto trap_entry;", size / 8,
+                                            static_cast<uint16_t>(iss::address_type::VIRTUAL), type, addr, id));
+                return value(fmt::format("rd_{}", id), size, false);
+            }
+            if(window_access) {
+                uses_window = true;
+                lines.push_back(fmt::format("wregs[1] = {:#x}ULL; rd_{} = *(uint{}_t*)(win + ((uint64_t)({}) & {:#x}ULL));", cur_pc, id,
+                                            size, addr, window_mask));
+                return value(fmt::format("rd_{}", id), size, false);
+            }
+            uses_tlb = true;
+            lines.push_back(fmt::format("{{ uint64_t a_{} = (uint64_t)({});", id, addr));
+            lines.push_back(fmt::format("uint64_t* e_{0} = (uint64_t*)(tlb + ((a_{0} >> {1}) & {2}) * {3});", id,
+                                        iss::jit::soft_tlb::page_bits, iss::jit::soft_tlb::entry_count - 1, sizeof(iss::jit::tlb_entry)));
+            lines.push_back(fmt::format("if((a_{0} & {1:#x}ULL) == e_{0}[{2}]) rd_{0} = *(uint{3}_t*)(a_{0} + e_{0}[{4}]);", id,
+                                        iss::jit::soft_tlb::tag_mask(size / 8), iss::jit::soft_tlb::read_tag_offset / 8, size,
+                                        iss::jit::soft_tlb::addend_offset / 8));
+            lines.push_back(fmt::format("else if((*read_mem{})(core_ptr, {}, {}, a_{}, &rd_{})) goto trap_entry; }}", size / 8,
+                                        static_cast<uint16_t>(iss::address_type::VIRTUAL), type, id, id));
+            return value(fmt::format("rd_{}", id), size, false);
+        }
+        default:
+            assert(false && "Unsupported mem read length");
+            return value("", 0, false);
+        }
+    }
+    /**
+     * emit a write to the memory, accesses to the memory space store to the host window if the instruction may access
+     * it. Otherwise they look up the software TLB and call write_memN only if the page is not entered as writable
+     */
+    inline void write_mem(mem_type_e type, std::string const& addr, value const& val) {
+        switch(val.size()) {
+        case 8:
+        case 16:
+        case 32:
+        case 64: {
+            if(type != arch::traits<ARCH>::MEM) {
+                lines.push_back(fmt::format("if((*write_mem{})(core_ptr, {}, {}, {}, {})) goto trap_entry;", val.size() / 8,
+                                            static_cast<uint16_t>(iss::address_type::VIRTUAL), type, addr, val));
+                break;
+            }
+            if(window_access) {
+                uses_window = true;
+                lines.push_back(fmt::format("wregs[1] = {:#x}ULL; *(uint{}_t*)(win + ((uint64_t)({}) & {:#x}ULL)) = {};", cur_pc,
+                                            val.size(), addr, window_mask, val));
+                break;
+            }
+            uses_tlb = true;
+            auto id = lines.size();
+            lines.push_back(fmt::format("{{ uint64_t a_{} = (uint64_t)({});", id, addr));
+            lines.push_back(fmt::format("uint64_t* e_{0} = (uint64_t*)(tlb + ((a_{0} >> {1}) & {2}) * {3});", id,
+                                        iss::jit::soft_tlb::page_bits, iss::jit::soft_tlb::entry_count - 1, sizeof(iss::jit::tlb_entry)));
+            lines.push_back(fmt::format("if((a_{0} & {1:#x}ULL) == e_{0}[{2}]) *(uint{3}_t*)(a_{0} + e_{0}[{4}]) = {5};", id,
+                                        iss::jit::soft_tlb::tag_mask(val.size() / 8), iss::jit::soft_tlb::write_tag_offset / 8,
+                                        val.size(), iss::jit::soft_tlb::addend_offset / 8, val));
+            lines.push_back(fmt::format("else if((*write_mem{})(core_ptr, {}, {}, a_{}, {})) goto trap_entry; }}", val.size() / 8,
+                                        static_cast<uint16_t>(iss::address_type::VIRTUAL), type, id, val));
+            break;
+        }
+        default:
+            assert(false && "Unsupported mem write length");
+        }
+    }
     std::string finish() {
         std::ostringstream os;
         // generate prologue
@@ -76,6 +168,14 @@ template <typename ARCH> struct code_builder {
         os << add_reg_ptr("last_branch", arch::traits<ARCH>::LAST_BRANCH);
         os << "*last_branch = 0;\n";
         os << "uint64_t tval = 0;\n";
+        if(uses_tlb || uses_window)
+            os << fmt::format("uint8_t* ctx = *(uint8_t**)((uint8_t*)vm_ptr + {});\n", context_offset);
+        if(uses_tlb)
+            os << fmt::format("uint8_t* tlb = ctx + {};\n", tlb_offset);
+        if(uses_window) {
+            os << fmt::format("uint64_t* wregs = (uint64_t*)(ctx + {});\n", window_offset);
+            os << "uint8_t* win = (uint8_t*)wregs[0];\n";
+        }
 
         for(size_t i = 0; i < arch::traits<ARCH>::NUM_REGS; ++i) {
             if(defined_regs[i]) {
@@ -342,69 +442,13 @@ template <typename ARCH> struct code_builder {
         return res;
     }
 
-    inline value read_mem(mem_type_e type, uint64_t addr, uint32_t size) {
-        switch(size) {
-        case 8:
-        case 16:
-        case 32:
-        case 64: {
-            auto id = lines.size();
-            lines.push_back(fmt::format("uint{}_t rd_{};", size, id));
-            lines.push_back(fmt::format("if((*read_mem{})(core_ptr, {}, {}, {}, &rd_{})) goto trap_entry;", size / 8,
-                                        iss::address_type::VIRTUAL, type, addr, id));
-            return value(fmt::format("rd_{}", id), size, false);
-        }
-        default:
-            assert(false && "Unsupported mem read length");
-            return value("", 0, false);
-        }
-    }
+    inline value read_mem(mem_type_e type, uint64_t addr, uint32_t size) { return read_mem(type, fmt::format("{}ULL", addr), size); }
 
-    inline value read_mem(mem_type_e type, value const& addr, uint32_t size) {
-        switch(size) {
-        case 8:
-        case 16:
-        case 32:
-        case 64: {
-            auto id = lines.size();
-            lines.push_back(fmt::format("uint{}_t rd_{};", size, id));
-            lines.push_back(fmt::format("if((*read_mem{})(core_ptr, {}, {}, {}, &rd_{})) goto trap_entry;", size / 8,
-                                        iss::address_type::VIRTUAL, type, addr, id));
-            return value(fmt::format("rd_{}", id), size, false);
-        }
-        default:
-            assert(false && "Unsupported mem read length");
-            return value("", 0, false);
-        }
-    }
+    inline value read_mem(mem_type_e type, value const& addr, uint32_t size) { return read_mem(type, addr.str, size); }
 
-    inline void write_mem(mem_type_e type, uint64_t addr, value val) {
-        switch(val.size()) {
-        case 8:
-        case 16:
-        case 32:
-        case 64:
-            lines.push_back(fmt::format("if((*write_mem{})(core_ptr, {}, {}, {}, {})) goto trap_entry;", val.size() / 8,
-                                        iss::address_type::VIRTUAL, type, addr, val));
-            break;
-        default:
-            assert(false && "Unsupported mem write length");
-        }
-    }
+    inline void write_mem(mem_type_e type, uint64_t addr, value val) { write_mem(type, fmt::format("{}ULL", addr), val); }
 
-    inline void write_mem(mem_type_e type, value const& addr, value val) {
-        switch(val.size()) {
-        case 8:
-        case 16:
-        case 32:
-        case 64:
-            lines.push_back(fmt::format("if((*write_mem{})(core_ptr, {}, {}, {}, {})) goto trap_entry;", val.size() / 8,
-                                        iss::address_type::VIRTUAL, type, addr, val));
-            break;
-        default:
-            assert(false && "Unsupported mem read length");
-        }
-    }
+    inline void write_mem(mem_type_e type, value const& addr, value val) { write_mem(type, addr.str, val); }
 
     inline value callf(std::string const& fn) { return {fmt::format("(*{})()", fn), 32, false}; }
 
@@ -466,6 +510,13 @@ template <typename ARCH> inline std::ostream& code_builder<ARCH>::write_prologue
     os << "int (*write_mem4)(void*, uint32_t, uint32_t, uint64_t, uint32_t)=" << (uintptr_t)&write_mem4 << ";\n";
     os << "int (*read_mem8)( void*, uint32_t, uint32_t, uint64_t, uint64_t*)=" << (uintptr_t)&read_mem8 << ";\n";
     os << "int (*write_mem8)(void*, uint32_t, uint32_t, uint64_t, uint64_t)=" << (uintptr_t)&write_mem8 << ";\n";
+    os << "int (*load_reserved4)(void*, uint32_t, uint32_t, uint64_t, uint32_t*)=" << (uintptr_t)&load_reserved4 << ";\n";
+    os << "int (*load_reserved8)(void*, uint32_t, uint32_t, uint64_t, uint64_t*)=" << (uintptr_t)&load_reserved8 << ";\n";
+    os << "int (*store_conditional4)(void*, uint32_t, uint32_t, uint64_t, uint32_t, uint32_t*)=" << (uintptr_t)&store_conditional4 << ";\n";
+    os << "int (*store_conditional8)(void*, uint32_t, uint32_t, uint64_t, uint64_t, uint32_t*)=" << (uintptr_t)&store_conditional8 << ";\n";
+    os << "int (*atomic_rmw4)(void*, uint32_t, uint32_t, uint64_t, uint32_t, uint32_t, uint32_t*)=" << (uintptr_t)&atomic_rmw4 << ";\n";
+    os << "int (*atomic_rmw8)(void*, uint32_t, uint32_t, uint64_t, uint32_t, uint64_t, uint64_t*)=" << (uintptr_t)&atomic_rmw8 << ";\n";
+    os << "void (*mem_fence)(void*, uint32_t)=" << (uintptr_t)&mem_fence << ";\n";
     os << "uint64_t (*enter_trap)(void*, uint64_t, uint64_t, uint64_t)=" << (uintptr_t)&enter_trap << ";\n";
     os << "uint64_t (*leave_trap)(void*, uint64_t)=" << (uintptr_t)&leave_trap << ";\n";
     os << "void (*wait)(void*, uint64_t)=" << (uintptr_t)&wait << ";\n";
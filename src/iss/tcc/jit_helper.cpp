@@ -33,51 +33,101 @@
 
 #include "jit_helper.h"
 #include <array>
+#include <atomic>
 #include <fmt/format.h>
 #include <fstream>
 #include <iostream>
 #include <iss/log_categories.h>
 #include <iss/vm_jit_funcs.h>
 #include <memory>
+#include <mutex>
 #include <stdexcept>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
 
 using namespace logging;
 
 namespace iss {
 namespace tcc {
+namespace {
+// TCC changes the page protection of the memory it relocates into, so the code gets pages of its own which are
+// returned to the OS instead of the heap
+void* alloc_code_mem(size_t size) {
+#ifdef _WIN32
+    return VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+    auto* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return mem == MAP_FAILED ? nullptr : mem;
+#endif
+}
+
+struct tcc_state_deleter {
+    void operator()(TCCState* s) const { tcc_delete(s); }
+};
+using tcc_state_ptr = std::unique_ptr<TCCState, tcc_state_deleter>;
+// libtcc keeps global state while compiling and relocating, depending on its version it does not guard it itself. So the
+// vms of a process running on concurrent threads take turns using it
+std::mutex tcc_mtx;
+} // namespace
+
+void free_code_mem(void* mem, size_t size) {
+#ifdef _WIN32
+    VirtualFree(mem, 0, MEM_RELEASE);
+#else
+    munmap(mem, size);
+#endif
+}
 
 translation_block getPointerToFunction(unsigned cluster_id, uint64_t phys_addr, gen_func& generator, bool dumpEnabled) {
+    auto res = generator();
+    return compile_function(cluster_id, phys_addr, std::get<0>(res), std::get<1>(res), dumpEnabled);
+}
+
+translation_block compile_function(unsigned cluster_id, uint64_t phys_addr, std::string const& fname, std::string const& code,
+                                   bool dumpEnabled) {
 #ifndef NDEBUG
     CPPLOG(TRACE) << "Compiling and executing code for 0x" << std::hex << phys_addr << std::dec;
 #endif
-    static unsigned i = 0;
-    auto res = generator();
+    static std::atomic<unsigned> i{0};
     if(dumpEnabled) {
         std::string name(fmt::format("tcc_jit_{}.c", ++i));
         std::ofstream ofs(name);
-        ofs << std::get<1>(res) << std::endl;
+        ofs << code << std::endl;
     }
-    auto tcc = tcc_new();
+    std::lock_guard<std::mutex> lock(tcc_mtx);
+    tcc_state_ptr tcc(tcc_new());
     if(!tcc)
         throw std::runtime_error("could not create TCC instance");
-    tcc_set_output_type(tcc, TCC_OUTPUT_MEMORY);
-    tcc_set_options(tcc, "-fno-common");
-    tcc_set_options(tcc, "-w");
+    tcc_set_output_type(tcc.get(), TCC_OUTPUT_MEMORY);
+    tcc_set_options(tcc.get(), "-fno-common");
+    tcc_set_options(tcc.get(), "-w");
     /* relocate the code */
-    auto result = tcc_compile_string(tcc, std::get<1>(res).c_str());
+    auto result = tcc_compile_string(tcc.get(), code.c_str());
     if(result)
         throw std::runtime_error("could not compile translated code");
-    int size = tcc_relocate(tcc, nullptr);
+    int size = tcc_relocate(tcc.get(), nullptr);
     if(!size)
         throw std::runtime_error("TCC did not return reasonable code size");
-    auto* fmem = malloc(size);
-    result = tcc_relocate(tcc, fmem);
-    if(result)
+    auto* fmem = alloc_code_mem(size);
+    if(!fmem)
+        throw std::runtime_error("could not allocate memory for compiled code");
+    result = tcc_relocate(tcc.get(), fmem);
+    if(result) {
+        free_code_mem(fmem, size);
         throw std::runtime_error("could not relocate compiled code");
+    }
     /* get entry symbol */
-    auto func = tcc_get_symbol(tcc, std::get<0>(res).c_str());
-    tcc_delete(tcc);
-    return translation_block(func, {nullptr, nullptr}, fmem);
+    auto func = tcc_get_symbol(tcc.get(), fname.c_str());
+    if(!func) {
+        free_code_mem(fmem, size);
+        throw std::runtime_error("could not find the compiled function");
+    }
+    // the state only owns memory it allocated itself (TCC_RELOCATE_AUTO), the code got copied into fmem which stays
+    // with the block so deleting the state does not touch it
+    return translation_block(func, {nullptr, nullptr}, fmem, size);
 }
 } // namespace tcc
 } // namespace iss
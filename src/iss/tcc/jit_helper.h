@@ -55,14 +55,23 @@ class arch_if;
 class vm_if;
 
 namespace tcc {
+/**
+ * release the memory TCC relocated a translation block into
+ *
+ * @param mem the memory holding the code
+ * @param size the size passed to tcc_relocate()
+ */
+void free_code_mem(void* mem, size_t size);
 
 struct alignas(4 * sizeof(void*)) translation_block {
     uintptr_t f_ptr = 0;
+    size_t f_size = 0;
     std::array<translation_block*, 2> cont;
     void* f_mem;
 
-    explicit translation_block(void* f_ptr_, std::array<translation_block*, 2> cont_, void* mem_ptr = nullptr)
+    explicit translation_block(void* f_ptr_, std::array<translation_block*, 2> cont_, void* mem_ptr = nullptr, size_t mem_size = 0)
     : f_ptr(reinterpret_cast<uintptr_t>(f_ptr_))
+    , f_size(mem_size)
     , cont(cont_)
     , f_mem(mem_ptr) {}
 
@@ -74,6 +83,7 @@ struct alignas(4 * sizeof(void*)) translation_block {
 
     translation_block(translation_block&& o) {
         f_ptr = o.f_ptr, o.f_ptr = 0;
+        f_size = o.f_size, o.f_size = 0;
         cont = o.cont;
         o.cont[0] = nullptr;
         o.cont[1] = nullptr;
@@ -82,7 +92,10 @@ struct alignas(4 * sizeof(void*)) translation_block {
     }
 
     translation_block& operator=(translation_block&& o) {
+        if(f_mem && f_mem != o.f_mem)
+            free_code_mem(f_mem, f_size);
         f_ptr = o.f_ptr, o.f_ptr = 0;
+        f_size = o.f_size, o.f_size = 0;
         cont = o.cont;
         o.cont[0] = nullptr;
         o.cont[1] = nullptr;
@@ -91,15 +104,40 @@ struct alignas(4 * sizeof(void*)) translation_block {
         return *this;
     }
 
+    // freeing the code used to crash as it lived in heap pages made executable together with their neighbours and
+    // blocks got destroyed by a flush while still executing. The code has pages of its own now and the translation
+    // cache destroys removed blocks only after all dispatchers left them
     ~translation_block() {
-        // FIXME: uncommenting the following line causes errors when continuing jitting
-        // free(f_mem);
+        if(f_mem)
+            free_code_mem(f_mem, f_size);
+    }
+    /**
+     * create a block executing the code of another one without owning it, e.g. if the code is shared
+     *
+     * @param owner the block owning the code
+     * @return the block
+     */
+    static translation_block view_of(translation_block const& owner) {
+        return translation_block(reinterpret_cast<void*>(owner.f_ptr), {nullptr, nullptr}, nullptr, owner.f_size);
     }
 };
 
 using gen_func = std::function<std::tuple<std::string, std::string>(void)>;
 
 translation_block getPointerToFunction(unsigned cluster_id, uint64_t phys_addr, gen_func& generator, bool dumpEnabled);
+/**
+ * compile the C code of a block, other than getPointerToFunction() it does not use the vm and can be called from any thread.
+ * The compilations of all threads take turns as libtcc is not reentrant
+ *
+ * @param cluster_id the cluster of the vm
+ * @param phys_addr the physical start address of the block
+ * @param fname the name of the block function
+ * @param code the C code of the block
+ * @param dumpEnabled write the code to a file
+ * @return the translation block
+ */
+translation_block compile_function(unsigned cluster_id, uint64_t phys_addr, std::string const& fname, std::string const& code,
+                                   bool dumpEnabled);
 } // namespace tcc
 } // namespace iss
 #endif /* _MCJITHELPER_H_ */
@@ -36,11 +36,16 @@
 #define TCC_VM_BASE_H_
 
 #include "jit_helper.h"
-#include <absl/container/flat_hash_map.h>
 #include <iss/arch/traits.h>
 #include <iss/arch_if.h>
+#include <iss/core_context.h>
 #include <iss/debugger/target_adapter_base.h>
 #include <iss/debugger_if.h>
+#include <iss/jit/async_compiler.h>
+#include <iss/jit/chaining.h>
+#include <iss/jit/code_sharing.h>
+#include <iss/jit/pretranslation.h>
+#include <iss/jit/translation_cache.h>
 #include <iss/tcc/code_builder.h>
 #include <iss/vm_if.h>
 #include <iss/vm_plugin.h>
@@ -49,11 +54,13 @@
 #include <util/logging.h>
 #include <util/range_lut.h>
 
+#include <algorithm>
 #include <array>
 #include <chrono>
 #include <map>
 #include <sstream>
 #include <stack>
+#include <typeinfo>
 #include <utility>
 #include <vector>
 
@@ -106,78 +113,383 @@ public:
 
     int start(uint64_t icount_limit = std::numeric_limits<uint64_t>::max(), bool dump = false,
               finish_cond_e cond = finish_cond_e::ICOUNT_LIMIT | finish_cond_e::JUMP_TO_SELF) override {
-        int error = 0;
-        uint32_t was_illegal = 0;
+        auto start = std::chrono::high_resolution_clock::now();
+        CPPLOG(INFO) << "Start at 0x" << std::hex << get_reg<typename arch::traits<ARCH>::addr_t>(arch::traits<ARCH>::PC) << std::dec;
+        slice_e result;
+        auto error = execute(icount_limit, dump, cond, result, true);
+        if(result != slice_e::STOPPED)
+            CPPLOG(INFO) << "ISS execution finished";
+        auto end = std::chrono::high_resolution_clock::now(); // end measurement
+                                                              // here
+        auto elapsed = end - start;
+        auto millis = std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count();
+        auto cur_icount = get_reg<uint64_t>(arch::traits<ARCH>::reg_e::ICOUNT);
+        CPPLOG(INFO) << "Executed " << cur_icount << " instructions in " << func_map.size() << " code blocks during " << millis
+                     << "ms resulting in " << (cur_icount * 0.001 / millis) << "MIPS";
+        auto& cache_stats = func_map.get_stats();
+        CPPLOG(DEBUG) << "Translation cache holds " << cache_stats.footprint() << " bytes, " << cache_stats.insertions
+                      << " blocks translated, " << cache_stats.evictions << " evicted, hit rate " << cache_stats.hit_rate() << " ("
+                      << cache_stats.jump_cache_hits << " from the jump cache)";
+        return error;
+    }
+
+    int run_slice(uint64_t icount_limit, finish_cond_e cond, slice_e& result) override {
+        return execute(icount_limit, false, cond, result, false);
+    }
+
+    void reset() override { core.reset(); }
+
+    void reset(uint64_t address) override { core.reset(address); }
+
+    iss::jit::translation_cache_if* get_translation_cache() override { return &func_map; }
+
+    void set_compile_threads(unsigned threads) override {
+        compiler = threads ? std::make_unique<iss::jit::async_compiler<translation_block>>(threads) : nullptr;
+    }
+
+    size_t pretranslate(std::vector<uint64_t> const& entries, size_t max_blocks) override {
+        setup_translation();
+        virt_addr_t pc(iss::access_type::DEBUG_FETCH, 0, 0);
+        continuation_e cont = CONT;
+        generator_state param{this, pc, cont, std::numeric_limits<uint64_t>::max()};
+        gen_func generator = make_generator(param);
+        iss::jit::pretranslation walk(entries, max_blocks);
+        // translating does not change the state of the core
+        spec_regs.assign(regs_base_ptr, regs_base_ptr + iss::jit::register_file_size<ARCH>());
+        uint64_t block_pc;
+        while(walk.next(block_pc)) {
+            if(func_map.peek(block_pc) || !func_map.admit(block_pc))
+                continue;
+            try {
+                pc.val = block_pc;
+                translate_block(block_pc, generator, cont, false, false, true);
+                if((cont == CONT || cont == BRANCH) && successors.from == block_pc)
+                    walk.translated(successors);
+            } catch(trap_access&) {
+            } catch(decoding_error&) {
+            }
+        }
+        if(compiler)
+            compiler->wait_all();
+        install_compiled();
+        walk.link(func_map);
+        std::copy(spec_regs.begin(), spec_regs.end(), regs_base_ptr);
+        return walk.size();
+    }
+
+    void pre_instr_sync() override {
+        uint64_t pc = get_reg<typename arch::traits<ARCH>::addr_t>(arch::traits<ARCH>::PC);
+        tgt_adapter->check_continue(pc);
+    }
+
+protected:
+    /**
+     * translate the block at pc. With background compilation the block is submitted to the compiler and available once
+     * it got installed. A block published by another vm of the cluster is taken from there if the guest code is unchanged
+     *
+     * @param pc the physical address of the block
+     * @param generator the generator of the block code
+     * @param cont the continuation the generator sets, set from the shared blocks for adopted blocks
+     * @param dump write the generated code to a file
+     * @param wait wait for the background compilation of the block
+     * @param speculative the block is translated ahead of its first execution, it is dropped if the dispatcher would
+     * need to handle its continuation
+     * @return the block or nullptr if it is being compiled and the caller does not wait
+     */
+    translation_block* translate_block(uint64_t pc, gen_func& generator, continuation_e& cont, bool dump, bool wait,
+                                       bool speculative = false) {
+        if(!compiler || !compiler->pending(pc)) {
+            if(auto* tb = shareable() ? sharing.adopt(func_map, pc, cont, successors, speculative) : nullptr)
+                return tb;
+            // writes to the guest code from the start of reading it on invalidate the block
+            auto res = generate_tracked(pc, generator);
+            // the dispatcher handles all continuations but CONT and BRANCH right after translating the block
+            auto regular = cont == CONT || cont == BRANCH;
+            if(speculative && !regular) {
+                func_map.untrack(pc);
+                return nullptr;
+            }
+            if(regular && shareable())
+                sharing.prepare(pc, cont, successors);
+            else
+                sharing.withdraw(pc);
+            if(!compiler || !regular)
+                return compile_block(pc, res, cont, dump, speculative);
+            compiler->submit(pc, func_map.install_generation(), [cluster = cluster_id, pc, res = std::move(res), dump]() {
+                return compile_function(cluster, pc, std::get<0>(res), std::get<1>(res), dump);
+            });
+        } else {
+            // the block was generated before, only blocks whose continuation the dispatcher does not handle are compiled
+            // in the background
+            cont = CONT;
+        }
+        if(!wait)
+            return nullptr;
+        compiler->wait(pc);
+        install_compiled();
+        if(auto* tb = func_map.find(pc))
+            return tb;
+        // the cache got flushed meanwhile
+        auto res = generate_tracked(pc, generator);
+        sharing.withdraw(pc);
+        return compile_block(pc, res, cont, dump);
+    }
+    /**
+     * run the generator of the block at pc with the pages of its guest code tracked, see
+     * translation_cache::translate_tracked()
+     *
+     * @param pc the physical address of the block
+     * @param generator the generator of the block code
+     * @return the result of the generator
+     */
+    std::tuple<std::string, std::string> generate_tracked(uint64_t pc, gen_func& generator) {
+        return func_map.translate_tracked(pc, [this, pc, &generator](uint64_t& end) {
+            auto res = generator();
+            end = successors.from == pc ? successors.end : pc + 1;
+            return res;
+        });
+    }
+    /**
+     * compile the block generated and tracked at pc and insert it into the cache
+     *
+     * @param pc the physical address of the block
+     * @param res the result of the generator
+     * @param cont the continuation of the block
+     * @param dump write the generated code to a file
+     * @param speculative the block is not executed right after inserting it
+     * @return the block as stored in the cache
+     */
+    translation_block* compile_block(uint64_t pc, std::tuple<std::string, std::string> const& res, continuation_e cont, bool dump,
+                                     bool speculative = false) {
+        try {
+            auto compiled = compile_function(cluster_id, pc, std::get<0>(res), std::get<1>(res), dump);
+            auto* tb = sharing.insert(func_map, pc, std::move(compiled), speculative);
+            // blocks synchronizing the instruction stream return to the dispatcher each time they are executed
+            if(cont == FLUSH)
+                func_map.mark_code_sync(tb);
+            return tb;
+        } catch(...) {
+            // the pages of a block not making it into the cache must not stay marked
+            func_map.untrack(pc);
+            sharing.withdraw(pc);
+            throw;
+        }
+    }
+    /**
+     * check if the blocks translated now can be shared with the vms of the cluster. Blocks calling plugins embed
+     * addresses of this vm
+     *
+     * @return true if the blocks can be shared
+     */
+    bool shareable() const { return sharing.attached() && plugins.empty(); }
+    /**
+     * set up the vm state the generated code depends on before translating blocks. If configured the vm attaches to
+     * the blocks shared within the cluster, the domain covers the cluster and everything besides the guest code the
+     * generated code depends on. This includes the host window setup, so the vm attaches to another domain if it
+     * changes
+     */
+    void setup_translation() {
         if(this->debugging_enabled())
             sync_exec |= PRE_SYNC;
-        auto start = std::chrono::high_resolution_clock::now();
+        if(!func_map.get_config().share_cluster) {
+            sharing.detach();
+            return;
+        }
+        std::ostringstream domain;
+        domain << "cluster " << cluster_id << "\narch " << typeid(ARCH).name() << "\nbackend tcc\nsync "
+               << static_cast<unsigned>(sync_exec) << "\n";
+        if(auto* window = translation_window())
+            domain << "window " << window->get_size() << " " << core_ctx->get_window_offset() << "\n";
+        else
+            domain << "window none\n";
+        sharing.attach(domain.str());
+    }
+    /**
+     * get the host window the generated code accesses the guest RAM through
+     *
+     * @return the window or nullptr if the accesses go through the software TLB
+     */
+    mem::host_window* translation_window() const {
+        // generated code masks the addresses to the window so it needs to cover all of them
+        auto* window = core_ctx->get_host_window(arch::traits<ARCH>::MEM);
+        return window && window->get_addr_bits() >= std::numeric_limits<addr_t>::digits ? window : nullptr;
+    }
+    /**
+     * translate the successors of a block which are known at translation time and chain them to the block so that
+     * the first execution of a successor does not return to the dispatcher. Translating does not change the state of
+     * the core, successors outside the page of the block or failing to translate are skipped
+     *
+     * @param succ the successors of the block
+     * @param generator the generator of the block code
+     * @param pc the pc the generator translates from
+     * @param cont the continuation the generator sets
+     * @param dump write the generated code to a file
+     */
+    void speculate(iss::jit::block_successors const& succ, gen_func& generator, virt_addr_t& pc, continuation_e& cont, bool dump) {
+        auto saved_pc = pc;
+        auto saved_cont = cont;
+        spec_regs.assign(regs_base_ptr, regs_base_ptr + iss::jit::register_file_size<ARCH>());
+        for(unsigned idx = 0; idx < succ.pc.size(); ++idx) {
+            if(!succ.in_page(idx) || func_map.peek(succ.pc[idx]) || !func_map.admit(succ.pc[idx]))
+                continue;
+            translation_block* tb = nullptr;
+            try {
+                pc.val = succ.pc[idx];
+                tb = translate_block(succ.pc[idx], generator, cont, dump, false, true);
+            } catch(trap_access&) {
+            } catch(decoding_error&) {
+            }
+            auto* from = func_map.peek(succ.from);
+            if(tb && from && from->cont[idx] == nullptr)
+                func_map.link(from, idx, tb);
+        }
+        std::copy(spec_regs.begin(), spec_regs.end(), regs_base_ptr);
+        pc = saved_pc;
+        cont = saved_cont;
+    }
+
+    void install_compiled() {
+        if(!compiler)
+            return;
+        auto install = [this](uint64_t pc, translation_block&& tb) { sharing.insert(func_map, pc, std::move(tb)); };
+        // blocks dropped as their guest code changed meanwhile or failing to compile give their pages up
+        auto drop = [this](uint64_t pc) {
+            func_map.untrack(pc);
+            sharing.withdraw(pc);
+        };
+        compiler->install(func_map.install_generation(), install, drop);
+    }
+
+    /**
+     * the state the block generator works on, kept outside of its closure to minimize the closure size to allow SSO
+     */
+    struct generator_state {
+        vm_base* vm;
+        virt_addr_t& pc;
+        continuation_e& cont;
+        uint64_t icount_limit;
+    };
+    /**
+     * create the generator translating the block at state.pc
+     *
+     * @param state the state of the generator, needs to outlive it
+     * @return the generator
+     */
+    static gen_func make_generator(generator_state& state) {
+        return gen_func{[&state]() -> std::tuple<std::string, std::string> {
+            std::string fname;
+            std::string code;
+            std::tie(state.cont, fname, code) = state.vm->translate(state.pc, state.icount_limit);
+            state.vm->mod = nullptr;
+            state.vm->func = nullptr;
+            return std::make_tuple(fname, code);
+        }};
+    }
+
+    /**
+     * the dispatch loop
+     *
+     * @param icount_limit the instruction count to run up to
+     * @param dump write the generated code to files
+     * @param cond conditions to stop execution
+     * @param result the reason for returning
+     * @param wait wait for blocks compiled in the background instead of returning
+     * @return 0 on success, the error code of the simulation otherwise
+     */
+    int execute(uint64_t icount_limit, bool dump, finish_cond_e cond, slice_e& result, bool wait) {
+        int error = 0;
+        uint32_t was_illegal = 0;
+        setup_translation();
         virt_addr_t pc(iss::access_type::DEBUG_FETCH, 0, get_reg<typename arch::traits<ARCH>::addr_t>(arch::traits<ARCH>::PC));
-        CPPLOG(INFO) << "Start at 0x" << std::hex << pc.val << std::dec;
+        result = slice_e::LIMIT;
         try {
             continuation_e cont = CONT;
-            // struct to minimize the type size of the closure below to allow SSO
-            struct {
-                vm_base* vm;
-                virt_addr_t& pc;
-                continuation_e& cont;
-            } param = {this, pc, cont};
             // translation_block getPointerToFunction(unsigned cluster_id, uint64_t phys_addr, gen_func &generator, bool
             // dumpEnabled);
-
-            iss::tcc::gen_func generator{[&param, icount_limit]() -> std::tuple<std::string, std::string> {
-                std::string fname;
-                std::string code;
-                std::tie(param.cont, fname, code) = param.vm->translate(param.pc, icount_limit);
-                param.vm->mod = nullptr;
-                param.vm->func = nullptr;
-                return std::make_tuple(fname, code);
-            }};
+            generator_state param{this, pc, cont, icount_limit};
+            iss::tcc::gen_func generator = make_generator(param);
             // explicit std::function to allow use as reference in call below
             // std::function<Function*(Module*)> gen_ref(std::ref(generator));
             translation_block *last_tb = nullptr, *cur_tb = nullptr;
+            uint64_t last_epoch = func_map.epoch();
+            // blocks removed from the cache are freed only after this loop passed a quiescent point
+            iss::jit::translation_cache<translation_block>::dispatcher tb_dispatcher(func_map);
             auto& last_branch = get_reg(arch::traits<ARCH>::reg_e::LAST_BRANCH);
             arch_if* const arch_if_ptr = static_cast<arch_if*>(&core);
             vm_if* const vm_if_ptr = static_cast<vm_if*>(this);
             uint64_t& cur_icount = get_reg<uint64_t>(arch::traits<ARCH>::reg_e::ICOUNT);
+            // the successors of the block translated in this iteration, translated after it got executed
+            iss::jit::block_successors spec;
             while(!core.should_stop() && cur_icount < icount_limit) {
+                spec.clear(0);
                 try {
                     // translate into physical address
                     phys_addr_t pc_p(pc.access, pc.space, pc.val);
+                    // remove the blocks whose guest code got written by the blocks executed so far
+                    if(func_map.has_written())
+                        func_map.invalidate_written();
+                    // make the blocks compiled in the background available
+                    install_compiled();
                     // check if we have the block already compiled
-                    auto it = this->func_map.find(pc_p.val);
-                    if(it == this->func_map.end()) { // if not generate and compile it
-                        auto res = func_map.insert(std::make_pair(pc_p.val, getPointerToFunction(cluster_id, pc_p.val, generator, dump)));
-                        it = res.first;
+                    cur_tb = func_map.find(pc_p.val);
+                    if(cur_tb == nullptr) { // if not generate and compile it unless the block is left to another engine
+                        if(!func_map.admit(pc_p.val) || !(cur_tb = translate_block(pc_p.val, generator, cont, dump, wait))) {
+                            result = slice_e::DECLINED;
+                            break;
+                        }
+                        if(func_map.get_config().speculate && successors.from == pc_p.val)
+                            spec = successors;
                     }
-                    cur_tb = &(it->second);
-                    if(cont == JUMP_TO_SELF) {
-                        // Execute the block we just compiled, but we know it will be the last one
-                        reinterpret_cast<func_ptr>(cur_tb->f_ptr)(regs_base_ptr, arch_if_ptr, vm_if_ptr);
-                        throw simulation_stopped(0);
+                    // inserting may have evicted blocks, last_tb is one of them if the epoch changed
+                    if(last_epoch != func_map.epoch()) {
+                        last_tb = nullptr;
+                        last_epoch = func_map.epoch();
                     }
-                    // if we have a previous block link the just compiled one as successor of the last tb
-                    if(last_tb && last_branch < 2 && last_tb->cont[last_branch] == nullptr)
-                        last_tb->cont[last_branch] = cur_tb;
-                    do {
-                        // execute the compiled function
-                        pc.val = reinterpret_cast<func_ptr>(cur_tb->f_ptr)(regs_base_ptr, arch_if_ptr, vm_if_ptr);
-                        if(core.should_stop() || last_branch == BRANCH_TO_SELF)
+                    tb_dispatcher.quiescent();
+                    // stores must not bypass the write path to pages holding code since translating the block
+                    core_ctx->sync_tlb();
+                    auto run_blocks = [&]() {
+                        if(cont == JUMP_TO_SELF) {
+                            // Execute the block we just compiled, but we know it will be the last one
+                            reinterpret_cast<func_ptr>(cur_tb->f_ptr)(regs_base_ptr, arch_if_ptr, vm_if_ptr);
                             throw simulation_stopped(0);
-                        // update last state
-                        last_tb = cur_tb;
-                        // if the current tb has a successor assign to current tb
-                        if(last_branch < 2 && cur_tb->cont[last_branch] != nullptr && cur_icount < icount_limit) {
-                            cur_tb = cur_tb->cont[last_branch];
-                            // update cont, as it only gets set when a new fptr gets created
-                            cont = static_cast<continuation_e>(last_branch);
-                        } else // if not we need to compile one
-                            cur_tb = nullptr;
-                    } while(cur_tb != nullptr);
-                    if(cont == FLUSH)
-                        func_map.clear();
+                        }
+                        // if we have a previous block link the just compiled one as successor of the last tb
+                        if(last_tb && last_branch < 2 && last_tb->cont[last_branch] == nullptr)
+                            func_map.link(last_tb, last_branch, cur_tb);
+                        do {
+                            // execute the compiled function
+                            pc.val = reinterpret_cast<func_ptr>(cur_tb->f_ptr)(regs_base_ptr, arch_if_ptr, vm_if_ptr);
+                            if(core.should_stop() || last_branch == BRANCH_TO_SELF)
+                                throw simulation_stopped(0);
+                            // update last state
+                            last_tb = cur_tb;
+                            // if the current tb has a successor assign to current tb
+                            if(last_branch < 2 && cur_tb->cont[last_branch] != nullptr && cur_icount < icount_limit) {
+                                cur_tb = cur_tb->cont[last_branch];
+                                // update cont, as it only gets set when a new fptr gets created
+                                cont = static_cast<continuation_e>(last_branch);
+                            } else // if not we need to compile one
+                                cur_tb = nullptr;
+                        } while(cur_tb != nullptr);
+                    };
+                    // blocks accessing the host window fault on accesses to anything but plain RAM
+                    mem::host_window::fault fault;
+                    auto* window = core_ctx->get_host_window(arch::traits<ARCH>::MEM);
+                    if(!window)
+                        run_blocks();
+                    else if(!window->run(run_blocks, fault)) {
+                        recover_window_fault(fault, pc);
+                        continue;
+                    }
+                    if(last_tb && func_map.is_code_sync(last_tb))
+                        func_map.sync_code();
+                    else if(!spec.empty())
+                        speculate(spec, generator, pc, cont, dump);
                     if(cont == ILLEGAL_INSTR) {
                         if(was_illegal > 2) {
                             CPPLOG(ERR) << "ISS execution aborted after trying to execute illegal instructions 3 times in a row";
+                            result = slice_e::STOPPED;
                             error = -1;
                             break;
                         }
@@ -192,46 +504,46 @@ public:
                 CPPLOG(TRACE) << "continuing  @0x" << std::hex << pc << std::dec;
 #endif
             }
-            CPPLOG(INFO) << "ISS execution finished";
             error = core.stop_code() > 1 ? core.stop_code() : 0;
         } catch(simulation_stopped& e) {
             CPPLOG(INFO) << "ISS execution stopped with status 0x" << std::hex << e.state << std::dec;
+            result = slice_e::STOPPED;
             if(e.state != 1)
                 error = e.state;
         } catch(decoding_error& e) {
             CPPLOG(ERR) << "ISS execution aborted at address 0x" << std::hex << e.addr << std::dec;
+            result = slice_e::STOPPED;
             error = -1;
         }
-        auto end = std::chrono::high_resolution_clock::now(); // end measurement
-                                                              // here
-        auto elapsed = end - start;
-        auto millis = std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count();
-        auto cur_icount = get_reg<uint64_t>(arch::traits<ARCH>::reg_e::ICOUNT);
-        CPPLOG(INFO) << "Executed " << cur_icount << " instructions in " << func_map.size() << " code blocks during " << millis
-                     << "ms resulting in " << (cur_icount * 0.001 / millis) << "MIPS";
         return error;
     }
 
-    void reset() override { core.reset(); }
-
-    void reset(uint64_t address) override { core.reset(address); }
-
-    void pre_instr_sync() override {
-        uint64_t pc = get_reg<typename arch::traits<ARCH>::addr_t>(arch::traits<ARCH>::PC);
-        tgt_adapter->check_continue(pc);
-    }
-
-protected:
     std::tuple<continuation_e, std::string, std::string> translate(virt_addr_t pc, uint64_t icount_limit) {
         unsigned cur_blk_size = 0;
         tu_builder tu;
+        tu.context_offset = reinterpret_cast<uintptr_t>(&core_ctx) - reinterpret_cast<uintptr_t>(static_cast<vm_if*>(this));
+        tu.tlb_offset = core_ctx->get_tlb_offset();
+        auto* window = translation_window();
+        auto use_window = window != nullptr;
+        if(use_window) {
+            tu.window_offset = core_ctx->get_window_offset();
+            tu.window_mask = window->get_size() - 1;
+            sharing.sync_window_checked(func_map.get_stats().flushes);
+        }
         add_prologue(tu);
         open_block_func(tu, pc);
         continuation_e cont = CONT;
+        successors.clear(pc.val);
         while(cont == CONT && cur_blk_size < blk_size && cur_blk_size < icount_limit) {
+            tu.cur_pc = pc.val;
+            tu.window_access = use_window && !sharing.is_window_checked(pc.val);
             cont = gen_single_inst_behavior(pc, tu);
             cur_blk_size++;
         }
+        if(cont == CONT)
+            successors.known[0] = true;
+        successors.pc[0] = pc.val;
+        successors.end = pc.val;
         close_block_func(tu);
         if(cont == ILLEGAL_FETCH && cur_blk_size == 1) {
             throw trap_access(0, pc.val);
@@ -239,10 +551,47 @@ protected:
         return std::make_tuple(cont, tu.fname, tu.finish());
     }
 
+    /**
+     * continue after a block faulted accessing the host window. The instructions of the block before the faulting one
+     * completed and the faulting one did not change the state yet, so execution resumes at it. It and the blocks
+     * containing it get translated again with checked accesses which reach MMIO, watchpoints and code pages through
+     * the core
+     *
+     * @param fault the fault
+     * @param pc set to the guest pc of the faulting instruction
+     */
+    void recover_window_fault(mem::host_window::fault const& fault, virt_addr_t& pc) {
+        auto* tb = func_map.find_code(fault.host_pc);
+        if(!tb)
+            throw std::runtime_error(
+                fmt::format("access to guest address {:#x} of the host window faulted outside of translated code", fault.addr));
+        auto guest_pc = core_ctx->get_window_pc();
+#ifndef NDEBUG
+        CPPLOG(TRACE) << "host window access to 0x" << std::hex << fault.addr << " faulted @0x" << guest_pc << std::dec;
+#endif
+        sharing.add_window_checked(guest_pc);
+        func_map.invalidate(tb);
+        get_reg<addr_t>(arch::traits<ARCH>::PC) = static_cast<addr_t>(guest_pc);
+        get_reg<addr_t>(arch::traits<ARCH>::NEXT_PC) = static_cast<addr_t>(guest_pc);
+        pc.val = guest_pc;
+    }
+
     virtual void setup_module(std::string m) {}
 
     virtual continuation_e gen_single_inst_behavior(virt_addr_t& pc_v, tu_builder& tu) = 0;
 
+    /**
+     * record the target of the direct branch ending the block being translated, called by the instruction generators
+     *
+     * @param target the address the branch goes to
+     * @param conditional the branch may fall through to the next instruction
+     */
+    void set_branch_target(uint64_t target, bool conditional) {
+        successors.pc[1] = target;
+        successors.known[1] = true;
+        successors.known[0] = conditional;
+    }
+
     virtual void gen_trap_behavior(tu_builder& tu) {
         tu("trap_entry:");
         tu("return *next_pc;");
@@ -250,6 +599,8 @@ protected:
 
     explicit vm_base(ARCH& core, unsigned core_id = 0, unsigned cluster_id = 0)
     : core(core)
+    , core_ctx_ref(iss::core_context::of(core))
+    , core_ctx(core_ctx_ref.get())
     , core_id(core_id)
     , cluster_id(cluster_id)
     , regs_base_ptr(core.get_regs_base_ptr())
@@ -258,11 +609,18 @@ protected:
     , func(nullptr)
     , tgt_adapter(nullptr) {
         sync_exec = static_cast<sync_type>(sync_exec | core.needed_sync());
+        // writes of the core to the guest code invalidate the blocks translated from it
+        core_ctx->get_code_pages().set_space(arch::traits<ARCH>::MEM);
+        func_map.set_code_pages(core_ctx->get_code_pages());
+        // accesses of the generated code to the memory look up the software TLB first
+        core_ctx->get_tlb().enable(arch::traits<ARCH>::MEM);
         static_assert(sizeof(reg_t) <= 4, "No registers larger than 32 bits are supported with tcc backend");
     }
     explicit vm_base(std::unique_ptr<ARCH> core_ptr, unsigned core_id = 0, unsigned cluster_id = 0)
     : core(*core_ptr)
     , core_ptr(std::move(core_ptr))
+    , core_ctx_ref(iss::core_context::of(core))
+    , core_ctx(core_ctx_ref.get())
     , core_id(core_id)
     , cluster_id(cluster_id)
     , regs_base_ptr(core.get_regs_base_ptr())
@@ -271,6 +629,11 @@ protected:
     , func(nullptr)
     , tgt_adapter(nullptr) {
         sync_exec = static_cast<sync_type>(sync_exec | core.needed_sync());
+        // writes of the core to the guest code invalidate the blocks translated from it
+        core_ctx->get_code_pages().set_space(arch::traits<ARCH>::MEM);
+        func_map.set_code_pages(core_ctx->get_code_pages());
+        // accesses of the generated code to the memory look up the software TLB first
+        core_ctx->get_tlb().enable(arch::traits<ARCH>::MEM);
         static_assert(sizeof(reg_t) <= 4, "No registers larger than 32 bits are supported with tcc backend");
     }
 
@@ -314,11 +677,24 @@ protected:
 
     ARCH& core;
     std::unique_ptr<ARCH> core_ptr;
+    //! the context of the core, shared with the other vms executing it
+    std::shared_ptr<iss::core_context> const core_ctx_ref;
+    //! the context, generated code loads it from the vm
+    iss::core_context* const core_ctx;
     unsigned core_id = 0;
     unsigned cluster_id = 0;
     uint8_t* regs_base_ptr;
     sync_type sync_exec;
-    absl::flat_hash_map<uint64_t, translation_block> func_map;
+    iss::jit::translation_cache<translation_block> func_map;
+    // the blocks shared with the vms of the cluster and the instructions with checked host window accesses, whose
+    // blocks are not shared
+    iss::jit::code_sharing<translation_block> sharing{core};
+    // compiles blocks in the background, null if they are compiled by the simulation thread
+    std::unique_ptr<iss::jit::async_compiler<translation_block>> compiler;
+    // the successors of the block translated last
+    iss::jit::block_successors successors;
+    // the register contents saved while translating successors
+    std::vector<uint8_t> spec_regs;
     // non-owning pointers
     void* mod;
     void* func;
@@ -0,0 +1,271 @@
+/*******************************************************************************
+ * Copyright (C) 2024 MINRES Technologies GmbH
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Contributors:
+ *       eyck@minres.com - initial implementation
+ ******************************************************************************/
+
+#ifndef _ISS_TIERED_VM_H_
+#define _ISS_TIERED_VM_H_
+
+#include <iss/arch/traits.h>
+#include <iss/arch_if.h>
+#include <iss/iss.h>
+#include <iss/jit/tier_profile.h>
+#include <iss/jit/translation_cache_if.h>
+#include <iss/vm_if.h>
+#include <util/logging.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+
+namespace iss {
+namespace tiered {
+/**
+ * vm running a core on up to three engines sharing its register file
+ *
+ * Cold code runs in the interpreter, which does not have a translation latency. Blocks which were interpreted
+ * tier_config::warm_threshold times are translated by the baseline engine (asmjit or TCC), blocks the baseline code
+ * spends most of its time in are translated by the optimized engine (LLVM with the optimization pipeline enabled).
+ * The translation caches of the engines admit only the blocks of their tier, an engine returns to this vm whenever
+ * it reaches a block it did not translate. Blocks are compiled in the background (tier_config::compile_threads) and
+ * executed by the next lower tier until their compilation finished. If one engine flushes its translation cache the
+ * others follow.
+ *
+ * @tparam ARCH the architecture of the core
+ */
+template <typename ARCH> class vm : public vm_if {
+public:
+    using reg_t = typename arch::traits<ARCH>::reg_t;
+    using addr_t = typename arch::traits<ARCH>::addr_t;
+    using tier_e = iss::jit::tier_e;
+
+    constexpr static unsigned blk_size = 128;
+    /**
+     * create the vm from the engines of the core
+     *
+     * @param core the core all engines execute
+     * @param interp the interpreter
+     * @param baseline the engine translating warm blocks, may be null
+     * @param optimized the engine translating hot blocks, may be null
+     * @param cfg the promotion thresholds
+     */
+    vm(ARCH& core, std::unique_ptr<vm_if> interp, std::unique_ptr<vm_if> baseline, std::unique_ptr<vm_if> optimized,
+       iss::jit::tier_config const& cfg = iss::jit::tier_config{})
+    : core(core)
+    , regs_base_ptr(core.get_regs_base_ptr())
+    , profile(cfg) {
+        if(!interp)
+            throw std::runtime_error("a tiered vm needs an interpreter");
+        engines[0] = std::move(interp);
+        // without a baseline engine the optimized engine translates the warm blocks
+        engines[1] = baseline ? std::move(baseline) : std::move(optimized);
+        engines[2] = std::move(optimized);
+        if(auto* cache = cache_of(tier_e::BASELINE))
+            cache->set_admission_filter([this](uint64_t pc) { return profile.tier_of(pc) != tier_e::INTERPRETED; });
+        if(auto* cache = cache_of(tier_e::OPTIMIZED)) {
+            cache->set_admission_filter([this](uint64_t pc) { return profile.tier_of(pc) == tier_e::OPTIMIZED; });
+            engines[2]->set_opt_level(2);
+        }
+        for(unsigned i = 1; i < engines.size(); ++i)
+            if(auto* cache = cache_of(static_cast<tier_e>(i))) {
+                flushes[i] = cache->get_stats().flushes;
+                engines[i]->set_compile_threads(cfg.compile_threads);
+            }
+    }
+
+    ~vm() override {
+        for(unsigned i = 1; i < engines.size(); ++i)
+            if(auto* cache = cache_of(static_cast<tier_e>(i)))
+                cache->set_admission_filter(nullptr);
+    }
+
+    void register_plugin(vm_plugin& plugin) override {
+        for(auto& e : engines)
+            if(e)
+                e->register_plugin(plugin);
+    }
+
+    arch_if* get_arch() override { return &core; }
+
+    int start(uint64_t icount_limit = std::numeric_limits<uint64_t>::max(), bool dump = false,
+              finish_cond_e cond = finish_cond_e::ICOUNT_LIMIT | finish_cond_e::JUMP_TO_SELF) override {
+        auto start = std::chrono::high_resolution_clock::now();
+        CPPLOG(INFO) << "Start at 0x" << std::hex << get_reg<addr_t>(arch::traits<ARCH>::PC) << std::dec;
+        slice_e result;
+        auto error = execute(icount_limit, cond, result);
+        auto end = std::chrono::high_resolution_clock::now();
+        auto millis = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+        auto icount = get_reg<uint64_t>(arch::traits<ARCH>::ICOUNT);
+        CPPLOG(INFO) << "Executed " << icount << " instructions during " << millis << "ms resulting in " << (icount * 0.001 / millis)
+                     << "MIPS";
+        CPPLOG(DEBUG) << "Promoted " << profile.promotions(tier_e::BASELINE) << " blocks to the baseline tier and "
+                      << profile.promotions(tier_e::OPTIMIZED) << " blocks to the optimized tier";
+        return error;
+    }
+
+    int run_slice(uint64_t icount_limit, finish_cond_e cond, slice_e& result) override { return execute(icount_limit, cond, result); }
+
+    void reset(uint64_t address) override { engines[0]->reset(address); }
+
+    void reset() override { engines[0]->reset(); }
+
+    void pre_instr_sync() override { engines[0]->pre_instr_sync(); }
+    /**
+     * get the translation cache of the baseline engine
+     *
+     * @return non-owning pointer to the translation cache or nullptr
+     */
+    jit::translation_cache_if* get_translation_cache() override { return cache_of(tier_e::BASELINE); }
+    /**
+     * get the translation cache of an engine
+     *
+     * @param tier the tier the engine executes
+     * @return non-owning pointer to the translation cache or nullptr
+     */
+    jit::translation_cache_if* get_translation_cache(tier_e tier) { return cache_of(tier); }
+
+    iss::jit::tier_profile const& get_profile() const { return profile; }
+
+protected:
+    template <typename T = reg_t> inline T& get_reg(unsigned r) {
+        return *reinterpret_cast<T*>(regs_base_ptr + arch::traits<ARCH>::reg_byte_offsets[r]);
+    }
+
+    // run the engines of the tiers until the limit is reached or the core stops. Blocks declined by an engine are
+    // executed by a lower tier, so the slice never ends with slice_e::DECLINED
+    int execute(uint64_t icount_limit, finish_cond_e cond, slice_e& result) {
+        // the engines need to return when reaching the limit of their slice
+        cond = cond | finish_cond_e::ICOUNT_LIMIT;
+        int error = 0;
+        result = slice_e::LIMIT;
+        auto& icount = get_reg<uint64_t>(arch::traits<ARCH>::ICOUNT);
+        // the block an engine returned at and the tier of the engine
+        uint64_t declined_pc = std::numeric_limits<uint64_t>::max();
+        auto declined_tier = tier_e::INTERPRETED;
+        while(!error && result != slice_e::STOPPED && !core.should_stop() && icount < icount_limit) {
+            uint64_t pc = get_reg<addr_t>(arch::traits<ARCH>::PC);
+            auto tier = profile.tier_of(pc);
+            if(tier == tier_e::INTERPRETED)
+                tier = profile.record_entry(pc);
+            // an engine declining a block of its tier is still compiling it, so a lower tier executes it meanwhile
+            if(pc == declined_pc && tier >= declined_tier)
+                tier = static_cast<tier_e>(static_cast<unsigned>(declined_tier) - 1);
+            if(tier == tier_e::OPTIMIZED && !engines[2])
+                tier = tier_e::BASELINE;
+            if(tier == tier_e::BASELINE && !engines[1])
+                tier = tier_e::INTERPRETED;
+            switch(tier) {
+            case tier_e::OPTIMIZED:
+                error = engines[2]->run_slice(icount_limit, cond, result);
+                break;
+            case tier_e::BASELINE:
+                error = engines[1]->run_slice(std::min(icount_limit, icount + profile.get_config().sample_interval), cond, result);
+                if(result == slice_e::LIMIT)
+                    profile.record_sample(get_reg<addr_t>(arch::traits<ARCH>::PC));
+                break;
+            default:
+                error = interpret_block(icount_limit, cond, result);
+            }
+            if(result == slice_e::DECLINED) {
+                declined_pc = get_reg<addr_t>(arch::traits<ARCH>::PC);
+                declined_tier = tier;
+            } else
+                declined_pc = std::numeric_limits<uint64_t>::max();
+            sync_flushes();
+        }
+        result = error || result == slice_e::STOPPED || core.should_stop() ? slice_e::STOPPED : slice_e::LIMIT;
+        return error;
+    }
+
+    jit::translation_cache_if* cache_of(tier_e tier) {
+        auto& e = engines[static_cast<unsigned>(tier)];
+        return tier != tier_e::INTERPRETED && e ? e->get_translation_cache() : nullptr;
+    }
+    // interpret the block at the current pc in one slice ending at its first taken branch, interpreters not supporting
+    // finish_cond_e::BRANCH end it after blk_size instructions
+    int interpret_block(uint64_t icount_limit, finish_cond_e cond, slice_e& result) {
+        auto icount = get_reg<uint64_t>(arch::traits<ARCH>::ICOUNT);
+        return engines[0]->run_slice(std::min(icount_limit, icount + blk_size), cond | finish_cond_e::BRANCH, result);
+    }
+    // code changed if one engine flushed its cache so the other engine and the profile need to forget it as well
+    void sync_flushes() {
+        bool flushed = false;
+        for(unsigned i = 1; i < engines.size(); ++i)
+            if(auto* cache = cache_of(static_cast<tier_e>(i)))
+                flushed |= cache->get_stats().flushes != flushes[i];
+        if(!flushed)
+            return;
+        for(unsigned i = 1; i < engines.size(); ++i)
+            if(auto* cache = cache_of(static_cast<tier_e>(i))) {
+                if(cache->get_stats().flushes == flushes[i])
+                    cache->flush();
+                flushes[i] = cache->get_stats().flushes;
+            }
+        profile.clear();
+    }
+
+    ARCH& core;
+    uint8_t* regs_base_ptr;
+    //! the engines indexed by the tier they execute
+    std::array<std::unique_ptr<vm_if>, 3> engines;
+    std::array<uint64_t, 3> flushes{};
+    iss::jit::tier_profile profile;
+};
+/**
+ * create a tiered vm over the interpreter and the JIT engines built into the library. asmjit is preferred over TCC as
+ * baseline engine, LLVM translates the hot blocks. The debugger attaches to the interpreter
+ *
+ * @param core the core to execute
+ * @param port the port of the debugger server, 0 if none is started
+ * @param dump write the code generated by the engines to files
+ * @return the vm
+ */
+template <typename ARCH> std::unique_ptr<iss::vm_if> create(ARCH* core, unsigned short port, bool dump) {
+    std::unique_ptr<vm_if> baseline;
+    std::unique_ptr<vm_if> optimized;
+#if defined(WITH_ASMJIT)
+    baseline = iss::asmjit::create<ARCH>(core, 0, dump);
+#elif defined(WITH_TCC)
+    baseline = iss::tcc::create<ARCH>(core, 0, dump);
+#endif
+#if defined(WITH_LLVM)
+    optimized = iss::llvm::create<ARCH>(core, 0, dump);
+#endif
+    return std::make_unique<vm<ARCH>>(*core, iss::interp::create<ARCH>(core, port, dump), std::move(baseline), std::move(optimized));
+}
+} // namespace tiered
+} // namespace iss
+
+#endif /* _ISS_TIERED_VM_H_ */
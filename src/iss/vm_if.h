@@ -38,13 +38,33 @@
 #include "vm_types.h"
 #include <memory>
 #include <string>
+#include <vector>
 
 namespace iss {
 // forward declaration
 class arch_if;
 class vm_plugin;
+namespace jit {
+class translation_cache_if;
+}
+
+/**
+ * conditions ending vm_if::start() and vm_if::run_slice(). BRANCH ends the execution after the first instruction taking
+ * a branch (setting the LAST_BRANCH register), engines not executing instruction by instruction ignore it
+ */
+enum class finish_cond_e { NONE = 0, JUMP_TO_SELF = 1, ICOUNT_LIMIT = 2, FCOUNT_LIMIT = 4, BRANCH = 8 };
 
-enum class finish_cond_e { NONE = 0, JUMP_TO_SELF = 1, ICOUNT_LIMIT = 2, FCOUNT_LIMIT = 4 };
+/**
+ * reason for returning from vm_if::run_slice()
+ */
+enum class slice_e {
+    //! the instruction count limit was reached
+    LIMIT,
+    //! the block at the current PC is not admitted by the translation cache
+    DECLINED,
+    //! the simulation finished or failed
+    STOPPED
+};
 
 inline finish_cond_e operator|(finish_cond_e a, finish_cond_e b) {
     return static_cast<finish_cond_e>(static_cast<int>(a) | static_cast<int>(b));
@@ -90,6 +110,20 @@ public:
 
     virtual int start(uint64_t count = std::numeric_limits<uint64_t>::max(), bool dump = false,
                       finish_cond_e cond = finish_cond_e::ICOUNT_LIMIT | finish_cond_e::JUMP_TO_SELF) = 0;
+    /**
+     * run a part of the simulation on behalf of another vm sharing the same core, e.g. a tiered vm. Other than start() it
+     * does not report to the log and it returns as soon as the block at the current PC is not admitted or is still being
+     * compiled in the background
+     *
+     * @param count the instruction count to run up to
+     * @param cond conditions to stop execution
+     * @param result the reason for returning
+     * @return 0 on success, the error code of the simulation otherwise
+     */
+    virtual int run_slice(uint64_t count, finish_cond_e cond, slice_e& result) {
+        result = slice_e::STOPPED;
+        return start(count, false, cond);
+    }
     /**
      * reset the core
      *
@@ -104,6 +138,41 @@ public:
      * Synchronization point at the before executing the next instruction
      */
     virtual void pre_instr_sync() = 0;
+    /**
+     * get the translation cache of the vm to configure it and to query its statistics. In case the vm does not
+     * translate code a null pointer is returned
+     *
+     * @return non-owning pointer to the translation cache or nullptr
+     */
+    virtual jit::translation_cache_if* get_translation_cache() { return nullptr; }
+    /**
+     * set the optimization level used when translating code, vms not optimizing their translations ignore it
+     *
+     * @param level 0 translates as fast as possible, higher levels spend more time on the quality of the code
+     */
+    virtual void set_opt_level(unsigned level) {}
+    /**
+     * set the number of threads compiling translated blocks in the background. Blocks being compiled are not executed
+     * by run_slice() but left to the caller, start() waits for them. vms not translating code or translating fast enough
+     * ignore it. It must not be called while the vm is executing
+     *
+     * @param threads the number of threads, 0 compiles in the simulation thread
+     */
+    virtual void set_compile_threads(unsigned threads) {}
+    /**
+     * translate the code reachable from the given addresses ahead of its execution so the translation cache is filled
+     * before the simulation starts, e.g. from the addresses iss::jit::pretranslation_entries() collects for a loaded
+     * executable. The code is followed along the successors known at translation time, the blocks are compiled in
+     * parallel by the threads set with set_compile_threads(). vms not translating code ignore it. It must not be called
+     * while the vm is executing
+     *
+     * @param entries the addresses to start from
+     * @param max_blocks the maximum number of blocks to translate
+     * @return the number of blocks translated
+     */
+    virtual size_t pretranslate(std::vector<uint64_t> const& entries, size_t max_blocks = std::numeric_limits<size_t>::max()) {
+        return 0;
+    }
     /**
      * check if instruction disassembly is enabled
      *
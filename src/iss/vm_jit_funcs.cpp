@@ -33,6 +33,7 @@
 
 #include "vm_jit_funcs.h"
 #include "arch_if.h"
+#include "core_context.h"
 #include "iss.h"
 #include "vm_if.h"
 #include "vm_plugin.h"
@@ -43,9 +44,17 @@ using arch_if_ptr_t = arch_if*;
 using vm_if_ptr_t = vm_if*;
 using vm_plugin_ptr_t = vm_plugin*;
 
-extern "C" {
-uint8_t read_mem_buf[8];
+namespace {
+// the context the vm keeps for the core, the vms of all backends attach one to their core
+inline core_context& context_of(void* iface) { return *reinterpret_cast<arch_if_ptr_t>(iface)->get_context(); }
+// enters the page of an access into the software TLB, cores accessed by other means than a vm have none
+inline void refill_tlb(void* iface, uint32_t addr_type, uint32_t space, uint64_t addr) {
+    if(auto* ctx = reinterpret_cast<arch_if_ptr_t>(iface)->get_context())
+        ctx->refill_tlb((address_type)addr_type, space, addr);
+}
+} // namespace
 
+extern "C" {
 uint8_t fetch(arch_if_ptr_t iface, uint32_t addr_type, uint32_t space, uint64_t addr, uint32_t length, uint8_t* data) {
     return iface->read((address_type)addr_type, access_type::FETCH, (uint16_t)space, addr, length, data);
 }
@@ -55,7 +64,10 @@ uint8_t fetch_dbg(arch_if_ptr_t iface, uint32_t addr_type, uint32_t space, uint6
 }
 
 uint8_t read_mem(arch_if_ptr_t iface, uint32_t addr_type, uint32_t space, uint64_t addr, uint32_t length, uint8_t* data) {
-    return iface->read((address_type)addr_type, access_type::READ, (uint16_t)space, addr, length, data);
+    auto res = iface->read((address_type)addr_type, access_type::READ, (uint16_t)space, addr, length, data);
+    if(res == iss::Ok)
+        refill_tlb(iface, addr_type, space, addr);
+    return res;
 }
 
 uint8_t write_mem(arch_if_ptr_t iface, uint32_t addr_type, uint32_t space, uint64_t addr, uint32_t length, uint8_t* data) {
@@ -63,7 +75,10 @@ uint8_t write_mem(arch_if_ptr_t iface, uint32_t addr_type, uint32_t space, uint6
     CPPLOG(TRACE) << "EXEC: write mem " << (unsigned)type << " of core " << iface << " at addr 0x" << hex << addr << " with value 0x"
                   << data << dec << " of len " << length;
 #endif
-    return iface->write((address_type)addr_type, access_type::WRITE, (uint16_t)space, addr, length, data);
+    auto res = iface->write((address_type)addr_type, access_type::WRITE, (uint16_t)space, addr, length, data);
+    if(res == iss::Ok)
+        refill_tlb(iface, addr_type, space, addr);
+    return res;
 }
 
 uint8_t read_mem_dbg(arch_if_ptr_t iface, uint32_t addr_type, uint32_t space, uint64_t addr, uint32_t length, uint8_t* data) {
@@ -93,41 +108,103 @@ void notify_phase(void* iface, uint32_t phase) { reinterpret_cast<arch_if_ptr_t>
 void call_plugin(void* iface, uint64_t instr_info) { reinterpret_cast<vm_plugin_ptr_t>(iface)->callback(instr_info_t(instr_info)); }
 
 int read_mem1(void* iface, uint32_t addr_type, uint32_t space, uint64_t addr, uint8_t* data) {
-    return reinterpret_cast<arch_if_ptr_t>(iface)->read((address_type)addr_type, access_type::READ, (uint16_t)space, addr, 1, data);
+    auto* core = reinterpret_cast<arch_if_ptr_t>(iface);
+    auto res = core->read((address_type)addr_type, access_type::READ, (uint16_t)space, addr, 1, reinterpret_cast<uint8_t*>(data));
+    if(res == iss::Ok)
+        refill_tlb(iface, addr_type, space, addr);
+    return res;
 }
 
 int read_mem2(void* iface, uint32_t addr_type, uint32_t space, uint64_t addr, uint16_t* data) {
-    return reinterpret_cast<arch_if_ptr_t>(iface)->read((address_type)addr_type, access_type::READ, (uint16_t)space, addr, 2,
-                                                        reinterpret_cast<uint8_t*>(data));
+    auto* core = reinterpret_cast<arch_if_ptr_t>(iface);
+    auto res = core->read((address_type)addr_type, access_type::READ, (uint16_t)space, addr, 2, reinterpret_cast<uint8_t*>(data));
+    if(res == iss::Ok)
+        refill_tlb(iface, addr_type, space, addr);
+    return res;
 }
 
 int read_mem4(void* iface, uint32_t addr_type, uint32_t space, uint64_t addr, uint32_t* data) {
-    return reinterpret_cast<arch_if_ptr_t>(iface)->read((address_type)addr_type, access_type::READ, (uint16_t)space, addr, 4,
-                                                        reinterpret_cast<uint8_t*>(data));
+    auto* core = reinterpret_cast<arch_if_ptr_t>(iface);
+    auto res = core->read((address_type)addr_type, access_type::READ, (uint16_t)space, addr, 4, reinterpret_cast<uint8_t*>(data));
+    if(res == iss::Ok)
+        refill_tlb(iface, addr_type, space, addr);
+    return res;
 }
 
 int read_mem8(void* iface, uint32_t addr_type, uint32_t space, uint64_t addr, uint64_t* data) {
-    return reinterpret_cast<arch_if_ptr_t>(iface)->read((address_type)addr_type, access_type::READ, (uint16_t)space, addr, 8,
-                                                        reinterpret_cast<uint8_t*>(data));
+    auto* core = reinterpret_cast<arch_if_ptr_t>(iface);
+    auto res = core->read((address_type)addr_type, access_type::READ, (uint16_t)space, addr, 8, reinterpret_cast<uint8_t*>(data));
+    if(res == iss::Ok)
+        refill_tlb(iface, addr_type, space, addr);
+    return res;
 }
 
 int write_mem1(void* iface, uint32_t addr_type, uint32_t space, uint64_t addr, uint8_t data) {
-    return reinterpret_cast<arch_if_ptr_t>(iface)->write((address_type)addr_type, access_type::WRITE, (uint16_t)space, addr, 1,
-                                                         reinterpret_cast<uint8_t*>(&data));
+    auto* core = reinterpret_cast<arch_if_ptr_t>(iface);
+    auto res = core->write((address_type)addr_type, access_type::WRITE, (uint16_t)space, addr, 1, reinterpret_cast<uint8_t*>(&data));
+    if(res == iss::Ok)
+        refill_tlb(iface, addr_type, space, addr);
+    return res;
 }
 
 int write_mem2(void* iface, uint32_t addr_type, uint32_t space, uint64_t addr, uint16_t data) {
-    return reinterpret_cast<arch_if_ptr_t>(iface)->write((address_type)addr_type, access_type::WRITE, (uint16_t)space, addr, 2,
-                                                         reinterpret_cast<uint8_t*>(&data));
+    auto* core = reinterpret_cast<arch_if_ptr_t>(iface);
+    auto res = core->write((address_type)addr_type, access_type::WRITE, (uint16_t)space, addr, 2, reinterpret_cast<uint8_t*>(&data));
+    if(res == iss::Ok)
+        refill_tlb(iface, addr_type, space, addr);
+    return res;
 }
 
 int write_mem4(void* iface, uint32_t addr_type, uint32_t space, uint64_t addr, uint32_t data) {
-    return reinterpret_cast<arch_if_ptr_t>(iface)->write((address_type)addr_type, access_type::WRITE, (uint16_t)space, addr, 4,
-                                                         reinterpret_cast<uint8_t*>(&data));
+    auto* core = reinterpret_cast<arch_if_ptr_t>(iface);
+    auto res = core->write((address_type)addr_type, access_type::WRITE, (uint16_t)space, addr, 4, reinterpret_cast<uint8_t*>(&data));
+    if(res == iss::Ok)
+        refill_tlb(iface, addr_type, space, addr);
+    return res;
 }
 
 int write_mem8(void* iface, uint32_t addr_type, uint32_t space, uint64_t addr, uint64_t data) {
-    return reinterpret_cast<arch_if_ptr_t>(iface)->write((address_type)addr_type, access_type::WRITE, (uint16_t)space, addr, 8,
-                                                         reinterpret_cast<uint8_t*>(&data));
+    auto* core = reinterpret_cast<arch_if_ptr_t>(iface);
+    auto res = core->write((address_type)addr_type, access_type::WRITE, (uint16_t)space, addr, 8, reinterpret_cast<uint8_t*>(&data));
+    if(res == iss::Ok)
+        refill_tlb(iface, addr_type, space, addr);
+    return res;
+}
+
+int load_reserved4(void* iface, uint32_t addr_type, uint32_t space, uint64_t addr, uint32_t* data) {
+    return context_of(iface).load_reserved((address_type)addr_type, (uint16_t)space, addr, 4, reinterpret_cast<uint8_t*>(data));
+}
+
+int load_reserved8(void* iface, uint32_t addr_type, uint32_t space, uint64_t addr, uint64_t* data) {
+    return context_of(iface).load_reserved((address_type)addr_type, (uint16_t)space, addr, 8, reinterpret_cast<uint8_t*>(data));
+}
+// failed is set to 0 if the store was executed, to 1 otherwise
+int store_conditional4(void* iface, uint32_t addr_type, uint32_t space, uint64_t addr, uint32_t data, uint32_t* failed) {
+    bool success = false;
+    auto res = context_of(iface).store_conditional((address_type)addr_type, (uint16_t)space, addr, 4, reinterpret_cast<uint8_t*>(&data),
+                                                   success);
+    *failed = success ? 0 : 1;
+    return res;
+}
+
+int store_conditional8(void* iface, uint32_t addr_type, uint32_t space, uint64_t addr, uint64_t data, uint32_t* failed) {
+    bool success = false;
+    auto res = context_of(iface).store_conditional((address_type)addr_type, (uint16_t)space, addr, 8, reinterpret_cast<uint8_t*>(&data),
+                                                   success);
+    *failed = success ? 0 : 1;
+    return res;
+}
+// op is a smp::amo_e, old receives the value read
+int atomic_rmw4(void* iface, uint32_t addr_type, uint32_t space, uint64_t addr, uint32_t op, uint32_t operand, uint32_t* old) {
+    uint64_t val = 0;
+    auto res = context_of(iface).atomic_rmw((address_type)addr_type, (uint16_t)space, addr, 4, (smp::amo_e)op, operand, val);
+    *old = static_cast<uint32_t>(val);
+    return res;
+}
+
+int atomic_rmw8(void* iface, uint32_t addr_type, uint32_t space, uint64_t addr, uint32_t op, uint64_t operand, uint64_t* old) {
+    return context_of(iface).atomic_rmw((address_type)addr_type, (uint16_t)space, addr, 8, (smp::amo_e)op, operand, *old);
 }
+// kind is a smp::fence_e
+void mem_fence(void* iface, uint32_t kind) { smp::atomic_domain::fence((smp::fence_e)kind); }
 }
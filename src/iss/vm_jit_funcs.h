@@ -8,6 +8,13 @@ extern int read_mem4(void*, uint32_t, uint32_t, uint64_t, uint32_t*);
 extern int write_mem4(void*, uint32_t, uint32_t, uint64_t, uint32_t);
 extern int read_mem8(void*, uint32_t, uint32_t, uint64_t, uint64_t*);
 extern int write_mem8(void*, uint32_t, uint32_t, uint64_t, uint64_t);
+extern int load_reserved4(void*, uint32_t, uint32_t, uint64_t, uint32_t*);
+extern int load_reserved8(void*, uint32_t, uint32_t, uint64_t, uint64_t*);
+extern int store_conditional4(void*, uint32_t, uint32_t, uint64_t, uint32_t, uint32_t*);
+extern int store_conditional8(void*, uint32_t, uint32_t, uint64_t, uint64_t, uint32_t*);
+extern int atomic_rmw4(void*, uint32_t, uint32_t, uint64_t, uint32_t, uint32_t, uint32_t*);
+extern int atomic_rmw8(void*, uint32_t, uint32_t, uint64_t, uint32_t, uint64_t, uint64_t*);
+extern void mem_fence(void*, uint32_t);
 extern uint64_t enter_trap(void*, uint64_t, uint64_t, uint64_t);
 extern uint64_t leave_trap(void*, uint64_t);
 extern void wait(void*, uint64_t);
@@ -16,5 +23,4 @@ extern void print_disass(void*, uint64_t, char*);
 extern void pre_instr_sync(void*);
 extern void notify_phase(void*, uint32_t);
 extern void call_plugin(void*, uint64_t);
-extern uint8_t read_mem_buf[];
 }
@@ -168,6 +168,36 @@ public:
     constexpr typed_addr_t(const addr_t& o)
     : typed_addr_t(o.access, o.space, o.val) {}
 };
+/**
+ * a range of guest addresses backed by contiguous host memory which can be accessed directly
+ */
+struct host_region {
+    //! the first guest address of the region
+    uint64_t start{0};
+    //! the size of the region in bytes, 0 if there is no region
+    uint64_t size{0};
+    //! the host memory of the first guest address
+    uint8_t* host{nullptr};
+    //! true if the host memory may be written as well
+    bool writable{false};
+
+    explicit operator bool() const { return host != nullptr && size != 0; }
+
+    bool contains(uint64_t addr, uint64_t length) const { return addr >= start && addr - start <= size && length <= size - (addr - start); }
+
+    uint8_t* at(uint64_t addr) const { return host + (addr - start); }
+};
+/**
+ * one element of a vectored memory access, see arch_if::read_vectored() and arch_if::write_vectored()
+ */
+struct transfer {
+    //! the guest address of the first byte
+    uint64_t addr{0};
+    //! the number of bytes to transfer
+    uint64_t length{0};
+    //! the host buffer to read into or to write from
+    uint8_t* data{nullptr};
+};
 } // namespace iss
 
 namespace iss {
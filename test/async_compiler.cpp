@@ -0,0 +1,122 @@
+/*******************************************************************************
+ * Copyright (C) 2024 MINRES Technologies GmbH
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Contributors:
+ *       eyck@minres.com - initial implementation
+ ******************************************************************************/
+
+// checks of the background compilation: finished blocks get installed, blocks of a flushed cache and failed ones get
+// dropped, the destruction drops the queued jobs
+
+#include "test_util.h"
+
+#include <iss/jit/async_compiler.h>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using namespace iss;
+
+namespace {
+void submitted_blocks_get_installed() {
+    jit::async_compiler<int> compiler(2);
+    compiler.submit(0x1000, 1, []() { return 42; });
+    CHECK(compiler.pending(0x1000) && compiler.size() == 1);
+    compiler.wait(0x1000);
+    std::vector<std::pair<uint64_t, int>> installed;
+    unsigned dropped = 0;
+    CHECK(compiler.install(1, [&installed](uint64_t pc, int&& blk) { installed.emplace_back(pc, blk); },
+                           [&dropped](uint64_t pc) { dropped++; }) == 1);
+    CHECK(installed.size() == 1 && installed[0].first == 0x1000 && installed[0].second == 42);
+    CHECK(dropped == 0 && !compiler.pending(0x1000) && compiler.size() == 0);
+}
+
+void blocks_of_a_flushed_cache_get_dropped() {
+    jit::async_compiler<int> compiler(1);
+    compiler.submit(0x1000, 1, []() { return 42; });
+    compiler.wait_all();
+    unsigned installed = 0;
+    std::vector<uint64_t> dropped;
+    // the translation cache got flushed while the block was compiled
+    CHECK(compiler.install(2, [&installed](uint64_t pc, int&& blk) { installed++; },
+                           [&dropped](uint64_t pc) { dropped.push_back(pc); }) == 0);
+    CHECK(installed == 0 && dropped.size() == 1 && dropped[0] == 0x1000 && compiler.size() == 0);
+}
+
+void compilation_errors_get_rethrown() {
+    jit::async_compiler<int> compiler(1);
+    compiler.submit(0x1000, 1, []() -> int { throw std::runtime_error("compilation failed"); });
+    compiler.wait(0x1000);
+    unsigned installed = 0;
+    std::vector<uint64_t> dropped;
+    bool thrown = false;
+    try {
+        compiler.install(1, [&installed](uint64_t pc, int&& blk) { installed++; }, [&dropped](uint64_t pc) { dropped.push_back(pc); });
+    } catch(std::runtime_error const&) {
+        thrown = true;
+    }
+    CHECK(thrown && installed == 0 && dropped.size() == 1 && dropped[0] == 0x1000 && compiler.size() == 0);
+}
+
+void destruction_drops_queued_jobs() {
+    std::atomic<bool> started{false}, release{false};
+    std::atomic<unsigned> ran{0};
+    auto compiler = std::make_unique<jit::async_compiler<int>>(1);
+    // the only worker is busy with the first job, the others stay queued
+    compiler->submit(0x1000, 1, [&started, &release]() {
+        started = true;
+        while(!release)
+            std::this_thread::yield();
+        return 0;
+    });
+    for(uint64_t pc = 0x2000; pc < 0x2100; pc += 0x10)
+        compiler->submit(pc, 1, [&ran]() { return static_cast<int>(ran++); });
+    while(!started)
+        std::this_thread::yield();
+    std::thread destroyer([&compiler]() { compiler.reset(); });
+    // the destruction dropped the queue long before the running job returns
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    release = true;
+    destroyer.join();
+    CHECK(!compiler && ran == 0);
+}
+} // namespace
+
+int main(int argc, char* argv[]) {
+    submitted_blocks_get_installed();
+    blocks_of_a_flushed_cache_get_dropped();
+    compilation_errors_get_rethrown();
+    destruction_drops_queued_jobs();
+    return 0;
+}
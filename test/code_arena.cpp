@@ -0,0 +1,113 @@
+/*******************************************************************************
+ * Copyright (C) 2024 MINRES Technologies GmbH
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Contributors:
+ *       eyck@minres.com - initial implementation
+ ******************************************************************************/
+
+// checks of the code arena: allocations get sealed into executable code, released chunks go back to the OS
+
+#include "test_util.h"
+
+#include <iss/jit/code_arena.h>
+
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+using iss::jit::code_arena;
+
+namespace {
+//! write a function returning val and seal it
+code_arena::allocation emit_constant(code_arena& arena, uint32_t val) {
+    auto mem = arena.allocate(6);
+    // mov eax, val; ret
+    mem.rw[0] = 0xb8;
+    std::memcpy(mem.rw + 1, &val, 4);
+    mem.rw[5] = 0xc3;
+    arena.seal(mem);
+    return mem;
+}
+
+void sealed_code_executes(code_arena& arena) {
+    std::vector<code_arena::allocation> mems;
+    for(uint32_t i = 0; i < 64; ++i)
+        mems.push_back(emit_constant(arena, i));
+#if defined(__x86_64__)
+    // sealing an allocation must not take away the pages of the code written before
+    for(uint32_t i = 0; i < mems.size(); ++i)
+        CHECK(reinterpret_cast<uint32_t (*)()>(mems[i].rx)() == i);
+#endif
+    for(auto& mem : mems)
+        arena.release(mem);
+}
+
+void patched_code_executes() {
+    code_arena arena(64 * 1024, 64);
+    auto mem = emit_constant(arena, 1);
+    uint32_t val = 2;
+    arena.patch(mem, 1, &val, 4);
+#if defined(__x86_64__)
+    CHECK(reinterpret_cast<uint32_t (*)()>(mem.rx)() == 2);
+#endif
+    CHECK(mem.rw[1] == 2);
+    bool thrown = false;
+    try {
+        arena.patch(mem, 4, &val, 4);
+    } catch(std::runtime_error&) {
+        thrown = true;
+    }
+    CHECK(thrown);
+    arena.release(mem);
+}
+
+void arena_accounts_and_releases_chunks() {
+    code_arena arena(64 * 1024, 64);
+    auto& stats = arena.get_stats();
+    sealed_code_executes(arena);
+    CHECK(stats.allocations == 64 && stats.releases == 64 && stats.used_bytes == 0);
+    // a new chunk is mapped once the active one is exhausted, the old one goes away when its last allocation does
+    auto first = arena.allocate(32 * 1024);
+    auto second = arena.allocate(48 * 1024);
+    CHECK(first.owner != second.owner && stats.chunks >= 2);
+    CHECK(first.rx != nullptr && (arena.is_dual_mapped() ? first.rw != first.rx : first.rw == first.rx));
+    auto chunks = stats.chunks;
+    arena.release(first);
+    CHECK(stats.chunks == chunks - 1 && stats.chunks_released >= 1);
+    arena.release(second);
+    CHECK(stats.used_bytes == 0);
+}
+} // namespace
+
+int main(int argc, char* argv[]) {
+    arena_accounts_and_releases_chunks();
+    patched_code_executes();
+    return 0;
+}
@@ -0,0 +1,195 @@
+/*******************************************************************************
+ * Copyright (C) 2024 MINRES Technologies GmbH
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Contributors:
+ *       eyck@minres.com - initial implementation
+ ******************************************************************************/
+
+// checks of the LLVM block generation: the IR of profiled blocks, of natively chained blocks and of regions merging
+// several blocks needs to pass the verifier
+
+#include "test_core.h"
+#include "test_util.h"
+
+#include <iss/llvm/vm_base.h>
+#include <iss/mem/memory_map.h>
+
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <limits>
+#include <memory>
+
+using test::core;
+
+namespace {
+/**
+ * a vm of an instruction set whose instructions only set the next pc, each instruction at an address ending with 0xc is
+ * a conditional branch 0x34 bytes ahead taken if X0 is not 0
+ */
+class test_vm : public iss::llvm::vm_base<test::core> {
+public:
+    using base = iss::llvm::vm_base<test::core>;
+    using traits = iss::arch::traits<test::core>;
+    using continuation_e = iss::llvm::continuation_e;
+
+    explicit test_vm(test::core& c)
+    : base(c) {}
+
+    iss::debugger::target_adapter_if* accquire_target_adapter(iss::debugger::server_if* server) override { return nullptr; }
+    /**
+     * let the block at pc appear executed before so it joins regions
+     */
+    void add_profiled_block(uint64_t pc) {
+        auto* tb = func_map.insert(pc, translation_block(0, {nullptr, nullptr}, nullptr));
+        tb->profile = std::make_shared<iss::llvm::block_profile>();
+    }
+    /**
+     * generate the module of the block at pc, recompiled using profile if it is not null, and verify it
+     *
+     * @return the number of blocks of the region, 0 if the block is no region
+     */
+    unsigned generate_and_verify(uint64_t block_pc, iss::llvm::block_profile const* profile) {
+        setup_translation();
+        CHECK(native_chaining);
+        continuation_e cont = iss::llvm::CONT;
+        virt_addr_t pc(iss::access_type::DEBUG_FETCH, 0, block_pc);
+        generator_state state{this, pc, cont, std::numeric_limits<uint64_t>::max()};
+        auto generator = make_generator(state);
+        recompiled_profile = profile;
+        auto res = iss::llvm::generate_module(context, cluster_id, block_pc, generator);
+        recompiled_profile = nullptr;
+        pending_profiles.clear();
+        auto lock = context.getLock();
+        auto& mod = *std::get<0>(res);
+        CHECK(!::llvm::verifyModule(mod, &::llvm::errs()));
+        auto* f = mod.getFunction(std::get<1>(res));
+        CHECK(f != nullptr);
+        for(auto& bb : *f)
+            if(bb.getName().find("region_lookup") == 0)
+                return ::llvm::cast<::llvm::SwitchInst>(bb.getTerminator())->getNumCases();
+        return 0;
+    }
+
+protected:
+    std::tuple<continuation_e, ::llvm::BasicBlock*> gen_single_inst_behavior(virt_addr_t& pc, ::llvm::BasicBlock* this_block) override {
+        builder.SetInsertPoint(this_block);
+        auto next = pc.val + 4;
+        if((pc.val & 0xf) != 0xc) {
+            set_reg(traits::NEXT_PC, gen_const(32, next));
+            pc.val = next;
+            return std::make_tuple(iss::llvm::CONT, this_block);
+        }
+        auto target = pc.val + 0x34;
+        auto* taken = builder.CreateICmpNE(get_reg(traits::X0), gen_const(32, 0));
+        set_reg(traits::NEXT_PC, builder.CreateSelect(taken, gen_const(32, target), gen_const(32, next)));
+        auto* outcome = builder.CreateSelect(taken, gen_const(32, 1U * iss::llvm::KNOWN_JUMP), gen_const(32, 1U * iss::llvm::NO_JUMP));
+        set_reg(traits::LAST_BRANCH, outcome);
+        set_branch_target(target, true);
+        pc.val = next;
+        return std::make_tuple(iss::llvm::BRANCH, this_block);
+    }
+
+    ::llvm::Function* open_block_func(phys_addr_t pc) override {
+        auto* f = base::open_block_func(pc);
+        // the block function takes the register file, the core and the vm as pointers
+        auto* ptr_ty = ::llvm::PointerType::getUnqual(mod->getContext());
+        auto* ty = ::llvm::FunctionType::get(f->getReturnType(), {ptr_ty, ptr_ty, ptr_ty}, false);
+        auto name = f->getName().str();
+        f->eraseFromParent();
+        f = ::llvm::Function::Create(ty, ::llvm::GlobalValue::ExternalLinkage, name, mod);
+        regs_ptr = f->getArg(0);
+        core_ptr = f->getArg(1);
+        vm_ptr = f->getArg(2);
+        regs_ptr->setName("regs_ptr");
+        core_ptr->setName("core_ptr");
+        vm_ptr->setName("vm_ptr");
+        return f;
+    }
+
+    void gen_leave_behavior(::llvm::BasicBlock* leave_blk) override {
+        builder.SetInsertPoint(leave_blk);
+        builder.CreateRet(get_reg(traits::NEXT_PC));
+    }
+
+    void gen_trap_behavior(::llvm::BasicBlock* trap_blk) override {
+        builder.SetInsertPoint(trap_blk);
+        builder.CreateRet(get_reg(traits::NEXT_PC));
+    }
+
+private:
+    // the registers are accessed in the register file as the architectures do
+    ::llvm::Value* get_reg(traits::reg_e r) { return builder.CreateLoad(get_typeptr(r), get_reg_ptr(r)); }
+
+    void set_reg(traits::reg_e r, ::llvm::Value* val) { builder.CreateStore(val, get_reg_ptr(r)); }
+};
+
+void profiled_blocks_verify() {
+    iss::mem::memory_map mem;
+    core c(mem);
+    test_vm vm(c);
+    iss::jit::cache_config cfg;
+    cfg.recompile_threshold = 100;
+    vm.get_translation_cache()->set_config(cfg);
+    CHECK(vm.generate_and_verify(0x1000, nullptr) == 0);
+}
+
+void regions_verify() {
+    iss::mem::memory_map mem;
+    core c(mem);
+    test_vm vm(c);
+    iss::jit::cache_config cfg;
+    cfg.recompile_threshold = 100;
+    cfg.region_blocks = 4;
+    vm.get_translation_cache()->set_config(cfg);
+    iss::llvm::block_profile profile;
+    profile.executions = 100;
+    profile.outcomes[iss::llvm::KNOWN_JUMP] = 60;
+    profile.outcomes[iss::llvm::NO_JUMP] = 40;
+    // without executed successors the region only holds the recompiled block, it may loop to itself
+    CHECK(vm.generate_and_verify(0x1000, &profile) == 1);
+    // both successors of 0x1000 got executed, 0x1040 continues with 0x1050 and 0x1080 of which only 0x1050 got executed
+    vm.add_profiled_block(0x1010);
+    vm.add_profiled_block(0x1040);
+    vm.add_profiled_block(0x1050);
+    CHECK(vm.generate_and_verify(0x1000, &profile) == 4);
+    // the region is limited to the configured number of blocks
+    cfg.region_blocks = 2;
+    vm.get_translation_cache()->set_config(cfg);
+    CHECK(vm.generate_and_verify(0x1000, &profile) == 2);
+}
+} // namespace
+
+int main(int argc, char* argv[]) {
+    profiled_blocks_verify();
+    regions_verify();
+    return 0;
+}
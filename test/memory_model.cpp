@@ -0,0 +1,279 @@
+/*******************************************************************************
+ * Copyright (C) 2024 MINRES Technologies GmbH
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Contributors:
+ *       eyck@minres.com - initial implementation
+ ******************************************************************************/
+
+// checks of the memory model: sparse RAM, memory map, code write notification, software TLB, host regions, vectored
+// transfers and host window
+
+#include "test_core.h"
+#include "test_util.h"
+
+#include <iss/jit/code_pages.h>
+#include <iss/mem/host_window.h>
+#include <iss/mem/memory_map.h>
+#include <iss/mem/sparse_ram.h>
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+using namespace iss;
+using test::core;
+
+namespace {
+constexpr uint64_t page_size = uint64_t(1) << jit::soft_tlb::page_bits;
+
+jit::tlb_entry const& tlb_entry_of(test::context& ctx, uint64_t addr) { return ctx.get_tlb().data()[jit::soft_tlb::index_of(addr)]; }
+
+//! a core whose MMU maps the virtual page at 0x8000 to the physical page at 0x4000
+class aliasing_core : public core {
+public:
+    using core::core;
+
+    uint8_t* get_host_page(const address_type type, const access_type access, const uint32_t space, const uint64_t page_addr) override {
+        if(type == address_type::VIRTUAL && page_addr == 0x8000)
+            return core::get_host_page(address_type::PHYSICAL, access, space, 0x4000);
+        return core::get_host_page(type, access, space, page_addr);
+    }
+};
+
+void sparse_ram_allocates_lazily_and_tracks_dirty_pages() {
+    mem::sparse_ram ram(uint64_t(1) << 40);
+    uint8_t buf[4]{1, 2, 3, 4};
+    uint8_t res[4]{};
+    CHECK(ram.read(uint64_t(1) << 39, 4, res) == Ok && res[0] == 0);
+    CHECK(ram.allocated() == 0);
+    CHECK(ram.write((uint64_t(1) << 39) - 2, 4, buf) == Ok);
+    CHECK(ram.read((uint64_t(1) << 39) - 2, 4, res) == Ok && std::memcmp(buf, res, 4) == 0);
+    CHECK(ram.allocated() == 2 * mem::sparse_ram::block_size);
+    CHECK(ram.write((uint64_t(1) << 40) - 2, 4, buf) == Err);
+    // blocks never written have no host memory to read from, while tracking not even to write to
+    CHECK(!ram.region(0x3000, 0, false) && ram.allocated() == 2 * mem::sparse_ram::block_size);
+    ram.track_dirty_pages(true);
+    CHECK(!ram.region(0x3000, 0, true));
+    CHECK(ram.write(0x3004, 4, buf) == Ok);
+    CHECK(ram.region(0x3000, 0, false));
+    auto region = ram.region(0x3000, 0, true);
+    CHECK(region && region.writable && region.start == 0x3000 && region.size == mem::sparse_ram::page_size);
+    std::vector<uint64_t> dirty;
+    ram.collect_dirty_pages([&dirty](uint64_t page) { dirty.push_back(page); });
+    CHECK(std::find(dirty.begin(), dirty.end(), 0x3000) != dirty.end());
+    CHECK(!ram.region(0x3000, 0, true));
+}
+
+void memory_map_dispatches_to_ram_and_mmio() {
+    mem::memory_map map;
+    map.map_ram(0, 0x100000);
+    uint32_t mmio_value = 0;
+    map.map_mmio(
+        0x100000, 0x1000, [&mmio_value](uint64_t offs, unsigned length, uint8_t* data) {
+            std::memcpy(data, &mmio_value, length);
+            return Ok;
+        },
+        [&mmio_value](uint64_t offs, unsigned length, uint8_t const* data) {
+            std::memcpy(&mmio_value, data, length);
+            return Ok;
+        });
+    uint32_t val = 0x12345678;
+    CHECK(map.write(0x100000, 4, reinterpret_cast<uint8_t*>(&val)) == Ok && mmio_value == val);
+    CHECK(!map.region(0x100000));
+    CHECK(map.region(0x1000, true).writable && map.region(0x1000));
+    CHECK(map.write(0x200000, 4, reinterpret_cast<uint8_t*>(&val)) == Err);
+}
+
+void memory_map_reports_code_writes() {
+    mem::memory_map map;
+    map.map_ram(0, 0x100000);
+    uint32_t val = 0x12345678;
+    // writes of other bus masters reach the caches through the code pages
+    jit::code_pages pages;
+    std::vector<uint64_t> written;
+    pages.attach([&written](uint64_t page) { written.push_back(page); });
+    map.set_code_pages(&pages);
+    pages.acquire(jit::code_pages::page_of(0x2000));
+    CHECK(map.write(0x1ffe, 4, reinterpret_cast<uint8_t*>(&val)) == Ok);
+    CHECK(written.size() == 1 && written[0] == jit::code_pages::page_of(0x2000));
+    CHECK(map.write(0x3000, 4, reinterpret_cast<uint8_t*>(&val)) == Ok && written.size() == 1);
+}
+
+void tlb_enters_ram_pages_and_protects_code_pages() {
+    mem::memory_map map;
+    map.map_ram(0, 0x100000);
+    core c(map);
+    test::context ctx(c);
+    // RAM never written is read through the slow path until a write allocates it
+    ctx.refill_tlb(address_type::VIRTUAL, core::traits::MEM, 0x4010);
+    auto& e = tlb_entry_of(ctx, 0x4000);
+    CHECK(e.read_tag == jit::soft_tlb::invalid_tag);
+    uint32_t val = 0;
+    CHECK(c.write(address_type::PHYSICAL, access_type::WRITE, core::traits::MEM, 0x4000, 4, reinterpret_cast<uint8_t*>(&val)) == Ok);
+    ctx.refill_tlb(address_type::VIRTUAL, core::traits::MEM, 0x4010);
+    CHECK(e.read_tag == 0x4000 && e.write_tag == 0x4000);
+    CHECK(e.addend + 0x4010 == reinterpret_cast<uintptr_t>(map.region(0x4010).at(0x4010)));
+    // a page becoming a code page stops direct stores to it once the core synchronizes its TLB before the next block
+    ctx.get_code_pages().acquire(jit::code_pages::page_of(0x4000));
+    CHECK(e.write_tag == 0x4000);
+    ctx.sync_tlb();
+    CHECK(e.read_tag == 0x4000 && e.write_tag == jit::soft_tlb::invalid_tag);
+    ctx.refill_tlb(address_type::VIRTUAL, core::traits::MEM, 0x4010);
+    CHECK(e.write_tag == jit::soft_tlb::invalid_tag);
+    // MMIO and unmapped pages are never entered
+    ctx.get_tlb().flush();
+    ctx.refill_tlb(address_type::VIRTUAL, core::traits::MEM, 0x200000);
+    CHECK(tlb_entry_of(ctx, 0x200000).read_tag == jit::soft_tlb::invalid_tag);
+}
+
+void tlb_keeps_aliased_pages_read_only() {
+    mem::memory_map map;
+    map.map_ram(0, 0x100000);
+    aliasing_core c(map);
+    test::context ctx(c);
+    uint32_t val = 0;
+    CHECK(c.write(address_type::PHYSICAL, access_type::WRITE, core::traits::MEM, 0x4000, 4, reinterpret_cast<uint8_t*>(&val)) == Ok);
+    // loads of the alias use the host memory of the physical page, stores need to take the write path reporting them
+    ctx.refill_tlb(address_type::VIRTUAL, core::traits::MEM, 0x8010);
+    auto& e = tlb_entry_of(ctx, 0x8000);
+    CHECK(e.read_tag == 0x8000 && e.write_tag == jit::soft_tlb::invalid_tag);
+    CHECK(e.addend + 0x8010 == reinterpret_cast<uintptr_t>(map.region(0x4010).at(0x4010)));
+    ctx.refill_tlb(address_type::VIRTUAL, core::traits::MEM, 0x4010);
+    CHECK(tlb_entry_of(ctx, 0x4000).write_tag == 0x4000);
+}
+
+void host_regions_cover_plain_memory_only() {
+    mem::memory_map map;
+    map.map_ram(0, 0x100000);
+    map.map_mmio(
+        0x100000, 0x1000, [](uint64_t offs, unsigned length, uint8_t* data) { return Ok; },
+        [](uint64_t offs, unsigned length, uint8_t const* data) { return Ok; });
+    core c(map);
+    // RAM never written reads as zeros through read(), it gets host memory once requested for writing
+    CHECK(!c.get_host_region(address_type::PHYSICAL, access_type::READ, core::traits::MEM, 0x1234));
+    CHECK(c.get_host_region(address_type::PHYSICAL, access_type::WRITE, core::traits::MEM, 0x1234));
+    auto region = c.get_host_region(address_type::PHYSICAL, access_type::READ, core::traits::MEM, 0x1234);
+    CHECK(region && region.contains(0x1234, 4) && region.writable);
+    CHECK(c.get_host_page(address_type::VIRTUAL, access_type::WRITE, core::traits::MEM, 0x1000) == region.at(0x1000));
+    // accesses to the region are seen by the memory model
+    *region.at(0x1234) = 0x5a;
+    uint8_t val = 0;
+    CHECK(c.read(address_type::PHYSICAL, access_type::READ, core::traits::MEM, 0x1234, 1, &val) == Ok && val == 0x5a);
+    // MMIO and unmapped addresses need to go through read() and write()
+    CHECK(!c.get_host_region(address_type::PHYSICAL, access_type::READ, core::traits::MEM, 0x100010));
+    CHECK(!c.get_host_page(address_type::VIRTUAL, access_type::READ, core::traits::MEM, 0x100000));
+    CHECK(!c.get_host_region(address_type::PHYSICAL, access_type::READ, core::traits::MEM, 0x200000));
+}
+
+void vectored_transfers_cross_regions() {
+    mem::memory_map map;
+    map.map_ram(0, 0x100000);
+    std::vector<uint8_t> mmio(0x1000);
+    map.map_mmio(
+        0x100000, 0x1000,
+        [&mmio](uint64_t offs, unsigned length, uint8_t* data) {
+            std::memcpy(data, mmio.data() + offs, length);
+            return Ok;
+        },
+        [&mmio](uint64_t offs, unsigned length, uint8_t const* data) {
+            std::memcpy(mmio.data() + offs, data, length);
+            return Ok;
+        });
+    core c(map);
+    test::context ctx(c);
+    std::vector<uint8_t> out(0x100), in(0x100);
+    for(size_t i = 0; i < out.size(); ++i)
+        out[i] = static_cast<uint8_t>(i);
+    // the first range straddles the end of the RAM and the start of the MMIO range
+    transfer wr[]{{0x100000 - 0x80, 0x100, out.data()}, {0x10, 0x10, out.data()}};
+    CHECK(c.write_vectored(address_type::PHYSICAL, access_type::WRITE, core::traits::MEM, wr, 2) == Ok);
+    transfer rd[]{{0x100000 - 0x80, 0x100, in.data()}};
+    CHECK(c.read_vectored(address_type::PHYSICAL, access_type::READ, core::traits::MEM, rd, 1) == Ok);
+    CHECK(in == out && mmio[0x7f] == 0xff);
+    // the range reaches past the end of the MMIO range
+    std::vector<uint8_t> large(0x1000);
+    transfer bad[]{{0x100800, 0x1000, large.data()}};
+    CHECK(c.read_vectored(address_type::PHYSICAL, access_type::READ, core::traits::MEM, bad, 1) == Err);
+}
+
+#ifdef __linux__
+void host_window_restricts_and_recovers() {
+    mem::host_window window(24);
+    mem::memory_map map;
+    map.map_ram(0, 0x100000, window);
+    core c(map);
+    test::context ctx(c);
+    ctx.set_host_window(&window, core::traits::MEM);
+    uint8_t* base = window.host_base();
+    mem::host_window::fault info;
+    CHECK(window.run([base]() { base[0x5000] = 1; }, info));
+    // accesses outside of the RAM fault and report the guest address
+    CHECK(!window.run([base]() { base[0x200010] = 1; }, info) && info.addr == 0x200010);
+    // a page holding translated code only permits loads until its last block is gone
+    auto code_page = jit::code_pages::page_of(0x6000);
+    ctx.get_code_pages().acquire(code_page);
+    CHECK(window.get_protection(0x6000) == mem::host_window::protection_e::READ);
+    CHECK(!window.run([base]() { base[0x6008] = 1; }, info) && info.addr == 0x6008);
+    CHECK(window.run([base]() { volatile uint8_t v = base[0x6008]; }, info));
+    ctx.get_code_pages().release(code_page);
+    CHECK(window.get_protection(0x6000) == mem::host_window::protection_e::READ_WRITE);
+    CHECK(window.run([base]() { base[0x6008] = 1; }, info));
+    // a watchpoint outlives the limit of a code page and drops the pages the core entered before
+    ctx.refill_tlb(address_type::VIRTUAL, core::traits::MEM, 0x7000);
+    CHECK(tlb_entry_of(ctx, 0x7000).read_tag == 0x7000);
+    window.protect(0x7000, 4, mem::host_window::protection_e::NONE);
+    CHECK(tlb_entry_of(ctx, 0x7000).read_tag == jit::soft_tlb::invalid_tag);
+    ctx.get_code_pages().acquire(jit::code_pages::page_of(0x7000));
+    ctx.get_code_pages().release(jit::code_pages::page_of(0x7000));
+    CHECK(window.get_protection(0x7000) == mem::host_window::protection_e::NONE);
+    CHECK(!window.region(0x7000));
+    CHECK(window.region(0x8000).contains(0x8000, page_size));
+    window.protect(0x7000, 4, mem::host_window::protection_e::READ_WRITE);
+    CHECK(window.run([base]() { base[0x7000] = 1; }, info));
+    // the host accesses the RAM through the alias which is never protected
+    uint8_t val = 0;
+    CHECK(map.read(0x7000, 1, &val) == Ok && val == 1);
+}
+#endif
+} // namespace
+
+int main(int argc, char* argv[]) {
+    sparse_ram_allocates_lazily_and_tracks_dirty_pages();
+    memory_map_dispatches_to_ram_and_mmio();
+    memory_map_reports_code_writes();
+    tlb_enters_ram_pages_and_protects_code_pages();
+    tlb_keeps_aliased_pages_read_only();
+    host_regions_cover_plain_memory_only();
+    vectored_transfers_cross_regions();
+#ifdef __linux__
+    host_window_restricts_and_recovers();
+#endif
+    return 0;
+}
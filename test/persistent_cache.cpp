@@ -0,0 +1,162 @@
+/*******************************************************************************
+ * Copyright (C) 2024 MINRES Technologies GmbH
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Contributors:
+ *       eyck@minres.com - initial implementation
+ ******************************************************************************/
+
+// checks of the persistent translation cache: stored blocks are found as long as their guest code is unchanged,
+// damaged entries are skipped and other runs sharing the directory find the stored blocks
+
+#include "test_util.h"
+
+#include <iss/jit/persistent_cache.h>
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+using namespace iss;
+namespace fs = std::filesystem;
+
+namespace {
+char const* const domain = "test core, llvm backend, opt level 2";
+//! the object of the blocks, the cache does not look into it
+std::string const object = "relocatable object";
+
+//! a cache directory of its own for each check, removed afterwards
+struct cache_dir {
+    explicit cache_dir(std::string const& name)
+    : path((fs::temp_directory_path() / ("dbt_rise_persistent_cache_" + name)).string()) {
+        fs::remove_all(path);
+    }
+
+    ~cache_dir() { fs::remove_all(path); }
+
+    std::string const path;
+};
+
+jit::persistent_cache::fetch_func fetch_from(std::vector<uint8_t> const& mem) {
+    return [&mem](uint64_t pc, size_t size, uint8_t* data) {
+        if(size > mem.size())
+            return false;
+        std::copy(mem.begin(), mem.begin() + size, data);
+        return true;
+    };
+}
+
+std::string read_object(jit::persistent_cache::entry const& e) {
+    std::ifstream is(e.path, std::ios::binary);
+    std::string res(e.object_size, 0);
+    is.seekg(e.object_offset);
+    is.read(&res[0], res.size());
+    return res;
+}
+
+void stored_blocks_are_found() {
+    cache_dir dir("round_trip");
+    jit::persistent_cache cache(dir.path, domain);
+    std::vector<uint8_t> guest{0x13, 0x05, 0x10, 0x00, 0x67, 0x80, 0x00, 0x00};
+    auto symbol = cache.symbol_name(0x1000, guest);
+    CHECK(cache.store(0x1000, guest, 3, symbol, object));
+    jit::persistent_cache::entry e;
+    CHECK(cache.find(0x1000, fetch_from(guest), e));
+    CHECK(e.symbol == symbol && e.cont == 3 && e.guest_size == guest.size() && read_object(e) == object);
+    // nothing is stored for other addresses
+    CHECK(!cache.find(0x2000, fetch_from(guest), e));
+    auto stats = cache.get_stats();
+    CHECK(stats.stores == 1 && stats.hits == 1 && stats.misses == 1);
+}
+
+void changed_guest_code_misses() {
+    cache_dir dir("changed_guest");
+    jit::persistent_cache cache(dir.path, domain);
+    std::vector<uint8_t> guest{0x13, 0x05, 0x10, 0x00, 0x67, 0x80, 0x00, 0x00};
+    CHECK(cache.store(0x1000, guest, 0, cache.symbol_name(0x1000, guest), object));
+    auto changed = guest;
+    changed[2] ^= 1;
+    jit::persistent_cache::entry e;
+    CHECK(!cache.find(0x1000, fetch_from(changed), e));
+    // guest code not readable any more misses as well
+    CHECK(!cache.find(0x1000, [](uint64_t pc, size_t size, uint8_t* data) { return false; }, e));
+    CHECK(cache.find(0x1000, fetch_from(guest), e));
+}
+
+void damaged_entries_are_skipped() {
+    cache_dir dir("damaged");
+    jit::persistent_cache cache(dir.path, domain);
+    std::vector<uint8_t> guest{0x13, 0x05, 0x10, 0x00};
+    jit::persistent_cache::entry e;
+    // an entry not starting with the magic
+    CHECK(cache.store(0x1000, guest, 0, cache.symbol_name(0x1000, guest), object));
+    CHECK(cache.find(0x1000, fetch_from(guest), e));
+    {
+        std::fstream os(e.path, std::ios::binary | std::ios::in | std::ios::out);
+        os.write("BADMAGIC", 8);
+    }
+    CHECK(!cache.find(0x1000, fetch_from(guest), e));
+    // an entry truncated within the header and one truncated before its object
+    CHECK(cache.store(0x2000, guest, 0, cache.symbol_name(0x2000, guest), object));
+    CHECK(cache.find(0x2000, fetch_from(guest), e));
+    fs::resize_file(e.path, 4);
+    CHECK(!cache.find(0x2000, fetch_from(guest), e));
+    CHECK(cache.store(0x3000, guest, 0, cache.symbol_name(0x3000, guest), object));
+    CHECK(cache.find(0x3000, fetch_from(guest), e));
+    fs::resize_file(e.path, e.object_offset);
+    CHECK(!cache.find(0x3000, fetch_from(guest), e));
+}
+
+void other_runs_find_stored_blocks() {
+    cache_dir dir("other_runs");
+    std::vector<uint8_t> guest{0x13, 0x05, 0x10, 0x00, 0x67, 0x80, 0x00, 0x00};
+    std::string symbol;
+    {
+        jit::persistent_cache cache(dir.path, domain);
+        symbol = cache.symbol_name(0x1000, guest);
+        CHECK(cache.store(0x1000, guest, 1, symbol, object));
+    }
+    jit::persistent_cache cache(dir.path, domain);
+    jit::persistent_cache::entry e;
+    CHECK(cache.find(0x1000, fetch_from(guest), e));
+    CHECK(e.symbol == symbol && e.cont == 1 && read_object(e) == object);
+    // the blocks of other domains are kept apart
+    jit::persistent_cache other(dir.path, "test core, tcc backend");
+    CHECK(!other.find(0x1000, fetch_from(guest), e));
+}
+} // namespace
+
+int main(int argc, char* argv[]) {
+    stored_blocks_are_found();
+    changed_guest_code_misses();
+    damaged_entries_are_skipped();
+    other_runs_find_stored_blocks();
+    return 0;
+}
@@ -0,0 +1,117 @@
+/*******************************************************************************
+ * Copyright (C) 2024 MINRES Technologies GmbH
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Contributors:
+ *       eyck@minres.com - initial implementation
+ ******************************************************************************/
+
+// checks of the blocks shared within a cluster: published blocks are found as long as their guest code is unchanged,
+// publishing the same guest code again yields the block published first
+
+#include "test_util.h"
+
+#include <iss/jit/shared_code.h>
+
+#include <memory>
+#include <vector>
+
+using namespace iss;
+
+namespace {
+//! a block without code
+struct block {
+    explicit block(int id)
+    : id(id) {}
+
+    int id;
+};
+using store_t = jit::shared_code<block>;
+
+store_t::fetch_func fetch_from(std::vector<uint8_t> const& mem) {
+    return [&mem](uint64_t pc, size_t size, uint8_t* data) {
+        if(size > mem.size())
+            return false;
+        std::copy(mem.begin(), mem.begin() + size, data);
+        return true;
+    };
+}
+
+void published_blocks_are_found() {
+    auto store = store_t::of_domain("published_blocks_are_found");
+    // the vms of a domain share the store
+    CHECK(store_t::of_domain("published_blocks_are_found") == store && store_t::of_domain("other domain") != store);
+    std::vector<uint8_t> guest{0x13, 0x05, 0x10, 0x00, 0x67, 0x80, 0x00, 0x00};
+    auto code = store->publish(0x1000, block(1), 2, guest);
+    store_t::block found;
+    CHECK(store->find(0x1000, fetch_from(guest), found));
+    CHECK(found.code == code && found.code->id == 1 && found.cont == 2 && found.guest_size == guest.size());
+    CHECK(!store->find(0x2000, fetch_from(guest), found));
+    // the store does not keep blocks alive no vm holds
+    code = nullptr;
+    found.code = nullptr;
+    CHECK(!store->find(0x1000, fetch_from(guest), found));
+    auto stats = store->get_stats();
+    CHECK(stats.publications == 1 && stats.adoptions == 1 && stats.stale == 0);
+}
+
+void changed_guest_code_is_rejected() {
+    auto store = store_t::of_domain("changed_guest_code_is_rejected");
+    std::vector<uint8_t> guest{0x13, 0x05, 0x10, 0x00, 0x67, 0x80, 0x00, 0x00};
+    auto code = store->publish(0x1000, block(1), 0, guest);
+    auto changed = guest;
+    changed[5] ^= 1;
+    store_t::block found;
+    CHECK(!store->find(0x1000, fetch_from(changed), found) && !found.code);
+    // guest code not readable any more is rejected as well
+    CHECK(!store->find(0x1000, [](uint64_t pc, size_t size, uint8_t* data) { return false; }, found));
+    CHECK(store->get_stats().stale == 2 && store->get_stats().adoptions == 0);
+    // a block of the changed code replaces the stale one
+    auto changed_code = store->publish(0x1000, block(2), 0, changed);
+    CHECK(changed_code != code && store->find(0x1000, fetch_from(changed), found) && found.code->id == 2);
+}
+
+void publishing_the_same_code_yields_the_first_block() {
+    auto store = store_t::of_domain("publishing_the_same_code_yields_the_first_block");
+    std::vector<uint8_t> guest{0x13, 0x05, 0x10, 0x00};
+    auto first = store->publish(0x1000, block(1), 0, guest);
+    // another vm translated the same block meanwhile, its block is released
+    auto second = store->publish(0x1000, block(2), 0, guest);
+    CHECK(second == first && second->id == 1);
+    store_t::block found;
+    CHECK(store->find(0x1000, fetch_from(guest), found) && found.code == first);
+}
+} // namespace
+
+int main(int argc, char* argv[]) {
+    published_blocks_are_found();
+    changed_guest_code_is_rejected();
+    publishing_the_same_code_yields_the_first_block();
+    return 0;
+}
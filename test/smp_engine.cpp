@@ -0,0 +1,248 @@
+/*******************************************************************************
+ * Copyright (C) 2024 MINRES Technologies GmbH
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Contributors:
+ *       eyck@minres.com - initial implementation
+ ******************************************************************************/
+
+// checks of the smp engine: cores run in lockstep quanta, unsynchronized cores stop on request, signals get delivered,
+// reserved and atomic accesses of cores sharing an atomic domain stay atomic
+
+#include "test_core.h"
+#include "test_util.h"
+
+#include <iss/mem/memory_map.h>
+#include <iss/smp/atomics.h>
+#include <iss/smp/engine.h>
+#include <iss/vm_if.h>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using namespace iss;
+using test::core;
+
+namespace {
+//! a vm executing no instructions but advancing the instruction count of its core
+class counting_vm : public vm_if {
+public:
+    explicit counting_vm(core& c, uint64_t stop_at = std::numeric_limits<uint64_t>::max())
+    : c(c)
+    , ctx(c)
+    , stop_at(stop_at) {}
+
+    void register_plugin(vm_plugin& plugin) override {}
+
+    arch_if* get_arch() override { return &c; }
+
+    int start(uint64_t count, bool dump, finish_cond_e cond) override {
+        slice_e result;
+        return run_slice(count, cond, result);
+    }
+
+    int run_slice(uint64_t count, finish_cond_e cond, slice_e& result) override {
+        slices++;
+        while(c.icount() < count) {
+            if(c.icount() >= stop_at) {
+                result = slice_e::STOPPED;
+                return 0;
+            }
+            c.icount() += std::min<uint64_t>(10, count - c.icount());
+        }
+        result = slice_e::LIMIT;
+        return 0;
+    }
+
+    void reset(uint64_t address) override { c.reset(address); }
+
+    void reset() override { c.reset(0); }
+
+    void pre_instr_sync() override {}
+
+    core& c;
+    test::context ctx;
+    uint64_t const stop_at;
+    uint64_t slices{0};
+};
+
+struct cluster {
+    explicit cluster(unsigned size, smp::engine_config const& cfg, uint64_t stop_at = std::numeric_limits<uint64_t>::max())
+    : engine(cfg) {
+        mem.map_ram(0, 0x100000);
+        for(unsigned i = 0; i < size; ++i) {
+            cores.push_back(std::make_unique<core>(mem));
+            vms.push_back(std::make_unique<counting_vm>(*cores.back(), i == 0 ? stop_at : std::numeric_limits<uint64_t>::max()));
+            engine.add(*vms.back());
+        }
+    }
+
+    mem::memory_map mem;
+    std::vector<std::unique_ptr<core>> cores;
+    std::vector<std::unique_ptr<counting_vm>> vms;
+    smp::engine<core> engine;
+};
+
+void cores_run_in_lockstep() {
+    smp::engine_config cfg;
+    cfg.quantum = 1000;
+    cluster cl(4, cfg);
+    uint64_t keeper_calls = 0;
+    cl.engine.set_time_keeper([&cl, &keeper_calls](uint64_t quantum) {
+        // all cores wait at the barrier, so all of them completed the same quantum
+        for(auto& c : cl.cores)
+            CHECK(c->icount() == (quantum + 1) * 1000);
+        keeper_calls++;
+    });
+    CHECK(cl.engine.run(10000) == 0);
+    CHECK(keeper_calls == 10 && cl.engine.quanta() == 10);
+    for(auto& c : cl.cores)
+        CHECK(c->icount() == 10000);
+}
+
+void unsynchronized_cores_stop_on_request() {
+    smp::engine_config cfg;
+    cfg.quantum = 0;
+    cfg.poll_interval = 1000;
+    cluster cl(3, cfg);
+    std::thread stopper([&cl]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        cl.engine.stop();
+    });
+    CHECK(cl.engine.run() == 0);
+    stopper.join();
+    for(auto& vm : cl.vms)
+        CHECK(vm->slices > 0 && vm->c.icount() > 0);
+    CHECK(cl.engine.quanta() == 0);
+}
+
+void stopped_core_stops_the_cluster() {
+    smp::engine_config cfg;
+    cfg.quantum = 0;
+    cfg.poll_interval = 1000;
+    cluster cl(2, cfg, 5000);
+    // the other core runs without limit, run() only returns as it got stopped as well
+    CHECK(cl.engine.run() == 0);
+    CHECK(cl.cores[0]->icount() == 5000);
+}
+
+void signals_reach_their_core() {
+    smp::engine_config cfg;
+    cfg.quantum = 100;
+    cluster cl(2, cfg);
+    std::atomic<uint64_t> received[2]{{0}, {0}};
+    cl.engine.set_signal_handler([&received](unsigned core, uint64_t signals) { received[core] |= signals; });
+    cl.engine.signal(1, 4);
+    cl.engine.signal(1, 1);
+    CHECK(cl.engine.run(1000) == 0);
+    CHECK(received[0] == 0 && received[1] == 5);
+}
+
+//! cores sharing a memory and an atomic domain, without vms
+struct shared_memory {
+    explicit shared_memory(unsigned size) {
+        mem.map_ram(0, 0x10000);
+        for(unsigned i = 0; i < size; ++i) {
+            cores.push_back(std::make_unique<core>(mem));
+            contexts.push_back(std::make_unique<test::context>(*cores.back()));
+            contexts.back()->set_atomic_domain(&domain, core::traits::MEM);
+        }
+    }
+
+    uint32_t load(uint64_t addr) {
+        uint32_t val = 0;
+        CHECK(mem.read(addr, 4, reinterpret_cast<uint8_t*>(&val)) == Ok);
+        return val;
+    }
+
+    mem::memory_map mem;
+    smp::atomic_domain domain;
+    std::vector<std::unique_ptr<core>> cores;
+    std::vector<std::unique_ptr<test::context>> contexts;
+};
+
+void store_conditional_fails_after_intervening_store() {
+    shared_memory sm(2);
+    uint32_t val = 0, mine = 1, other = 2;
+    CHECK(sm.contexts[0]->load_reserved(address_type::PHYSICAL, core::traits::MEM, 0x100, 4, reinterpret_cast<uint8_t*>(&val)) == Ok);
+    CHECK(sm.contexts[1]->write(address_type::PHYSICAL, access_type::WRITE, core::traits::MEM, 0x100, 4,
+                                reinterpret_cast<uint8_t*>(&other)) == Ok);
+    bool success = true;
+    CHECK(sm.contexts[0]->store_conditional(address_type::PHYSICAL, core::traits::MEM, 0x100, 4, reinterpret_cast<uint8_t*>(&mine),
+                                            success) == Ok);
+    CHECK(!success && sm.load(0x100) == 2);
+}
+
+void store_conditional_succeeds_on_untouched_reservation() {
+    shared_memory sm(2);
+    uint32_t val = 0, mine = 1, other = 2;
+    CHECK(sm.contexts[0]->load_reserved(address_type::PHYSICAL, core::traits::MEM, 0x100, 4, reinterpret_cast<uint8_t*>(&val)) == Ok);
+    // a store of another core to a different granule keeps the reservation
+    CHECK(sm.contexts[1]->write(address_type::PHYSICAL, access_type::WRITE, core::traits::MEM, 0x1000, 4,
+                                reinterpret_cast<uint8_t*>(&other)) == Ok);
+    bool success = false;
+    CHECK(sm.contexts[0]->store_conditional(address_type::PHYSICAL, core::traits::MEM, 0x100, 4, reinterpret_cast<uint8_t*>(&mine),
+                                            success) == Ok);
+    CHECK(success && sm.load(0x100) == 1);
+    // the reservation got consumed
+    CHECK(sm.contexts[0]->store_conditional(address_type::PHYSICAL, core::traits::MEM, 0x100, 4, reinterpret_cast<uint8_t*>(&other),
+                                            success) == Ok);
+    CHECK(!success && sm.load(0x100) == 1);
+}
+
+void atomic_adds_of_concurrent_cores_sum_up() {
+    constexpr unsigned cores = 4, adds = 20000;
+    shared_memory sm(cores);
+    std::vector<std::thread> threads;
+    for(unsigned i = 0; i < cores; ++i)
+        threads.emplace_back([&sm, i]() {
+            for(unsigned n = 0; n < adds; ++n) {
+                uint64_t old = 0;
+                CHECK(sm.contexts[i]->atomic_rmw(address_type::PHYSICAL, core::traits::MEM, 0x200, 4, smp::amo_e::ADD, 1, old) == Ok);
+            }
+        });
+    for(auto& t : threads)
+        t.join();
+    CHECK(sm.load(0x200) == cores * adds);
+}
+} // namespace
+
+int main(int argc, char* argv[]) {
+    cores_run_in_lockstep();
+    unsynchronized_cores_stop_on_request();
+    stopped_core_stops_the_cluster();
+    signals_reach_their_core();
+    store_conditional_fails_after_intervening_store();
+    store_conditional_succeeds_on_untouched_reservation();
+    atomic_adds_of_concurrent_cores_sum_up();
+    return 0;
+}
@@ -0,0 +1,143 @@
+/*******************************************************************************
+ * Copyright (C) 2024 MINRES Technologies GmbH
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Contributors:
+ *       eyck@minres.com - initial implementation
+ ******************************************************************************/
+
+#ifndef _TEST_TEST_CORE_H_
+#define _TEST_TEST_CORE_H_
+
+#include <iss/arch/traits.h>
+#include <iss/arch_if.h>
+#include <iss/core_context.h>
+#include <iss/mem/memory_map.h>
+#include <iss/vm_types.h>
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <utility>
+
+namespace test {
+class core;
+}
+
+namespace iss {
+namespace arch {
+template <> struct traits<test::core> {
+    enum reg_e { X0, PC, NEXT_PC, LAST_BRANCH, ICOUNT, INSTRET, PENDING_TRAP, TRAP_STATE, NUM_REGS };
+    enum sreg_flag_e { FLAGS };
+    enum mem_type_e { MEM, CSR };
+    using reg_t = uint32_t;
+    using addr_t = uint32_t;
+    using code_word_t = uint32_t;
+    using virt_addr_t = iss::typed_addr_t<iss::address_type::VIRTUAL>;
+    using phys_addr_t = iss::typed_addr_t<iss::address_type::PHYSICAL>;
+    static constexpr std::array<uint32_t, NUM_REGS> reg_bit_widths{{32, 32, 32, 32, 64, 64, 32, 32}};
+    static constexpr std::array<uint32_t, NUM_REGS> reg_byte_offsets{{0, 4, 8, 12, 16, 24, 32, 36}};
+};
+} // namespace arch
+} // namespace iss
+
+namespace test {
+/**
+ * a core without instruction set for the tests, it accesses a memory map and backs its RAM by host memory so the
+ * software TLB and the code pages behave as with a real core
+ */
+class core : public iss::arch_if {
+public:
+    using traits = iss::arch::traits<core>;
+
+    explicit core(iss::mem::memory_map& mem)
+    : mem(mem) {
+        rd_func = util::delegate<rd_func_sig>::from<core, &core::read_mem>(this);
+        wr_func = util::delegate<wr_func_sig>::from<core, &core::write_mem>(this);
+    }
+
+    void reset(uint64_t address) override { pc() = static_cast<uint32_t>(address); }
+
+    void reset() { reset(0); }
+
+    std::pair<uint64_t, bool> load_file(std::string name, int type) override { return {0, false}; }
+
+    uint8_t* get_regs_base_ptr() override { return regs.data(); }
+
+    iss::host_region get_host_region(const iss::address_type type, const iss::access_type access, const uint32_t space,
+                                     const uint64_t addr) override {
+        return space == traits::MEM ? mem.region(addr, access == iss::access_type::WRITE) : iss::host_region{};
+    }
+
+    bool const* get_stop_flag_ptr() override { return &stop; }
+
+    bool should_stop() const { return stop; }
+
+    iss::sync_type needed_sync() const { return iss::NO_SYNC; }
+
+    uint32_t& pc() { return reg<uint32_t>(traits::PC); }
+
+    uint64_t& icount() { return reg<uint64_t>(traits::ICOUNT); }
+
+    template <typename T> T& reg(unsigned idx) { return *reinterpret_cast<T*>(regs.data() + traits::reg_byte_offsets[idx]); }
+
+    uint64_t stop_code() const { return interrupt_sim; }
+
+    bool stop{false};
+    //! the code the simulation got stopped with, the interpreting vms set it
+    uint64_t interrupt_sim{0};
+
+private:
+    iss::status read_mem(iss::address_type type, iss::access_type access, uint32_t space, uint64_t addr, unsigned length,
+                         uint8_t* data) {
+        return space == traits::MEM ? mem.read(addr, length, data) : iss::Err;
+    }
+
+    iss::status write_mem(iss::address_type type, iss::access_type access, uint32_t space, uint64_t addr, unsigned length,
+                          uint8_t const* data) {
+        return space == traits::MEM ? mem.write(addr, length, data) : iss::Err;
+    }
+
+    iss::mem::memory_map& mem;
+    alignas(8) std::array<uint8_t, 64> regs{};
+};
+/**
+ * the context a vm keeps for a test core, set up for the memory of the core like the JIT backends do
+ */
+class context : public iss::core_context {
+public:
+    explicit context(test::core& c)
+    : iss::core_context(c) {
+        get_tlb().enable(core::traits::MEM);
+        get_code_pages().set_space(test::core::traits::MEM);
+    }
+};
+} // namespace test
+
+#endif /* _TEST_TEST_CORE_H_ */
@@ -0,0 +1,333 @@
+/*******************************************************************************
+ * Copyright (C) 2024 MINRES Technologies GmbH
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Contributors:
+ *       eyck@minres.com - initial implementation
+ ******************************************************************************/
+
+// checks of the translation cache: lookup and budget eviction, the jump cache, the slab pool of the block
+// descriptors, unlinking of removed blocks, indirect branch targets, invalidation of written code pages across cores,
+// the mapping of host code to blocks and the reclamation of removed blocks
+
+#include "test_core.h"
+#include "test_util.h"
+
+#include <iss/jit/chaining.h>
+#include <iss/jit/slab_pool.h>
+#include <iss/jit/translation_cache.h>
+#include <iss/mem/memory_map.h>
+
+#include <array>
+#include <vector>
+
+using namespace iss;
+using test::core;
+
+namespace {
+//! a block without code, its host code is only a range of addresses
+struct block {
+    block(uintptr_t f_ptr, size_t f_size, unsigned* destroyed = nullptr)
+    : f_ptr(f_ptr)
+    , f_size(f_size)
+    , destroyed(destroyed) {}
+
+    block(block&& o) noexcept
+    : f_ptr(o.f_ptr)
+    , f_size(o.f_size)
+    , cont(o.cont)
+    , targets(o.targets)
+    , destroyed(o.destroyed) {
+        o.destroyed = nullptr;
+    }
+
+    ~block() {
+        if(destroyed)
+            ++*destroyed;
+    }
+
+    uintptr_t f_ptr;
+    size_t f_size;
+    std::array<block*, 2> cont{};
+    jit::indirect_targets targets{};
+    unsigned* destroyed;
+};
+
+using cache_t = jit::translation_cache<block>;
+
+//! a block jumping to its successors directly, it records the jumps the cache patches
+struct jumping_block : public block {
+    using block::block;
+
+    void chain(unsigned idx, jumping_block const* to) { jumps[idx] = to; }
+
+    std::array<jumping_block const*, 2> jumps{};
+};
+
+void find_returns_inserted_blocks() {
+    cache_t cache;
+    CHECK(!cache.find(0x1000));
+    auto* b = cache.insert(0x1000, block(0x10000, 0x40));
+    CHECK(cache.find(0x1000) == b && cache.peek(0x1000) == b);
+    auto& stats = cache.get_stats();
+    CHECK(stats.blocks == 1 && stats.code_bytes == 0x40 && stats.lookups == 2 && stats.hits == 1);
+    cache.flush();
+    CHECK(!cache.peek(0x1000) && stats.blocks == 0 && stats.code_bytes == 0 && stats.flushes == 1);
+}
+
+void repeated_lookups_hit_the_jump_cache() {
+    cache_t cache;
+    auto* a = cache.insert(0x1000, block(0x10000, 0x40));
+    auto* b = cache.insert(0x1004, block(0x10040, 0x40));
+    CHECK(cache.find(0x1000) == a && cache.find(0x1000) == a && cache.find(0x1004) == b);
+    CHECK(cache.get_stats().jump_cache_hits == 1);
+    // removed blocks must not be found through stale entries
+    cache.invalidate(a);
+    CHECK(!cache.find(0x1000) && cache.find(0x1004) == b);
+    cache.flush();
+    CHECK(!cache.find(0x1004));
+}
+
+void slab_pool_reuses_slots() {
+    unsigned destroyed = 0;
+    jit::slab_pool<block, 4> pool;
+    std::vector<block*> blocks;
+    for(uintptr_t i = 0; i < 6; ++i)
+        blocks.push_back(pool.create(0x10000 + i * 0x40, 0x40, &destroyed));
+    CHECK(pool.size() == 6 && pool.capacity_bytes() >= 8 * sizeof(block));
+    auto capacity = pool.capacity_bytes();
+    // the blocks stay where they are while other ones come and go
+    auto* third = blocks[2];
+    pool.destroy(blocks[4]);
+    CHECK(destroyed == 1 && pool.size() == 5 && third->f_ptr == 0x10080);
+    auto* reused = pool.create(0x20000, 0x40);
+    CHECK(reused == blocks[4] && pool.capacity_bytes() == capacity);
+    for(size_t i = 0; i < blocks.size(); ++i)
+        pool.destroy(blocks[i]);
+    CHECK(pool.size() == 0 && destroyed == 6);
+}
+
+void removed_blocks_are_unlinked() {
+    cache_t cache;
+    auto* a = cache.insert(0x1000, block(0x10000, 0x40));
+    auto* b = cache.insert(0x1010, block(0x10040, 0x40));
+    auto* c = cache.insert(0x1020, block(0x10080, 0x40));
+    cache.link(a, 0, b);
+    cache.link(a, 1, c);
+    cache.link(b, 0, c);
+    auto epoch = cache.epoch();
+    cache.invalidate(c);
+    CHECK(a->cont[0] == b && !a->cont[1] && !b->cont[0]);
+    CHECK(cache.get_stats().unlinks == 2 && cache.get_stats().invalidations == 1 && cache.epoch() != epoch);
+    // a block replacing another one at the same address is not reached through the old links
+    auto* e = cache.insert(0x1040, block(0x10100, 0x40));
+    cache.link(b, 1, e);
+    cache.insert(0x1040, block(0x10140, 0x40));
+    CHECK(!b->cont[1] && cache.size() == 3);
+}
+
+void direct_jumps_follow_the_links() {
+    jit::translation_cache<jumping_block> cache;
+    auto* a = cache.insert(0x1000, jumping_block(0x10000, 0x40));
+    auto* b = cache.insert(0x1010, jumping_block(0x10040, 0x40));
+    auto* c = cache.insert(0x1020, jumping_block(0x10080, 0x40));
+    cache.link(a, 0, b);
+    cache.link(a, 1, c);
+    CHECK(a->jumps[0] == b && a->jumps[1] == c);
+    // the jumps to a removed block return to the dispatcher again
+    cache.invalidate(b);
+    CHECK(!a->jumps[0] && a->jumps[1] == c);
+    cache.mark_code_sync(c);
+    cache.link(c, 0, a);
+    CHECK(!c->jumps[0]);
+}
+
+void indirect_targets_keep_recent_ones() {
+    cache_t cache;
+    auto* a = cache.insert(0x1000, block(0x10000, 0x40));
+    auto* b = cache.insert(0x1010, block(0x10040, 0x40));
+    auto* d = cache.insert(0x1030, block(0x100c0, 0x40));
+    // the indirect targets keep the most recent target first and drop removed ones
+    cache.link_indirect(b, 0x1000, a);
+    cache.link_indirect(b, 0x1030, d);
+    CHECK(b->targets[0].tb == d && b->targets[0].pc == 0x1030 && b->targets[1].tb == a && b->targets[1].pc == 0x1000);
+    // the return target of a caller is unlinked like the indirect targets
+    cache.link_return(a, 0x1030, d);
+    CHECK(a->targets[jit::return_target_idx].tb == d);
+    cache.invalidate(a);
+    CHECK(b->targets[0].tb == d && !b->targets[1].tb);
+    cache.invalidate(d);
+    CHECK(!b->targets[0].tb);
+    auto* c = cache.insert(0x1020, block(0x10080, 0x40));
+    auto* e = cache.insert(0x1040, block(0x10100, 0x40));
+    cache.link_return(c, 0x1040, e);
+    cache.invalidate(e);
+    CHECK(!c->targets[jit::return_target_idx].tb);
+    // the test core does not mark calls, its returns only use the indirect targets
+    static_assert(!jit::has_call_marks<core>(), "the test core has no call marks");
+}
+
+void budget_evicts_oldest_generations() {
+    jit::cache_config cfg;
+    cfg.budget = 64 * 1024;
+    cfg.generations = 4;
+    cache_t cache(cfg);
+    auto* first = cache.insert(0x0, block(0x100000, 0x400));
+    auto* second = cache.insert(0x4, block(0x100400, 0x400));
+    cache.link(second, 0, first);
+    for(uint64_t pc = 8; pc < 8 + 4 * 1024; pc += 4)
+        cache.insert(pc, block(0x100000 + pc * 0x100, 0x400));
+    auto& stats = cache.get_stats();
+    CHECK(stats.evictions > 0 && stats.footprint() <= cfg.budget);
+    CHECK(!cache.peek(0x0) && cache.peek(4 * 1024 + 4));
+    CHECK(stats.blocks == cache.size() && stats.code_bytes == cache.size() * 0x400);
+}
+
+void writes_of_other_cores_invalidate_blocks() {
+    mem::memory_map map;
+    map.map_ram(0, 0x100000);
+    core a(map), b(map);
+    test::context a_ctx(a), b_ctx(b);
+    a_ctx.share_code_pages(b_ctx);
+    jit::cache_config cfg;
+    cfg.invalidate_pages = true;
+    cache_t cache(cfg);
+    cache.set_code_pages(a_ctx.get_code_pages());
+    uint32_t val = 0x13;
+    CHECK(b.write(address_type::PHYSICAL, access_type::WRITE, core::traits::MEM, 0x2000, 4, reinterpret_cast<uint8_t*>(&val)) == Ok);
+    b_ctx.refill_tlb(address_type::VIRTUAL, core::traits::MEM, 0x2000);
+    auto const& entry = b_ctx.get_tlb().data()[jit::soft_tlb::index_of(0x2000)];
+    CHECK(entry.write_tag == 0x2000);
+    cache.track(0x2000, 0x2010);
+    auto* blk = cache.insert(0x2000, block(0x10000, 0x40));
+    cache.track(0x3000, 0x3010);
+    auto* other = cache.insert(0x3000, block(0x10040, 0x40));
+    cache.link(other, 0, blk);
+    // the pages of the block are translated code for both cores now, stores of b take the slow path from its next block
+    CHECK(entry.write_tag == 0x2000);
+    b_ctx.sync_tlb();
+    CHECK(entry.write_tag == jit::soft_tlb::invalid_tag);
+    CHECK(a_ctx.get_code_pages().holds_code(0x2008, 4) && b_ctx.get_code_pages().holds_code(0x2008, 4));
+    CHECK(b.write(address_type::PHYSICAL, access_type::WRITE, core::traits::MEM, 0x2008, 4, reinterpret_cast<uint8_t*>(&val)) == Ok);
+    CHECK(cache.has_written() && cache.peek(0x2000));
+    cache.sync_code();
+    CHECK(!cache.has_written() && !cache.peek(0x2000) && cache.peek(0x3000) && !other->cont[0]);
+    CHECK(cache.get_stats().invalidations == 1 && !a_ctx.get_code_pages().holds_code(0x2000, 0x1000));
+    // a block compiled while its page got written must not be inserted
+    cache.track(0x2000, 0x2010);
+    auto generation = cache.install_generation();
+    CHECK(b.write(address_type::PHYSICAL, access_type::WRITE, core::traits::MEM, 0x2008, 4, reinterpret_cast<uint8_t*>(&val)) == Ok);
+    cache.sync_code();
+    CHECK(cache.install_generation() != generation && !a_ctx.get_code_pages().holds_code(0x2000, 0x1000));
+}
+
+void translations_notice_racing_writes() {
+    mem::memory_map map;
+    map.map_ram(0, 0x100000);
+    core a(map), b(map);
+    test::context a_ctx(a), b_ctx(b);
+    a_ctx.share_code_pages(b_ctx);
+    jit::cache_config cfg;
+    cfg.invalidate_pages = true;
+    cache_t cache(cfg);
+    cache.set_code_pages(a_ctx.get_code_pages());
+    // a block reaching into a page not tracked before gets translated again
+    unsigned calls = 0;
+    cache.translate_tracked(0x2ff0, [&](uint64_t& end) {
+        CHECK(a_ctx.get_code_pages().holds_code(0x2ff0, 4));
+        end = 0x3010;
+        return ++calls;
+    });
+    CHECK(calls == 2 && a_ctx.get_code_pages().holds_code(0x3000, 4));
+    cache.insert(0x2ff0, block(0x10000, 0x40));
+    // a write of another core while reading the guest code repeats the translation
+    calls = 0;
+    uint32_t val = 0x13;
+    cache.translate_tracked(0x5000, [&](uint64_t& end) {
+        if(!calls)
+            b.write(address_type::PHYSICAL, access_type::WRITE, core::traits::MEM, 0x5008, 4, reinterpret_cast<uint8_t*>(&val));
+        end = 0x5010;
+        return ++calls;
+    });
+    CHECK(calls == 2 && !cache.has_written());
+    cache.insert(0x5000, block(0x10040, 0x40));
+    CHECK(b.write(address_type::PHYSICAL, access_type::WRITE, core::traits::MEM, 0x5008, 4, reinterpret_cast<uint8_t*>(&val)) == Ok);
+    cache.invalidate_written();
+    CHECK(!cache.peek(0x5000) && cache.peek(0x2ff0));
+}
+
+void code_sync_blocks_are_not_chained() {
+    cache_t cache;
+    auto* a = cache.insert(0x1000, block(0x10000, 0x40));
+    auto* b = cache.insert(0x1010, block(0x10040, 0x40));
+    cache.mark_code_sync(a);
+    cache.link(a, 0, b);
+    cache.link_indirect(a, 0x1010, b);
+    cache.link(b, 0, a);
+    CHECK(cache.is_code_sync(a) && !a->cont[0] && !a->targets[0].tb);
+    CHECK(!cache.is_code_sync(b) && b->cont[0] == a);
+}
+
+void find_code_maps_host_addresses_to_blocks() {
+    cache_t cache;
+    auto* a = cache.insert(0x1000, block(0x10ff0, 0x20));
+    auto* b = cache.insert(0x1010, block(0x11010, 0x2000));
+    CHECK(cache.find_code(0x10ff0) == a && cache.find_code(0x1100f) == a && !cache.find_code(0x10fef));
+    CHECK(cache.find_code(0x11010) == b && cache.find_code(0x1300f) == b && !cache.find_code(0x13010));
+    cache.invalidate(a);
+    CHECK(!cache.find_code(0x11000));
+}
+
+void removed_blocks_live_until_quiescence() {
+    unsigned destroyed = 0;
+    cache_t cache;
+    cache_t::dispatcher d(cache);
+    auto* a = cache.insert(0x1000, block(0x10000, 0x40, &destroyed));
+    cache.invalidate(a);
+    CHECK(destroyed == 0 && a->f_ptr == 0x10000);
+    d.quiescent();
+    CHECK(destroyed == 1);
+}
+} // namespace
+
+int main(int argc, char* argv[]) {
+    find_returns_inserted_blocks();
+    repeated_lookups_hit_the_jump_cache();
+    slab_pool_reuses_slots();
+    removed_blocks_are_unlinked();
+    direct_jumps_follow_the_links();
+    indirect_targets_keep_recent_ones();
+    budget_evicts_oldest_generations();
+    writes_of_other_cores_invalidate_blocks();
+    translations_notice_racing_writes();
+    code_sync_blocks_are_not_chained();
+    find_code_maps_host_addresses_to_blocks();
+    removed_blocks_live_until_quiescence();
+    return 0;
+}
@@ -0,0 +1,371 @@
+/*******************************************************************************
+ * Copyright (C) 2024 MINRES Technologies GmbH
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Contributors:
+ *       eyck@minres.com - initial implementation
+ ******************************************************************************/
+
+// stress test of vms running on concurrent host threads, meant to be run in a ThreadSanitizer build (WITH_TSAN). For
+// each backend of the build several cores execute a common program, each on a thread of its own creating its vm and a
+// debugger server for it. Half of the vms write out the code they generate. The program loads from a device, so the
+// generated code calls the memory access functions of the vm
+
+#include "test_core.h"
+#include "test_util.h"
+
+#include <iss/debugger/gdb_session.h>
+#include <iss/debugger/server.h>
+#include <iss/interp/vm_base.h>
+#include <iss/mem/memory_map.h>
+#ifdef WITH_ASMJIT
+#include <iss/asmjit/vm_base.h>
+#endif
+#ifdef WITH_LLVM
+#include <iss/llvm/jit_init.h>
+#include <iss/llvm/vm_base.h>
+#endif
+#ifdef WITH_TCC
+#include <iss/tcc/vm_base.h>
+#endif
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+using namespace iss;
+using test::core;
+using traits = arch::traits<core>;
+
+namespace {
+constexpr unsigned cores_per_backend = 4;
+constexpr uint64_t icount_limit = 100000;
+constexpr uint64_t code_base = 0x10000;
+//! the program consists of chunks of 16 instructions, the last one jumps to the next chunk
+constexpr unsigned chunk_count = 64;
+constexpr uint64_t chunk_bytes = 64;
+//! the offset of the load in a chunk
+constexpr uint64_t load_offset = 0x20;
+constexpr uint64_t device_addr = 0x80000;
+
+//! the opcodes are the low byte of an instruction word, the upper bytes of a jump hold its target divided by 4
+enum opcode_e : uint8_t { NOP = 0x13, LOAD = 0x03, JUMP = 0x6f };
+
+struct instr {
+    opcode_e op;
+    uint64_t target;
+};
+
+uint32_t encode(opcode_e op, uint64_t target = 0) { return static_cast<uint32_t>(target >> 2 << 8) | op; }
+
+/**
+ * fetch and decode an instruction of the program, a load adds the word read from the device to X0
+ */
+instr fetch(core& c, uint64_t pc) {
+    uint32_t word = 0;
+    CHECK(c.read(address_type::PHYSICAL, access_type::FETCH, traits::MEM, pc, 4, reinterpret_cast<uint8_t*>(&word)) == Ok);
+    auto op = static_cast<opcode_e>(word & 0xff);
+    CHECK(op == NOP || op == LOAD || op == JUMP);
+    return {op, static_cast<uint64_t>(word >> 8) << 2};
+}
+
+/**
+ * write the program, chunk k jumps to chunk 5k+1 which visits all chunks in turn
+ */
+void write_program(mem::memory_map& mem) {
+    std::vector<uint32_t> code(chunk_count * chunk_bytes / 4, encode(NOP));
+    for(unsigned k = 0; k < chunk_count; ++k) {
+        auto chunk = k * chunk_bytes / 4;
+        code[chunk + load_offset / 4] = encode(LOAD);
+        code[chunk + chunk_bytes / 4 - 1] = encode(JUMP, code_base + (k * 5 + 1) % chunk_count * chunk_bytes);
+    }
+    CHECK(mem.write(code_base, static_cast<unsigned>(code.size() * 4), reinterpret_cast<uint8_t const*>(code.data())) == Ok);
+}
+
+//! a vm interpreting the program
+class interp_vm : public interp::vm_base<test::core> {
+public:
+    explicit interp_vm(test::core& c)
+    : interp::vm_base<test::core>(c) {}
+
+    debugger::target_adapter_if* accquire_target_adapter(debugger::server_if* server) override { return nullptr; }
+
+protected:
+    virt_addr_t execute_inst(finish_cond_e cond, virt_addr_t start, uint64_t count_limit) override {
+        while(core.icount() < count_limit && !core.should_stop()) {
+            auto in = fetch(core, core.pc());
+            if(in.op == LOAD)
+                get_reg(traits::X0) += read_mem<uint32_t>(traits::MEM, device_addr);
+            core.pc() = in.op == JUMP ? static_cast<uint32_t>(in.target) : core.pc() + 4;
+            core.icount()++;
+        }
+        start.val = core.pc();
+        return start;
+    }
+};
+
+#ifdef WITH_ASMJIT
+//! a vm translating the program with asmjit
+class asmjit_vm : public iss::asmjit::vm_base<test::core> {
+public:
+    explicit asmjit_vm(test::core& c)
+    : iss::asmjit::vm_base<test::core>(c) {}
+
+    debugger::target_adapter_if* accquire_target_adapter(debugger::server_if* server) override { return nullptr; }
+
+protected:
+    using jit_holder = iss::asmjit::jit_holder;
+
+    iss::asmjit::continuation_e gen_single_inst_behavior(virt_addr_t& pc, jit_holder& jh) override {
+        auto& cc = jh.cc;
+        auto in = fetch(core, pc.val);
+        iss::asmjit::mov(cc, jh.pc, pc.val);
+        cc.add(get_ptr_for(jh, traits::ICOUNT), 1);
+        if(in.op == JUMP) {
+            iss::asmjit::mov(cc, jh.next_pc, in.target);
+            iss::asmjit::mov(cc, get_ptr_for(jh, traits::LAST_BRANCH), static_cast<int>(iss::asmjit::KNOWN_JUMP));
+            set_branch_target(in.target, false);
+            pc.val += 4;
+            return iss::asmjit::BRANCH;
+        }
+        if(in.op == LOAD) {
+            auto val = gen_read_mem(jh, traits::MEM, device_addr, 4);
+            auto x0 = load_reg_from_mem_Gp(jh, traits::X0);
+            cc.add(x0, nonstd::get<::asmjit::x86::Gp>(val));
+            write_reg_to_mem(jh, x0, traits::X0);
+        }
+        pc.val += 4;
+        iss::asmjit::mov(cc, jh.next_pc, pc.val);
+        return iss::asmjit::CONT;
+    }
+
+    void gen_block_prologue(jit_holder& jh) override {
+        jh.pc = load_reg_from_mem_Gp(jh, traits::PC);
+        jh.next_pc = load_reg_from_mem_Gp(jh, traits::NEXT_PC);
+        iss::asmjit::mov(jh.cc, get_ptr_for(jh, traits::LAST_BRANCH), static_cast<int>(iss::asmjit::NO_JUMP));
+    }
+
+    void gen_block_epilogue(jit_holder& jh) override {
+        write_back(jh);
+        jh.cc.ret(jh.next_pc);
+        jh.cc.bind(jh.trap_entry);
+        write_back(jh);
+        iss::asmjit::mov(jh.cc, get_ptr_for(jh, traits::LAST_BRANCH), static_cast<int>(iss::asmjit::UNKNOWN_JUMP));
+        jh.cc.ret(jh.next_pc);
+    }
+};
+#endif
+
+#ifdef WITH_LLVM
+//! a vm translating the program with LLVM, the blocks take the register file, the core and the vm as pointers
+class llvm_vm : public iss::llvm::vm_base<test::core> {
+public:
+    explicit llvm_vm(test::core& c)
+    : iss::llvm::vm_base<test::core>(c) {}
+
+    debugger::target_adapter_if* accquire_target_adapter(debugger::server_if* server) override { return nullptr; }
+
+protected:
+    std::tuple<iss::llvm::continuation_e, ::llvm::BasicBlock*> gen_single_inst_behavior(virt_addr_t& pc,
+                                                                                         ::llvm::BasicBlock* this_block) override {
+        builder.SetInsertPoint(this_block);
+        auto in = fetch(core, pc.val);
+        set_reg(traits::PC, gen_const(32, pc.val));
+        set_reg(traits::ICOUNT, builder.CreateAdd(get_reg(traits::ICOUNT), gen_const(64, 1)));
+        if(in.op == JUMP) {
+            set_reg(traits::NEXT_PC, gen_const(32, in.target));
+            set_reg(traits::LAST_BRANCH, gen_const(32, iss::llvm::KNOWN_JUMP));
+            set_branch_target(in.target, false);
+            pc.val += 4;
+            return std::make_tuple(iss::llvm::BRANCH, builder.GetInsertBlock());
+        }
+        if(in.op == LOAD) {
+            auto* val = gen_read_mem(traits::MEM, device_addr, 4);
+            set_reg(traits::X0, builder.CreateAdd(get_reg(traits::X0), val));
+        }
+        pc.val += 4;
+        set_reg(traits::NEXT_PC, gen_const(32, pc.val));
+        set_reg(traits::LAST_BRANCH, gen_const(32, iss::llvm::NO_JUMP));
+        return std::make_tuple(iss::llvm::CONT, builder.GetInsertBlock());
+    }
+
+    ::llvm::Function* open_block_func(phys_addr_t pc) override {
+        auto* f = iss::llvm::vm_base<test::core>::open_block_func(pc);
+        auto* ptr_ty = ::llvm::PointerType::getUnqual(mod->getContext());
+        auto* ty = ::llvm::FunctionType::get(f->getReturnType(), {ptr_ty, ptr_ty, ptr_ty}, false);
+        auto name = f->getName().str();
+        f->eraseFromParent();
+        f = ::llvm::Function::Create(ty, ::llvm::GlobalValue::ExternalLinkage, name, mod);
+        regs_ptr = f->getArg(0);
+        core_ptr = f->getArg(1);
+        vm_ptr = f->getArg(2);
+        regs_ptr->setName("regs_ptr");
+        core_ptr->setName("core_ptr");
+        vm_ptr->setName("vm_ptr");
+        return f;
+    }
+
+    void gen_leave_behavior(::llvm::BasicBlock* leave_blk) override {
+        builder.SetInsertPoint(leave_blk);
+        builder.CreateRet(get_reg(traits::NEXT_PC));
+    }
+
+    void gen_trap_behavior(::llvm::BasicBlock* trap_blk) override {
+        builder.SetInsertPoint(trap_blk);
+        set_reg(traits::LAST_BRANCH, gen_const(32, iss::llvm::UNKNOWN_JUMP));
+        builder.CreateRet(get_reg(traits::NEXT_PC));
+    }
+
+private:
+    ::llvm::Value* get_reg(traits::reg_e r) { return builder.CreateLoad(get_typeptr(r), get_reg_ptr(r)); }
+
+    void set_reg(traits::reg_e r, ::llvm::Value* val) { builder.CreateStore(val, get_reg_ptr(r)); }
+};
+#endif
+
+#ifdef WITH_TCC
+//! a vm translating the program to C compiled by TCC
+class tcc_vm : public iss::tcc::vm_base<test::core> {
+public:
+    explicit tcc_vm(test::core& c)
+    : iss::tcc::vm_base<test::core>(c) {}
+
+    debugger::target_adapter_if* accquire_target_adapter(debugger::server_if* server) override { return nullptr; }
+
+protected:
+    iss::tcc::continuation_e gen_single_inst_behavior(virt_addr_t& pc, tu_builder& tu) override {
+        auto in = fetch(core, pc.val);
+        tu("*pc = {:#x};", pc.val);
+        tu("(*icount)++;");
+        if(in.op == JUMP) {
+            tu("*next_pc = {:#x};", in.target);
+            tu("*last_branch = {};", iss::tcc::KNOWN_JUMP);
+            set_branch_target(in.target, false);
+            pc.val += 4;
+            return iss::tcc::BRANCH;
+        }
+        if(in.op == LOAD) {
+            tu.defined_regs[traits::X0] = true;
+            auto val = tu.read_mem(traits::MEM, fmt::format("{:#x}", device_addr), 32);
+            tu("*reg{:02d} += {};", static_cast<unsigned>(traits::X0), val);
+        }
+        pc.val += 4;
+        tu("*next_pc = {:#x};", pc.val);
+        return iss::tcc::CONT;
+    }
+};
+#endif
+
+//! the state of a core after its vm stopped
+struct core_result {
+    uint64_t icount{0};
+    uint32_t loads{0};
+};
+
+using server = debugger::server<debugger::gdb_session>;
+
+/**
+ * run a core on the calling thread, the vm and its debugger server get created on the thread as well
+ */
+template <typename VM> void run_core(mem::memory_map& mem, bool dump, core_result& res) {
+    core c(mem);
+    c.reset(code_base);
+    VM vm(c);
+    // the servers keep running until the process exits as they do in a simulator
+    server::run_server(&vm, 0);
+    auto* srv = server::get(&vm);
+    CHECK(srv != nullptr && srv->get_port_nr() != 0);
+    CHECK(vm.start(icount_limit, dump) == 0);
+    res.icount = c.icount();
+    res.loads = c.reg<uint32_t>(traits::X0);
+}
+
+template <typename VM> void add_cores(mem::memory_map& mem, std::vector<std::function<void()>>& runs, std::vector<core_result>& results) {
+    for(unsigned i = 0; i < cores_per_backend; ++i) {
+        results.emplace_back();
+        auto idx = results.size() - 1;
+        runs.emplace_back([&mem, &results, idx, i]() { run_core<VM>(mem, i % 2 == 1, results[idx]); });
+    }
+}
+} // namespace
+
+int main(int argc, char* argv[]) {
+#ifdef WITH_LLVM
+    init_jit();
+#endif
+    mem::memory_map mem;
+    mem.map_ram(0, 0x40000);
+    std::atomic<uint64_t> device_reads{0};
+    mem.map_mmio(
+        device_addr, 0x1000,
+        [&device_reads](uint64_t offset, unsigned length, uint8_t* data) {
+            uint32_t val = 1;
+            std::copy(reinterpret_cast<uint8_t*>(&val), reinterpret_cast<uint8_t*>(&val) + length, data);
+            device_reads++;
+            return Ok;
+        },
+        [](uint64_t offset, unsigned length, uint8_t const* data) { return Err; });
+    write_program(mem);
+    // the generated code gets written to a directory of its own
+    auto dump_dir = std::filesystem::temp_directory_path() / "tsan_stress";
+    std::filesystem::create_directories(dump_dir);
+    std::filesystem::current_path(dump_dir);
+    std::vector<std::function<void()>> runs;
+    std::vector<core_result> results;
+    results.reserve(4 * cores_per_backend);
+    add_cores<interp_vm>(mem, runs, results);
+#ifdef WITH_ASMJIT
+    add_cores<asmjit_vm>(mem, runs, results);
+#endif
+#ifdef WITH_LLVM
+    add_cores<llvm_vm>(mem, runs, results);
+#endif
+#ifdef WITH_TCC
+    add_cores<tcc_vm>(mem, runs, results);
+#endif
+    std::vector<std::thread> threads;
+    for(auto& run : runs)
+        threads.emplace_back(run);
+    for(auto& t : threads)
+        t.join();
+    uint64_t loads = 0;
+    for(auto& res : results) {
+        CHECK(res.icount >= icount_limit && res.loads > 0);
+        loads += res.loads;
+    }
+    // each load executed by a core went to the device once
+    CHECK(loads == device_reads);
+    std::filesystem::current_path(dump_dir.parent_path());
+    std::filesystem::remove_all(dump_dir);
+    return 0;
+}